@@ -451,7 +451,7 @@ void doT55x7Acquisition(size_t sample_size, bool ledcontrol) {
 #define T55xx_READ_TOL   5
 
     uint8_t *dest = BigBuf_get_addr();
-    uint16_t bufsize = BigBuf_max_traceLen();
+    uint16_t bufsize = MIN(BigBuf_max_traceLen(), 0xFFFF);
 
     if (bufsize > sample_size)
         bufsize = sample_size;
@@ -536,7 +536,7 @@ void doT55x7Acquisition(size_t sample_size, bool ledcontrol) {
 #endif
 void doCotagAcquisition(void) {
 
-    uint16_t bufsize = BigBuf_max_traceLen();
+    uint16_t bufsize = MIN(BigBuf_max_traceLen(), 0xFFFF);
     uint8_t *dest = BigBuf_malloc(bufsize);
 
     dest[0] = 0;
@@ -153,6 +153,7 @@ endif ()
 
 add_library(pm3rrg_rdv4_hardnested STATIC
         hardnested/hardnested_bruteforce.c
+        hardnested/hardnested_verify.c
         $<TARGET_OBJECTS:pm3rrg_rdv4_hardnested_nosimd>
         ${SIMD_TARGETS})
 target_compile_options(pm3rrg_rdv4_hardnested PRIVATE -Wall -Werror -O3)
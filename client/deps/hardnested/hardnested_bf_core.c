@@ -168,11 +168,6 @@ static void *malloc_bitslice(size_t x) {
 #define free_bitslice(x) free(x)
 #endif
 
-typedef enum {
-    EVEN_STATE = 0,
-    ODD_STATE = 1
-} odd_even_t;
-
 
 // arrays of bitsliced states with identical values in all slices
 static bitslice_t bitsliced_encrypted_nonces[256][KEYSTREAM_SIZE];
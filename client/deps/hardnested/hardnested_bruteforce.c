@@ -55,6 +55,7 @@ THE SOFTWARE.
 #include <pthread.h>
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
 
 #include "common.h"
 #include "proxmark3.h"
@@ -73,16 +74,15 @@ THE SOFTWARE.
 #define TEST_BENCH_SIZE                 (6000)        // number of odd and even states for brute force benchmark
 #define TEST_BENCH_FILENAME             "hardnested_bf_bench_data.bin"
 //#define WRITE_BENCH_FILE
+#define BF_CHECKPOINT_INTERVAL          (60 * 1000)   // ms between checkpoint writes
+#define BF_CHECKPOINT_MAGIC             "PM3HNCP"
+#define BF_CHECKPOINT_VERSION           1
+#define BF_CHECKPOINT_MAX_FILES         32
 
 // debugging options
 #define DEBUG_KEY_ELIMINATION           1
 // #define DEBUG_BRUTE_FORCE
 
-typedef enum {
-    EVEN_STATE = 0,
-    ODD_STATE = 1
-} odd_even_t;
-
 static uint32_t nonces_to_bruteforce = 0;
 static uint32_t bf_test_nonce[256];
 static uint8_t bf_test_nonce_2nd_byte[256];
@@ -93,53 +93,263 @@ static uint32_t keys_found = 0;
 static uint64_t num_keys_tested;
 static uint64_t found_bs_key = 0;
 
-inline uint8_t trailing_zeros(uint8_t byte) {
-    static const uint8_t trailing_zeros_LUT[256] = {
-        8, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
-        4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
-        5, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
-        4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
-        6, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
-        4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
-        5, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
-        4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
-        7, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
-        4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
-        5, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
-        4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
-        6, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
-        4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
-        5, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
-        4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0
-    };
-
-    return trailing_zeros_LUT[byte];
+// the work chunks, see bf_make_chunks
+static bf_chunk_t *chunks = NULL;
+static uint32_t chunk_count = 0;
+static uint32_t next_chunk = 0;
+static uint8_t *chunk_done = NULL;      // bitmap, set when a chunk was searched completely
+
+//----------------------------------------------------------------------------
+// Checkpoints.
+// The done bitmap is written to the user cache directory every BF_CHECKPOINT_INTERVAL,
+// keyed by a fingerprint of the candidate space and the test nonces. A later run on the
+// same nonces (e.g. hf mf hardnested -r) skips the chunks already searched.
+// A candidate space searched to the end without a key is kept as completely done, so a
+// resumed run gets to the next Sum(a8) guess at once. The files are removed when the
+// attack ends, only an interrupted run leaves them behind.
+//
+// layout:  header | bitmap[(num_chunks + 7) / 8]
+//----------------------------------------------------------------------------
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t cuid;
+    uint64_t fingerprint;
+    uint64_t chunk_states;      // BF_CHUNK_STATES used when building the chunks
+    uint32_t num_chunks;
+    uint32_t rfu;
+} PACKED bf_checkpoint_header_t;
+
+static bool checkpoint_enabled = false;
+static uint32_t checkpoint_cuid = 0;
+static uint64_t checkpoint_fingerprint = 0;
+static char *checkpoint_path = NULL;
+static uint64_t checkpoint_time = 0;
+static pthread_mutex_t checkpoint_lock = PTHREAD_MUTEX_INITIALIZER;
+// checkpoint files of this attack, see remove_bf_checkpoints()
+static char *checkpoint_files[BF_CHECKPOINT_MAX_FILES];
+static uint32_t checkpoint_files_count = 0;
+
+static bool chunk_is_done(uint32_t chunk) {
+    return (__atomic_load_n(&chunk_done[chunk / 8], __ATOMIC_ACQUIRE) >> (chunk % 8)) & 1;
 }
 
+static void set_chunk_done(uint32_t chunk) {
+    __atomic_fetch_or(&chunk_done[chunk / 8], (uint8_t)(1 << (chunk % 8)), __ATOMIC_RELEASE);
+}
 
-bool verify_key(uint32_t cuid, noncelist_t *nonces, const uint8_t *best_first_bytes, uint32_t odd, uint32_t even) {
-    struct Crypto1State pcs;
-    for (uint16_t test_first_byte = 1; test_first_byte < 256; test_first_byte++) {
-        noncelistentry_t *test_nonce = nonces[best_first_bytes[test_first_byte]].first;
-        while (test_nonce != NULL) {
-            pcs.odd = odd;
-            pcs.even = even;
-            lfsr_rollback_byte(&pcs, (cuid >> 24) ^ best_first_bytes[0], true);
-            for (int8_t byte_pos = 3; byte_pos >= 0; byte_pos--) {
-                uint8_t test_par_enc_bit = (test_nonce->par_enc >> byte_pos) & 0x01;     // the encoded parity bit
-                uint8_t test_byte_enc = (test_nonce->nonce_enc >> (8 * byte_pos)) & 0xff; // the encoded nonce byte
-                uint8_t test_byte_dec = crypto1_byte(&pcs, test_byte_enc /* ^ (cuid >> (8*byte_pos)) */, true) ^ test_byte_enc; // decode the nonce byte
-                uint8_t ks_par = filter(pcs.odd);                                        // the keystream bit to encode/decode the parity bit
-                uint8_t test_par_enc2 = ks_par ^ evenparity8(test_byte_dec);             // determine the decoded byte's parity and encode it
-                if (test_par_enc_bit != test_par_enc2) {
-                    return false;
-                }
-            }
-            test_nonce = test_nonce->next;
-        }
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t *)data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint64_t bucket_hash(const statelist_t *bucket) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    hash = fnv1a(hash, bucket->len, sizeof(bucket->len));
+    hash = fnv1a(hash, bucket->states[ODD_STATE], bucket->len[ODD_STATE] * sizeof(uint32_t));
+    hash = fnv1a(hash, bucket->states[EVEN_STATE], bucket->len[EVEN_STATE] * sizeof(uint32_t));
+    return hash;
+}
+
+static uint64_t bucket_hashes[128];
+
+static int compare_bucket_hash(const void *b1, const void *b2) {
+    uint64_t h1 = bucket_hashes[*(const uint32_t *)b1];
+    uint64_t h2 = bucket_hashes[*(const uint32_t *)b2];
+    return (h1 > h2) - (h1 < h2);
+}
+
+// The candidates are generated by several threads, the order of the buckets differs
+// from run to run. Sort them by content so the chunk numbers in a checkpoint stay valid.
+static uint64_t sort_buckets(uint32_t cuid, uint8_t best_first_byte) {
+    uint32_t order[128];
+    statelist_t *sorted[128];
+    for (uint32_t i = 0; i < bucket_count; i++) {
+        bucket_hashes[i] = bucket_hash(buckets[i]);
+        order[i] = i;
+    }
+    qsort(order, bucket_count, sizeof(uint32_t), compare_bucket_hash);
+
+    uint64_t fingerprint = 0xcbf29ce484222325ULL;
+    fingerprint = fnv1a(fingerprint, &cuid, sizeof(cuid));
+    fingerprint = fnv1a(fingerprint, &best_first_byte, sizeof(best_first_byte));
+    fingerprint = fnv1a(fingerprint, &nonces_to_bruteforce, sizeof(nonces_to_bruteforce));
+    fingerprint = fnv1a(fingerprint, bf_test_nonce, nonces_to_bruteforce * sizeof(bf_test_nonce[0]));
+    fingerprint = fnv1a(fingerprint, bf_test_nonce_par, nonces_to_bruteforce * sizeof(bf_test_nonce_par[0]));
+    for (uint32_t i = 0; i < bucket_count; i++) {
+        sorted[i] = buckets[order[i]];
+        fingerprint = fnv1a(fingerprint, &bucket_hashes[order[i]], sizeof(uint64_t));
+    }
+    memcpy(buckets, sorted, bucket_count * sizeof(statelist_t *));
+    return fingerprint;
+}
+
+static void free_chunks(void) {
+    free(chunks);
+    chunks = NULL;
+    free(chunk_done);
+    chunk_done = NULL;
+    chunk_count = 0;
+    next_chunk = 0;
+}
+
+static bool make_chunks(void) {
+    next_chunk = 0;
+    chunks = bf_make_chunks(buckets, bucket_count, &chunk_count);
+    chunk_done = calloc((chunk_count + 7) / 8 + 1, sizeof(uint8_t));
+    if (chunks == NULL || chunk_done == NULL) {
+        free_chunks();
+        return false;
     }
     return true;
 }
+
+static uint64_t chunk_states(uint32_t chunk) {
+    return (uint64_t)chunks[chunk].odd_len * buckets[chunks[chunk].bucket]->len[EVEN_STATE];
+}
+
+static void write_checkpoint(void) {
+    if (checkpoint_path == NULL) {
+        return;
+    }
+
+    size_t tmplen = strlen(checkpoint_path) + 5;
+    char *tmppath = calloc(tmplen, sizeof(char));
+    if (tmppath == NULL) {
+        return;
+    }
+    snprintf(tmppath, tmplen, "%s.tmp", checkpoint_path);
+
+    FILE *f = fopen(tmppath, "wb");
+    if (f == NULL) {
+        PrintAndLogEx(DEBUG, "could not create brute force checkpoint %s", tmppath);
+        free(tmppath);
+        return;
+    }
+
+    bf_checkpoint_header_t hdr = {0};
+    memcpy(hdr.magic, BF_CHECKPOINT_MAGIC, sizeof(BF_CHECKPOINT_MAGIC));
+    hdr.version = BF_CHECKPOINT_VERSION;
+    hdr.cuid = checkpoint_cuid;
+    hdr.fingerprint = checkpoint_fingerprint;
+    hdr.chunk_states = BF_CHUNK_STATES;
+    hdr.num_chunks = chunk_count;
+
+    uint32_t bitmap_len = (chunk_count + 7) / 8;
+    uint8_t *bitmap = calloc(bitmap_len + 1, sizeof(uint8_t));
+    bool ok = (bitmap != NULL);
+    for (uint32_t i = 0; ok && i < bitmap_len; i++) {
+        bitmap[i] = __atomic_load_n(&chunk_done[i], __ATOMIC_ACQUIRE);
+    }
+
+    ok = ok && (fwrite(&hdr, sizeof(hdr), 1, f) == 1);
+    ok = ok && (bitmap_len == 0 || fwrite(bitmap, bitmap_len, 1, f) == 1);
+    ok = (fclose(f) == 0) && ok;
+    free(bitmap);
+
+#if defined(_WIN32)
+    // rename doesn't replace an existing file
+    if (ok) {
+        remove(checkpoint_path);
+    }
+#endif
+    if (ok == false || rename(tmppath, checkpoint_path) != 0) {
+        PrintAndLogEx(DEBUG, "could not write brute force checkpoint %s", checkpoint_path);
+        remove(tmppath);
+    }
+    free(tmppath);
+}
+
+// marks the chunks of a matching checkpoint as done, returns the number of states skipped
+static uint64_t read_checkpoint(void) {
+    FILE *f = fopen(checkpoint_path, "rb");
+    if (f == NULL) {
+        return 0;
+    }
+
+    bf_checkpoint_header_t hdr;
+    uint32_t bitmap_len = (chunk_count + 7) / 8;
+    bool ok = (fread(&hdr, sizeof(hdr), 1, f) == 1)
+              && memcmp(hdr.magic, BF_CHECKPOINT_MAGIC, sizeof(BF_CHECKPOINT_MAGIC)) == 0
+              && hdr.version == BF_CHECKPOINT_VERSION
+              && hdr.cuid == checkpoint_cuid
+              && hdr.fingerprint == checkpoint_fingerprint
+              && hdr.chunk_states == BF_CHUNK_STATES
+              && hdr.num_chunks == chunk_count
+              && (bitmap_len == 0 || fread(chunk_done, bitmap_len, 1, f) == 1);
+    fclose(f);
+
+    uint64_t skipped = 0;
+    if (ok == false) {
+        memset(chunk_done, 0, bitmap_len);
+        return 0;
+    }
+    for (uint32_t i = 0; i < chunk_count; i++) {
+        if (chunk_is_done(i)) {
+            skipped += chunk_states(i);
+        }
+    }
+    return skipped;
+}
+
+static void checkpoint_begin(uint32_t cuid, uint64_t fingerprint) {
+    checkpoint_cuid = cuid;
+    checkpoint_fingerprint = fingerprint;
+
+    char filename[64];
+    snprintf(filename, sizeof(filename), "hardnested_bf_%08" PRIx32 "_%016" PRIx64 ".bin", cuid, fingerprint);
+    if (searchHomeFilePath(&checkpoint_path, CACHE_SUBDIR, filename, true) != PM3_SUCCESS) {
+        checkpoint_path = NULL;
+    }
+    checkpoint_time = msclock();
+}
+
+static void checkpoint_end(bool key_found) {
+    if (checkpoint_path == NULL) {
+        return;
+    }
+
+    if (key_found == false) {
+        write_checkpoint();
+    }
+    if (checkpoint_files_count < BF_CHECKPOINT_MAX_FILES) {
+        checkpoint_files[checkpoint_files_count++] = checkpoint_path;
+    } else {
+        remove(checkpoint_path);
+        free(checkpoint_path);
+    }
+    checkpoint_path = NULL;
+}
+
+void remove_bf_checkpoints(void) {
+    for (uint32_t i = 0; i < checkpoint_files_count; i++) {
+        remove(checkpoint_files[i]);
+        free(checkpoint_files[i]);
+    }
+    checkpoint_files_count = 0;
+}
+
+// called by the brute force threads after each chunk
+static void checkpoint_maybe_write(void) {
+    // unlocked peek, checkpoint_time only changes under checkpoint_lock
+    if (checkpoint_path == NULL || msclock() - __atomic_load_n(&checkpoint_time, __ATOMIC_RELAXED) < BF_CHECKPOINT_INTERVAL) {
+        return;
+    }
+    // one writer, the others carry on
+    if (pthread_mutex_trylock(&checkpoint_lock) != 0) {
+        return;
+    }
+    if (msclock() - checkpoint_time >= BF_CHECKPOINT_INTERVAL) {
+        write_checkpoint();
+        __atomic_store_n(&checkpoint_time, msclock(), __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&checkpoint_lock);
+}
+
 static void *
 #ifdef __has_attribute
 #if __has_attribute(force_align_arg_pointer)
@@ -158,37 +368,45 @@ crack_states_thread(void *x) {
     } *thread_arg;
 
     thread_arg = (struct arg *)x;
-    const int thread_id = thread_arg->thread_ID;
-    uint32_t current_bucket = thread_id;
-    while (current_bucket < bucket_count) {
-        statelist_t *bucket = buckets[current_bucket];
-        if (bucket) {
+    while (true) {
+        if (keys_found) {
+            break;
+        }
+
+        uint32_t chunk = __atomic_fetch_add(&next_chunk, 1, __ATOMIC_SEQ_CST);
+        if (chunk >= chunk_count) {
+            break;
+        }
+        if (chunk_is_done(chunk)) {
+            continue;
+        }
+
 #if defined (DEBUG_BRUTE_FORCE)
-            PrintAndLogEx(INFO, "Thread " _YELLOW_("%u") " starts working on bucket " _YELLOW_("%u") "\n", thread_id, current_bucket);
+        PrintAndLogEx(INFO, "Thread " _YELLOW_("%u") " starts working on bucket " _YELLOW_("%u") " chunk " _YELLOW_("%u") "\n", thread_arg->thread_ID, chunks[chunk].bucket, chunk);
 #endif
-            const uint64_t key = crack_states_bitsliced(thread_arg->cuid, thread_arg->best_first_bytes, bucket, &keys_found, &num_keys_tested, nonces_to_bruteforce, bf_test_nonce_2nd_byte, thread_arg->nonces);
-            if (key != -1) {
-                __atomic_fetch_add(&keys_found, 1, __ATOMIC_SEQ_CST);
-                __atomic_fetch_add(&found_bs_key, key, __ATOMIC_SEQ_CST);
-
+        const uint64_t key = bf_crack_chunk(buckets, &chunks[chunk], thread_arg->cuid, thread_arg->best_first_bytes, &keys_found, &num_keys_tested, nonces_to_bruteforce, bf_test_nonce_2nd_byte, thread_arg->nonces);
+        if (key != -1) {
+            __atomic_fetch_add(&keys_found, 1, __ATOMIC_SEQ_CST);
+            __atomic_fetch_add(&found_bs_key, key, __ATOMIC_SEQ_CST);
+
+            char progress_text[80];
+            char keystr[19];
+            snprintf(keystr, sizeof(keystr), "%012" PRIX64 "  ", key);
+            snprintf(progress_text, sizeof(progress_text), "Brute force phase completed.  Key found: " _GREEN_("%s"), keystr);
+            hardnested_print_progress(thread_arg->num_acquired_nonces, progress_text, 0.0, 0);
+            break;
+        } else if (keys_found) {
+            break;
+        } else {
+            set_chunk_done(chunk);
+            checkpoint_maybe_write();
+            if (!thread_arg->silent) {
                 char progress_text[80];
-                char keystr[19];
-                snprintf(keystr, sizeof(keystr), "%012" PRIX64 "  ", key);
-                snprintf(progress_text, sizeof(progress_text), "Brute force phase completed.  Key found: " _GREEN_("%s"), keystr);
-                hardnested_print_progress(thread_arg->num_acquired_nonces, progress_text, 0.0, 0);
-                break;
-            } else if (keys_found) {
-                break;
-            } else {
-                if (!thread_arg->silent) {
-                    char progress_text[80];
-                    snprintf(progress_text, sizeof(progress_text), "Brute force phase: %6.02f%%\t", 100.0 * (float)num_keys_tested / (float)(thread_arg->maximum_states));
-                    float remaining_bruteforce = thread_arg->nonces[thread_arg->best_first_bytes[0]].expected_num_brute_force - (float)num_keys_tested / 2;
-                    hardnested_print_progress(thread_arg->num_acquired_nonces, progress_text, remaining_bruteforce, 5000);
-                }
+                snprintf(progress_text, sizeof(progress_text), "Brute force phase: %6.02f%%\t", 100.0 * (float)num_keys_tested / (float)(thread_arg->maximum_states));
+                float remaining_bruteforce = thread_arg->nonces[thread_arg->best_first_bytes[0]].expected_num_brute_force - (float)num_keys_tested / 2;
+                hardnested_print_progress(thread_arg->num_acquired_nonces, progress_text, remaining_bruteforce, 5000);
             }
         }
-        current_bucket += NUM_BRUTE_FORCE_THREADS;
     }
     return NULL;
 }
@@ -294,7 +512,7 @@ static void write_benchfile(statelist_t *candidates) {
 #endif
 
 
-bool brute_force_bs(float *bf_rate, statelist_t *candidates, uint32_t cuid, uint32_t num_acquired_nonces, uint64_t maximum_states, noncelist_t *nonces, uint8_t *best_first_bytes, uint64_t *found_key) {
+bool brute_force_bs(float *bf_rate, statelist_t *candidates, uint32_t cuid, uint32_t num_acquired_nonces, uint64_t maximum_states, noncelist_t *nonces, uint8_t *best_first_bytes, uint64_t *found_key, bool checkpoint) {
 #if defined (WRITE_BENCH_FILE)
     write_benchfile(candidates);
 #endif
@@ -315,6 +533,29 @@ bool brute_force_bs(float *bf_rate, statelist_t *candidates, uint32_t cuid, uint
         }
     }
 
+    // resume needs the test nonces, the benchmark has none
+    checkpoint_enabled = checkpoint && !silent && nonces != NULL;
+    if (checkpoint_enabled) {
+        checkpoint_begin(cuid, sort_buckets(cuid, best_first_bytes[0]));
+    }
+
+    if (make_chunks() == false) {
+        PrintAndLogEx(WARNING, "Out of memory error in brute_force. Aborting...");
+        checkpoint_enabled = false;
+        free(checkpoint_path);
+        checkpoint_path = NULL;
+        return false;
+    }
+
+    if (checkpoint_enabled && checkpoint_path != NULL) {
+        uint64_t skipped = read_checkpoint();
+        if (skipped) {
+            num_keys_tested = skipped;
+            PrintAndLogEx(INFO, "Resuming brute force from " _YELLOW_("%s"), checkpoint_path);
+            PrintAndLogEx(INFO, "%1.1f%% of the candidates already tested", 100.0 * (double)skipped / (double)MAX(maximum_states, 1));
+        }
+    }
+
     uint64_t start_time = msclock();
 
 #if defined(__linux__) ||  defined(__APPLE__)
@@ -349,6 +590,12 @@ bool brute_force_bs(float *bf_rate, statelist_t *candidates, uint32_t cuid, uint
 
     uint64_t elapsed_time = msclock() - start_time;
 
+    if (checkpoint_enabled) {
+        checkpoint_end(keys_found != 0);
+        checkpoint_enabled = false;
+    }
+    free_chunks();
+
     if (bf_rate != NULL)
         *bf_rate = (float)num_keys_tested / ((float)elapsed_time / 1000.0);
 
@@ -359,6 +606,206 @@ bool brute_force_bs(float *bf_rate, statelist_t *candidates, uint32_t cuid, uint
 }
 
 
+//----------------------------------------------------------------------------
+// Shard export, see bf_shard_header_t.
+// The chunks of each candidate space are dealt to the shard with the fewest states so
+// far, so every shard gets about the same share of each Sum(a8) guess. A shard stores
+// the full even list of a bucket and the odd states of its own chunks only.
+//----------------------------------------------------------------------------
+static FILE **shard_files = NULL;
+static uint64_t *shard_states = NULL;
+static uint32_t shard_count = 0;
+static uint32_t shard_cuid = 0;
+static bool shard_error = false;
+
+static bool write_shard_header(FILE *f, uint32_t shard, uint32_t cuid, noncelist_t *nonces, uint8_t *best_first_bytes) {
+    bf_shard_header_t hdr = {0};
+    memcpy(hdr.magic, BF_SHARD_MAGIC, sizeof(BF_SHARD_MAGIC));
+    hdr.version = BF_SHARD_VERSION;
+    hdr.cuid = cuid;
+    hdr.shard = shard + 1;
+    hdr.num_shards = shard_count;
+    hdr.num_test_nonces = nonces_to_bruteforce;
+    for (uint16_t i = 0; i < 256; i++) {
+        for (noncelistentry_t *p = nonces[i].first; p != NULL; p = p->next) {
+            hdr.num_nonces++;
+        }
+    }
+
+    bool ok = (fwrite(&hdr, sizeof(hdr), 1, f) == 1);
+    ok = ok && (fwrite(best_first_bytes, 256, 1, f) == 1);
+    for (uint32_t i = 0; ok && i < nonces_to_bruteforce; i++) {
+        ok = (fwrite(&bf_test_nonce[i], sizeof(uint32_t), 1, f) == 1)
+             && (fwrite(&bf_test_nonce_par[i], sizeof(uint8_t), 1, f) == 1);
+    }
+    for (uint16_t i = 0; ok && i < 256; i++) {
+        uint8_t first_byte = i;
+        for (noncelistentry_t *p = nonces[i].first; ok && p != NULL; p = p->next) {
+            ok = (fwrite(&first_byte, sizeof(uint8_t), 1, f) == 1)
+                 && (fwrite(&p->nonce_enc, sizeof(uint32_t), 1, f) == 1)
+                 && (fwrite(&p->par_enc, sizeof(uint8_t), 1, f) == 1);
+        }
+    }
+    return ok;
+}
+
+static void shard_filename(char *dst, size_t len, uint32_t shard) {
+    snprintf(dst, len, "hf-mf-%08" PRIX32 "-shard-%" PRIu32 "-of-%" PRIu32 ".bin", shard_cuid, shard + 1, shard_count);
+}
+
+static bool open_bf_shards(uint32_t cuid, noncelist_t *nonces, uint8_t *best_first_bytes, uint32_t num_shards) {
+    shard_files = calloc(num_shards, sizeof(FILE *));
+    shard_states = calloc(num_shards, sizeof(uint64_t));
+    if (shard_files == NULL || shard_states == NULL) {
+        PrintAndLogEx(WARNING, "Out of memory error in write_bf_shards. Aborting...");
+        return false;
+    }
+    shard_count = num_shards;
+    shard_cuid = cuid;
+
+    for (uint32_t s = 0; s < shard_count; s++) {
+        char filename[64];
+        shard_filename(filename, sizeof(filename), s);
+        shard_files[s] = fopen(filename, "wb");
+        if (shard_files[s] == NULL) {
+            PrintAndLogEx(ERR, "Could not create file " _YELLOW_("%s"), filename);
+            return false;
+        }
+        if (write_shard_header(shard_files[s], s, cuid, nonces, best_first_bytes) == false) {
+            PrintAndLogEx(ERR, "Could not write to file " _YELLOW_("%s"), filename);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool write_shard_section(uint32_t shard, const uint32_t *owner, uint64_t states) {
+    FILE *f = shard_files[shard];
+
+    // odd states of this shard per bucket, the chunks of a bucket are in ascending order
+    uint32_t odd_len[128] = {0};
+    for (uint32_t c = 0; c < chunk_count; c++) {
+        if (owner[c] == shard) {
+            odd_len[chunks[c].bucket] += chunks[c].odd_len;
+        }
+    }
+
+    bf_shard_section_t section = {0};
+    section.num_states = states;
+    for (uint32_t b = 0; b < bucket_count; b++) {
+        if (odd_len[b]) {
+            section.num_buckets++;
+        }
+    }
+
+    bool ok = (fwrite(&section, sizeof(section), 1, f) == 1);
+    for (uint32_t b = 0; ok && b < bucket_count; b++) {
+        if (odd_len[b] == 0) {
+            continue;
+        }
+        uint32_t len[2];
+        len[EVEN_STATE] = buckets[b]->len[EVEN_STATE];
+        len[ODD_STATE] = odd_len[b];
+        ok = (fwrite(len, sizeof(len), 1, f) == 1)
+             && (fwrite(buckets[b]->states[EVEN_STATE], sizeof(uint32_t), len[EVEN_STATE], f) == len[EVEN_STATE]);
+        for (uint32_t c = 0; ok && c < chunk_count; c++) {
+            if (owner[c] == shard && chunks[c].bucket == b) {
+                ok = (fwrite(buckets[b]->states[ODD_STATE] + chunks[c].odd_start, sizeof(uint32_t), chunks[c].odd_len, f) == chunks[c].odd_len);
+            }
+        }
+    }
+    return ok;
+}
+
+bool write_bf_shards(statelist_t *candidates, uint32_t cuid, noncelist_t *nonces, uint8_t *best_first_bytes, uint32_t num_shards) {
+    if (shard_error) {
+        return false;
+    }
+    if (shard_files == NULL && open_bf_shards(cuid, nonces, best_first_bytes, num_shards) == false) {
+        shard_error = true;
+        return false;
+    }
+
+    bucket_count = 0;
+    for (statelist_t *p = candidates; p != NULL; p = p->next) {
+        if (p->states[ODD_STATE] != NULL && p->states[EVEN_STATE] != NULL) {
+            buckets[bucket_count] = p;
+            bucket_count++;
+        }
+    }
+
+    uint32_t *owner = NULL;
+    uint64_t *load = calloc(shard_count, sizeof(uint64_t));
+    bool ok = (load != NULL) && make_chunks();
+    if (ok) {
+        owner = calloc(MAX(chunk_count, 1), sizeof(uint32_t));
+        ok = (owner != NULL);
+    }
+    if (ok == false) {
+        PrintAndLogEx(WARNING, "Out of memory error in write_bf_shards. Aborting...");
+    }
+
+    for (uint32_t c = 0; ok && c < chunk_count; c++) {
+        uint32_t best = 0;
+        for (uint32_t s = 1; s < shard_count; s++) {
+            if (load[s] < load[best]) {
+                best = s;
+            }
+        }
+        owner[c] = best;
+        load[best] += chunk_states(c);
+    }
+
+    for (uint32_t s = 0; ok && s < shard_count; s++) {
+        ok = write_shard_section(s, owner, load[s]);
+        if (ok == false) {
+            char filename[64];
+            shard_filename(filename, sizeof(filename), s);
+            PrintAndLogEx(ERR, "Could not write to file " _YELLOW_("%s"), filename);
+        }
+        shard_states[s] += load[s];
+    }
+
+    free(owner);
+    free(load);
+    free_chunks();
+    shard_error = !ok;
+    return ok;
+}
+
+int close_bf_shards(void) {
+    bool ok = (shard_files != NULL) && !shard_error;
+    uint64_t total = 0;
+    for (uint32_t s = 0; s < shard_count; s++) {
+        if (shard_files[s] != NULL && fclose(shard_files[s]) != 0) {
+            ok = false;
+        }
+        total += shard_states[s];
+    }
+
+    if (ok) {
+        char filename[64];
+        shard_filename(filename, sizeof(filename), 0);
+        PrintAndLogEx(SUCCESS, "Wrote " _YELLOW_("%" PRIu32) " shard files, %1.0f (2^%1.1f) states in total", shard_count, (double)total, log((double)MAX(total, 1)) / log(2.0));
+        for (uint32_t s = 0; s < shard_count; s++) {
+            shard_filename(filename, sizeof(filename), s);
+            PrintAndLogEx(INFO, "  " _YELLOW_("%s") "  %1.0f states", filename, (double)shard_states[s]);
+        }
+        PrintAndLogEx(HINT, "Hint: copy the shards to the workers and run `" _YELLOW_("hardnested_worker <shard file>") "` on each");
+    } else if (shard_files == NULL && !shard_error) {
+        PrintAndLogEx(WARNING, "No candidates, no shard files written");
+    }
+
+    free(shard_files);
+    shard_files = NULL;
+    free(shard_states);
+    shard_states = NULL;
+    shard_count = 0;
+    shard_error = false;
+    return ok ? PM3_SUCCESS : PM3_EFILE;
+}
+
+
 static bool read_bench_data(statelist_t *test_candidates) {
 
     size_t bytes_read = 0;
@@ -461,7 +908,7 @@ float brute_force_benchmark(void) {
 
     float bf_rate;
     uint64_t found_key = 0;
-    brute_force_bs(&bf_rate, test_candidates, 0, 0, maximum_states, NULL, 0, &found_key);
+    brute_force_bs(&bf_rate, test_candidates, 0, 0, maximum_states, NULL, 0, &found_key, false);
 
     free(test_candidates[0].states[ODD_STATE]);
     free(test_candidates[0].states[EVEN_STATE]);
@@ -22,6 +22,15 @@
 
 #define NUM_SUMS 19 // number of possible sum property values
 
+// work split of the brute force, shared with tools/hardnested_worker
+#define BF_CHUNK_STATES     (1ULL << 31)  // keys per work chunk
+#define BF_CHUNK_MIN_ODD    (256)         // odd states per chunk at least, the even states are bitsliced per chunk
+
+typedef enum {
+    EVEN_STATE = 0,
+    ODD_STATE = 1
+} odd_even_t;
+
 typedef struct guess_sum_a8 {
     float prob;
     uint64_t num_states;
@@ -53,10 +62,64 @@ typedef struct {
     void *next;
 } statelist_t;
 
+//----------------------------------------------------------------------------
+// Shard files for brute forcing on several hosts, written by hf mf hardnested --shards
+// and searched by tools/hardnested_worker. Each shard holds its part of all candidate
+// spaces plus everything needed to test a key, so shards can be copied anywhere.
+// Fields are in host byte order.
+//
+// layout:  header | best_first_bytes[256] | test nonces | nonces | sections
+//   test nonce:  uint32 nonce_enc | uint8 par_enc                      (num_test_nonces)
+//   nonce:       uint8 first byte | uint32 nonce_enc | uint8 par_enc   (num_nonces)
+//   section:     bf_shard_section_t | buckets
+//   bucket:      uint32 len[2] | uint32 even states[len[0]] | uint32 odd states[len[1]]
+// The sections are the candidate spaces of the Sum(a8) guesses, most probable first.
+// The nonces are xored with the cuid already, as in noncelist_t.
+//----------------------------------------------------------------------------
+#define BF_SHARD_MAGIC      "PM3HNSH"
+#define BF_SHARD_VERSION    1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t cuid;
+    uint32_t shard;             // 1 .. num_shards
+    uint32_t num_shards;
+    uint32_t num_test_nonces;
+    uint32_t num_nonces;
+} bf_shard_header_t;
+
+typedef struct {
+    uint32_t num_buckets;
+    uint32_t rfu;
+    uint64_t num_states;
+} bf_shard_section_t;
+
 void prepare_bf_test_nonces(noncelist_t *nonces, uint8_t best_first_byte);
-bool brute_force_bs(float *bf_rate, statelist_t *candidates, uint32_t cuid, uint32_t num_acquired_nonces, uint64_t maximum_states, noncelist_t *nonces, uint8_t *best_first_bytes, uint64_t *found_key);
+bool brute_force_bs(float *bf_rate, statelist_t *candidates, uint32_t cuid, uint32_t num_acquired_nonces, uint64_t maximum_states, noncelist_t *nonces, uint8_t *best_first_bytes, uint64_t *found_key, bool checkpoint);
 float brute_force_benchmark(void);
+// removes the checkpoint files written by brute_force_bs since the last call
+void remove_bf_checkpoints(void);
+// adds the candidates of one Sum(a8) guess to the shard files, creating them on first use
+bool write_bf_shards(statelist_t *candidates, uint32_t cuid, noncelist_t *nonces, uint8_t *best_first_bytes, uint32_t num_shards);
+// closes the shard files, returns PM3_SUCCESS if all were written
+int close_bf_shards(void);
 uint8_t trailing_zeros(uint8_t byte);
 bool verify_key(uint32_t cuid, noncelist_t *nonces, const uint8_t *best_first_bytes, uint32_t odd, uint32_t even);
 
+// Buckets are split into chunks of about BF_CHUNK_STATES keys, threads take the next
+// chunk from an atomic cursor. Bucket sizes differ by orders of magnitude, so a static
+// distribution of buckets leaves threads idle.
+typedef struct {
+    uint32_t bucket;
+    uint32_t odd_start;
+    uint32_t odd_len;
+} bf_chunk_t;
+
+// splits the buckets into chunks, in bucket order. Returns NULL if out of memory, free() the result
+bf_chunk_t *bf_make_chunks(statelist_t *const *buckets, uint32_t bucket_count, uint32_t *chunk_count);
+// brute forces one chunk, returns the key or -1
+uint64_t bf_crack_chunk(statelist_t *const *buckets, const bf_chunk_t *chunk, uint32_t cuid, uint8_t *best_first_bytes,
+                        uint32_t *keys_found, uint64_t *num_keys_tested, uint32_t num_test_nonces, uint8_t *test_nonce_2nd_byte, noncelist_t *nonces);
+
 #endif
@@ -0,0 +1,108 @@
+//-----------------------------------------------------------------------------
+// Copyright (C) 2016, 2017 by piwi
+//
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Key verification,  work chunks and helpers used by the bitsliced brute force cores.
+// Kept apart from hardnested_bruteforce.c, so tools/hardnested_worker can link
+// the cores without the client.
+//-----------------------------------------------------------------------------
+
+#include "hardnested_bruteforce.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "common.h"
+#include "hardnested_bf_core.h"
+#include "crapto1/crapto1.h"
+#include "parity.h"
+
+inline uint8_t trailing_zeros(uint8_t byte) {
+    static const uint8_t trailing_zeros_LUT[256] = {
+        8, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+        4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+        5, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+        4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+        6, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+        4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+        5, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+        4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+        7, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+        4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+        5, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+        4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+        6, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+        4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+        5, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+        4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0
+    };
+
+    return trailing_zeros_LUT[byte];
+}
+
+
+bool verify_key(uint32_t cuid, noncelist_t *nonces, const uint8_t *best_first_bytes, uint32_t odd, uint32_t even) {
+    struct Crypto1State pcs;
+    for (uint16_t test_first_byte = 1; test_first_byte < 256; test_first_byte++) {
+        noncelistentry_t *test_nonce = nonces[best_first_bytes[test_first_byte]].first;
+        while (test_nonce != NULL) {
+            pcs.odd = odd;
+            pcs.even = even;
+            lfsr_rollback_byte(&pcs, (cuid >> 24) ^ best_first_bytes[0], true);
+            for (int8_t byte_pos = 3; byte_pos >= 0; byte_pos--) {
+                uint8_t test_par_enc_bit = (test_nonce->par_enc >> byte_pos) & 0x01;     // the encoded parity bit
+                uint8_t test_byte_enc = (test_nonce->nonce_enc >> (8 * byte_pos)) & 0xff; // the encoded nonce byte
+                uint8_t test_byte_dec = crypto1_byte(&pcs, test_byte_enc /* ^ (cuid >> (8*byte_pos)) */, true) ^ test_byte_enc; // decode the nonce byte
+                uint8_t ks_par = filter(pcs.odd);                                        // the keystream bit to encode/decode the parity bit
+                uint8_t test_par_enc2 = ks_par ^ evenparity8(test_byte_dec);             // determine the decoded byte's parity and encode it
+                if (test_par_enc_bit != test_par_enc2) {
+                    return false;
+                }
+            }
+            test_nonce = test_nonce->next;
+        }
+    }
+    return true;
+}
+
+bf_chunk_t *bf_make_chunks(statelist_t *const *buckets, uint32_t bucket_count, uint32_t *chunk_count) {
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < bucket_count; i++) {
+        uint32_t odd_len = buckets[i]->len[ODD_STATE];
+        uint64_t per_chunk = MAX(BF_CHUNK_STATES / MAX(buckets[i]->len[EVEN_STATE], 1), BF_CHUNK_MIN_ODD);
+        count += (odd_len + per_chunk - 1) / per_chunk;
+    }
+
+    *chunk_count = 0;
+    bf_chunk_t *chunks = calloc(MAX(count, 1), sizeof(bf_chunk_t));
+    if (chunks == NULL) {
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < bucket_count; i++) {
+        uint32_t odd_len = buckets[i]->len[ODD_STATE];
+        uint64_t per_chunk = MAX(BF_CHUNK_STATES / MAX(buckets[i]->len[EVEN_STATE], 1), BF_CHUNK_MIN_ODD);
+        for (uint64_t start = 0; start < odd_len; start += per_chunk) {
+            chunks[*chunk_count].bucket = i;
+            chunks[*chunk_count].odd_start = start;
+            chunks[*chunk_count].odd_len = MIN(per_chunk, odd_len - start);
+            (*chunk_count)++;
+        }
+    }
+    return chunks;
+}
+
+uint64_t bf_crack_chunk(statelist_t *const *buckets, const bf_chunk_t *chunk, uint32_t cuid, uint8_t *best_first_bytes,
+                        uint32_t *keys_found, uint64_t *num_keys_tested, uint32_t num_test_nonces, uint8_t *test_nonce_2nd_byte, noncelist_t *nonces) {
+    // a bucket restricted to the odd states of this chunk
+    statelist_t part = *buckets[chunk->bucket];
+    part.states[ODD_STATE] += chunk->odd_start;
+    part.len[ODD_STATE] = chunk->odd_len;
+    part.next = NULL;
+    return crack_states_bitsliced(cuid, best_first_bytes, &part, keys_found, num_keys_tested, num_test_nonces, test_nonce_2nd_byte, nonces);
+}
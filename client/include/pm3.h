@@ -16,11 +16,41 @@
 #ifndef LIBPM3_H
 #define LIBPM3_H
 
+#include <stdint.h>
+#include <stddef.h>
+
 typedef struct pm3_device pm3;
 
+// Every pm3_open gives a separate device with its own communication thread, so one process
+// can drive several Proxmark3 at the same time.  Use each device from one thread at a time.
+// Returns NULL if the port can't be opened.  A NULL port gives a device that is not connected,
+// commands run on it are offline.  Either way the device belongs to the caller.
 pm3 *pm3_open(const char *port);
+// Runs a client command against dev, on the calling thread
 int pm3_console(pm3 *dev, const char *cmd);
 const char *pm3_name_get(pm3 *dev);
+// Closes the port and frees dev, once calls on dev still running in other threads returned
 void pm3_close(pm3 *dev);
+// Device used by the calling thread, i.e. the one of the console when called from a script
 pm3 *pm3_get_current_dev(void);
+
+// Structured calls, nothing is printed and results come back as data.
+// Returned buffers are allocated by the library, release them with pm3_free.
+// Return PM3_* status codes; PM3_ENOTTY when dev is not connected.
+
+// Sends one NG frame
+int pm3_send(pm3 *dev, uint16_t cmd, const uint8_t *in, size_t inlen);
+// Waits for a reply to cmd.  NG frames give their payload and return their status,
+// MIX / OLD frames give the three little endian uint64 arguments followed by the payload.
+int pm3_receive(pm3 *dev, uint16_t cmd, uint32_t timeout, uint8_t **out, size_t *outlen);
+// Downloads the trace buffer of the device, the raw bytes as used by trace load / save
+int pm3_trace(pm3 *dev, uint8_t **out, size_t *outlen);
+// MIFARE Classic key check of keyslen / 6 keys over sectors sectors, the result as JSON:
+// {"found":n,"sectors":[{"sector":0,"a":"FFFFFFFFFFFF","b":null},...]}
+// PM3_EPARTIAL when some keys were not found.
+int pm3_mf_chk(pm3 *dev, uint8_t sectors, const uint8_t *keys, size_t keyslen, char **json);
+// MIFARE Classic dump with sectors * 12 bytes of keys (key A then key B per sector).
+// Sectors that can't be read stay zero and give PM3_EPARTIAL.
+int pm3_mf_dump(pm3 *dev, uint8_t sectors, const uint8_t *keys, size_t keyslen, uint8_t **out, size_t *outlen);
+void pm3_free(void *p);
 #endif // LIBPM3_H
@@ -17,6 +17,7 @@
 //-----------------------------------------------------------------------------
 #include "cmddata.h"
 #include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
 #include <limits.h>              // for CmdNorm INT_MIN && INT_MAX
 #include <math.h>                // pow
@@ -26,6 +27,8 @@
 #include "ui.h"                  // for show graph controls
 #include "proxgui.h"
 #include "graph.h"               // for graph data
+#include "fft.h"                 // fft_xcorr
+#include "util_posix.h"          // msclock
 #include "comms.h"
 #include "lfdemod.h"             // for demod code
 #include "loclass/cipherutils.h" // for decimating samples in getsamples
@@ -70,6 +73,87 @@ bool getDemodBuff(uint8_t *buff, size_t *size) {
     return true;
 }
 
+int DemodCtxInit(demod_ctx_t *ctx, const uint8_t *samples, size_t len, size_t maxlen) {
+    memset(ctx, 0, sizeof(demod_ctx_t));
+    if (samples == NULL || len == 0) {
+        return PM3_EINVARG;
+    }
+    // the demods got a zeroed graph copy of at least GRAPH_TRACE_LEN_INIT,  same here
+    ctx->bits = calloc(MAX(len, GRAPH_TRACE_LEN_INIT), sizeof(uint8_t));
+    if (ctx->bits == NULL) {
+        return PM3_EMALLOC;
+    }
+    ctx->owned = true;
+    ctx->samples = samples;
+    ctx->samples_len = len;
+    ctx->maxlen = maxlen;
+    return PM3_SUCCESS;
+}
+
+void DemodCtxFree(demod_ctx_t *ctx) {
+    if (ctx->owned) {
+        free(ctx->bits);
+    }
+    memset(ctx, 0, sizeof(demod_ctx_t));
+}
+
+// make the result of a demod the current g_DemodBuffer
+void DemodCtxApply(const demod_ctx_t *ctx) {
+    if (ctx->st) {
+        g_CursorCPos = ctx->st_start;
+        g_CursorDPos = ctx->st_end;
+    }
+    setDemodBuff(ctx->bits, ctx->len, 0);
+    setClockGrid(ctx->clock, ctx->start_idx);
+}
+
+// where the tag demods report to,  per thread like the demods themselves
+static _Thread_local demod_ctx_t *g_demod_collect = NULL;
+
+void DemodCtxCollect(demod_ctx_t *ctx) {
+    g_demod_collect = ctx;
+}
+
+void DemodCtxReportId(const char *fmt, ...) {
+    if (g_demod_collect == NULL) {
+        return;
+    }
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(g_demod_collect->id, sizeof(g_demod_collect->id), fmt, args);
+    va_end(args);
+}
+
+// a single demod on a graph copy from getGraphBufU8,  done in place
+static void demod_ctx_wrap(demod_ctx_t *ctx, uint8_t *bits, size_t len) {
+    memset(ctx, 0, sizeof(demod_ctx_t));
+    ctx->samples = bits;
+    ctx->samples_len = len;
+    ctx->bits = bits;
+    ctx->maxlen = g_pm3_capabilities.bigbuf_size;
+}
+
+// fresh copy of the samples to demodulate
+static uint8_t *demod_ctx_load(demod_ctx_t *ctx, size_t *len) {
+    if (ctx->bits != ctx->samples) {
+        memcpy(ctx->bits, ctx->samples, ctx->samples_len);
+    }
+    ctx->len = 0;
+    ctx->clock = 0;
+    ctx->start_idx = 0;
+    ctx->errors = 0;
+    ctx->st = false;
+    *len = ctx->samples_len;
+    return ctx->bits;
+}
+
+static void demod_ctx_set(demod_ctx_t *ctx, size_t len, int clk, int32_t start_idx, int errors) {
+    ctx->len = MIN(len, MAX_DEMOD_BUF_LEN);
+    ctx->clock = clk;
+    ctx->start_idx = start_idx;
+    ctx->errors = errors;
+}
+
 // include <math.h>
 // Root mean square
 /*
@@ -367,39 +451,16 @@ static int CmdConvertBitStream(const char *Cmd) {
     return PM3_SUCCESS;
 }
 
-// Cmd Args: Clock, invert, maxErr, maxLen as integers and amplify as char == 'a'
-//   (amp may not be needed anymore)
-// verbose will print results and demoding messages
-// emSearch will auto search for EM410x format in bitstream
-// askType switches decode: ask/raw = 0, ask/manchester = 1
-int ASKDemod_ext(int clk, int invert, int maxErr, size_t maxlen, bool amplify, bool verbose, bool emSearch, uint8_t askType, bool *stCheck) {
-    PrintAndLogEx(DEBUG, "DEBUG: (ASKDemod_ext) clk %i invert %i maxErr %i maxLen %zu amplify %i verbose %i emSearch %i askType %i "
-                  , clk
-                  , invert
-                  , maxErr
-                  , maxlen
-                  , amplify
-                  , verbose
-                  , emSearch
-                  , askType
-                 );
+int ASKDemodCtx(demod_ctx_t *ctx, int clk, int invert, int maxErr, bool amplify, uint8_t askType, bool *stCheck) {
     uint8_t askamp = 0;
+    size_t maxlen = ctx->maxlen;
 
-    if (maxlen == 0)
-        maxlen = g_pm3_capabilities.bigbuf_size;
-
-    uint8_t *bits = calloc(MAX_GRAPH_TRACE_LEN, sizeof(uint8_t));
-    if (bits == NULL) {
-        PrintAndLogEx(INFO, "failed to allocate memory");
-        return PM3_EMALLOC;
-    }
-
-    size_t bitlen = getFromGraphBuf(bits);
+    size_t bitlen = 0;
+    uint8_t *bits = demod_ctx_load(ctx, &bitlen);
 
     PrintAndLogEx(DEBUG, "DEBUG: (ASKDemod_ext) #samples from graphbuff: %zu", bitlen);
 
     if (bitlen < 255) {
-        free(bits);
         return PM3_ESOFT;
     }
 
@@ -425,10 +486,9 @@ int ASKDemod_ext(int clk, int invert, int maxErr, size_t maxlen, bool amplify, b
 
     if (st) {
         *stCheck = st;
-        g_CursorCPos = ststart;
-        g_CursorDPos = stend;
-        if (verbose)
-            PrintAndLogEx(DEBUG, "Found Sequence Terminator - First one is shown by orange / blue graph markers");
+        ctx->st = true;
+        ctx->st_start = ststart;
+        ctx->st_end = stend;
     }
 
     int start_idx = 0;
@@ -446,7 +506,6 @@ int ASKDemod_ext(int clk, int invert, int maxErr, size_t maxlen, bool amplify, b
                       , bitlen
                       , clk
                      );
-        free(bits);
         return PM3_ESOFT;
     }
 
@@ -456,32 +515,73 @@ int ASKDemod_ext(int clk, int invert, int maxErr, size_t maxlen, bool amplify, b
                       , bitlen
                       , clk
                      );
-        free(bits);
         return PM3_ESOFT;
     }
 
+    demod_ctx_set(ctx, bitlen, clk, start_idx, errCnt);
+    return PM3_SUCCESS;
+}
+
+// Cmd Args: Clock, invert, maxErr, maxLen as integers and amplify as char == 'a'
+//   (amp may not be needed anymore)
+// verbose will print results and demoding messages
+// emSearch will auto search for EM410x format in bitstream
+// askType switches decode: ask/raw = 0, ask/manchester = 1
+int ASKDemod_ext(int clk, int invert, int maxErr, size_t maxlen, bool amplify, bool verbose, bool emSearch, uint8_t askType, bool *stCheck) {
+    PrintAndLogEx(DEBUG, "DEBUG: (ASKDemod_ext) clk %i invert %i maxErr %i maxLen %zu amplify %i verbose %i emSearch %i askType %i "
+                  , clk
+                  , invert
+                  , maxErr
+                  , maxlen
+                  , amplify
+                  , verbose
+                  , emSearch
+                  , askType
+                 );
+
+    size_t bitlen = 0;
+    uint8_t *bits = getGraphBufU8(&bitlen);
+
+    demod_ctx_t ctx;
+    demod_ctx_wrap(&ctx, bits, bitlen);
+    if (maxlen) {
+        ctx.maxlen = maxlen;
+    }
+    int res = ASKDemodCtx(&ctx, clk, invert, maxErr, amplify, askType, stCheck);
+
+    if (ctx.st) {
+        g_CursorCPos = ctx.st_start;
+        g_CursorDPos = ctx.st_end;
+        if (verbose)
+            PrintAndLogEx(DEBUG, "Found Sequence Terminator - First one is shown by orange / blue graph markers");
+    }
+
+    if (res != PM3_SUCCESS) {
+        releaseGraphBufU8(bits);
+        return res;
+    }
+
     if (verbose) {
         PrintAndLogEx(DEBUG, "DEBUG: (ASKDemod_ext) using clock:%d, %sbits found:%zu, start index %d"
-                      , clk
+                      , ctx.clock
                       , (invert) ? "inverted, " : ""
-                      , bitlen
-                      , start_idx
+                      , ctx.len
+                      , ctx.start_idx
                      );
     }
 
     //output
-    setDemodBuff(bits, bitlen, 0);
-    setClockGrid(clk, start_idx);
+    DemodCtxApply(&ctx);
 
     if (verbose) {
-        if (errCnt > 0)
-            PrintAndLogEx(DEBUG, "# Errors during demoding (shown as 7 in bit stream): %d", errCnt);
+        if (ctx.errors > 0)
+            PrintAndLogEx(DEBUG, "# Errors during demoding (shown as 7 in bit stream): %d", ctx.errors);
 
         if (askType) {
-            PrintAndLogEx(SUCCESS, _YELLOW_("ASK/Manchester") " - clock %d - decoded bitstream", clk);
+            PrintAndLogEx(SUCCESS, _YELLOW_("ASK/Manchester") " - clock %d - decoded bitstream", ctx.clock);
             PrintAndLogEx(INFO, "---------------------------------------------");
         } else {
-            PrintAndLogEx(SUCCESS, _YELLOW_("ASK/Raw") " - clock %d - decoded bitstream", clk);
+            PrintAndLogEx(SUCCESS, _YELLOW_("ASK/Raw") " - clock %d - decoded bitstream", ctx.clock);
             PrintAndLogEx(INFO, "--------------------------------------");
         }
 
@@ -492,7 +592,7 @@ int ASKDemod_ext(int clk, int invert, int maxErr, size_t maxlen, bool amplify, b
     if (emSearch)
         AskEm410xDecode(true, &hi, &lo);
 
-    free(bits);
+    releaseGraphBufU8(bits);
     return PM3_SUCCESS;
 }
 
@@ -676,16 +776,11 @@ static int CmdBiphaseDecodeRaw(const char *Cmd) {
     return PM3_SUCCESS;
 }
 
-// ASK Demod then Biphase decode g_GraphBuffer samples
-int ASKbiphaseDemod(int offset, int clk, int invert, int maxErr, bool verbose) {
-    //ask raw demod g_GraphBuffer first
+int ASKbiphaseDemodCtx(demod_ctx_t *ctx, int *offset, int clk, int invert, int maxErr) {
+    //ask raw demod the samples first
+    size_t size = 0;
+    uint8_t *bs = demod_ctx_load(ctx, &size);
 
-    uint8_t bs[MAX_DEMOD_BUF_LEN];
-    size_t size = getFromGraphBuf(bs);
-    if (size == 0) {
-        PrintAndLogEx(DEBUG, "DEBUG: no data in graphbuf");
-        return PM3_ESOFT;
-    }
     int startIdx = 0;
     //invert here inverts the ask raw demoded bits which has no effect on the demod, but we need the pointer
     int errCnt = askdemod_ext(bs, &size, &clk, &invert, maxErr, 0, 0, &startIdx);
@@ -695,24 +790,47 @@ int ASKbiphaseDemod(int offset, int clk, int invert, int maxErr, bool verbose) {
     }
 
     //attempt to Biphase decode BitStream
-    errCnt = BiphaseRawDecode(bs, &size, &offset, invert);
+    errCnt = BiphaseRawDecode(bs, &size, offset, invert);
     if (errCnt < 0) {
-        if (g_debugMode || verbose) PrintAndLogEx(DEBUG, "DEBUG: Error BiphaseRawDecode: %d", errCnt);
+        PrintAndLogEx(DEBUG, "DEBUG: Error BiphaseRawDecode: %d", errCnt);
         return PM3_ESOFT;
     }
     if (errCnt > maxErr) {
-        if (g_debugMode || verbose) PrintAndLogEx(DEBUG, "DEBUG: Error BiphaseRawDecode too many errors: %d", errCnt);
+        PrintAndLogEx(DEBUG, "DEBUG: Error BiphaseRawDecode too many errors: %d", errCnt);
+        return PM3_ESOFT;
+    }
+
+    if (*offset >= 1) {
+        *offset -= 1;
+    }
+    demod_ctx_set(ctx, size, clk, startIdx + clk * *offset / 2, errCnt);
+    return PM3_SUCCESS;
+}
+
+// ASK Demod then Biphase decode g_GraphBuffer samples
+int ASKbiphaseDemod(int offset, int clk, int invert, int maxErr, bool verbose) {
+    //ask raw demod g_GraphBuffer first
+
+    size_t size = 0;
+    uint8_t *bs = getGraphBufU8(&size);
+    if (bs == NULL) {
+        PrintAndLogEx(DEBUG, "DEBUG: no data in graphbuf");
         return PM3_ESOFT;
     }
 
-    if (offset >= 1) {
-        offset -= 1;
+    demod_ctx_t ctx;
+    demod_ctx_wrap(&ctx, bs, size);
+    int res = ASKbiphaseDemodCtx(&ctx, &offset, clk, invert, maxErr);
+    if (res != PM3_SUCCESS) {
+        releaseGraphBufU8(bs);
+        return res;
     }
+
     //success set g_DemodBuffer and return
-    setDemodBuff(bs, size, 0);
-    setClockGrid(clk, startIdx + clk * offset / 2);
+    DemodCtxApply(&ctx);
+    releaseGraphBufU8(bs);
     if (g_debugMode || verbose) {
-        PrintAndLogEx(DEBUG, "Biphase Decoded using offset %d | clock %d | #errors %d | start index %d\ndata\n", offset, clk, errCnt, (startIdx + clk * offset / 2));
+        PrintAndLogEx(DEBUG, "Biphase Decoded using offset %d | clock %d | #errors %d | start index %d\ndata\n", offset, ctx.clock, ctx.errors, ctx.start_idx);
         printDemodBuff(offset, false, false, false);
     }
     return PM3_SUCCESS;
@@ -783,15 +901,58 @@ static int Cmdaskrawdemod(const char *Cmd) {
     return ASKDemod_ext(clk, invert, max_err, max_len, amplify, true, false, 0, &st);
 }
 
-int AutoCorrelate(const int *in, int *out, size_t len, size_t window, bool SaveGrph, bool verbose) {
+// sum over j of (in[j] - mean) * (in[j + i] - mean) for the shifts i < lags.
+// The products of the raw samples come from an FFT, they are integers so rounding makes them exact,
+// the mean is taken out afterwards with prefix sums.  direct = true is the plain O(len * lags) loop.
+static int AutoCorrelateSums(const int *in, size_t len, size_t lags, double mean, bool direct, double *sums) {
+
+    if (direct) {
+        for (size_t i = 0; i < lags; ++i) {
+            double sum = 0.0;
+            for (size_t j = 0; j < (len - i); j++) {
+                sum += (in[j] - mean) * (in[j + i] - mean);
+            }
+            sums[i] = sum;
+        }
+        return PM3_SUCCESS;
+    }
+
+    double *x = calloc(len, sizeof(double));
+    int64_t *prefix = calloc(len + 1, sizeof(int64_t));
+    if (x == NULL || prefix == NULL) {
+        free(x);
+        free(prefix);
+        return PM3_EMALLOC;
+    }
+
+    for (size_t j = 0; j < len; j++) {
+        x[j] = in[j];
+        prefix[j + 1] = prefix[j] + in[j];
+    }
+
+    int res = fft_xcorr(x, len, x, len, lags, sums);
+    if (res == PM3_SUCCESS) {
+        for (size_t i = 0; i < lags; i++) {
+            double raw = round(sums[i]);
+            double head = prefix[len - i];            // in[0 .. len - i)
+            double tail = prefix[len] - prefix[i];    // in[i .. len)
+            sums[i] = raw - mean * (head + tail) + (len - i) * mean * mean;
+        }
+    }
+
+    free(x);
+    free(prefix);
+    return res;
+}
+
+static int AutoCorrelateComputeEx(const int *in, size_t len, size_t window, const bool *cancel, bool direct, autocorr_t *ac) {
     // sanity check
     if (window > len) window = len;
 
-    if (verbose) PrintAndLogEx(INFO, "performing " _YELLOW_("%zu") " correlations", g_GraphTraceLen - window);
+    memset(ac, 0, sizeof(autocorr_t));
 
     //test
     double autocv = 0.0;    // Autocovariance value
-    size_t correlation = 0;
     int lastmax = 0;
 
     // in, len, 4000
@@ -799,16 +960,31 @@ int AutoCorrelate(const int *in, int *out, size_t len, size_t window, bool SaveG
     // Computed variance
     double variance = compute_variance(in, len);
 
-    int *correl_buf = calloc(MAX_GRAPH_TRACE_LEN, sizeof(int));
+    ac->correl_buf = calloc(len + 1, sizeof(int));
+    if (ac->correl_buf == NULL) {
+        return PM3_EMALLOC;
+    }
+
+    size_t lags = len - window;
+    double *sums = calloc(lags + 1, sizeof(double));
+    if (sums == NULL || (lags && AutoCorrelateSums(in, len, lags, mean, direct, sums) != PM3_SUCCESS)) {
+        free(sums);
+        free(ac->correl_buf);
+        ac->correl_buf = NULL;
+        return PM3_EMALLOC;
+    }
 
-    for (size_t i = 0; i < len - window; ++i) {
+    for (size_t i = 0; i < lags; ++i) {
 
-        for (size_t j = 0; j < (len - i); j++) {
-            autocv += (in[j] - mean) * (in[j + i] - mean);
+        if (cancel && __atomic_load_n(cancel, __ATOMIC_RELAXED)) {
+            free(sums);
+            return PM3_EOPABORTED;
         }
+
+        autocv += sums[i];
         autocv = (1.0 / (len - i)) * autocv;
 
-        correl_buf[i] = autocv;
+        ac->correl_buf[i] = autocv;
 
         // Computed autocorrelation value to be returned
         // Autocorrelation is autocovariance divided by variance
@@ -816,76 +992,105 @@ int AutoCorrelate(const int *in, int *out, size_t len, size_t window, bool SaveG
 
         // keep track of which distance is repeating.
         if (ac_value > 1) {
-            correlation = i - lastmax;
+            ac->correlation = i - lastmax;
             lastmax = i;
         }
     }
+    free(sums);
 
     //
-    int hi = 0, idx = 0;
-    int distance = 0, hi_1 = 0, idx_1 = 0;
     for (size_t i = 0; i <= len; ++i) {
-        if (correl_buf[i] > hi) {
-            hi = correl_buf[i];
-            idx = i;
+        if (ac->correl_buf[i] > ac->hi) {
+            ac->hi = ac->correl_buf[i];
+            ac->idx = i;
         }
     }
 
-    for (size_t i = idx + 1; i <= window; ++i) {
-        if (correl_buf[i] > hi_1) {
-            hi_1 = correl_buf[i];
-            idx_1 = i;
+    for (size_t i = ac->idx + 1; i <= window; ++i) {
+        if (ac->correl_buf[i] > ac->hi_1) {
+            ac->hi_1 = ac->correl_buf[i];
+            ac->idx_1 = i;
         }
     }
+    return PM3_SUCCESS;
+}
+
+// The correlation part of AutoCorrelate.  It doesn't print nor touch any globals,
+// so it can run on a copy of the samples in another thread.  ac->correl_buf must be freed by the caller.
+// If cancel is set from another thread it gives up and returns PM3_EOPABORTED.
+int AutoCorrelateCompute(const int *in, size_t len, size_t window, const bool *cancel, autocorr_t *ac) {
+    return AutoCorrelateComputeEx(in, len, window, cancel, false, ac);
+}
 
-    int foo = ABS(hi - hi_1);
-    int bar = (int)((int)((hi + hi_1) / 2) * 0.04);
+// print and apply the result of AutoCorrelateCompute,  frees ac->correl_buf
+int AutoCorrelateApply(autocorr_t *ac, int *out, size_t len, bool SaveGrph, bool verbose) {
+    int distance = 0;
+    int foo = ABS(ac->hi - ac->hi_1);
+    int bar = (int)((int)((ac->hi + ac->hi_1) / 2) * 0.04);
 
     if (verbose && foo < bar) {
-        distance = idx_1 - idx;
+        distance = ac->idx_1 - ac->idx;
         PrintAndLogEx(SUCCESS, "possible visible correlation "_YELLOW_("%4d") " samples", distance);
-    } else if (verbose && (correlation > 1)) {
-        PrintAndLogEx(SUCCESS, "possible correlation " _YELLOW_("%4zu") " samples", correlation);
+    } else if (verbose && (ac->correlation > 1)) {
+        PrintAndLogEx(SUCCESS, "possible correlation " _YELLOW_("%4zu") " samples", ac->correlation);
     } else {
         PrintAndLogEx(FAILED, "no repeating pattern found, try increasing window size");
     }
 
-    int retval = correlation;
-    if (SaveGrph) {
+    int retval = ac->correlation;
+    if (SaveGrph && ac->correl_buf) {
         //g_GraphTraceLen = g_GraphTraceLen - window;
-        memcpy(out, correl_buf, len * sizeof(int));
+        memcpy(out, ac->correl_buf, len * sizeof(int));
         if (distance > 0) {
-            setClockGrid(distance, idx);
+            setClockGrid(distance, ac->idx);
             retval = distance;
         } else
-            setClockGrid(correlation, idx);
+            setClockGrid(ac->correlation, ac->idx);
 
-        g_CursorCPos = idx_1;
-        g_CursorDPos = idx_1 + retval;
+        g_CursorCPos = ac->idx_1;
+        g_CursorDPos = ac->idx_1 + retval;
         g_DemodBufferLen = 0;
         RepaintGraphWindow();
     }
-    free(correl_buf);
+    free(ac->correl_buf);
+    ac->correl_buf = NULL;
     return retval;
 }
 
+int AutoCorrelate(const int *in, int *out, size_t len, size_t window, bool SaveGrph, bool verbose) {
+    // sanity check
+    if (window > len) window = len;
+
+    if (verbose) PrintAndLogEx(INFO, "performing " _YELLOW_("%zu") " correlations", g_GraphTraceLen - window);
+
+    autocorr_t ac;
+    if (AutoCorrelateCompute(in, len, window, NULL, &ac) != PM3_SUCCESS) {
+        PrintAndLogEx(WARNING, "Failed to allocate memory");
+        return 0;
+    }
+    return AutoCorrelateApply(&ac, out, len, SaveGrph, verbose);
+}
+
 static int CmdAutoCorr(const char *Cmd) {
     CLIParserContext *ctx;
     CLIParserInit(&ctx, "data autocorr",
                   "Autocorrelate over window is used to detect repeating sequences.\n"
                   "We use it as detection of how long in bits a message inside the signal is",
                   "data autocorr -w 4000\n"
-                  "data autocorr -w 4000 -g"
+                  "data autocorr -w 4000 -g\n"
+                  "data autocorr -w 4000 -t     -> also time the direct correlation against the FFT one"
                  );
     void *argtable[] = {
         arg_param_begin,
         arg_lit0("g", NULL, "save back to GraphBuffer (overwrite)"),
         arg_u64_0("w", "win", "<dec>", "window length for correlation. def 4000"),
+        arg_lit0("t", "time", "compare the time of the direct and the FFT correlation"),
         arg_param_end
     };
     CLIExecWithReturn(ctx, Cmd, argtable, true);
     bool updateGrph = arg_get_lit(ctx, 1);
     uint32_t window = arg_get_u32_def(ctx, 2, 4000);
+    bool timing = arg_get_lit(ctx, 3);
     CLIParserFree(ctx);
 
     PrintAndLogEx(INFO, "Using window size " _YELLOW_("%u"), window);
@@ -901,6 +1106,35 @@ static int CmdAutoCorr(const char *Cmd) {
         return PM3_EINVARG;
     }
 
+    if (timing) {
+        autocorr_t ac[2];
+        uint64_t t[2];
+        for (int i = 0; i < 2; i++) {
+            t[i] = msclock();
+            if (AutoCorrelateComputeEx(g_GraphBuffer, g_GraphTraceLen, window, NULL, (i == 0), &ac[i]) != PM3_SUCCESS) {
+                PrintAndLogEx(WARNING, "Failed to allocate memory");
+                free(ac[0].correl_buf);
+                return PM3_EMALLOC;
+            }
+            t[i] = msclock() - t[i];
+        }
+
+        size_t diff = 0;
+        for (size_t i = 0; i <= g_GraphTraceLen; i++) {
+            diff += (ac[0].correl_buf[i] != ac[1].correl_buf[i]);
+        }
+        free(ac[0].correl_buf);
+        free(ac[1].correl_buf);
+
+        PrintAndLogEx(INFO, "direct..... " _YELLOW_("%" PRIu64) " ms", t[0]);
+        PrintAndLogEx(INFO, "FFT........ " _YELLOW_("%" PRIu64) " ms", t[1]);
+        if (diff) {
+            PrintAndLogEx(WARNING, "results differ in %zu of %zu shifts", diff, g_GraphTraceLen - window);
+        } else {
+            PrintAndLogEx(SUCCESS, "results match");
+        }
+    }
+
     AutoCorrelate(g_GraphBuffer, g_GraphBuffer, g_GraphTraceLen, window, updateGrph, true);
     return PM3_SUCCESS;
 }
@@ -1009,22 +1243,40 @@ static int CmdUndecimate(const char *Cmd) {
     int factor = arg_get_int_def(ctx, 1, 2);
     CLIParserFree(ctx);
 
-    //We have memory, don't we?
-    int swap[MAX_GRAPH_TRACE_LEN] = {0};
-    uint32_t g_index = 0, s_index = 0;
-    while (g_index < g_GraphTraceLen && s_index + factor < MAX_GRAPH_TRACE_LEN) {
+    if (factor < 1) {
+        PrintAndLogEx(WARNING, "factor must be at least 1");
+        return PM3_EINVARG;
+    }
+
+    size_t swaplen = g_GraphTraceLen * factor + 1;
+    int *swap = calloc(swaplen, sizeof(int));
+    if (swap == NULL) {
+        PrintAndLogEx(WARNING, "Failed to allocate memory");
+        return PM3_EMALLOC;
+    }
+
+    size_t g_index = 0, s_index = 0;
+    while (g_index < g_GraphTraceLen && s_index + factor < swaplen) {
         int count = 0;
-        for (count = 0; count < factor && s_index + count < MAX_GRAPH_TRACE_LEN; count++) {
+        // the last sample has no successor,  it used to read past the trace
+        int next = (g_index + 1 < g_GraphTraceLen) ? g_GraphBuffer[g_index + 1] : 0;
+        for (count = 0; count < factor && s_index + count < swaplen; count++) {
             swap[s_index + count] = (
                                         (double)(factor - count) / (factor - 1)) * g_GraphBuffer[g_index] +
-                                    ((double)count / factor) * g_GraphBuffer[g_index + 1]
+                                    ((double)count / factor) * next
                                     ;
         }
         s_index += count;
         g_index++;
     }
 
+    if (reserveGraphBuf(s_index) == false) {
+        free(swap);
+        return PM3_EMALLOC;
+    }
+
     memcpy(g_GraphBuffer, swap, s_index * sizeof(int));
+    free(swap);
     g_GraphTraceLen = s_index;
     RepaintGraphWindow();
     return PM3_SUCCESS;
@@ -1173,30 +1425,14 @@ static char *GetFSKType(uint8_t fchigh, uint8_t fclow, uint8_t invert) {
     return fskType;
 }
 
-// fsk raw demod and print binary
-// takes 4 arguments - Clock, invert, fchigh, fclow
-// defaults: clock = 50, invert=1, fchigh=10, fclow=8 (RF/10 RF/8 (fsk2a))
-int FSKrawDemod(uint8_t rfLen, uint8_t invert, uint8_t fchigh, uint8_t fclow, bool verbose) {
+int FSKrawDemodCtx(demod_ctx_t *ctx, uint8_t rfLen, uint8_t invert, uint8_t fchigh, uint8_t fclow) {
     //raw fsk demod  no manchester decoding no start bit finding just get binary from wave
     if (getSignalProperties()->isnoise) {
-        if (verbose) {
-            PrintAndLogEx(INFO, "signal looks like noise");
-        }
         return PM3_ESOFT;
     }
 
-    uint8_t *bits = calloc(MAX_GRAPH_TRACE_LEN, sizeof(uint8_t));
-    if (bits == NULL) {
-        PrintAndLogEx(FAILED, "failed to allocate memory");
-        return PM3_EMALLOC;
-    }
-
-    size_t bitlen = getFromGraphBuf(bits);
-    if (bitlen == 0) {
-        PrintAndLogEx(DEBUG, "DEBUG: no data in graphbuf");
-        free(bits);
-        return PM3_ESOFT;
-    }
+    size_t bitlen = 0;
+    uint8_t *bits = demod_ctx_load(ctx, &bitlen);
 
     //get field clock lengths
     if (!fchigh || !fclow) {
@@ -1216,32 +1452,59 @@ int FSKrawDemod(uint8_t rfLen, uint8_t invert, uint8_t fchigh, uint8_t fclow, bo
         if (!rfLen) rfLen = 50;
     }
 
+    ctx->fc_high = fchigh;
+    ctx->fc_low = fclow;
+
     int start_idx = 0;
     int size = fskdemod(bits, bitlen, rfLen, invert, fchigh, fclow, &start_idx);
-    if (size > 0) {
-        setDemodBuff(bits, size, 0);
-        setClockGrid(rfLen, start_idx);
+    if (size <= 0) {
+        PrintAndLogEx(DEBUG, "no FSK data found");
+        return PM3_ESOFT;
+    }
+    demod_ctx_set(ctx, size, rfLen, start_idx, 0);
+    return PM3_SUCCESS;
+}
+
+// fsk raw demod and print binary
+// takes 4 arguments - Clock, invert, fchigh, fclow
+// defaults: clock = 50, invert=1, fchigh=10, fclow=8 (RF/10 RF/8 (fsk2a))
+int FSKrawDemod(uint8_t rfLen, uint8_t invert, uint8_t fchigh, uint8_t fclow, bool verbose) {
+    if (getSignalProperties()->isnoise) {
+        if (verbose) {
+            PrintAndLogEx(INFO, "signal looks like noise");
+        }
+        return PM3_ESOFT;
+    }
+
+    size_t bitlen = 0;
+    uint8_t *bits = getGraphBufU8(&bitlen);
+    if (bits == NULL) {
+        PrintAndLogEx(DEBUG, "DEBUG: no data in graphbuf");
+        releaseGraphBufU8(bits);
+        return PM3_ESOFT;
+    }
+
+    demod_ctx_t ctx;
+    demod_ctx_wrap(&ctx, bits, bitlen);
+    if (FSKrawDemodCtx(&ctx, rfLen, invert, fchigh, fclow) == PM3_SUCCESS) {
+        DemodCtxApply(&ctx);
 
         // Now output the bitstream to the scrollback by line of 16 bits
         if (verbose || g_debugMode) {
             PrintAndLogEx(DEBUG, "DEBUG: (FSKrawDemod) using clock:%u, %sfc high:%u, fc low:%u"
-                          , rfLen
+                          , ctx.clock
                           , (invert) ? "inverted, " : ""
-                          , fchigh
-                          , fclow
+                          , ctx.fc_high
+                          , ctx.fc_low
                          );
             PrintAndLogEx(NORMAL, "");
-            PrintAndLogEx(SUCCESS, _YELLOW_("%s") " decoded bitstream", GetFSKType(fchigh, fclow, invert));
+            PrintAndLogEx(SUCCESS, _YELLOW_("%s") " decoded bitstream", GetFSKType(ctx.fc_high, ctx.fc_low, invert));
             PrintAndLogEx(INFO, "-----------------------");
             printDemodBuff(0, false, false, false);
         }
-        goto out;
-    } else {
-        PrintAndLogEx(DEBUG, "no FSK data found");
     }
 
-out:
-    free(bits);
+    releaseGraphBufU8(bits);
     return PM3_SUCCESS;
 }
 
@@ -1279,6 +1542,32 @@ static int CmdFSKrawdemod(const char *Cmd) {
     return FSKrawDemod(clk, invert, fchigh, fclow, true);
 }
 
+int PSKDemodCtx(demod_ctx_t *ctx, int clk, int invert, int maxErr) {
+    if (getSignalProperties()->isnoise) {
+        return PM3_ESOFT;
+    }
+
+    size_t bitlen = 0;
+    uint8_t *bits = demod_ctx_load(ctx, &bitlen);
+
+    int startIdx = 0;
+    int errCnt = pskRawDemod_ext(bits, &bitlen, &clk, &invert, &startIdx);
+    if (errCnt > maxErr) {
+        PrintAndLogEx(DEBUG, "DEBUG: (PSKdemod) Too many errors found, clk: %d, invert: %d, numbits: %zu, errCnt: %d", clk, invert, bitlen, errCnt);
+        return PM3_ESOFT;
+    }
+    if (errCnt < 0 || bitlen < 16) { //throw away static - allow 1 and -1 (in case of threshold command first)
+        PrintAndLogEx(DEBUG, "DEBUG: (PSKdemod) no data found, clk: %d, invert: %d, numbits: %zu, errCnt: %d", clk, invert, bitlen, errCnt);
+        return PM3_ESOFT;
+    }
+    PrintAndLogEx(DEBUG, "DEBUG: (PSKdemod) Using Clock:%d, invert:%d, Bits Found:%zu", clk, invert, bitlen);
+    if (errCnt > 0) {
+        PrintAndLogEx(DEBUG, "DEBUG: (PSKdemod) errors during Demoding (shown as 7 in bit stream): %d", errCnt);
+    }
+    demod_ctx_set(ctx, bitlen, clk, startIdx, errCnt);
+    return PM3_SUCCESS;
+}
+
 // attempt to psk1 demod graph buffer
 int PSKDemod(int clk, int invert, int maxErr, bool verbose) {
     if (getSignalProperties()->isnoise) {
@@ -1288,39 +1577,45 @@ int PSKDemod(int clk, int invert, int maxErr, bool verbose) {
         return PM3_ESOFT;
     }
 
-    uint8_t *bits = calloc(MAX_GRAPH_TRACE_LEN, sizeof(uint8_t));
+    size_t bitlen = 0;
+    uint8_t *bits = getGraphBufU8(&bitlen);
     if (bits == NULL) {
-        PrintAndLogEx(FAILED, "failed to allocate memory");
-        return PM3_EMALLOC;
+        return PM3_ESOFT;
     }
-    size_t bitlen = getFromGraphBuf(bits);
-    if (bitlen == 0) {
-        free(bits);
+
+    demod_ctx_t ctx;
+    demod_ctx_wrap(&ctx, bits, bitlen);
+    int res = PSKDemodCtx(&ctx, clk, invert, maxErr);
+    if (res == PM3_SUCCESS) {
+        //prime g_DemodBuffer for output
+        DemodCtxApply(&ctx);
+    }
+    releaseGraphBufU8(bits);
+    return res;
+}
+
+int NRZrawDemodCtx(demod_ctx_t *ctx, int clk, int invert, int maxErr) {
+
+    if (getSignalProperties()->isnoise) {
         return PM3_ESOFT;
     }
 
-    int startIdx = 0;
-    int errCnt = pskRawDemod_ext(bits, &bitlen, &clk, &invert, &startIdx);
+    size_t bitlen = 0;
+    uint8_t *bits = demod_ctx_load(ctx, &bitlen);
+
+    int clkStartIdx = 0;
+    int errCnt = nrzRawDemod(bits, &bitlen, &clk, &invert, &clkStartIdx);
     if (errCnt > maxErr) {
-        if (g_debugMode || verbose) PrintAndLogEx(DEBUG, "DEBUG: (PSKdemod) Too many errors found, clk: %d, invert: %d, numbits: %zu, errCnt: %d", clk, invert, bitlen, errCnt);
-        free(bits);
+        PrintAndLogEx(DEBUG, "DEBUG: (NRZrawDemod) Too many errors found, clk: %d, invert: %d, numbits: %zu, errCnt: %d", clk, invert, bitlen, errCnt);
         return PM3_ESOFT;
     }
     if (errCnt < 0 || bitlen < 16) { //throw away static - allow 1 and -1 (in case of threshold command first)
-        if (g_debugMode || verbose) PrintAndLogEx(DEBUG, "DEBUG: (PSKdemod) no data found, clk: %d, invert: %d, numbits: %zu, errCnt: %d", clk, invert, bitlen, errCnt);
-        free(bits);
+        PrintAndLogEx(DEBUG, "DEBUG: (NRZrawDemod) no data found, clk: %d, invert: %d, numbits: %zu, errCnt: %d", clk, invert, bitlen, errCnt);
         return PM3_ESOFT;
     }
-    if (verbose || g_debugMode) {
-        PrintAndLogEx(DEBUG, "DEBUG: (PSKdemod) Using Clock:%d, invert:%d, Bits Found:%zu", clk, invert, bitlen);
-        if (errCnt > 0) {
-            PrintAndLogEx(DEBUG, "DEBUG: (PSKdemod) errors during Demoding (shown as 7 in bit stream): %d", errCnt);
-        }
-    }
-    //prime g_DemodBuffer for output
-    setDemodBuff(bits, bitlen, 0);
-    setClockGrid(clk, startIdx);
-    free(bits);
+
+    PrintAndLogEx(DEBUG, "DEBUG: (NRZrawDemod) Tried NRZ Demod using Clock: %d - invert: %d - Bits Found: %zu", clk, invert, bitlen);
+    demod_ctx_set(ctx, bitlen, clk, clkStartIdx, errCnt);
     return PM3_SUCCESS;
 }
 
@@ -1329,8 +1624,6 @@ int PSKDemod(int clk, int invert, int maxErr, bool verbose) {
 // prints binary found and saves in g_DemodBuffer for further commands
 int NRZrawDemod(int clk, int invert, int maxErr, bool verbose) {
 
-    int errCnt = 0, clkStartIdx = 0;
-
     if (getSignalProperties()->isnoise) {
         if (verbose) {
             PrintAndLogEx(INFO, "signal looks like noise");
@@ -1338,45 +1631,31 @@ int NRZrawDemod(int clk, int invert, int maxErr, bool verbose) {
         return PM3_ESOFT;
     }
 
-    uint8_t *bits = calloc(MAX_GRAPH_TRACE_LEN, sizeof(uint8_t));
+    size_t bitlen = 0;
+    uint8_t *bits = getGraphBufU8(&bitlen);
     if (bits == NULL) {
-        PrintAndLogEx(FAILED, "failed to allocate memory");
-        return PM3_EMALLOC;
-    }
-
-    size_t bitlen = getFromGraphBuf(bits);
-
-    if (bitlen == 0) {
-        free(bits);
         return PM3_ESOFT;
     }
 
-    errCnt = nrzRawDemod(bits, &bitlen, &clk, &invert, &clkStartIdx);
-    if (errCnt > maxErr) {
-        PrintAndLogEx(DEBUG, "DEBUG: (NRZrawDemod) Too many errors found, clk: %d, invert: %d, numbits: %zu, errCnt: %d", clk, invert, bitlen, errCnt);
-        free(bits);
-        return PM3_ESOFT;
-    }
-    if (errCnt < 0 || bitlen < 16) { //throw away static - allow 1 and -1 (in case of threshold command first)
-        PrintAndLogEx(DEBUG, "DEBUG: (NRZrawDemod) no data found, clk: %d, invert: %d, numbits: %zu, errCnt: %d", clk, invert, bitlen, errCnt);
-        free(bits);
-        return PM3_ESOFT;
+    demod_ctx_t ctx;
+    demod_ctx_wrap(&ctx, bits, bitlen);
+    int res = NRZrawDemodCtx(&ctx, clk, invert, maxErr);
+    if (res != PM3_SUCCESS) {
+        releaseGraphBufU8(bits);
+        return res;
     }
 
-    if (verbose || g_debugMode) PrintAndLogEx(DEBUG, "DEBUG: (NRZrawDemod) Tried NRZ Demod using Clock: %d - invert: %d - Bits Found: %zu", clk, invert, bitlen);
     //prime g_DemodBuffer for output
-    setDemodBuff(bits, bitlen, 0);
-    setClockGrid(clk, clkStartIdx);
-
+    DemodCtxApply(&ctx);
 
-    if (errCnt > 0 && (verbose || g_debugMode)) PrintAndLogEx(DEBUG, "DEBUG: (NRZrawDemod) Errors during Demoding (shown as 7 in bit stream): %d", errCnt);
+    if (ctx.errors > 0 && (verbose || g_debugMode)) PrintAndLogEx(DEBUG, "DEBUG: (NRZrawDemod) Errors during Demoding (shown as 7 in bit stream): %d", ctx.errors);
     if (verbose || g_debugMode) {
         PrintAndLogEx(NORMAL, "NRZ demoded bitstream:");
         // Now output the bitstream to the scrollback by line of 16 bits
         printDemodBuff(0, false, invert, false);
     }
 
-    free(bits);
+    releaseGraphBufU8(bits);
     return PM3_SUCCESS;
 }
 
@@ -1707,13 +1986,14 @@ int CmdHpf(const char *Cmd) {
     CLIExecWithReturn(ctx, Cmd, argtable, true);
     CLIParserFree(ctx);
 
-    uint8_t bits[g_GraphTraceLen];
-    size_t size = getFromGraphBuf(bits);
+    size_t size = 0;
+    uint8_t *bits = getGraphBufU8(&size);
     removeSignalOffset(bits, size);
     // push it back to graph
     setGraphBuf(bits, size);
     // set signal properties low/high/mean/amplitude and is_noise detection
     computeSignalProperties(bits, size);
+    releaseGraphBufU8(bits);
 
     RepaintGraphWindow();
     return PM3_SUCCESS;
@@ -1780,9 +2060,13 @@ int getSamplesEx(uint32_t start, uint32_t end, bool verbose, bool ignore_lf_conf
 
         if (verbose) PrintAndLogEx(INFO, "Unpacking...");
 
+        if (reserveGraphBuf(((size_t)n * 8) / bits_per_sample + 1) == false) {
+            return PM3_EMALLOC;
+        }
+
         BitstreamOut_t bout = { got, bits_per_sample * n,  0};
         uint32_t j = 0;
-        for (j = 0; j * bits_per_sample < n * 8 && j * bits_per_sample < MAX_GRAPH_TRACE_LEN * 8; j++) {
+        for (j = 0; j * bits_per_sample < n * 8; j++) {
             uint8_t sample = getByte(bits_per_sample, &bout);
             g_GraphBuffer[j] = ((int) sample) - 127;
         }
@@ -1791,16 +2075,21 @@ int getSamplesEx(uint32_t start, uint32_t end, bool verbose, bool ignore_lf_conf
         if (verbose) PrintAndLogEx(INFO, "Unpacked %d samples", j);
 
     } else {
+        if (reserveGraphBuf(n) == false) {
+            return PM3_EMALLOC;
+        }
+
         for (uint32_t j = 0; j < n; j++) {
             g_GraphBuffer[j] = ((int)got[j]) - 127;
         }
         g_GraphTraceLen = n;
     }
 
-    uint8_t bits[g_GraphTraceLen];
-    size_t size = getFromGraphBuf(bits);
+    size_t size = 0;
+    uint8_t *bits = getGraphBufU8(&size);
     // set signal properties low/high/mean/amplitude and is_noise detection
     computeSignalProperties(bits, size);
+    releaseGraphBufU8(bits);
 
     setClockGrid(0, 0);
     g_DemodBufferLen = 0;
@@ -2073,20 +2362,20 @@ static int CmdLoad(const char *Cmd) {
     if (is_bin) {
         uint8_t val[2];
         while (fread(val, 1, 1, f)) {
+            if (reserveGraphBuf(g_GraphTraceLen + 1) == false)
+                break;
+
             g_GraphBuffer[g_GraphTraceLen] = val[0] - 127;
             g_GraphTraceLen++;
-
-            if (g_GraphTraceLen >= MAX_GRAPH_TRACE_LEN)
-                break;
         }
     } else {
         char line[80];
         while (fgets(line, sizeof(line), f)) {
+            if (reserveGraphBuf(g_GraphTraceLen + 1) == false)
+                break;
+
             g_GraphBuffer[g_GraphTraceLen] = atoi(line);
             g_GraphTraceLen++;
-
-            if (g_GraphTraceLen >= MAX_GRAPH_TRACE_LEN)
-                break;
         }
     }
     fclose(f);
@@ -2094,12 +2383,13 @@ static int CmdLoad(const char *Cmd) {
     PrintAndLogEx(SUCCESS, "loaded " _YELLOW_("%zu") " samples", g_GraphTraceLen);
 
     if (nofix == false) {
-        uint8_t bits[g_GraphTraceLen];
-        size_t size = getFromGraphBuf(bits);
+        size_t size = 0;
+        uint8_t *bits = getGraphBufU8(&size);
 
         removeSignalOffset(bits, size);
         setGraphBuf(bits, size);
         computeSignalProperties(bits, size);
+        releaseGraphBufU8(bits);
     }
 
     setClockGrid(0, 0);
@@ -2231,10 +2521,11 @@ int CmdNorm(const char *Cmd) {
         }
     }
 
-    uint8_t bits[g_GraphTraceLen];
-    size_t size = getFromGraphBuf(bits);
+    size_t size = 0;
+    uint8_t *bits = getGraphBufU8(&size);
     // set signal properties low/high/mean/amplitude and is_noise detection
     computeSignalProperties(bits, size);
+    releaseGraphBufU8(bits);
 
     RepaintGraphWindow();
     return PM3_SUCCESS;
@@ -2377,10 +2668,11 @@ static int CmdDirectionalThreshold(const char *Cmd) {
     directionalThreshold(g_GraphBuffer, g_GraphBuffer, g_GraphTraceLen, up, down);
 
     // set signal properties low/high/mean/amplitude and isnoice detection
-    uint8_t bits[g_GraphTraceLen];
-    size_t size = getFromGraphBuf(bits);
+    size_t size = 0;
+    uint8_t *bits = getGraphBufU8(&size);
     // set signal properties low/high/mean/amplitude and is_noice detection
     computeSignalProperties(bits, size);
+    releaseGraphBufU8(bits);
 
     RepaintGraphWindow();
     return PM3_SUCCESS;
@@ -2420,10 +2712,11 @@ static int CmdZerocrossings(const char *Cmd) {
         }
     }
 
-    uint8_t bits[g_GraphTraceLen];
-    size_t size = getFromGraphBuf(bits);
+    size_t size = 0;
+    uint8_t *bits = getGraphBufU8(&size);
     // set signal properties low/high/mean/amplitude and is_noise detection
     computeSignalProperties(bits, size);
+    releaseGraphBufU8(bits);
     RepaintGraphWindow();
     return PM3_SUCCESS;
 }
@@ -2733,10 +3026,11 @@ static int CmdDataIIR(const char *Cmd) {
 
     iceSimple_Filter(g_GraphBuffer, g_GraphTraceLen, k);
 
-    uint8_t bits[g_GraphTraceLen];
-    size_t size = getFromGraphBuf(bits);
+    size_t size = 0;
+    uint8_t *bits = getGraphBufU8(&size);
     // set signal properties low/high/mean/amplitude and is_noise detection
     computeSignalProperties(bits, size);
+    releaseGraphBufU8(bits);
     RepaintGraphWindow();
     return PM3_SUCCESS;
 }
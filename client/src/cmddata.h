@@ -76,6 +76,45 @@ int FSKrawDemod(uint8_t rfLen, uint8_t invert, uint8_t fchigh, uint8_t fclow, bo
 int PSKDemod(int clk, int invert, int maxErr, bool verbose);                                    // used by cmd lf em4x, lf indala, lf keri, lf nexwatch, lf t55xx
 int NRZrawDemod(int clk, int invert, int maxErr, bool verbose);                                 // used by cmd lf pac, lf t55xx
 
+// Demodulation context.  The *Ctx demods read the samples given to DemodCtxInit and leave
+// their bits in the context instead of g_DemodBuffer / g_DemodClock / g_DemodStartIdx,  so
+// several hypotheses can run on the same trace at once.  They don't print,  and only read
+// the signal properties,  compute those (computeSignalProperties) before starting them.
+typedef struct {
+    const uint8_t *samples;  // input,  as from getGraphBufU8,  not modified
+    size_t samples_len;
+    uint8_t *bits;           // demodulated bits
+    size_t len;
+    int clock;
+    int32_t start_idx;
+    int errors;
+    uint8_t fc_high;         // FSK field clocks used
+    uint8_t fc_low;
+    bool st;                 // sequence terminator found,  between st_start and st_end
+    size_t st_start;
+    size_t st_end;
+    size_t maxlen;           // ASK demods look at no more samples,  set by whoever creates the context
+    bool owned;              // bits is our own buffer
+    // tag decoded from the bits,  see DemodCtxCollect
+    const char *tag;         // NULL if none
+    const char *modulation;
+    char id[192];            // decoded ID as reported by the tag demod
+} demod_ctx_t;
+
+int DemodCtxInit(demod_ctx_t *ctx, const uint8_t *samples, size_t len, size_t maxlen);
+void DemodCtxFree(demod_ctx_t *ctx);
+void DemodCtxApply(const demod_ctx_t *ctx);
+// The tag demods (lf em 410x demod, lf hid demod, ...) report the ID they decoded with
+// DemodCtxReportId.  It ends up in the context set with DemodCtxCollect,  NULL stops.
+void DemodCtxCollect(demod_ctx_t *ctx);
+void DemodCtxReportId(const char *fmt, ...);
+
+int ASKDemodCtx(demod_ctx_t *ctx, int clk, int invert, int maxErr, bool amplify, uint8_t askType, bool *stCheck);
+int ASKbiphaseDemodCtx(demod_ctx_t *ctx, int *offset, int clk, int invert, int maxErr);
+int FSKrawDemodCtx(demod_ctx_t *ctx, uint8_t rfLen, uint8_t invert, uint8_t fchigh, uint8_t fclow);
+int PSKDemodCtx(demod_ctx_t *ctx, int clk, int invert, int maxErr);
+int NRZrawDemodCtx(demod_ctx_t *ctx, int clk, int invert, int maxErr);
+
 
 int printDemodBuff(uint8_t offset, bool strip_leading, bool invert, bool print_hex);
 
@@ -84,6 +123,17 @@ bool getDemodBuff(uint8_t *buff, size_t *size);
 void save_restoreDB(uint8_t saveOpt);// option '1' to save g_DemodBuffer any other to restore
 int AutoCorrelate(const int *in, int *out, size_t len, size_t window, bool SaveGrph, bool verbose);
 
+typedef struct {
+    int *correl_buf;        // autocovariance for every shift
+    size_t correlation;     // distance between the last two shifts with an autocorrelation above 1
+    int hi;                 // highest autocovariance and its shift
+    int idx;
+    int hi_1;               // highest autocovariance after idx,  within the window
+    int idx_1;
+} autocorr_t;
+int AutoCorrelateCompute(const int *in, size_t len, size_t window, const bool *cancel, autocorr_t *ac);
+int AutoCorrelateApply(autocorr_t *ac, int *out, size_t len, bool SaveGrph, bool verbose);
+
 int getSamples(uint32_t n, bool verbose);
 int getSamplesEx(uint32_t start, uint32_t end, bool verbose, bool ignore_lf_config);
 
@@ -27,6 +27,7 @@
 #include "des.h"
 #include "loclass/cipherutils.h"
 #include "loclass/cipher.h"
+#include "loclass/cipher_bs.h"
 #include "loclass/ikeys.h"
 #include "loclass/elite_crack.h"
 #include "fileutils.h"
@@ -2552,6 +2553,7 @@ static int CmdHFiClass_loclass(const char *Cmd) {
     if (test || longtest) {
         int errors = testCipherUtils();
         errors += testMAC();
+        errors += testMAC_bs();
         errors += doKeyTests();
         errors += testElite(longtest);
 
@@ -3295,7 +3297,9 @@ static int CmdHFiClassCheckKeys(const char *Cmd) {
     if (use_raw)
         PrintAndLogEx(NORMAL, "using " _YELLOW_("raw mode"));
 
-    GenerateMacFrom(CSN, CCNR, use_raw, use_elite, keyBlock, keycount, pre);
+    uint64_t t_gen = msclock();
+    uint32_t threads = GenerateMacFrom(CSN, CCNR, use_raw, use_elite, keyBlock, keycount, pre);
+    PrintPreCalcSpeed(keycount, msclock() - t_gen, threads);
 
     PrintAndLogEx(SUCCESS, "Searching for " _YELLOW_("%s") " key...", (use_credit_key) ? "CREDIT" : "DEBIT");
 
@@ -3507,7 +3511,9 @@ static int CmdHFiClassLookUp(const char *Cmd) {
     }
 
     PrintAndLogEx(INFO, "Generating diversified keys...");
-    GenerateMacKeyFrom(csn, CCNR, use_raw, use_elite, keyBlock, keycount, prekey);
+    uint64_t t_gen = msclock();
+    uint32_t threads = GenerateMacKeyFrom(csn, CCNR, use_raw, use_elite, keyBlock, keycount, prekey);
+    PrintPreCalcSpeed(keycount, msclock() - t_gen, threads);
 
     if (use_elite)
         PrintAndLogEx(INFO, "Using " _YELLOW_("elite algo"));
@@ -3542,156 +3548,125 @@ static int CmdHFiClassLookUp(const char *Cmd) {
 }
 
 typedef struct {
-    uint8_t thread_idx;
     uint8_t use_raw;
     uint8_t use_elite;
     uint32_t keycnt;
+    uint32_t *next;
     uint8_t csn[8];
     uint8_t cc_nr[12];
     uint8_t *keys;
-    union {
-        iclass_premac_t *premac;
-        iclass_prekey_t *prekey;
-    } list;
-} PACKED iclass_thread_arg_t;
+    iclass_premac_t *premac;
+    iclass_prekey_t *prekey;
+} iclass_thread_arg_t;
 
-static size_t iclass_tc = 1;
-
-static pthread_mutex_t generator_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Threads grab chunks of keys from a shared cursor, diversify them one by one
+// and calculate the MACs of a whole chunk with the bitsliced MAC.
 static void *bf_generate_mac(void *thread_arg) {
 
     iclass_thread_arg_t *targ = (iclass_thread_arg_t *)thread_arg;
-    const uint8_t idx = targ->thread_idx;
-    const uint8_t use_raw = targ->use_raw;
-    const uint8_t use_elite = targ->use_elite;
     const uint32_t keycnt = targ->keycnt;
 
-    uint8_t *keys = targ->keys;
-    iclass_premac_t *list = targ->list.premac;
+    uint8_t div_keys[LOCLASS_MAC_BS_MAX][8];
+    uint8_t macs[LOCLASS_MAC_BS_MAX][4];
 
-    uint8_t csn[8];
-    uint8_t cc_nr[12];
-    memcpy(csn, targ->csn, sizeof(csn));
-    memcpy(cc_nr, targ->cc_nr, sizeof(cc_nr));
+    while (true) {
 
-    uint8_t key[8] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
-    uint8_t div_key[8] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+        uint32_t base = __atomic_fetch_add(targ->next, LOCLASS_MAC_BS_MAX, __ATOMIC_SEQ_CST);
+        if (base >= keycnt) {
+            break;
+        }
 
-    for (uint32_t i = idx; i < keycnt; i += iclass_tc) {
+        uint32_t cnt = MIN(keycnt - base, LOCLASS_MAC_BS_MAX);
 
-        memcpy(key, keys + 8 * i, 8);
+        for (uint32_t i = 0; i < cnt; i++) {
+            uint8_t *key = targ->keys + 8 * (base + i);
+            if (targ->use_raw)
+                memcpy(div_keys[i], key, 8);
+            else
+                HFiClassCalcDivKey(targ->csn, key, div_keys[i], targ->use_elite);
+        }
 
-        pthread_mutex_lock(&generator_mutex);
-        if (use_raw)
-            memcpy(div_key, key, 8);
-        else
-            HFiClassCalcDivKey(csn, key, div_key, use_elite);
+        doMAC_batch(targ->cc_nr, (const uint8_t (*)[8])div_keys, cnt, macs);
 
-        doMAC(cc_nr, div_key, list[i].mac);
-        pthread_mutex_unlock(&generator_mutex);
+        for (uint32_t i = 0; i < cnt; i++) {
+            if (targ->prekey) {
+                memcpy(targ->prekey[base + i].key, targ->keys + 8 * (base + i), 8);
+                memcpy(targ->prekey[base + i].mac, macs[i], 4);
+            } else {
+                memcpy(targ->premac[base + i].mac, macs[i], 4);
+            }
+        }
     }
     return NULL;
 }
 
-// precalc diversified keys and their MAC
-void GenerateMacFrom(uint8_t *CSN, uint8_t *CCNR, bool use_raw, bool use_elite, uint8_t *keys, uint32_t keycnt, iclass_premac_t *list) {
+// returns the number of threads used
+static uint32_t iclass_generate(uint8_t *CSN, uint8_t *CCNR, bool use_raw, bool use_elite, uint8_t *keys, uint32_t keycnt, iclass_premac_t *premac, iclass_prekey_t *prekey) {
 
-    pthread_mutex_init(&generator_mutex, NULL);
+    uint32_t next = 0;
 
-    iclass_tc = num_CPUs();
-    pthread_t threads[iclass_tc];
-    iclass_thread_arg_t args[iclass_tc];
-    // init thread arguments
-    for (size_t i = 0; i < iclass_tc; i++) {
-        args[i].thread_idx = i;
-        args[i].use_raw = use_raw;
-        args[i].use_elite = use_elite;
-        args[i].keycnt = keycnt;
-        args[i].keys = keys;
-        args[i].list.premac = list;
+    iclass_thread_arg_t arg = {
+        .use_raw = use_raw,
+        .use_elite = use_elite,
+        .keycnt = keycnt,
+        .next = &next,
+        .keys = keys,
+        .premac = premac,
+        .prekey = prekey,
+    };
+    memcpy(arg.csn, CSN, sizeof(arg.csn));
+    memcpy(arg.cc_nr, CCNR, sizeof(arg.cc_nr));
 
-        memcpy(args[i].csn, CSN, sizeof(args[i].csn));
-        memcpy(args[i].cc_nr, CCNR, sizeof(args[i].cc_nr));
+    // no more threads than chunks
+    size_t tc = num_CPUs();
+    size_t chunks = (keycnt + LOCLASS_MAC_BS_MAX - 1) / LOCLASS_MAC_BS_MAX;
+    if (tc > chunks)
+        tc = chunks;
+
+    if (tc <= 1) {
+        bf_generate_mac(&arg);
+        return 1;
     }
 
-    for (int i = 0; i < iclass_tc; i++) {
-        int res = pthread_create(&threads[i], NULL, bf_generate_mac, (void *)&args[i]);
-        if (res) {
-            PrintAndLogEx(NORMAL, "");
-            PrintAndLogEx(WARNING, "Failed to create pthreads. Quitting");
-            return;
+    pthread_t threads[tc];
+    size_t started = 0;
+    for (; started < tc; started++) {
+        if (pthread_create(&threads[started], NULL, bf_generate_mac, (void *)&arg)) {
+            PrintAndLogEx(WARNING, "Failed to create pthreads, continuing with %zu", started);
+            break;
         }
     }
 
-    for (int i = 0; i < iclass_tc; i++)
-        pthread_join(threads[i], NULL);
-}
-
-static void *bf_generate_mackey(void *thread_arg) {
-
-    iclass_thread_arg_t *targ = (iclass_thread_arg_t *)thread_arg;
-    const uint8_t idx = targ->thread_idx;
-    const uint8_t use_raw = targ->use_raw;
-    const uint8_t use_elite = targ->use_elite;
-    const uint32_t keycnt = targ->keycnt;
-
-    uint8_t *keys = targ->keys;
-    iclass_prekey_t *list = targ->list.prekey;
-
-    uint8_t csn[8];
-    uint8_t cc_nr[12];
-    memcpy(csn, targ->csn, sizeof(csn));
-    memcpy(cc_nr, targ->cc_nr, sizeof(cc_nr));
-
-    uint8_t div_key[8] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
-
-    for (uint32_t i = idx; i < keycnt; i += iclass_tc) {
-
-        memcpy(list[i].key, keys + 8 * i, 8);
-
-        pthread_mutex_lock(&generator_mutex);
-        if (use_raw)
-            memcpy(div_key, list[i].key, 8);
-        else
-            HFiClassCalcDivKey(csn, list[i].key, div_key, use_elite);
-
-        doMAC(cc_nr, div_key, list[i].mac);
-        pthread_mutex_unlock(&generator_mutex);
+    // no threads at all, do it here
+    if (started == 0) {
+        bf_generate_mac(&arg);
+        return 1;
     }
-    return NULL;
-}
-
-void GenerateMacKeyFrom(uint8_t *CSN, uint8_t *CCNR, bool use_raw, bool use_elite, uint8_t *keys, uint32_t keycnt, iclass_prekey_t *list) {
 
-    pthread_mutex_init(&generator_mutex, NULL);
-    iclass_tc = num_CPUs();
-    pthread_t threads[iclass_tc];
-    iclass_thread_arg_t args[iclass_tc];
-    // init thread arguments
-    for (size_t i = 0; i < iclass_tc; i++) {
-        args[i].thread_idx = i;
-        args[i].use_raw = use_raw;
-        args[i].use_elite = use_elite;
-        args[i].keycnt = keycnt;
-        args[i].keys = keys;
-        args[i].list.prekey = list;
+    for (size_t i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
 
-        memcpy(args[i].csn, CSN, sizeof(args[i].csn));
-        memcpy(args[i].cc_nr, CCNR, sizeof(args[i].cc_nr));
-    }
+    return started;
+}
 
-    for (size_t i = 0; i < iclass_tc; i++) {
-        int res = pthread_create(&threads[i], NULL, bf_generate_mackey, (void *)&args[i]);
-        if (res) {
-            PrintAndLogEx(NORMAL, "");
-            PrintAndLogEx(WARNING, "Failed to create pthreads. Quitting");
-            return;
-        }
-    }
+// precalc diversified keys and their MAC, returns the number of threads used
+uint32_t GenerateMacFrom(uint8_t *CSN, uint8_t *CCNR, bool use_raw, bool use_elite, uint8_t *keys, uint32_t keycnt, iclass_premac_t *list) {
+    return iclass_generate(CSN, CCNR, use_raw, use_elite, keys, keycnt, list, NULL);
+}
 
-    for (int i = 0; i < iclass_tc; i++)
-        pthread_join(threads[i], NULL);
+uint32_t GenerateMacKeyFrom(uint8_t *CSN, uint8_t *CCNR, bool use_raw, bool use_elite, uint8_t *keys, uint32_t keycnt, iclass_prekey_t *list) {
+    return iclass_generate(CSN, CCNR, use_raw, use_elite, keys, keycnt, NULL, list);
+}
 
+// print how fast the diversified keys and MACs were generated
+void PrintPreCalcSpeed(uint32_t keycnt, uint64_t ms, uint32_t threads) {
+    PrintAndLogEx(INFO, "Generated " _YELLOW_("%u") " MACs in " _YELLOW_("%.3f") " seconds, " _YELLOW_("%.0f") " keys/s ( %u threads, %s MAC )"
+                  , keycnt
+                  , (float)ms / 1000.0
+                  , (ms) ? (double)keycnt * 1000 / ms : (double)keycnt * 1000
+                  , threads
+                  , doMAC_bs_name()
+                 );
 }
 
 // print diversified keys
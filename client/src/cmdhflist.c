@@ -21,9 +21,13 @@
 #include <inttypes.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
 
 #include "commonutil.h"  // ARRAYLEN
 #include "mifare/mifarehost.h"
+#include "mifare/mifare4.h"   // mfSectorNum
+#include "mifare/crypto1_bs.h"
 #include "parity.h"         // oddparity
 #include "ui.h"
 #include "crc16.h"
@@ -307,6 +311,8 @@ int applyIso14443a(char *exp, size_t size, uint8_t *cmd, uint8_t cmdsize, bool i
                 if (cmdsize > 3) {
                     snprintf(exp, size, "AUTH-A(%d)", cmd[1]);
                     MifareAuthState = masNt;
+                    AuthData.auth_cmd = cmd[0];
+                    AuthData.auth_block = cmd[1];
                 } else {
                     // case MIFARE_ULEV1_VERSION :  both 0x60.
                     snprintf(exp, size, "EV1 VERSION");
@@ -315,6 +321,8 @@ int applyIso14443a(char *exp, size_t size, uint8_t *cmd, uint8_t cmdsize, bool i
             }
             case MIFARE_AUTH_KEYB: {
                 MifareAuthState = masNt;
+                AuthData.auth_cmd = cmd[0];
+                AuthData.auth_block = cmd[1];
                 snprintf(exp, size, "AUTH-B(%d)", cmd[1]);
                 break;
             }
@@ -322,11 +330,15 @@ int applyIso14443a(char *exp, size_t size, uint8_t *cmd, uint8_t cmdsize, bool i
                 if (cmdsize > 3) {
                     snprintf(exp, size, "MAGIC AUTH-A(%d)", cmd[1]);
                     MifareAuthState = masNt;
+                    AuthData.auth_cmd = cmd[0];
+                    AuthData.auth_block = cmd[1];
                 }
                 break;
             }
             case MIFARE_MAGIC_GDM_AUTH_KEYB: {
                 MifareAuthState = masNt;
+                AuthData.auth_cmd = cmd[0];
+                AuthData.auth_block = cmd[1];
                 snprintf(exp, size, "MAGIC AUTH-B(%d)", cmd[1]);
                 break;
             }
@@ -1666,6 +1678,171 @@ static void mf_get_paritybinstr(char *s, uint32_t val, uint8_t par) {
     s[0] = '\0';
 }
 
+// Keys recovered while decoding, per uid / sector / key type. Sniffed traces tend
+// to authenticate the same sectors over and over, with the same keys.
+#define MF_TRACE_KEYS_MAX     256
+
+typedef struct {
+    uint32_t uid;
+    uint8_t sector;
+    uint8_t auth_cmd;
+    uint64_t key;
+} mf_trace_key_t;
+
+static mf_trace_key_t mf_trace_keys[MF_TRACE_KEYS_MAX];
+static size_t mf_trace_keys_cnt;
+
+static mf_trace_key_t *mf_trace_key_find(const AuthData_t *ad) {
+    uint8_t sector = mfSectorNum(ad->auth_block);
+    for (size_t i = 0; i < mf_trace_keys_cnt && i < MF_TRACE_KEYS_MAX; i++) {
+        mf_trace_key_t *e = &mf_trace_keys[i];
+        if (e->uid == ad->uid && e->sector == sector && e->auth_cmd == ad->auth_cmd) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static void mf_trace_key_add(const AuthData_t *ad, uint64_t key) {
+    mf_trace_key_t *e = mf_trace_key_find(ad);
+    if (e == NULL) {
+        // when full, the oldest entries are overwritten
+        e = &mf_trace_keys[mf_trace_keys_cnt++ % MF_TRACE_KEYS_MAX];
+        e->uid = ad->uid;
+        e->sector = mfSectorNum(ad->auth_block);
+        e->auth_cmd = ad->auth_cmd;
+    }
+    e->key = key;
+}
+
+// Cipher state right after the auth in ad, i.e. what lfsr_recovery64(ks2, ks3) returns,
+// for a known key. Replaying the auth is far cheaper than the recovery.
+static struct Crypto1State *mf_trace_state(const AuthData_t *ad, uint64_t key) {
+    struct Crypto1State *pcs = crypto1_create(key);
+    if (pcs == NULL) {
+        return NULL;
+    }
+    crypto1_word(pcs, ad->uid ^ ad->nt, 0);
+    crypto1_word(pcs, ad->nr_enc, 1);
+    crypto1_word(pcs, 0, 0);
+    crypto1_word(pcs, 0, 0);
+    return pcs;
+}
+
+// nested candidates, the tag nonce is one of the next 16383 prng states after nt + 90
+#define MF_NESTED_CANDIDATES  16383
+#define MF_NESTED_CHUNK       256
+
+typedef struct {
+    AuthData_t ad;
+    const uint8_t *cmd;
+    uint8_t cmdsize;
+    const uint8_t *parity;
+    uint32_t next;          // first candidate of the next chunk
+    uint32_t best;          // lowest candidate that decrypts cmd
+    uint64_t key;           // key of the best candidate
+    pthread_mutex_t lock;   // guards best / key updates
+} nested_search_t;
+
+static void *nested_thread(void *thread_arg) {
+    nested_search_t *ns = (nested_search_t *)thread_arg;
+
+    for (;;) {
+        uint32_t start = __atomic_fetch_add(&ns->next, MF_NESTED_CHUNK, __ATOMIC_RELAXED);
+        if (start >= MF_NESTED_CANDIDATES || start >= __atomic_load_n(&ns->best, __ATOMIC_RELAXED)) {
+            break;
+        }
+
+        uint32_t ntx = prng_successor(ns->ad.nt, 91 + start);
+        for (uint32_t i = start; i < start + MF_NESTED_CHUNK && i < MF_NESTED_CANDIDATES; i++, ntx = prng_successor(ntx, 1)) {
+
+            // a lower candidate already matched, keep the result of a serial search
+            if (i >= __atomic_load_n(&ns->best, __ATOMIC_RELAXED)) {
+                break;
+            }
+
+            if (NTParityChk(&ns->ad, ntx) == false) {
+                continue;
+            }
+
+            uint32_t ks2 = ns->ad.ar_enc ^ prng_successor(ntx, 64);
+            uint32_t ks3 = ns->ad.at_enc ^ prng_successor(ntx, 96);
+            // the state list lives on the stack, no allocation per candidate
+            struct Crypto1State states[LFSR_RECOVERY64_STATES];
+            lfsr_recovery64_into(ks2, ks3, states);
+            struct Crypto1State *pcs = states;
+
+            uint8_t buf[32] = {0};
+            struct Crypto1State st = *pcs;
+            memcpy(buf, ns->cmd, ns->cmdsize);
+            mf_crypto1_decrypt(&st, buf, ns->cmdsize, 0);
+
+            if (CheckCrypto1Parity(ns->cmd, ns->cmdsize, buf, ns->parity) && check_crc(CRC_14443_A, buf, ns->cmdsize)) {
+                // same as GetCrypto1ProbableKey(), without a second recovery
+                lfsr_rollback_word(pcs, 0, 0);
+                lfsr_rollback_word(pcs, 0, 0);
+                lfsr_rollback_word(pcs, ns->ad.nr_enc, 1);
+                lfsr_rollback_word(pcs, ns->ad.uid ^ ntx, 0);
+                uint64_t key = 0;
+                crypto1_get_lfsr(pcs, &key);
+
+                pthread_mutex_lock(&ns->lock);
+                if (i < ns->best) {
+                    ns->key = key;
+                    __atomic_store_n(&ns->best, i, __ATOMIC_RELAXED);
+                }
+                pthread_mutex_unlock(&ns->lock);
+                break;
+            }
+        }
+    }
+    return NULL;
+}
+
+// finds the tag nonce of a nested auth with a weak prng, spread over all CPUs
+static bool NestedSearchNonce(AuthData_t *ad, uint8_t *cmd, uint8_t cmdsize, uint8_t *parity, uint64_t *key) {
+
+    nested_search_t ns = {
+        .ad = *ad,
+        .cmd = cmd,
+        .cmdsize = cmdsize,
+        .parity = parity,
+        .next = 0,
+        .best = MF_NESTED_CANDIDATES,
+        .key = 0,
+    };
+    pthread_mutex_init(&ns.lock, NULL);
+
+    int thread_count = num_CPUs();
+    if (thread_count > MF_NESTED_CANDIDATES / MF_NESTED_CHUNK) {
+        thread_count = MF_NESTED_CANDIDATES / MF_NESTED_CHUNK;
+    }
+
+    pthread_t threads[MF_NESTED_CANDIDATES / MF_NESTED_CHUNK];
+    int started = 0;
+    for (; started < thread_count - 1; started++) {
+        if (pthread_create(&threads[started], NULL, nested_thread, &ns) != 0) {
+            break;
+        }
+    }
+    nested_thread(&ns);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&ns.lock);
+
+    if (ns.best == MF_NESTED_CANDIDATES) {
+        return false;
+    }
+
+    uint32_t ntx = prng_successor(ad->nt, 91 + ns.best);
+    ad->ks2 = ad->ar_enc ^ prng_successor(ntx, 64);
+    ad->ks3 = ad->at_enc ^ prng_successor(ntx, 96);
+    ad->nt = ntx;
+    *key = ns.key;
+    return true;
+}
+
 bool DecodeMifareData(uint8_t *cmd, uint8_t cmdsize, uint8_t *parity, bool isResponse, uint8_t *mfData, size_t *mfDataLen, const uint64_t *dicKeys, uint32_t dicKeysCount) {
     static struct Crypto1State *traceCrypto1;
 
@@ -1697,8 +1874,9 @@ bool DecodeMifareData(uint8_t *cmd, uint8_t cmdsize, uint8_t *parity, bool isRes
                           validate_prng_nonce(AuthData.nt) ? _GREEN_("WEAK") : _YELLOW_("HARD"));
 
             AuthData.first_auth = false;
+            mf_trace_key_add(&AuthData, mfLastKey);
 
-            traceCrypto1 = lfsr_recovery64(AuthData.ks2, AuthData.ks3);
+            traceCrypto1 = mf_trace_state(&AuthData, mfLastKey);
         } else {
             if (traceCrypto1) {
                 crypto1_destroy(traceCrypto1);
@@ -1709,54 +1887,54 @@ bool DecodeMifareData(uint8_t *cmd, uint8_t cmdsize, uint8_t *parity, bool isRes
             if (mfLastKey) {
                 if (NestedCheckKey(mfLastKey, &AuthData, cmd, cmdsize, parity)) {
                     PrintAndLogEx(NORMAL, "            |            |  *  |%60s " _GREEN_("%012" PRIX64) "|     |", "last used key", mfLastKey);
-                    traceCrypto1 = lfsr_recovery64(AuthData.ks2, AuthData.ks3);
+                    traceCrypto1 = mf_trace_state(&AuthData, mfLastKey);
                 };
             }
 
-            // check default keys
-            if (!traceCrypto1 && dicKeys != NULL && dicKeysCount > 0) {
-                for (int i = 0; i < dicKeysCount; i++) {
-                    if (NestedCheckKey(dicKeys[i], &AuthData, cmd, cmdsize, parity)) {
-                        PrintAndLogEx(NORMAL, "            |            |  *  |%60s " _GREEN_("%012" PRIX64) "|     |", "key", dicKeys[i]);
+            // check key found earlier for this sector
+            const mf_trace_key_t *cached = mf_trace_key_find(&AuthData);
+            if (!traceCrypto1 && cached && cached->key != mfLastKey) {
+                if (NestedCheckKey(cached->key, &AuthData, cmd, cmdsize, parity)) {
+                    PrintAndLogEx(NORMAL, "            |            |  *  |%60s " _GREEN_("%012" PRIX64) "|     |", "cached key", cached->key);
+                    mfLastKey = cached->key;
+                    traceCrypto1 = mf_trace_state(&AuthData, mfLastKey);
+                };
+            }
 
-                        mfLastKey = dicKeys[i];
-                        traceCrypto1 = lfsr_recovery64(AuthData.ks2, AuthData.ks3);
-                        break;
-                    };
+            // check default keys, bitsliced pre-filter and a full check of the candidates
+            if (!traceCrypto1 && dicKeys != NULL && dicKeysCount > 0) {
+                size_t *hits = calloc(dicKeysCount, sizeof(size_t));
+                if (hits != NULL) {
+                    size_t found = crypto1_bs_nested_check(AuthData.uid, AuthData.nt_enc, AuthData.nr_enc, AuthData.ar_enc, AuthData.at_enc, dicKeys, dicKeysCount, hits);
+                    for (size_t i = 0; i < found; i++) {
+                        if (NestedCheckKey(dicKeys[hits[i]], &AuthData, cmd, cmdsize, parity)) {
+                            PrintAndLogEx(NORMAL, "            |            |  *  |%60s " _GREEN_("%012" PRIX64) "|     |", "key", dicKeys[hits[i]]);
+
+                            mfLastKey = dicKeys[hits[i]];
+                            traceCrypto1 = mf_trace_state(&AuthData, mfLastKey);
+                            break;
+                        };
+                    }
+                    free(hits);
                 }
             }
 
             // nested
             if (!traceCrypto1 && validate_prng_nonce(AuthData.nt)) {
-                uint32_t ntx = prng_successor(AuthData.nt, 90);
-                for (int i = 0; i < 16383; i++) {
-                    ntx = prng_successor(ntx, 1);
-                    if (NTParityChk(&AuthData, ntx)) {
+                if (NestedSearchNonce(&AuthData, cmd, cmdsize, parity, &mfLastKey)) {
+                    PrintAndLogEx(NORMAL, "            |            |  *  | nested probable key: " _GREEN_("%012" PRIX64) "     ks2:%08x ks3:%08x |     |",
+                                  mfLastKey,
+                                  AuthData.ks2,
+                                  AuthData.ks3);
 
-                        uint32_t ks2 = AuthData.ar_enc ^ prng_successor(ntx, 64);
-                        uint32_t ks3 = AuthData.at_enc ^ prng_successor(ntx, 96);
-                        struct Crypto1State *pcs = lfsr_recovery64(ks2, ks3);
-                        memcpy(mfData, cmd, cmdsize);
-                        mf_crypto1_decrypt(pcs, mfData, cmdsize, 0);
-                        crypto1_destroy(pcs);
-
-                        if (CheckCrypto1Parity(cmd, cmdsize, mfData, parity) && check_crc(CRC_14443_A, mfData, cmdsize)) {
-                            AuthData.ks2 = ks2;
-                            AuthData.ks3 = ks3;
-                            AuthData.nt = ntx;
-                            mfLastKey = GetCrypto1ProbableKey(&AuthData);
-                            PrintAndLogEx(NORMAL, "            |            |  *  | nested probable key: " _GREEN_("%012" PRIX64) "     ks2:%08x ks3:%08x |     |",
-                                          mfLastKey,
-                                          AuthData.ks2,
-                                          AuthData.ks3);
-
-                            traceCrypto1 = lfsr_recovery64(AuthData.ks2, AuthData.ks3);
-                            break;
-                        }
-                    }
+                    traceCrypto1 = mf_trace_state(&AuthData, mfLastKey);
                 }
             }
 
+            if (traceCrypto1) {
+                mf_trace_key_add(&AuthData, mfLastKey);
+            }
+
             //hardnested
             if (!traceCrypto1) {
 
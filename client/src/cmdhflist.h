@@ -34,6 +34,8 @@ typedef struct {
     bool first_auth;    // is first authentication
     uint32_t ks2;       // ar ^ ar_enc
     uint32_t ks3;       // at ^ at_enc
+    uint8_t auth_cmd;   // authentication command, key A / B
+    uint8_t auth_block; // authenticated block
 } AuthData_t;
 
 void ClearAuthData(void);
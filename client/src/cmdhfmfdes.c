@@ -20,6 +20,7 @@
 #include "cmdhfmfdes.h"
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
 #include "commonutil.h"             // ARRAYLEN
 #include "cmdparser.h"              // command_t
 #include "comms.h"
@@ -45,6 +46,7 @@
 #include "generator.h"
 #include "mifare/aiddesfire.h"
 #include "util.h"
+#include "emv/emvjson.h"
 
 #define MAX_KEY_LEN        24
 #define MAX_KEYS_LIST_LEN  1024
@@ -849,56 +851,260 @@ static int CmdHF14ADesInfo(const char *Cmd) {
     return PM3_SUCCESS;
 }
 
-static void DesFill2bPattern(
-    uint8_t deskeyList[MAX_KEYS_LIST_LEN][8], uint32_t *deskeyListLen,
-    uint8_t aeskeyList[MAX_KEYS_LIST_LEN][16], uint32_t *aeskeyListLen,
-    uint8_t k3kkeyList[MAX_KEYS_LIST_LEN][24], uint32_t *k3kkeyListLen, uint32_t *startPattern) {
-
-    for (uint32_t pt = *startPattern; pt < 0x10000; pt++) {
-        if (*deskeyListLen != MAX_KEYS_LIST_LEN) {
-            deskeyList[*deskeyListLen][0] = (pt >> 8) & 0xff;
-            deskeyList[*deskeyListLen][1] = pt & 0xff;
-            memcpy(&deskeyList[*deskeyListLen][2], &deskeyList[*deskeyListLen][0], 2);
-            memcpy(&deskeyList[*deskeyListLen][4], &deskeyList[*deskeyListLen][0], 4);
-            (*deskeyListLen)++;
-        }
-        if (*aeskeyListLen != MAX_KEYS_LIST_LEN) {
-            aeskeyList[*aeskeyListLen][0] = (pt >> 8) & 0xff;
-            aeskeyList[*aeskeyListLen][1] = pt & 0xff;
-            memcpy(&aeskeyList[*aeskeyListLen][2], &aeskeyList[*aeskeyListLen][0], 2);
-            memcpy(&aeskeyList[*aeskeyListLen][4], &aeskeyList[*aeskeyListLen][0], 4);
-            memcpy(&aeskeyList[*aeskeyListLen][8], &aeskeyList[*aeskeyListLen][0], 8);
-            (*aeskeyListLen)++;
-        }
-        if (*k3kkeyListLen != MAX_KEYS_LIST_LEN) {
-            k3kkeyList[*k3kkeyListLen][0] = (pt >> 8) & 0xff;
-            k3kkeyList[*k3kkeyListLen][1] = pt & 0xff;
-            memcpy(&k3kkeyList[*k3kkeyListLen][2], &k3kkeyList[*k3kkeyListLen][0], 2);
-            memcpy(&k3kkeyList[*k3kkeyListLen][4], &k3kkeyList[*k3kkeyListLen][0], 4);
-            memcpy(&k3kkeyList[*k3kkeyListLen][8], &k3kkeyList[*k3kkeyListLen][0], 8);
-            memcpy(&k3kkeyList[*k3kkeyListLen][16], &k3kkeyList[*k3kkeyListLen][0], 4);
-            (*k3kkeyListLen)++;
-        }
+// keys for `hf mfdes chk`, made on the fly so the pattern modes and large dictionaries need no key lists
+typedef enum {
+    DCKSource,      // dictionary and/or single key
+    DCKPattern1b,
+    DCKPattern2b,
+} DesfireChkMode;
+
+// foundKeys / key list index: DES, 2TDEA, AES, 3TDEA
+#define DESFIRE_CHK_TYPES  4
+static const DesfireCryptoAlgorithm DesfireChkAlgo[DESFIRE_CHK_TYPES] = {T_DES, T_3DES, T_AES, T_3K3DES};
+static const char *DesfireChkName[DESFIRE_CHK_TYPES] = {"DES", "2TDEA", "AES", "3TDEA"};
+
+typedef struct {
+    DesfireChkMode mode;
+    uint32_t startPattern;
+    // dictionary keys by length, 8 (DES), 16 (2TDEA, AES), 24 (3TDEA)
+    uint8_t *list[3];
+    uint32_t listcnt[3];
+} DesfireChkKeys_t;
+
+static int DesfireChkList(DesfireCryptoAlgorithm algo) {
+    return (algo == T_DES) ? 0 : ((algo == T_3K3DES) ? 2 : 1);
+}
+
+static uint32_t DesfireChkKeyCount(const DesfireChkKeys_t *keys, DesfireCryptoAlgorithm algo) {
+    switch (keys->mode) {
+        case DCKPattern1b:
+            return 0x100;
+        case DCKPattern2b:
+            return 0x10000 - keys->startPattern;
+        case DCKSource:
+        default:
+            return keys->listcnt[DesfireChkList(algo)];
+    }
+}
 
-        *startPattern = pt;
-        if ((*deskeyListLen == MAX_KEYS_LIST_LEN) &&
-                (*aeskeyListLen == MAX_KEYS_LIST_LEN) &&
-                (*k3kkeyListLen == MAX_KEYS_LIST_LEN)) {
+static void DesfireChkGetKey(const DesfireChkKeys_t *keys, DesfireCryptoAlgorithm algo, uint32_t index, uint8_t *key) {
+    size_t keylen = desfire_get_key_length(algo);
+    switch (keys->mode) {
+        case DCKPattern1b:
+            memset(key, index, keylen);
             break;
+        case DCKPattern2b: {
+            uint32_t pt = keys->startPattern + index;
+            for (size_t i = 0; i < keylen; i += 2) {
+                key[i] = (pt >> 8) & 0xff;
+                key[i + 1] = pt & 0xff;
+            }
+            break;
+        }
+        case DCKSource:
+        default:
+            memcpy(key, keys->list[DesfireChkList(algo)] + index * keylen, keylen);
+            break;
+    }
+}
+
+// keys are prepared (pattern / dictionary lookup and key diversification) by a thread of its own
+// while the reader works on the current authentication, up to DESFIRE_CHK_WINDOW keys ahead
+#define DESFIRE_CHK_WINDOW  64
+
+typedef struct {
+    const DesfireChkKeys_t *keys;
+    DesfireCryptoAlgorithm algo;
+    uint8_t keyNum;
+    // key diversification, same inputs DesfireAuthenticate() uses
+    uint8_t kdfAlgo;
+    uint8_t kdfInputLen;
+    uint8_t kdfInput[31];
+    uint8_t uid[10];
+    uint8_t uidlen;
+    uint32_t aid;
+
+    bool threaded;
+    uint32_t end;
+    uint32_t produced;   // absolute key index of the next key to prepare
+    uint32_t consumed;   // absolute key index of the next key to check
+    bool stop;
+    uint8_t ring[DESFIRE_CHK_WINDOW][2][MAX_KEY_LEN]; // [0] key as listed, [1] key for the card
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} DesfireChkPipe_t;
+
+static void DesfireChkDiversify(const DesfireChkPipe_t *p, const uint8_t *key, uint8_t *cardkey) {
+    size_t keylen = desfire_get_key_length(p->algo);
+    if (p->kdfAlgo != MFDES_KDF_ALGO_AN10922 && p->kdfAlgo != MFDES_KDF_ALGO_GALLAGHER) {
+        memcpy(cardkey, key, keylen);
+        return;
+    }
+
+    DesfireContext_t kctx = {0};
+    DesfireSetKeyNoClear(&kctx, p->keyNum, p->algo, (uint8_t *)key);
+    uint8_t kdfInput[31] = {0};
+    uint8_t kdfInputLen = p->kdfInputLen;
+    memcpy(kdfInput, p->kdfInput, sizeof(kdfInput));
+    if (p->kdfAlgo == MFDES_KDF_ALGO_GALLAGHER) {
+        uint8_t uid[10] = {0};
+        memcpy(uid, p->uid, sizeof(uid));
+        kdfInputLen = 11;
+        mfdes_kdf_input_gallagher(uid, p->uidlen, p->keyNum, p->aid, kdfInput, &kdfInputLen);
+    }
+    MifareKdfAn10922(&kctx, DCOMasterKey, kdfInput, kdfInputLen);
+    memcpy(cardkey, kctx.key, keylen);
+}
+
+static void *DesfireChkPrepareThread(void *arg) {
+    DesfireChkPipe_t *p = (DesfireChkPipe_t *)arg;
+
+    pthread_mutex_lock(&p->lock);
+    while (p->stop == false && p->produced < p->end) {
+        if (p->produced - p->consumed == DESFIRE_CHK_WINDOW) {
+            pthread_cond_wait(&p->cond, &p->lock);
+            continue;
         }
+        uint32_t index = p->produced;
+        pthread_mutex_unlock(&p->lock);
+
+        uint8_t (*slot)[MAX_KEY_LEN] = p->ring[index % DESFIRE_CHK_WINDOW];
+        DesfireChkGetKey(p->keys, p->algo, index, slot[0]);
+        DesfireChkDiversify(p, slot[0], slot[1]);
+
+        pthread_mutex_lock(&p->lock);
+        p->produced++;
+        pthread_cond_broadcast(&p->cond);
     }
-    (*startPattern)++;
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+// waits for the prepared key at p->consumed, false once the range is done
+static bool DesfireChkNextKey(DesfireChkPipe_t *p, uint8_t *key, uint8_t *cardkey) {
+    if (p->threaded == false) {
+        // no thread, prepare it here
+        if (p->consumed >= p->end)
+            return false;
+        DesfireChkGetKey(p->keys, p->algo, p->consumed, key);
+        DesfireChkDiversify(p, key, cardkey);
+        p->consumed++;
+        return true;
+    }
+
+    pthread_mutex_lock(&p->lock);
+    while (p->consumed == p->produced && p->consumed < p->end)
+        pthread_cond_wait(&p->cond, &p->lock);
+
+    bool res = (p->consumed < p->end);
+    if (res) {
+        size_t keylen = desfire_get_key_length(p->algo);
+        memcpy(key, p->ring[p->consumed % DESFIRE_CHK_WINDOW][0], keylen);
+        memcpy(cardkey, p->ring[p->consumed % DESFIRE_CHK_WINDOW][1], keylen);
+        p->consumed++;
+        pthread_cond_broadcast(&p->cond);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return res;
+}
+
+// search position, everything `--checkpoint` needs to continue later
+typedef struct {
+    const DesfireChkKeys_t *keys;
+    const char *source;  // identifies the key source in the checkpoint file
+    uint8_t kdfAlgo;
+    uint8_t kdfInputLen;
+    uint8_t *kdfInput;
+
+    uint32_t aidIndex;
+    uint32_t job;        // type * 0xE + key number
+    uint32_t keyIndex;
+    uint8_t foundKeys[DESFIRE_CHK_TYPES][0xE][24 + 1];
+    bool result;
+
+    const char *checkpoint;
+    uint64_t lastSave;
+} DesfireChkState_t;
+
+#define DESFIRE_CHK_SAVE_MS  10000
+
+static int DesfireChkSave(DesfireChkState_t *st, DesfireContext_t *dctx) {
+    if (st->checkpoint == NULL)
+        return PM3_SUCCESS;
+
+    json_t *root = json_object();
+    JsonSaveStr(root, "Created", "proxmark3");
+    JsonSaveStr(root, "FileType", "mfdes chk");
+    JsonSaveBufAsHexCompact(root, "$.Card.UID", dctx->uid, dctx->uidlen);
+    JsonSaveStr(root, "Keys", st->source);
+    JsonSaveInt(root, "KDF", st->kdfAlgo);
+    JsonSaveBufAsHexCompact(root, "KDFInput", st->kdfInput, st->kdfInputLen);
+    JsonSaveInt(root, "$.Position.AID", st->aidIndex);
+    JsonSaveInt(root, "$.Position.Job", st->job);
+    JsonSaveInt(root, "$.Position.Key", st->keyIndex);
+    JsonSaveBufAsHexCompact(root, "Found", (uint8_t *)st->foundKeys, sizeof(st->foundKeys));
+
+    int res = saveFileJSONrootEx(st->checkpoint, root, JSON_INDENT(2), false, true);
+    json_decref(root);
+    st->lastSave = msclock();
+    return res;
+}
+
+static int DesfireChkLoad(DesfireChkState_t *st, DesfireContext_t *dctx) {
+    json_error_t error;
+    json_t *root = json_load_file(st->checkpoint, 0, &error);
+    if (root == NULL)
+        return PM3_EFILE;
+
+    int res = PM3_ESOFT;
+    char str[300] = {0};
+    uint8_t uid[10] = {0};
+    size_t uidlen = 0;
+    uint8_t kdfInput[31] = {0};
+    size_t kdfInputLen = 0;
+
+    if (JsonLoadStr(root, "$.FileType", str) || strcmp(str, "mfdes chk")) {
+        PrintAndLogEx(ERR, "Checkpoint " _YELLOW_("%s") " is not a `hf mfdes chk` file", st->checkpoint);
+        goto out;
+    }
+
+    JsonLoadBufAsHex(root, "$.Card.UID", uid, sizeof(uid), &uidlen);
+    if (uidlen != dctx->uidlen || memcmp(uid, dctx->uid, uidlen)) {
+        PrintAndLogEx(ERR, "Checkpoint was made for card %s", sprint_hex_inrow(uid, uidlen));
+        goto out;
+    }
+
+    memset(str, 0, sizeof(str));
+    JsonLoadStr(root, "$.Keys", str);
+    JsonLoadBufAsHex(root, "$.KDFInput", kdfInput, sizeof(kdfInput), &kdfInputLen);
+    if (strcmp(str, st->source) ||
+            json_integer_value(json_object_get(root, "KDF")) != st->kdfAlgo ||
+            kdfInputLen != st->kdfInputLen || memcmp(kdfInput, st->kdfInput, kdfInputLen)) {
+        PrintAndLogEx(ERR, "Checkpoint was made with other keys ( %s )", str);
+        goto out;
+    }
+
+    json_t *pos = json_object_get(root, "Position");
+    st->aidIndex = json_integer_value(json_object_get(pos, "AID"));
+    st->job = json_integer_value(json_object_get(pos, "Job"));
+    st->keyIndex = json_integer_value(json_object_get(pos, "Key"));
+
+    size_t foundlen = 0;
+    JsonLoadBufAsHex(root, "$.Found", (uint8_t *)st->foundKeys, sizeof(st->foundKeys), &foundlen);
+    for (int t = 0; t < DESFIRE_CHK_TYPES; t++)
+        for (int k = 0; k < 0xE; k++)
+            st->result = st->result || st->foundKeys[t][k][0];
+
+    res = PM3_SUCCESS;
+out:
+    json_decref(root);
+    return res;
 }
 
 static int AuthCheckDesfire(DesfireContext_t *dctx,
                             DesfireSecureChannel secureChannel,
                             const uint8_t *aid,
-                            uint8_t deskeyList[MAX_KEYS_LIST_LEN][8], uint32_t deskeyListLen,
-                            uint8_t aeskeyList[MAX_KEYS_LIST_LEN][16], uint32_t aeskeyListLen,
-                            uint8_t k3kkeyList[MAX_KEYS_LIST_LEN][24], uint32_t k3kkeyListLen,
-                            uint8_t cmdKdfAlgo, uint8_t kdfInputLen, uint8_t *kdfInput,
-                            uint8_t foundKeys[4][0xE][24 + 1],
-                            bool *result,
+                            DesfireChkState_t *st,
                             bool verbose) {
 
     uint32_t curaid = (aid[0] & 0xFF) + ((aid[1] & 0xFF) << 8) + ((aid[2] & 0xFF) << 16);
@@ -911,10 +1117,7 @@ static int AuthCheckDesfire(DesfireContext_t *dctx,
     }
 
     int usedkeys[0xF] = {0};
-    bool des = false;
-    bool tdes = false;
-    bool aes = false;
-    bool k3kdes = false;
+    bool checktype[DESFIRE_CHK_TYPES] = {false};
 
     uint8_t data[250] = {0};
     size_t datalen = 0;
@@ -927,14 +1130,14 @@ static int AuthCheckDesfire(DesfireContext_t *dctx,
     uint8_t num_keys = data[1];
     switch (num_keys >> 6) {
         case 0:
-            des = true;
-            tdes = true;
+            checktype[0] = true; // DES
+            checktype[1] = true; // 2TDEA
             break;
         case 1:
-            k3kdes = true;
+            checktype[3] = true; // 3TDEA
             break;
         case 2:
-            aes = true;
+            checktype[2] = true; // AES
             break;
         default:
             break;
@@ -971,7 +1174,7 @@ static int AuthCheckDesfire(DesfireContext_t *dctx,
     }
 
     if (verbose) {
-        PrintAndLogEx(INFO, "Check: %s %s %s %s " NOLF, (des) ? "DES" : "", (tdes) ? "2TDEA" : "", (k3kdes) ? "3TDEA" : "", (aes) ? "AES" : "");
+        PrintAndLogEx(INFO, "Check: %s %s %s %s " NOLF, (checktype[0]) ? "DES" : "", (checktype[1]) ? "2TDEA" : "", (checktype[3]) ? "3TDEA" : "", (checktype[2]) ? "AES" : "");
         PrintAndLogEx(NORMAL, "keys: " NOLF);
         for (int i = 0; i < 0xE; i++)
             if (usedkeys[i] == 1)
@@ -979,157 +1182,129 @@ static int AuthCheckDesfire(DesfireContext_t *dctx,
         PrintAndLogEx(NORMAL, "");
     }
 
-    bool badlen = false;
+    // the prepared keys are already diversified
+    uint8_t kdfAlgo = dctx->kdfAlgo;
+    dctx->kdfAlgo = MFDES_KDF_ALGO_NONE;
 
-    if (des) {
+    uint32_t auths = 0;
+    uint64_t t1 = msclock();
 
-        for (uint8_t keyno = 0; keyno < 0xE; keyno++) {
+    for (; st->job < DESFIRE_CHK_TYPES * 0xE; st->job++, st->keyIndex = 0) {
+        uint8_t type = st->job / 0xE;
+        uint8_t keyno = st->job % 0xE;
+        DesfireCryptoAlgorithm algo = DesfireChkAlgo[type];
+        size_t keylen = desfire_get_key_length(algo);
 
-            if (usedkeys[keyno] == 1 && foundKeys[0][keyno][0] == 0) {
-                for (uint32_t curkey = 0; curkey < deskeyListLen; curkey++) {
-                    DesfireSetKeyNoClear(dctx, keyno, T_DES, deskeyList[curkey]);
-                    res = DesfireAuthenticate(dctx, secureChannel, false);
-                    if (res == PM3_SUCCESS) {
-                        PrintAndLogEx(SUCCESS, "AID 0x%06X, Found DES Key %02u          : " _GREEN_("%s"), curaid, keyno, sprint_hex(deskeyList[curkey], 8));
-                        foundKeys[0][keyno][0] = 0x01;
-                        *result = true;
-                        memcpy(&foundKeys[0][keyno][1], deskeyList[curkey], 8);
-                        break;
-                    } else if (res < 7) {
-                        badlen = true;
-                        DropField();
-                        res = DesfireSelectAIDHex(dctx, curaid, false, 0);
-                        if (res != PM3_SUCCESS) {
-                            return res;
-                        }
-                        break;
-                    }
-                }
-                if (badlen == true) {
-                    badlen = false;
-                    break;
-                }
-            }
-        }
-    }
-
-    if (tdes) {
+        if (checktype[type] == false || usedkeys[keyno] == 0 || st->foundKeys[type][keyno][0])
+            continue;
 
-        for (uint8_t keyno = 0; keyno < 0xE; keyno++) {
+        DesfireChkPipe_t pipe = {
+            .keys = st->keys,
+            .algo = algo,
+            .keyNum = keyno,
+            .kdfAlgo = kdfAlgo,
+            .kdfInputLen = dctx->kdfInputLen,
+            .uidlen = dctx->uidlen,
+            .aid = curaid,
+            .end = DesfireChkKeyCount(st->keys, algo),
+            .produced = st->keyIndex,
+            .consumed = st->keyIndex,
+        };
+        memcpy(pipe.kdfInput, dctx->kdfInput, sizeof(pipe.kdfInput));
+        memcpy(pipe.uid, dctx->uid, sizeof(pipe.uid));
+        pthread_mutex_init(&pipe.lock, NULL);
+        pthread_cond_init(&pipe.cond, NULL);
+
+        pthread_t thread;
+        pipe.threaded = (pthread_create(&thread, NULL, DesfireChkPrepareThread, &pipe) == 0);
+
+        bool badlen = false;
+        uint8_t key[MAX_KEY_LEN] = {0};
+        uint8_t cardkey[MAX_KEY_LEN] = {0};
+        for (;;) {
+            if (DesfireChkNextKey(&pipe, key, cardkey) == false)
+                break;
 
-            if (usedkeys[keyno] == 1 && foundKeys[1][keyno][0] == 0) {
-                for (uint32_t curkey = 0; curkey < aeskeyListLen; curkey++) {
-                    DesfireSetKeyNoClear(dctx, keyno, T_3DES, aeskeyList[curkey]);
-                    res = DesfireAuthenticate(dctx, secureChannel, false);
-                    if (res == PM3_SUCCESS) {
-                        PrintAndLogEx(SUCCESS, "AID 0x%06X, Found 2TDEA Key %02u        : " _GREEN_("%s"), curaid, keyno, sprint_hex(aeskeyList[curkey], 16));
-                        foundKeys[1][keyno][0] = 0x01;
-                        *result = true;
-                        memcpy(&foundKeys[1][keyno][1], aeskeyList[curkey], 16);
-                        break;
-                    } else if (res < 7) {
-                        badlen = true;
-                        DropField();
-                        res = DesfireSelectAIDHex(dctx, curaid, false, 0);
-                        if (res != PM3_SUCCESS) {
-                            return res;
-                        }
-                        break;
-                    }
-                }
-                if (badlen == true) {
-                    badlen = false;
-                    break;
-                }
+            if (kbd_enter_pressed()) {
+                res = PM3_EOPABORTED;
+                break;
             }
-        }
-    }
-
-    if (aes) {
 
-        for (uint8_t keyno = 0; keyno < 0xE; keyno++) {
+            DesfireSetKeyNoClear(dctx, keyno, algo, cardkey);
+            res = DesfireAuthenticate(dctx, secureChannel, false);
+            auths++;
+            st->keyIndex = pipe.consumed;
 
-            if (usedkeys[keyno] == 1 && foundKeys[2][keyno][0] == 0) {
-                for (uint32_t curkey = 0; curkey < aeskeyListLen; curkey++) {
-                    DesfireSetKeyNoClear(dctx, keyno, T_AES, aeskeyList[curkey]);
-                    res = DesfireAuthenticate(dctx, secureChannel, false);
-                    if (res == PM3_SUCCESS) {
-                        PrintAndLogEx(SUCCESS, "AID 0x%06X, Found AES Key %02u          : " _GREEN_("%s"), curaid, keyno, sprint_hex(aeskeyList[curkey], 16));
-                        foundKeys[2][keyno][0] = 0x01;
-                        *result = true;
-                        memcpy(&foundKeys[2][keyno][1], aeskeyList[curkey], 16);
-                        break;
-                    } else if (res < 7) {
-                        badlen = true;
-                        DropField();
-                        res = DesfireSelectAIDHex(dctx, curaid, false, 0);
-                        if (res != PM3_SUCCESS) {
-                            return res;
-                        }
-                        break;
-                    }
-                }
-                if (badlen == true) {
-                    badlen = false;
-                    break;
-                }
+            if (res == PM3_SUCCESS) {
+                char label[20] = {0};
+                snprintf(label, sizeof(label), "%s Key %02u", DesfireChkName[type], keyno);
+                PrintAndLogEx(SUCCESS, "AID 0x%06X, Found %-20s: " _GREEN_("%s"), curaid, label, sprint_hex(key, keylen));
+                st->foundKeys[type][keyno][0] = 0x01;
+                st->result = true;
+                memcpy(&st->foundKeys[type][keyno][1], key, keylen);
+                break;
+            } else if (res < 7) {
+                // the card does not take this key type / number, no need to try the rest
+                badlen = true;
+                break;
             }
-        }
-    }
 
-    if (k3kdes) {
+            if (msclock() - st->lastSave > DESFIRE_CHK_SAVE_MS)
+                DesfireChkSave(st, dctx);
+        }
 
-        for (uint8_t keyno = 0; keyno < 0xE; keyno++) {
+        pthread_mutex_lock(&pipe.lock);
+        pipe.stop = true;
+        pthread_cond_broadcast(&pipe.cond);
+        pthread_mutex_unlock(&pipe.lock);
+        if (pipe.threaded)
+            pthread_join(thread, NULL);
+        pthread_cond_destroy(&pipe.cond);
+        pthread_mutex_destroy(&pipe.lock);
 
-            if (usedkeys[keyno] == 1 && foundKeys[3][keyno][0] == 0) {
-                for (uint32_t curkey = 0; curkey < k3kkeyListLen; curkey++) {
-                    DesfireSetKeyNoClear(dctx, keyno, T_3K3DES, k3kkeyList[curkey]);
-                    res = DesfireAuthenticate(dctx, secureChannel, false);
-                    if (res == PM3_SUCCESS) {
-                        PrintAndLogEx(SUCCESS, "AID 0x%06X, Found 3TDEA Key %02u        : " _GREEN_("%s"), curaid, keyno, sprint_hex(k3kkeyList[curkey], 24));
-                        foundKeys[3][keyno][0] = 0x01;
-                        *result = true;
-                        memcpy(&foundKeys[3][keyno][1], k3kkeyList[curkey], 16);
-                        break;
-                    } else if (res < 7) {
-                        badlen = true;
-                        DropField();
-                        res = DesfireSelectAIDHex(dctx, curaid, false, 0);
-                        if (res != PM3_SUCCESS) {
-                            return res;
-                        }
-                        break;
-                    }
-                }
+        if (res == PM3_EOPABORTED) {
+            dctx->kdfAlgo = kdfAlgo;
+            DesfireChkSave(st, dctx);
+            DropField();
+            return res;
+        }
 
-                if (badlen == true) {
-                    break;
-                }
+        if (badlen) {
+            DropField();
+            res = DesfireSelectAIDHex(dctx, curaid, false, 0);
+            if (res != PM3_SUCCESS) {
+                dctx->kdfAlgo = kdfAlgo;
+                return res;
             }
+            // skip the other key numbers of this type
+            st->job = (type + 1) * 0xE - 1;
         }
     }
+    dctx->kdfAlgo = kdfAlgo;
+
+    uint64_t t2 = msclock() - t1;
+    if (auths > 0 && t2 > 0) {
+        PrintAndLogEx(INFO, "AID 0x%06X, " _YELLOW_("%u") " keys in %.1f s ( " _YELLOW_("%.1f") " auth/s )", curaid, auths, (float)t2 / 1000.0, (float)auths * 1000.0 / t2);
+    }
+
     DropField();
     return PM3_SUCCESS;
 }
 
 static int CmdHF14aDesChk(const char *Cmd) {
     int res;
-    uint8_t deskeyList[MAX_KEYS_LIST_LEN][8] = {{0}};
-    uint8_t aeskeyList[MAX_KEYS_LIST_LEN][16] = {{0}};
-    uint8_t k3kkeyList[MAX_KEYS_LIST_LEN][MAX_KEY_LEN] = {{0}};
-    uint32_t deskeyListLen = 0;
-    uint32_t aeskeyListLen = 0;
-    uint32_t k3kkeyListLen = 0;
-    uint8_t foundKeys[4][0xE][24 + 1] = {{{0}}};
 
     CLIParserContext *ctx;
     CLIParserInit(&ctx, "hf mfdes chk",
-                  "Checks keys with MIFARE DESFire card.",
+                  "Checks keys with MIFARE DESFire card.\n"
+                  "Keys are prepared on a separate thread while the card answers, press <Enter> to abort.\n"
+                  "With `--cp` the search position is saved regularly and on abort, running the same command again continues from there.",
                   "hf mfdes chk --aid 123456 -k 000102030405060708090a0b0c0d0e0f  -> check key on aid 0x123456\n"
                   "hf mfdes chk -d mfdes_default_keys                          -> check keys from dictionary against all existing aid on card\n"
                   "hf mfdes chk -d mfdes_default_keys --aid 123456        -> check keys from dictionary against aid 0x123456\n"
                   "hf mfdes chk --aid 123456 --pattern1b -j keys          -> check all 1-byte keys pattern on aid 0x123456 and save found keys to json\n"
-                  "hf mfdes chk --aid 123456 --pattern2b --startp2b FA00  -> check all 2-byte keys pattern on aid 0x123456. Start from key FA00FA00...FA00");
+                  "hf mfdes chk --aid 123456 --pattern2b --startp2b FA00  -> check all 2-byte keys pattern on aid 0x123456. Start from key FA00FA00...FA00\n"
+                  "hf mfdes chk --pattern2b --cp chk_progress             -> check all 2-byte keys pattern, resumable");
 
     void *argtable[] = {
         arg_param_begin,
@@ -1144,6 +1319,7 @@ static int CmdHF14aDesChk(const char *Cmd) {
         arg_int0(NULL, "kdf",        "<0|1|2>", "Key Derivation Function (KDF) (0=None, 1=AN10922, 2=Gallagher)"),
         arg_str0("i",  "kdfi",       "<hex>", "KDF input (1-31 hex bytes)"),
         arg_lit0("a",  "apdu",       "Show APDU requests and responses"),
+        arg_str0(NULL, "cp",         "<fn>", "Checkpoint file, resume from it when it exists"),
         arg_param_end
     };
     CLIExecWithReturn(ctx, Cmd, argtable, false);
@@ -1154,25 +1330,14 @@ static int CmdHF14aDesChk(const char *Cmd) {
     uint8_t aid[3] = {0};
     CLIGetHexWithReturn(ctx, 1, aid, &aidlength);
     swap24(aid);
-    uint8_t vkey[16] = {0};
+    uint8_t vkey[24] = {0};
     int vkeylen = 0;
     CLIGetHexWithReturn(ctx, 2, vkey, &vkeylen);
 
-    if (vkeylen > 0) {
-        if (vkeylen == 8) {
-            memcpy(&deskeyList[deskeyListLen], vkey, 8);
-            deskeyListLen++;
-        } else if (vkeylen == 16) {
-            memcpy(&aeskeyList[aeskeyListLen], vkey, 16);
-            aeskeyListLen++;
-        } else if (vkeylen == 24) {
-            memcpy(&k3kkeyList[k3kkeyListLen], vkey, 16);
-            k3kkeyListLen++;
-        } else {
-            PrintAndLogEx(ERR, "Specified key must have 8, 16 or 24 bytes length.");
-            CLIParserFree(ctx);
-            return PM3_EINVARG;
-        }
+    if (vkeylen > 0 && vkeylen != 8 && vkeylen != 16 && vkeylen != 24) {
+        PrintAndLogEx(ERR, "Specified key must have 8, 16 or 24 bytes length.");
+        CLIParserFree(ctx);
+        return PM3_EINVARG;
     }
 
     uint8_t dict_filename[FILE_PATH_SIZE + 2] = {0};
@@ -1232,48 +1397,68 @@ static int CmdHF14aDesChk(const char *Cmd) {
     int kdfInputLen = 0;
     CLIGetHexWithReturn(ctx, 10, kdfInput, &kdfInputLen);
 
-    CLIParserFree(ctx);
-    SetAPDULogging(APDULogging);
-
-    // 1-byte pattern search mode
-    if (pattern1b) {
-        for (uint32_t i = 0; i < 0x100; i++)
-            memset(aeskeyList[i], i, 16);
-        for (uint32_t i = 0; i < 0x100; i++)
-            memset(deskeyList[i], i, 8);
-        for (uint32_t i = 0; i < 0x100; i++)
-            memset(k3kkeyList[i], i, 24);
-        aeskeyListLen = 0x100;
-        deskeyListLen = 0x100;
-        k3kkeyListLen = 0x100;
+    char cpname[FILE_PATH_SIZE + 6] = {0};
+    int cpnamelen = 0;
+    if (CLIParamStrToBuf(arg_get_str(ctx, 12), (uint8_t *)cpname, FILE_PATH_SIZE, &cpnamelen)) {
+        PrintAndLogEx(ERR, "Invalid checkpoint file name.");
+        CLIParserFree(ctx);
+        return PM3_EINVARG;
     }
-
-    // 2-byte pattern search mode
-    if (pattern2b) {
-        DesFill2bPattern(deskeyList, &deskeyListLen, aeskeyList, &aeskeyListLen, k3kkeyList, &k3kkeyListLen, &startPattern);
+    // saved as json, keep the name the same for loading
+    if (cpnamelen && str_endswith(cpname, ".json") == false) {
+        strcat(cpname, ".json");
     }
 
-    // dictionary mode
-    size_t endFilePosition = 0;
-    if (dict_filenamelen) {
-
-        res = loadFileDICTIONARYEx((char *)dict_filename, deskeyList, sizeof(deskeyList), NULL, 8, &deskeyListLen, 0, &endFilePosition, true);
-        if (res == PM3_SUCCESS && endFilePosition)
-            PrintAndLogEx(SUCCESS, "First part of des dictionary successfully loaded.");
+    CLIParserFree(ctx);
+    SetAPDULogging(APDULogging);
 
-        endFilePosition = 0;
-        res = loadFileDICTIONARYEx((char *)dict_filename, aeskeyList, sizeof(aeskeyList), NULL, 16, &aeskeyListLen, 0, &endFilePosition, true);
-        if (res == PM3_SUCCESS && endFilePosition)
-            PrintAndLogEx(SUCCESS, "First part of aes dictionary successfully loaded.");
+    DesfireChkKeys_t keys = {0};
+    char source[FILE_PATH_SIZE + 64] = {0};
 
-        endFilePosition = 0;
-        res = loadFileDICTIONARYEx((char *)dict_filename, k3kkeyList, sizeof(k3kkeyList), NULL, 24, &k3kkeyListLen, 0, &endFilePosition, true);
-        if (res == PM3_SUCCESS && endFilePosition)
-            PrintAndLogEx(SUCCESS, "First part of k3kdes dictionary successfully loaded.");
+    if (pattern1b) {
+        keys.mode = DCKPattern1b;
+        snprintf(source, sizeof(source), "pattern1b");
+    } else if (pattern2b) {
+        keys.mode = DCKPattern2b;
+        keys.startPattern = startPattern;
+        snprintf(source, sizeof(source), "pattern2b %04X", startPattern);
+    } else {
+        keys.mode = DCKSource;
+        // dictionary mode
+        if (dict_filenamelen) {
+            for (int i = 0; i < 3; i++) {
+                res = loadFileDICTIONARY_safe((char *)dict_filename, (void **)&keys.list[i], (i == 0) ? 8 : ((i == 1) ? 16 : 24), &keys.listcnt[i]);
+                if (res != PM3_SUCCESS && res != PM3_EFILE) {
+                    keys.listcnt[i] = 0;
+                }
+            }
+            snprintf(source, sizeof(source), "dict %s", dict_filename);
+        }
 
-        endFilePosition = 0;
+        // single key goes first
+        if (vkeylen > 0) {
+            int i = (vkeylen == 8) ? 0 : ((vkeylen == 16) ? 1 : 2);
+            uint8_t *list = calloc(keys.listcnt[i] + 1, vkeylen);
+            if (list == NULL) {
+                PrintAndLogEx(WARNING, "Failed to allocate memory");
+                for (int j = 0; j < 3; j++)
+                    free(keys.list[j]);
+                return PM3_EMALLOC;
+            }
+            memcpy(list, vkey, vkeylen);
+            if (keys.listcnt[i])
+                memcpy(list + vkeylen, keys.list[i], keys.listcnt[i] * vkeylen);
+            free(keys.list[i]);
+            keys.list[i] = list;
+            keys.listcnt[i]++;
+            snprintf(source + strlen(source), sizeof(source) - strlen(source), "%skey %s", (dict_filenamelen) ? " + " : "", sprint_hex_inrow(vkey, vkeylen));
+        }
     }
 
+    uint32_t aeskeyListLen = DesfireChkKeyCount(&keys, T_AES);
+    uint32_t deskeyListLen = DesfireChkKeyCount(&keys, T_DES);
+    uint32_t k3kkeyListLen = DesfireChkKeyCount(&keys, T_3K3DES);
+
     if (aeskeyListLen == 0 && deskeyListLen == 0 && k3kkeyListLen == 0) {
         PrintAndLogEx(ERR, "No keys provided. Nothing to check.");
         return PM3_EINVARG;
@@ -1294,13 +1479,22 @@ static int CmdHF14aDesChk(const char *Cmd) {
     if (verbose == false)
         PrintAndLogEx(INFO, "Search keys:");
 
-    bool result = false;
+    DesfireChkState_t st = {
+        .keys = &keys,
+        .source = source,
+        .kdfAlgo = cmdKDFAlgo,
+        .kdfInputLen = kdfInputLen,
+        .kdfInput = kdfInput,
+        .checkpoint = (cpnamelen) ? cpname : NULL,
+        .lastSave = msclock(),
+    };
+
     uint8_t app_ids[78] = {0};
     size_t app_ids_len = 0;
 
     clearCommandBuffer();
 
-    DesfireContext_t dctx;
+    DesfireContext_t dctx = {0};
     DesfireSetKdf(&dctx, cmdKDFAlgo, kdfInput, kdfInputLen);
     DesfireSetCommandSet(&dctx, DCCNativeISO);
     DesfireSetCommMode(&dctx, DCMPlain);
@@ -1313,15 +1507,16 @@ static int CmdHF14aDesChk(const char *Cmd) {
     if (res != PM3_SUCCESS) {
         PrintAndLogEx(ERR, "Can't select PICC level.");
         DropField();
-        return PM3_ESOFT;
+        res = PM3_ESOFT;
+        goto out;
     }
 
-
     res = DesfireGetAIDList(&dctx, app_ids, &app_ids_len);
     if (res != PM3_SUCCESS) {
         PrintAndLogEx(ERR, "Can't get list of applications on tag");
         DropField();
-        return PM3_ESOFT;
+        res = PM3_ESOFT;
+        goto out;
     }
 
     if (aidlength != 0) {
@@ -1329,54 +1524,41 @@ static int CmdHF14aDesChk(const char *Cmd) {
         app_ids_len = 3;
     }
 
-    for (uint32_t x = 0; x < app_ids_len / 3; x++) {
+    if (st.checkpoint && fileExists(st.checkpoint)) {
+        res = DesfireChkLoad(&st, &dctx);
+        if (res != PM3_SUCCESS) {
+            PrintAndLogEx(HINT, "Hint: remove " _YELLOW_("%s") " or use another checkpoint file to start over", st.checkpoint);
+            DropField();
+            goto out;
+        }
+        PrintAndLogEx(INFO, "Resuming from " _YELLOW_("%s") ", aid %u / %zu", st.checkpoint, st.aidIndex + 1, app_ids_len / 3);
+    }
 
+    res = PM3_SUCCESS;
+    for (; st.aidIndex < app_ids_len / 3; st.aidIndex++, st.job = 0, st.keyIndex = 0) {
+
+        uint32_t x = st.aidIndex;
         uint32_t curaid = (app_ids[x * 3] & 0xFF) + ((app_ids[(x * 3) + 1] & 0xFF) << 8) + ((app_ids[(x * 3) + 2] & 0xFF) << 16);
         PrintAndLogEx(ERR, "Checking aid 0x%06X...", curaid);
 
-        res = AuthCheckDesfire(&dctx, secureChannel, &app_ids[x * 3], deskeyList, deskeyListLen, aeskeyList, aeskeyListLen, k3kkeyList, k3kkeyListLen, cmdKDFAlgo, kdfInputLen, kdfInput, foundKeys, &result, (verbose == false));
+        res = AuthCheckDesfire(&dctx, secureChannel, &app_ids[x * 3], &st, (verbose == false));
         if (res == PM3_EOPABORTED) {
+            PrintAndLogEx(WARNING, "\naborted via keyboard!");
+            if (st.checkpoint)
+                PrintAndLogEx(INFO, "Progress saved to " _YELLOW_("%s"), st.checkpoint);
             break;
         }
-
-        if (pattern2b && startPattern < 0x10000) {
-            if (verbose == false)
-                PrintAndLogEx(NORMAL, "p" NOLF);
-
-            aeskeyListLen = 0;
-            deskeyListLen = 0;
-            k3kkeyListLen = 0;
-            DesFill2bPattern(deskeyList, &deskeyListLen, aeskeyList, &aeskeyListLen, k3kkeyList, &k3kkeyListLen, &startPattern);
-            continue;
-        }
-
-        if (dict_filenamelen) {
-            if (verbose == false)
-                PrintAndLogEx(NORMAL, "d" NOLF);
-
-            uint32_t keycnt = 0;
-            res = loadFileDICTIONARYEx((char *)dict_filename, deskeyList, sizeof(deskeyList), NULL, 16, &keycnt, endFilePosition, &endFilePosition, false);
-            if (res == PM3_SUCCESS && endFilePosition)
-                deskeyListLen = keycnt;
-
-            keycnt = 0;
-            res = loadFileDICTIONARYEx((char *)dict_filename, aeskeyList, sizeof(aeskeyList), NULL, 16, &keycnt, endFilePosition, &endFilePosition, false);
-            if (res == PM3_SUCCESS && endFilePosition)
-                aeskeyListLen = keycnt;
-
-            keycnt = 0;
-            res = loadFileDICTIONARYEx((char *)dict_filename, k3kkeyList, sizeof(k3kkeyList), NULL, 16, &keycnt, endFilePosition, &endFilePosition, false);
-            if (res == PM3_SUCCESS && endFilePosition)
-                k3kkeyListLen = keycnt;
-
-            continue;
-        }
     }
     if (verbose == false)
         PrintAndLogEx(NORMAL, "");
 
+    // finished, a new run starts over
+    if (res != PM3_EOPABORTED && st.checkpoint && fileExists(st.checkpoint)) {
+        remove(st.checkpoint);
+    }
+
     // save keys to json
-    if ((jsonnamelen > 0) && result) {
+    if ((jsonnamelen > 0) && st.result) {
         DropField();
         // MIFARE DESFire info
         SendCommandMIX(CMD_HF_ISO14443A_READER, ISO14A_CONNECT, 0, 0, NULL, 0);
@@ -1402,12 +1584,16 @@ static int CmdHF14aDesChk(const char *Cmd) {
         }
 
         // length: UID(10b)+SAK(1b)+ATQA(2b)+ATSlen(1b)+ATS(atslen)+foundKeys[2][64][AES_KEY_LEN + 1]
-        memcpy(&data[14 + atslen], foundKeys, 4 * 0xE * (24 + 1));
+        memcpy(&data[14 + atslen], st.foundKeys, 4 * 0xE * (24 + 1));
         saveFileJSON((char *)jsonname, jsfMfDesfireKeys, data, 0xE, NULL);
     }
 
     DropField();
-    return PM3_SUCCESS;
+    res = (res == PM3_EOPABORTED) ? res : PM3_SUCCESS;
+out:
+    for (int i = 0; i < 3; i++)
+        free(keys.list[i]);
+    return res;
 }
 
 static int CmdHF14ADesList(const char *Cmd) {
@@ -5669,15 +5855,21 @@ static int CmdHF14ADesTest(const char *Cmd) {
     CLIParserContext *ctx;
     CLIParserInit(&ctx, "hf mfdes test",
                   "Regression crypto tests",
-                  "hf mfdes test");
+                  "hf mfdes test\n"
+                  "hf mfdes test --bench     -> also measure secure channel crypto throughput");
 
     void *argtable[] = {
         arg_param_begin,
+        arg_lit0(NULL, "bench", "run crypto micro benchmark"),
         arg_param_end
     };
     CLIExecWithReturn(ctx, Cmd, argtable, true);
+    bool bench = arg_get_lit(ctx, 1);
     CLIParserFree(ctx);
     DesfireTest(true);
+    if (bench) {
+        DesfireBenchmark();
+    }
     return PM3_SUCCESS;
 }
 
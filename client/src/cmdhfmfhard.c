@@ -31,6 +31,12 @@
 #include <math.h>
 #include <time.h> // MingW
 #include <bzlib.h>
+#include <sys/stat.h>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
 
 #include "commonutil.h"  // ARRAYLEN
 #include "comms.h"
@@ -62,11 +68,6 @@ static uint16_t sums[NUM_SUMS] = {0, 32, 56, 64, 80, 96, 104, 112, 120, 128, 136
 // number of possible partial sum property values
 #define NUM_PART_SUMS                  9
 
-typedef enum {
-    EVEN_STATE = 0,
-    ODD_STATE = 1
-} odd_even_t;
-
 static uint32_t num_acquired_nonces = 0;
 static uint64_t start_time = 0;
 static uint16_t effective_bitflip[2][0x400];
@@ -247,54 +248,64 @@ static void init_bunzip2(bz_stream *compressed_stream, char *input_buffer, uint3
 
 }
 
-static void init_bitflip_bitarrays(void) {
+static int get_bitflip_state_file(odd_even_t odd_even, uint16_t bitflip, char **path) {
+    char state_files_path[strlen(STATE_FILES_DIRECTORY) + strlen(STATE_FILE_TEMPLATE) + 1];
+    char state_file_name[strlen(STATE_FILE_TEMPLATE) + 1];
+
+    snprintf(state_file_name, sizeof(state_file_name), STATE_FILE_TEMPLATE, odd_even, bitflip);
+    strncpy(state_files_path, STATE_FILES_DIRECTORY, sizeof(state_files_path) - 1);
+    strncat(state_files_path, state_file_name, sizeof(state_files_path) - (strlen(STATE_FILES_DIRECTORY) + 1));
+
+    return searchFile(path, RESOURCES_SUBDIR, state_files_path, "", true);
+}
+
+static void load_bitflip_bitarrays_bz2(void) {
 #if defined (DEBUG_REDUCTION)
     uint8_t line = 0;
 #endif
 
     bz_stream compressed_stream;
 
-    char state_files_path[strlen(get_my_executable_directory()) + strlen(STATE_FILES_DIRECTORY) + strlen(STATE_FILE_TEMPLATE) + 1];
-    char state_file_name[strlen(STATE_FILE_TEMPLATE) + 1];
-
     for (odd_even_t odd_even = EVEN_STATE; odd_even <= ODD_STATE; odd_even++) {
         num_effective_bitflips[odd_even] = 0;
         for (uint16_t bitflip = 0x001; bitflip < 0x400; bitflip++) {
             bitflip_bitarrays[odd_even][bitflip] = NULL;
             count_bitflip_bitarrays[odd_even][bitflip] = 1 << 24;
 
-            snprintf(state_file_name, sizeof(state_file_name), STATE_FILE_TEMPLATE, odd_even, bitflip);
-            strncpy(state_files_path, STATE_FILES_DIRECTORY, sizeof(state_files_path) - 1);
-            strncat(state_files_path, state_file_name, sizeof(state_files_path) - (strlen(STATE_FILES_DIRECTORY) + 1));
-
             char *path;
-            if (searchFile(&path, RESOURCES_SUBDIR, state_files_path, "", true) != PM3_SUCCESS) {
+            if (get_bitflip_state_file(odd_even, bitflip, &path) != PM3_SUCCESS) {
                 continue;
             }
 
             FILE *statesfile = fopen(path, "rb");
-            free(path);
             if (statesfile == NULL) {
+                free(path);
                 continue;
             } else {
                 fseek(statesfile, 0, SEEK_END);
                 int fsize = ftell(statesfile);
                 if (fsize == -1) {
-                    PrintAndLogEx(ERR, "File read error with %s. Aborting...\n", state_file_name);
+                    PrintAndLogEx(ERR, "File read error with %s. Aborting...\n", path);
                     fclose(statesfile);
                     exit(5);
                 }
                 uint32_t filesize = (uint32_t)fsize;
                 rewind(statesfile);
-                char input_buffer[filesize];
+                char *input_buffer = calloc(filesize, sizeof(uint8_t));
+                if (input_buffer == NULL) {
+                    PrintAndLogEx(ERR, "Out of memory error in init_bitflip_statelists(). Aborting...\n");
+                    fclose(statesfile);
+                    exit(4);
+                }
                 size_t bytesread = fread(input_buffer, 1, filesize, statesfile);
                 if (bytesread != filesize) {
-                    PrintAndLogEx(ERR, "File read error with %s. Aborting...\n", state_file_name);
+                    PrintAndLogEx(ERR, "File read error with %s. Aborting...\n", path);
                     fclose(statesfile);
                     //BZ2_bzDecompressEnd(&compressed_stream);
                     exit(5);
                 }
                 fclose(statesfile);
+                free(path);
                 uint32_t count = 0;
                 init_bunzip2(&compressed_stream, input_buffer, filesize, (char *)&count, sizeof(count));
                 int res = BZ2_bzDecompress(&compressed_stream);
@@ -331,10 +342,237 @@ static void init_bitflip_bitarrays(void) {
 #endif
                 }
                 BZ2_bzDecompressEnd(&compressed_stream);
+                free(input_buffer);
             }
         }
         effective_bitflip[odd_even][num_effective_bitflips[odd_even]] = 0x400; // EndOfList marker
     }
+}
+
+//----------------------------------------------------------------------------
+// Bitflip table cache.
+// Bunzipping the ~350 state files takes several seconds and every run keeps its own
+// private copy of the effective tables.  After the first run the effective tables are
+// written uncompressed into one file in the user directory, which later runs mmap
+// read-only.  Concurrent hardnested runs then share the same pages.
+//
+// layout:  header | entries[num_entries] | padding | bitarray 0 | bitarray 1 | ...
+// every bitarray starts on a BITFLIP_CACHE_ALIGN boundary.
+//----------------------------------------------------------------------------
+#define BITFLIP_CACHE_FILE      "hardnested_bitflips.bin"
+#define BITFLIP_CACHE_MAGIC     "PM3HNBF"
+#define BITFLIP_CACHE_VERSION   1
+#define BITFLIP_CACHE_ALIGN     4096
+#define BITFLIP_BITARRAY_SIZE   (sizeof(uint32_t) * (1 << 19))
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_entries;
+    uint64_t fingerprint;       // hash over size and mtime of the source .bz2 files
+    uint32_t threshold;         // IGNORE_BITFLIP_THRESHOLD * 1000 used when building
+    uint32_t rfu;
+} PACKED bitflip_cache_header_t;
+
+typedef struct {
+    uint16_t bitflip;
+    uint8_t odd_even;
+    uint8_t rfu;
+    uint32_t count;
+    uint64_t offset;            // from start of file
+} PACKED bitflip_cache_entry_t;
+
+#if !defined(_WIN32)
+static void *bitflip_cache_map = NULL;
+static size_t bitflip_cache_map_len = 0;
+#endif
+
+// A cache is stale when the set of .bz2 files, their sizes or their mtimes changed.
+static uint64_t bitflip_state_files_fingerprint(void) {
+    uint64_t hash = 0xcbf29ce484222325ULL; // FNV-1a
+    for (odd_even_t odd_even = EVEN_STATE; odd_even <= ODD_STATE; odd_even++) {
+        for (uint16_t bitflip = 0x001; bitflip < 0x400; bitflip++) {
+            char *path;
+            if (get_bitflip_state_file(odd_even, bitflip, &path) != PM3_SUCCESS) {
+                continue;
+            }
+            struct stat st;
+            if (stat(path, &st) == 0) {
+                uint64_t v[3] = { ((uint64_t)odd_even << 16) | bitflip, (uint64_t)st.st_size, (uint64_t)st.st_mtime };
+                const uint8_t *p = (const uint8_t *)v;
+                for (size_t i = 0; i < sizeof(v); i++) {
+                    hash ^= p[i];
+                    hash *= 0x100000001b3ULL;
+                }
+            }
+            free(path);
+        }
+    }
+    return hash;
+}
+
+static bool load_bitflip_cache(uint64_t fingerprint) {
+#if defined(_WIN32)
+    (void) fingerprint;
+    return false;
+#else
+    char *path = NULL;
+    if (searchHomeFilePath(&path, CACHE_SUBDIR, BITFLIP_CACHE_FILE, false) != PM3_SUCCESS) {
+        return false;
+    }
+
+    int fd = open(path, O_RDONLY);
+    free(path);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(bitflip_cache_header_t)) {
+        close(fd);
+        return false;
+    }
+
+    size_t len = (size_t)st.st_size;
+    void *map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    const bitflip_cache_header_t *hdr = (const bitflip_cache_header_t *)map;
+    const bitflip_cache_entry_t *entries = (const bitflip_cache_entry_t *)(hdr + 1);
+
+    if (memcmp(hdr->magic, BITFLIP_CACHE_MAGIC, sizeof(BITFLIP_CACHE_MAGIC)) != 0
+            || hdr->version != BITFLIP_CACHE_VERSION
+            || hdr->fingerprint != fingerprint
+            || hdr->threshold != (uint32_t)(IGNORE_BITFLIP_THRESHOLD * 1000)
+            || hdr->num_entries > 2 * 0x400
+            || sizeof(bitflip_cache_header_t) + hdr->num_entries * sizeof(bitflip_cache_entry_t) > len) {
+        munmap(map, len);
+        return false;
+    }
+
+    // every bitflip at most once per odd/even list, so the lists and their EndOfList
+    // markers fit into effective_bitflip[][0x400]. Anything else is rebuilt from the .bz2 files
+    uint8_t seen[2][0x400] = {{0}};
+    for (uint32_t i = 0; i < hdr->num_entries; i++) {
+        if (entries[i].bitflip == 0 || entries[i].bitflip >= 0x400 || entries[i].odd_even > ODD_STATE
+                || seen[entries[i].odd_even][entries[i].bitflip]
+                || (entries[i].offset % BITFLIP_CACHE_ALIGN) || entries[i].offset + BITFLIP_BITARRAY_SIZE > len) {
+            PrintAndLogEx(DEBUG, "bitflip cache corrupt, rebuilding it");
+            munmap(map, len);
+            return false;
+        }
+        seen[entries[i].odd_even][entries[i].bitflip] = 1;
+    }
+
+    for (odd_even_t odd_even = EVEN_STATE; odd_even <= ODD_STATE; odd_even++) {
+        num_effective_bitflips[odd_even] = 0;
+        for (uint16_t bitflip = 0x001; bitflip < 0x400; bitflip++) {
+            bitflip_bitarrays[odd_even][bitflip] = NULL;
+            count_bitflip_bitarrays[odd_even][bitflip] = 1 << 24;
+        }
+    }
+
+    // entries are stored in the same order the .bz2 loader discovers them
+    for (uint32_t i = 0; i < hdr->num_entries; i++) {
+        odd_even_t odd_even = entries[i].odd_even;
+        uint16_t bitflip = entries[i].bitflip;
+        effective_bitflip[odd_even][num_effective_bitflips[odd_even]++] = bitflip;
+        bitflip_bitarrays[odd_even][bitflip] = (uint32_t *)((uint8_t *)map + entries[i].offset);
+        count_bitflip_bitarrays[odd_even][bitflip] = entries[i].count;
+    }
+    effective_bitflip[EVEN_STATE][num_effective_bitflips[EVEN_STATE]] = 0x400; // EndOfList marker
+    effective_bitflip[ODD_STATE][num_effective_bitflips[ODD_STATE]] = 0x400;
+
+    bitflip_cache_map = map;
+    bitflip_cache_map_len = len;
+    return true;
+#endif
+}
+
+static void save_bitflip_cache(uint64_t fingerprint) {
+#if defined(_WIN32)
+    (void) fingerprint;
+#else
+    char *path = NULL;
+    if (searchHomeFilePath(&path, CACHE_SUBDIR, BITFLIP_CACHE_FILE, true) != PM3_SUCCESS) {
+        return;
+    }
+
+    // write to a private temp file and rename it into place,
+    // so concurrent runs never map a half written cache
+    size_t tmplen = strlen(path) + 16;
+    char *tmppath = calloc(tmplen, sizeof(char));
+    if (tmppath == NULL) {
+        free(path);
+        return;
+    }
+    snprintf(tmppath, tmplen, "%s.%u", path, (uint32_t)getpid());
+
+    FILE *f = fopen(tmppath, "wb");
+    if (f == NULL) {
+        PrintAndLogEx(DEBUG, "could not create bitflip cache %s", tmppath);
+        free(tmppath);
+        free(path);
+        return;
+    }
+
+    bitflip_cache_header_t hdr = {0};
+    memcpy(hdr.magic, BITFLIP_CACHE_MAGIC, sizeof(BITFLIP_CACHE_MAGIC));
+    hdr.version = BITFLIP_CACHE_VERSION;
+    hdr.num_entries = num_effective_bitflips[EVEN_STATE] + num_effective_bitflips[ODD_STATE];
+    hdr.fingerprint = fingerprint;
+    hdr.threshold = (uint32_t)(IGNORE_BITFLIP_THRESHOLD * 1000);
+
+    uint64_t offset = sizeof(hdr) + hdr.num_entries * sizeof(bitflip_cache_entry_t);
+    offset = (offset + BITFLIP_CACHE_ALIGN - 1) & ~((uint64_t)BITFLIP_CACHE_ALIGN - 1);
+    uint64_t data_start = offset;
+
+    bool ok = (fwrite(&hdr, sizeof(hdr), 1, f) == 1);
+    for (odd_even_t odd_even = EVEN_STATE; ok && odd_even <= ODD_STATE; odd_even++) {
+        for (uint16_t i = 0; ok && i < num_effective_bitflips[odd_even]; i++) {
+            uint16_t bitflip = effective_bitflip[odd_even][i];
+            bitflip_cache_entry_t e = {
+                .bitflip = bitflip,
+                .odd_even = odd_even,
+                .count = count_bitflip_bitarrays[odd_even][bitflip],
+                .offset = offset,
+            };
+            ok = (fwrite(&e, sizeof(e), 1, f) == 1);
+            offset += BITFLIP_BITARRAY_SIZE;
+        }
+    }
+
+    ok = ok && (fseek(f, (long)data_start, SEEK_SET) == 0);
+    for (odd_even_t odd_even = EVEN_STATE; ok && odd_even <= ODD_STATE; odd_even++) {
+        for (uint16_t i = 0; ok && i < num_effective_bitflips[odd_even]; i++) {
+            uint16_t bitflip = effective_bitflip[odd_even][i];
+            ok = (fwrite(bitflip_bitarrays[odd_even][bitflip], BITFLIP_BITARRAY_SIZE, 1, f) == 1);
+        }
+    }
+
+    ok = (fclose(f) == 0) && ok;
+    if (ok && rename(tmppath, path) == 0) {
+        PrintAndLogEx(DEBUG, "saved bitflip cache to " _YELLOW_("%s"), path);
+    } else {
+        PrintAndLogEx(DEBUG, "could not write bitflip cache %s", path);
+        remove(tmppath);
+    }
+    free(tmppath);
+    free(path);
+#endif
+}
+
+static void init_bitflip_bitarrays(void) {
+
+    uint64_t fingerprint = bitflip_state_files_fingerprint();
+    if (load_bitflip_cache(fingerprint) == false) {
+        // cache missing or stale,  build it from the .bz2 files
+        load_bitflip_bitarrays_bz2();
+        save_bitflip_cache(fingerprint);
+    }
 
     uint16_t i = 0;
     uint16_t j = 0;
@@ -376,6 +614,15 @@ static void init_bitflip_bitarrays(void) {
 }
 
 static void free_bitflip_bitarrays(void) {
+#if !defined(_WIN32)
+    if (bitflip_cache_map != NULL) {
+        munmap(bitflip_cache_map, bitflip_cache_map_len);
+        bitflip_cache_map = NULL;
+        bitflip_cache_map_len = 0;
+        memset(bitflip_bitarrays, 0, sizeof(bitflip_bitarrays));
+        return;
+    }
+#endif
     for (int16_t bitflip = 0x3ff; bitflip > 0x000; bitflip--) {
         free_bitarray(bitflip_bitarrays[ODD_STATE][bitflip]);
     }
@@ -519,6 +766,8 @@ static uint8_t best_first_byte_smallest_bitarray = 0;
 static uint16_t first_byte_Sum = 0;
 static uint16_t first_byte_num = 0;
 static bool write_stats = false;
+static uint32_t num_bf_shards = 0;     // export the candidates to shard files instead of brute forcing
+static bool bf_shards_failed = false;
 static FILE *fstats = NULL;
 static uint32_t *all_bitflips_bitarray[2];
 static uint32_t num_all_bitflips_bitarray[2];
@@ -2103,7 +2352,16 @@ static bool brute_force(uint64_t *found_key) {
     if (known_target_key != -1) {
         TestIfKeyExists(known_target_key);
     }
-    return brute_force_bs(NULL, candidates, cuid, num_acquired_nonces, maximum_states, nonces, best_first_bytes, found_key);
+    if (num_bf_shards) {
+        // the workers search the candidates, carry on with the next guess
+        if (write_bf_shards(candidates, cuid, nonces, best_first_bytes, num_bf_shards) == false) {
+            PrintAndLogEx(ERR, "Failed to write the shard files. Aborting...");
+            bf_shards_failed = true;
+        }
+        return false;
+    }
+    // no checkpoints for the simulated test runs
+    return brute_force_bs(NULL, candidates, cuid, num_acquired_nonces, maximum_states, nonces, best_first_bytes, found_key, write_stats == false);
 }
 
 static uint16_t SumProperty(struct Crypto1State *s) {
@@ -2209,7 +2467,7 @@ static void init_it_all(void) {
     memset(sum_a0_bitarrays, 0, sizeof(sum_a0_bitarrays));
 }
 
-int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBlockNo, uint8_t trgKeyType, uint8_t *trgkey, bool nonce_file_read, bool nonce_file_write, bool slow, int tests, uint64_t *foundkey, char *filename) {
+int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBlockNo, uint8_t trgKeyType, uint8_t *trgkey, bool nonce_file_read, bool nonce_file_write, bool slow, int tests, uint32_t shards, uint64_t *foundkey, char *filename) {
     char progress_text[80];
     char instr_set[12] = {0};
 
@@ -2222,6 +2480,8 @@ int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBloc
     srand((unsigned) time(NULL));
     brute_force_per_second = brute_force_benchmark();
     write_stats = false;
+    num_bf_shards = shards;
+    bf_shards_failed = false;
 
     if (tests) {
         // set the correct locale for the stats printing
@@ -2300,7 +2560,7 @@ int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBloc
             } else {
                 pre_XOR_nonces();
                 prepare_bf_test_nonces(nonces, best_first_bytes[0]);
-                for (uint8_t j = 0; j < NUM_SUMS && !key_found; j++) {
+                for (uint8_t j = 0; j < NUM_SUMS && !key_found && !bf_shards_failed; j++) {
                     float expected_brute_force = nonces[best_first_bytes[0]].expected_num_brute_force;
                     snprintf(progress_text, sizeof(progress_text), "(%d. guess: Sum(a8) = %" PRIu16 ")", j + 1, sums[nonces[best_first_bytes[0]].sum_a8_guess[j].sum_a8_idx]);
                     hardnested_print_progress(num_acquired_nonces, progress_text, expected_brute_force, 0);
@@ -2430,7 +2690,7 @@ int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBloc
             pre_XOR_nonces();
             prepare_bf_test_nonces(nonces, best_first_bytes[0]);
 
-            for (uint8_t j = 0; j < NUM_SUMS && !key_found; j++) {
+            for (uint8_t j = 0; j < NUM_SUMS && !key_found && !bf_shards_failed; j++) {
                 float expected_brute_force = nonces[best_first_bytes[0]].expected_num_brute_force;
                 snprintf(progress_text, sizeof(progress_text), "(%d. guess: Sum(a8) = %" PRIu16 ")", j + 1, sums[nonces[best_first_bytes[0]].sum_a8_guess[j].sum_a8_idx]);
                 hardnested_print_progress(num_acquired_nonces, progress_text, expected_brute_force, 0);
@@ -2455,11 +2715,17 @@ int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBloc
             }
         }
 
+        remove_bf_checkpoints();
+        if (num_bf_shards) {
+            res = close_bf_shards();
+            num_bf_shards = 0;
+        }
         free_nonces_memory();
         free_bitarray(all_bitflips_bitarray[ODD_STATE]);
         free_bitarray(all_bitflips_bitarray[EVEN_STATE]);
         free_sum_bitarrays();
         free_part_sum_bitarrays();
+        return res;
     }
     return PM3_SUCCESS;
 }
@@ -823,6 +823,8 @@ static int CmdStatus(const char *Cmd) {
         PrintAndLogEx(WARNING, "Status command timeout. Communication speed test timed out");
         return PM3_ETIMEOUT;
     }
+    PrintAndLogEx(NORMAL, "");
+    PrintCommsStats();
     return PM3_SUCCESS;
 }
 
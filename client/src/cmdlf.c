@@ -21,6 +21,7 @@
 #include <string.h>
 #include <limits.h>
 #include <ctype.h>
+#include <pthread.h>
 #include "cmdparser.h"      // command_t
 #include "comms.h"
 #include "commonutil.h"     // ARRAYLEN
@@ -63,6 +64,7 @@
 #include "cmdlfviking.h"    // for viking menu
 #include "cmdlfvisa2000.h"  // for VISA2000 menu
 #include "cmdlfzx8211.h"    // for ZX8211 menu
+#include "cmdlfbatch.h"     // for batch decoding
 #include "crc.h"
 #include "pm3_cmd.h"        // for LF_CMDREAD_MAX_EXTRA_SYMBOLS
 
@@ -1428,6 +1430,180 @@ out:
     return retval;
 }
 
+//-----------------------------------------------------------------------------
+// lf search engine
+// The known tag demodulators are tried one after another in their usual order,  they all share
+// g_DemodBuffer / g_GraphBuffer and print while decoding.  The autocorrelation used by the
+// unknown tag search only reads a copy of the samples,  it runs in the background meanwhile.
+// When continuing after a hit,  all matches are listed at the end.
+//-----------------------------------------------------------------------------
+typedef enum {
+    LF_MOD_ASK,
+    LF_MOD_FSK,
+    LF_MOD_PSK,
+    LF_MOD_NRZ,
+} lf_modulation_t;
+
+static const char *lf_modulation_str[] = { "ASK", "FSK", "PSK", "NRZ" };
+
+typedef struct {
+    const char *name;
+    int (*demod)(bool verbose);
+    lf_modulation_t modulation;
+} lf_search_demod_t;
+
+// in the order they are tried
+static const lf_search_demod_t lf_search_demods[] = {
+    // ask / man
+    {"EM410x ID",               demodEM410x,    LF_MOD_ASK},
+    {"FDX-A FECAVA Destron ID", demodDestron,   LF_MOD_FSK},    // to do before HID
+    {"GALLAGHER ID",            demodGallagher, LF_MOD_ASK},
+    {"Noralsy ID",              demodNoralsy,   LF_MOD_ASK},
+    {"Presco ID",               demodPresco,    LF_MOD_ASK},
+    {"Securakey ID",            demodSecurakey, LF_MOD_ASK},
+    {"Viking ID",               demodViking,    LF_MOD_ASK},
+    {"Visa2000 ID",             demodVisa2k,    LF_MOD_ASK},
+    // ask / bi
+    {"FDX-B ID",                demodFDXB,      LF_MOD_ASK},
+    {"Jablotron ID",            demodJablotron, LF_MOD_ASK},
+    {"Guardall G-Prox II ID",   demodGuard,     LF_MOD_ASK},
+    {"NEDAP ID",                demodNedap,     LF_MOD_ASK},
+    // nrz
+    {"PAC/Stanley ID",          demodPac,       LF_MOD_NRZ},
+    // fsk
+    {"HID Prox ID",             demodHID,       LF_MOD_FSK},
+    {"AWID ID",                 demodAWID,      LF_MOD_FSK},
+    {"IO Prox ID",              demodIOProx,    LF_MOD_FSK},
+    {"Pyramid ID",              demodPyramid,   LF_MOD_FSK},
+    {"Paradox ID",              demodParadox,   LF_MOD_FSK},
+    // psk
+    {"Idteck ID",               demodIdteck,    LF_MOD_PSK},
+    {"KERI ID",                 demodKeri,      LF_MOD_PSK},
+    {"NexWatch ID",             demodNexWatch,  LF_MOD_PSK},
+    {"Indala ID",               demodIndala,    LF_MOD_PSK},
+};
+
+#define LF_SEARCH_DEMODS    ARRAYLEN(lf_search_demods)
+
+// autocorrelation of the GraphBuffer,  running in the background
+typedef struct {
+    bool started;
+    pthread_t thread;
+    int *samples;
+    size_t len;
+    bool cancel;
+    autocorr_t ac;
+    int res;
+} lf_autocorr_job_t;
+
+static void *lf_autocorr_thread(void *arg) {
+    lf_autocorr_job_t *job = arg;
+    job->res = AutoCorrelateCompute(job->samples, job->len, 8000, &job->cancel, &job->ac);
+    return NULL;
+}
+
+static void lf_autocorr_start(lf_autocorr_job_t *job) {
+    memset(job, 0, sizeof(lf_autocorr_job_t));
+    if (g_GraphTraceLen == 0) {
+        return;
+    }
+    job->len = g_GraphTraceLen;
+    job->samples = calloc(job->len, sizeof(int));
+    if (job->samples == NULL) {
+        return;
+    }
+    memcpy(job->samples, g_GraphBuffer, job->len * sizeof(int));
+    job->started = (pthread_create(&job->thread, NULL, lf_autocorr_thread, job) == 0);
+}
+
+// wait for the background autocorrelation.  Returns false if it couldn't be computed
+static bool lf_autocorr_wait(lf_autocorr_job_t *job) {
+    if (job->started == false) {
+        return false;
+    }
+    pthread_join(job->thread, NULL);
+    job->started = false;
+    return (job->res == PM3_SUCCESS);
+}
+
+static void lf_autocorr_free(lf_autocorr_job_t *job) {
+    if (job->started) {
+        // no longer needed
+        __atomic_store_n(&job->cancel, true, __ATOMIC_RELAXED);
+        pthread_join(job->thread, NULL);
+        job->started = false;
+    }
+    free(job->ac.correl_buf);
+    job->ac.correl_buf = NULL;
+    free(job->samples);
+    job->samples = NULL;
+}
+
+// try the known tag demodulators.
+// The indices of the matching ones are stored in matches[] in the order found, returns number of matches.
+static uint8_t lf_search_known(bool search_cont, uint8_t *matches) {
+    uint8_t found = 0;
+    for (uint8_t i = 0; i < LF_SEARCH_DEMODS; i++) {
+        const lf_search_demod_t *d = &lf_search_demods[i];
+        if (d->demod(true) == PM3_SUCCESS) {
+            PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("%s") " found!", d->name);
+            matches[found++] = i;
+            if (search_cont == false) {
+                break;
+            }
+        }
+    }
+    return found;
+}
+
+static void lf_search_print_matches(const uint8_t *matches, uint8_t found) {
+    PrintAndLogEx(NORMAL, "");
+    PrintAndLogEx(INFO, "--- " _CYAN_("Matches") " ---------------------------------------");
+    for (uint8_t i = 0; i < found; i++) {
+        const lf_search_demod_t *d = &lf_search_demods[matches[i]];
+        PrintAndLogEx(SUCCESS, " %2u. %-24s %s", i + 1, d->name, lf_modulation_str[d->modulation]);
+    }
+}
+
+// Known tag search on the GraphBuffer without reading a tag,  for batch decoding.
+// Stops at the first match.  The tag found,  the ID its demodulator reported and its bits
+// end up in ctx,  to be freed with DemodCtxFree.  The demodulators still print as usual.
+int lf_search_graph(demod_ctx_t *ctx) {
+    memset(ctx, 0, sizeof(demod_ctx_t));
+
+    if (g_GraphTraceLen < 2000) {
+        return PM3_ESOFT;
+    }
+
+    DemodCtxCollect(ctx);
+    for (uint8_t i = 0; i < LF_SEARCH_DEMODS; i++) {
+        const lf_search_demod_t *d = &lf_search_demods[i];
+        if (d->demod(true) == PM3_SUCCESS) {
+            ctx->tag = d->name;
+            ctx->modulation = lf_modulation_str[d->modulation];
+            break;
+        }
+        // reported before a later check failed
+        ctx->id[0] = '\0';
+    }
+    DemodCtxCollect(NULL);
+
+    if (ctx->tag == NULL) {
+        return PM3_SUCCESS;
+    }
+
+    ctx->bits = calloc(MAX_DEMOD_BUF_LEN, sizeof(uint8_t));
+    if (ctx->bits == NULL) {
+        return PM3_EMALLOC;
+    }
+    ctx->owned = true;
+    memcpy(ctx->bits, g_DemodBuffer, g_DemodBufferLen);
+    ctx->len = g_DemodBufferLen;
+    ctx->clock = g_DemodClock;
+    ctx->start_idx = g_DemodStartIdx;
+    return PM3_SUCCESS;
+}
+
 int CmdLFfind(const char *Cmd) {
 
     CLIParserContext *ctx;
@@ -1537,191 +1713,24 @@ int CmdLFfind(const char *Cmd) {
 
     int retval = PM3_SUCCESS;
 
-    // ask / man
-    if (demodEM410x(true) == PM3_SUCCESS) {
-        PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("EM410x ID") " found!");
-        if (search_cont) {
-            found++;
-        } else {
-            goto out;
-        }
-    }
-    if (demodDestron(true) == PM3_SUCCESS) { // to do before HID
-        PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("FDX-A FECAVA Destron ID") " found!");
-        if (search_cont) {
-            found++;
-        } else {
-            goto out;
-        }
-    }
-    if (demodGallagher(true) == PM3_SUCCESS) {
-        PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("GALLAGHER ID") " found!");
-        if (search_cont) {
-            found++;
-        } else {
-            goto out;
-        }
-    }
-    if (demodNoralsy(true) == PM3_SUCCESS) {
-        PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("Noralsy ID") " found!");
-        if (search_cont) {
-            found++;
-        } else {
-            goto out;
-        }
-    }
-    if (demodPresco(true) == PM3_SUCCESS) {
-        PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("Presco ID") " found!");
-        if (search_cont) {
-            found++;
-        } else {
-            goto out;
-        }
-    }
-    if (demodSecurakey(true) == PM3_SUCCESS) {
-        PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("Securakey ID") " found!");
-        if (search_cont) {
-            found++;
-        } else {
-            goto out;
-        }
-    }
-    if (demodViking(true) == PM3_SUCCESS) {
-        PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("Viking ID") " found!");
-        if (search_cont) {
-            found++;
-        } else {
-            goto out;
-        }
-    }
-    if (demodVisa2k(true) == PM3_SUCCESS) {
-        PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("Visa2000 ID") " found!");
-        if (search_cont) {
-            found++;
-        } else {
-            goto out;
-        }
-    }
-
-    // ask / bi
-    if (demodFDXB(true) == PM3_SUCCESS) {
-        PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("FDX-B ID") " found!");
-        if (search_cont) {
-            found++;
-        } else {
-            goto out;
-        }
-    }
-    if (demodJablotron(true) == PM3_SUCCESS) {
-        PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("Jablotron ID") " found!");
-        if (search_cont) {
-            found++;
-        } else {
-            goto out;
-        }
-    }
-    if (demodGuard(true) == PM3_SUCCESS) {
-        PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("Guardall G-Prox II ID") " found!");
-        if (search_cont) {
-            found++;
-        } else {
-            goto out;
-        }
-    }
-    if (demodNedap(true) == PM3_SUCCESS) {
-        PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("NEDAP ID") " found!");
-        if (search_cont) {
-            found++;
-        } else {
-            goto out;
-        }
+    lf_autocorr_job_t autocorr;
+    if (search_unk) {
+        lf_autocorr_start(&autocorr);
+    } else {
+        memset(&autocorr, 0, sizeof(autocorr));
     }
 
-    // nrz
-    if (demodPac(true) == PM3_SUCCESS) {
-        PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("PAC/Stanley ID") " found!");
-        if (search_cont) {
-            found++;
-        } else {
-            goto out;
-        }
+    uint8_t matches[LF_SEARCH_DEMODS];
+    uint8_t known = lf_search_known(search_cont, matches);
+    found += known;
+    if (known && search_cont == false) {
+        goto out;
     }
 
-    // fsk
-    if (demodHID(true) == PM3_SUCCESS) {
-        PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("HID Prox ID") " found!");
-        if (search_cont) {
-            found++;
-        } else {
-            goto out;
-        }
-    }
-    if (demodAWID(true) == PM3_SUCCESS) {
-        PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("AWID ID") " found!");
-        if (search_cont) {
-            found++;
-        } else {
-            goto out;
-        }
-    }
-    if (demodIOProx(true) == PM3_SUCCESS) {
-        PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("IO Prox ID") " found!");
-        if (search_cont) {
-            found++;
-        } else {
-            goto out;
-        }
-    }
-    if (demodPyramid(true) == PM3_SUCCESS) {
-        PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("Pyramid ID") " found!");
-        if (search_cont) {
-            found++;
-        } else {
-            goto out;
-        }
-    }
-    if (demodParadox(true) == PM3_SUCCESS) {
-        PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("Paradox ID") " found!");
-        if (search_cont) {
-            found++;
-        } else {
-            goto out;
-        }
+    if (known > 1) {
+        lf_search_print_matches(matches, known);
     }
 
-    // psk
-    if (demodIdteck(true) == PM3_SUCCESS) {
-        PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("Idteck ID") " found!");
-        if (search_cont) {
-            found++;
-        } else {
-            goto out;
-        }
-    }
-    if (demodKeri(true) == PM3_SUCCESS) {
-        PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("KERI ID") " found!");
-        if (search_cont) {
-            found++;
-        } else {
-            goto out;
-        }
-    }
-    if (demodNexWatch(true) == PM3_SUCCESS) {
-        PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("NexWatch ID") " found!");
-        if (search_cont) {
-            found++;
-        } else {
-            goto out;
-        }
-    }
-    if (demodIndala(true) == PM3_SUCCESS) {
-        PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("Indala ID") " found!");
-        if (search_cont) {
-            found++;
-        } else {
-            goto out;
-        }
-    }
     /*
     if (demodTI() == PM3_SUCCESS) {
         PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("Texas Instrument ID") " found!");
@@ -1747,7 +1756,12 @@ int CmdLFfind(const char *Cmd) {
     if (search_unk) {
         //test unknown tag formats (raw mode)
         PrintAndLogEx(INFO, "\nChecking for unknown tags:\n");
-        int ans = AutoCorrelate(g_GraphBuffer, g_GraphBuffer, g_GraphTraceLen, 8000, false, false);
+        int ans = 0;
+        if (lf_autocorr_wait(&autocorr)) {
+            ans = AutoCorrelateApply(&autocorr.ac, g_GraphBuffer, g_GraphTraceLen, false, false);
+        } else {
+            ans = AutoCorrelate(g_GraphBuffer, g_GraphBuffer, g_GraphTraceLen, 8000, false, false);
+        }
         if (ans > 0) {
 
             PrintAndLogEx(INFO, "Possible auto correlation of %d repeating samples", ans);
@@ -1801,6 +1815,8 @@ int CmdLFfind(const char *Cmd) {
     }
 
 out:
+    lf_autocorr_free(&autocorr);
+
     // identify chipset
     if (CheckChipType(is_online) == false) {
         PrintAndLogEx(DEBUG, "Automatic chip type detection " _RED_("failed"));
@@ -1844,6 +1860,7 @@ static command_t CommandTable[] = {
     {"config",      CmdLFConfig,        IfPm3Lf,         "Get/Set config for LF sampling, bit/sample, decimation, frequency"},
     {"cmdread",     CmdLFCommandRead,   IfPm3Lf,         "Modulate LF reader field to send command before read"},
     {"read",        CmdLFRead,          IfPm3Lf,         "Read LF tag"},
+    {"batch",       CmdLFBatch,         AlwaysAvailable, "Decode directories of pm3 sample files to JSON lines"},
     {"search",      CmdLFfind,          AlwaysAvailable, "Read and Search for valid known tag"},
     {"sim",         CmdLFSim,           IfPm3Lf,         "Simulate LF tag from buffer"},
     {"simask",      CmdLFaskSim,        IfPm3Lf,         "Simulate " _YELLOW_("ASK") " tag"},
@@ -21,6 +21,7 @@
 
 #include "common.h"
 #include "pm3_cmd.h" // sample_config_t
+#include "cmddata.h" // demod_ctx_t
 
 #define T55XX_WRITE_TIMEOUT 1500
 
@@ -40,6 +41,8 @@ int CmdLFSniff(const char *Cmd);
 int CmdVchDemod(const char *Cmd);
 int CmdLFfind(const char *Cmd);
 
+int lf_search_graph(demod_ctx_t *ctx);
+
 int lf_read(bool verbose, uint32_t samples);
 int lf_sniff(bool verbose, uint32_t samples);
 int lf_config(sample_config *config);
@@ -143,16 +143,10 @@ static int CmdAWIDWatch(const char *Cmd) {
 //print full AWID Prox ID and some bit format details if found
 int demodAWID(bool verbose) {
     (void) verbose; // unused so far
-    uint8_t *bits = calloc(MAX_GRAPH_TRACE_LEN, sizeof(uint8_t));
+    size_t size = 0;
+    uint8_t *bits = getGraphBufU8(&size);
     if (bits == NULL) {
-        PrintAndLogEx(DEBUG, "DEBUG: Error - AWID failed to allocate memory");
-        return PM3_EMALLOC;
-    }
-
-    size_t size = getFromGraphBuf(bits);
-    if (size == 0) {
         PrintAndLogEx(DEBUG, "DEBUG: Error - AWID not enough samples");
-        free(bits);
         return PM3_ENODATA;
     }
     //get binary from fsk wave
@@ -173,7 +167,7 @@ int demodAWID(bool verbose) {
         else
             PrintAndLogEx(DEBUG, "DEBUG: Error - AWID error demoding fsk %d", idx);
 
-        free(bits);
+        releaseGraphBufU8(bits);
         return PM3_ESOFT;
     }
 
@@ -202,7 +196,7 @@ int demodAWID(bool verbose) {
     size = removeParity(bits, idx + 8, 4, 1, 88);
     if (size != 66) {
         PrintAndLogEx(DEBUG, "DEBUG: Error - AWID at parity check-tag size does not match AWID format");
-        free(bits);
+        releaseGraphBufU8(bits);
         return PM3_ESOFT;
     }
     // ok valid card found!
@@ -272,7 +266,8 @@ int demodAWID(bool verbose) {
             }
             break;
     }
-    free(bits);
+    DemodCtxReportId("len: %u FC: %u Card: %u", fmtLen, fc, cardnum);
+    releaseGraphBufU8(bits);
 
     PrintAndLogEx(DEBUG, "DEBUG: AWID idx: %d, Len: %zu", idx, size);
     PrintAndLogEx(DEBUG, "DEBUG: Printing DemodBuffer:");
@@ -0,0 +1,656 @@
+//-----------------------------------------------------------------------------
+// Copyright (C) Proxmark3 contributors. See AUTHORS.md for details.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See LICENSE.txt for the text of the license.
+//-----------------------------------------------------------------------------
+// Low frequency batch decoding of pm3 sample files
+//
+// Every file is mapped, loaded into the GraphBuffer and run through the `lf search`
+// demodulators.  Those share the graph and demod buffers,  so files are decoded in parallel
+// by worker processes,  each taking the next file from a shared queue.  A worker writes
+// its results to its own temp file,  they are put back in file order at the end.
+// On Windows the files are decoded one after another.
+//-----------------------------------------------------------------------------
+#include "cmdlfbatch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <glob.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#endif
+#include "jansson.h"
+#include "cliparser.h"
+#include "ui.h"
+#include "util.h"           // num_CPUs, str_endswith
+#include "util_posix.h"     // msclock
+#include "graph.h"
+#include "cmddata.h"
+#include "lfdemod.h"        // computeSignalProperties
+#include "cmdlf.h"          // lf_search_graph
+#include "proxmark3.h"      // get_my_executable_path
+
+#if !defined(_WIN32) && !defined(LIBPM3)
+extern char **environ;
+#endif
+
+typedef struct {
+    char **names;
+    size_t count;
+    size_t cap;
+} lf_batch_files_t;
+
+static bool lf_batch_add(lf_batch_files_t *fl, const char *name) {
+    if (fl->count == fl->cap) {
+        size_t cap = (fl->cap) ? fl->cap * 2 : 256;
+        char **tmp = realloc(fl->names, cap * sizeof(char *));
+        if (tmp == NULL) {
+            return false;
+        }
+        fl->names = tmp;
+        fl->cap = cap;
+    }
+    fl->names[fl->count] = strdup(name);
+    if (fl->names[fl->count] == NULL) {
+        return false;
+    }
+    fl->count++;
+    return true;
+}
+
+static void lf_batch_files_free(lf_batch_files_t *fl) {
+    for (size_t i = 0; i < fl->count; i++) {
+        free(fl->names[i]);
+    }
+    free(fl->names);
+    memset(fl, 0, sizeof(lf_batch_files_t));
+}
+
+static int lf_batch_name_cmp(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// a directory (all .pm3 files in it),  a glob pattern or a single file
+static int lf_batch_collect(lf_batch_files_t *fl, const char *arg) {
+    struct stat st;
+    if (stat(arg, &st) == 0 && S_ISDIR(st.st_mode)) {
+        DIR *dir = opendir(arg);
+        if (dir == NULL) {
+            return PM3_EFILE;
+        }
+        size_t first = fl->count;
+        struct dirent *e;
+        while ((e = readdir(dir)) != NULL) {
+            if (str_endswith(e->d_name, ".pm3") == false) {
+                continue;
+            }
+            size_t len = strlen(arg) + strlen(e->d_name) + 2;
+            char *path = calloc(len, sizeof(char));
+            if (path == NULL) {
+                closedir(dir);
+                return PM3_EMALLOC;
+            }
+            bool slash = str_endswith(arg, "/");
+            snprintf(path, len, "%s%s%s", arg, (slash) ? "" : "/", e->d_name);
+            bool ok = lf_batch_add(fl, path);
+            free(path);
+            if (ok == false) {
+                closedir(dir);
+                return PM3_EMALLOC;
+            }
+        }
+        closedir(dir);
+        qsort(fl->names + first, fl->count - first, sizeof(char *), lf_batch_name_cmp);
+        return PM3_SUCCESS;
+    }
+
+#if !defined(_WIN32)
+    glob_t g;
+    memset(&g, 0, sizeof(g));
+    if (glob(arg, 0, NULL, &g) == 0) {
+        for (size_t i = 0; i < g.gl_pathc; i++) {
+            if (lf_batch_add(fl, g.gl_pathv[i]) == false) {
+                globfree(&g);
+                return PM3_EMALLOC;
+            }
+        }
+        globfree(&g);
+        return PM3_SUCCESS;
+    }
+    globfree(&g);
+#endif
+
+    if (stat(arg, &st) == 0) {
+        return lf_batch_add(fl, arg) ? PM3_SUCCESS : PM3_EMALLOC;
+    }
+    return PM3_EFILE;
+}
+
+// One sample per line,  read like `data load` does with atoi()
+static int lf_batch_parse(const char *p, size_t len) {
+    const char *end = p + len;
+
+    size_t lines = 1;
+    for (const char *q = p; q < end && (q = memchr(q, '\n', end - q)) != NULL; q++) {
+        lines++;
+    }
+    if (reserveGraphBuf(lines) == false) {
+        return PM3_EMALLOC;
+    }
+
+    size_t n = 0;
+    while (p < end) {
+        while (p < end && *p != '\n' && isspace((unsigned char)*p)) {
+            p++;
+        }
+        bool neg = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            neg = (*p == '-');
+            p++;
+        }
+        int v = 0;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (v < 100000000) {
+                v = v * 10 + (*p - '0');
+            }
+            p++;
+        }
+        g_GraphBuffer[n++] = (neg) ? -v : v;
+
+        const char *nl = memchr(p, '\n', end - p);
+        if (nl == NULL) {
+            break;
+        }
+        p = nl + 1;
+    }
+    g_GraphTraceLen = n;
+
+    // same clean up as `data load`
+    size_t size = 0;
+    uint8_t *bits = getGraphBufU8(&size);
+    if (bits) {
+        removeSignalOffset(bits, size);
+        setGraphBuf(bits, size);
+        computeSignalProperties(bits, size);
+        releaseGraphBufU8(bits);
+    }
+    setClockGrid(0, 0);
+    // some demodulators read past what they set,  results must not depend on the file before
+    memset(g_DemodBuffer, 0, sizeof(g_DemodBuffer));
+    g_DemodBufferLen = 0;
+    return PM3_SUCCESS;
+}
+
+static int lf_batch_load(const char *fn) {
+#if defined(_WIN32)
+    FILE *f = fopen(fn, "rb");
+    if (f == NULL) {
+        return PM3_EFILE;
+    }
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (len < 0) {
+        fclose(f);
+        return PM3_EFILE;
+    }
+    char *data = calloc(len + 1, sizeof(char));
+    if (data == NULL) {
+        fclose(f);
+        return PM3_EMALLOC;
+    }
+    size_t got = fread(data, 1, len, f);
+    fclose(f);
+    int res = lf_batch_parse(data, got);
+    free(data);
+    return res;
+#else
+    int fd = open(fn, O_RDONLY);
+    if (fd < 0) {
+        return PM3_EFILE;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return PM3_EFILE;
+    }
+    size_t len = (size_t)st.st_size;
+    if (len == 0) {
+        close(fd);
+        return lf_batch_parse("", 0);
+    }
+    void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return PM3_EFILE;
+    }
+    madvise(map, len, MADV_SEQUENTIAL);
+    int res = lf_batch_parse(map, len);
+    munmap(map, len);
+    return res;
+#endif
+}
+
+// demodulated bits as hex,  msb first,  the last nibble zero padded
+static json_t *lf_batch_raw(const demod_ctx_t *ctx) {
+    size_t nibbles = (ctx->len + 3) / 4;
+    char *hex = calloc(nibbles + 1, sizeof(char));
+    if (hex == NULL) {
+        return json_null();
+    }
+    for (size_t i = 0; i < nibbles; i++) {
+        uint8_t v = 0;
+        for (size_t j = 0; j < 4; j++) {
+            size_t idx = i * 4 + j;
+            v = (v << 1) | ((idx < ctx->len) ? (ctx->bits[idx] & 1) : 0);
+        }
+        hex[i] = "0123456789ABCDEF"[v];
+    }
+    json_t *res = json_string(hex);
+    free(hex);
+    return res;
+}
+
+// decode one file,  returns a JSON line to be freed by the caller
+static char *lf_batch_decode(const char *fn) {
+    json_t *root = json_object();
+    json_object_set_new(root, "file", json_string(fn));
+
+    // the demodulators print what they find,  the results come back in the context
+    bool quiet = GetQuietOutput();
+    SetQuietOutput(true);
+
+    int res = lf_batch_load(fn);
+    if (res != PM3_SUCCESS) {
+        json_object_set_new(root, "error", json_string((res == PM3_EMALLOC) ? "out of memory" : "can't read file"));
+    } else {
+        json_object_set_new(root, "samples", json_integer(g_GraphTraceLen));
+
+        demod_ctx_t m;
+        res = lf_search_graph(&m);
+        if (res == PM3_ESOFT) {
+            json_object_set_new(root, "error", json_string("too few samples"));
+        } else if (res != PM3_SUCCESS) {
+            json_object_set_new(root, "error", json_string("out of memory"));
+        } else if (m.tag == NULL) {
+            json_object_set_new(root, "protocol", json_null());
+        } else {
+            // table names end in " ID"
+            char name[64];
+            snprintf(name, sizeof(name), "%s", m.tag);
+            if (str_endswith(name, " ID")) {
+                name[strlen(name) - 3] = '\0';
+            }
+            json_object_set_new(root, "protocol", json_string(name));
+            json_object_set_new(root, "modulation", json_string(m.modulation));
+            json_object_set_new(root, "id", json_string(m.id));
+            json_object_set_new(root, "clock", json_integer(m.clock));
+            json_object_set_new(root, "bits", json_integer(m.len));
+            json_object_set_new(root, "raw", lf_batch_raw(&m));
+        }
+        DemodCtxFree(&m);
+    }
+
+    SetQuietOutput(quiet);
+
+    char *line = json_dumps(root, JSON_COMPACT | JSON_PRESERVE_ORDER);
+    json_decref(root);
+    return line;
+}
+
+static char *lf_batch_error_line(const char *fn, const char *err) {
+    json_t *root = json_object();
+    json_object_set_new(root, "file", json_string(fn));
+    json_object_set_new(root, "error", json_string(err));
+    char *line = json_dumps(root, JSON_COMPACT | JSON_PRESERVE_ORDER);
+    json_decref(root);
+    return line;
+}
+
+#if !defined(_WIN32) && !defined(LIBPM3)
+// what a worker inherits from the parent: the file names ('\0' separated),  the
+// queue of file indices all workers read from and the file taking its results
+#define LF_BATCH_FD_NAMES   3
+#define LF_BATCH_FD_QUEUE   4
+#define LF_BATCH_FD_OUT     5
+
+// worker process,  decodes files until the queue runs out,  lines are "<index>\t<json>"
+static int lf_batch_child(void) {
+    struct stat st;
+    if (fstat(LF_BATCH_FD_NAMES, &st) != 0) {
+        return PM3_EFILE;
+    }
+    size_t len = (size_t)st.st_size;
+    char *names = calloc(len + 1, sizeof(char));
+    if (names == NULL) {
+        return PM3_EMALLOC;
+    }
+    // the other workers share the file offset,  don't move it
+    if (pread(LF_BATCH_FD_NAMES, names, len, 0) != (ssize_t)len) {
+        free(names);
+        return PM3_EFILE;
+    }
+
+    lf_batch_files_t fl;
+    memset(&fl, 0, sizeof(fl));
+    for (size_t pos = 0; pos < len; pos += strlen(names + pos) + 1) {
+        if (lf_batch_add(&fl, names + pos) == false) {
+            free(names);
+            lf_batch_files_free(&fl);
+            return PM3_EMALLOC;
+        }
+    }
+    free(names);
+
+    FILE *out = fdopen(LF_BATCH_FD_OUT, "w");
+    if (out == NULL) {
+        lf_batch_files_free(&fl);
+        return PM3_EFILE;
+    }
+
+    // reads of one index are atomic,  every index is taken by one worker
+    uint32_t i;
+    while (read(LF_BATCH_FD_QUEUE, &i, sizeof(i)) == sizeof(i)) {
+        if (i >= fl.count) {
+            continue;
+        }
+        char *line = lf_batch_decode(fl.names[i]);
+        if (line) {
+            fprintf(out, "%" PRIu32 "\t%s\n", i, line);
+            // what is decoded survives a crash on a later file
+            fflush(out);
+            free(line);
+        }
+    }
+
+    fclose(out);
+    lf_batch_files_free(&fl);
+    return PM3_SUCCESS;
+}
+
+// a copy of fd above the ones handed to the workers,  not inherited itself
+static int lf_batch_fd(FILE *f) {
+    return (f) ? fcntl(fileno(f), F_DUPFD_CLOEXEC, LF_BATCH_FD_OUT + 1) : -1;
+}
+
+// The client keeps threads running (output writer,  comms),  forking it would leave the
+// child with their locks.  Workers are fresh client processes running `lf batch --child`.
+static int lf_batch_run_spawned(const lf_batch_files_t *fl, size_t workers, char **lines) {
+    const char *exe = get_my_executable_path();
+    if (exe == NULL) {
+        return PM3_ESOFT;
+    }
+
+    FILE *names = tmpfile();
+    FILE *queue = tmpfile();
+    FILE **tmp = calloc(workers, sizeof(FILE *));
+    pid_t *pids = calloc(workers, sizeof(pid_t));
+    int res = PM3_EMALLOC;
+    if (names == NULL || queue == NULL || tmp == NULL || pids == NULL) {
+        goto out;
+    }
+
+    for (size_t i = 0; i < fl->count; i++) {
+        uint32_t idx = i;
+        fwrite(fl->names[i], 1, strlen(fl->names[i]) + 1, names);
+        fwrite(&idx, sizeof(idx), 1, queue);
+    }
+    res = PM3_EFILE;
+    if (fflush(names) != 0 || fflush(queue) != 0 || ferror(names) || ferror(queue)) {
+        goto out;
+    }
+    rewind(queue);
+
+    int names_fd = lf_batch_fd(names);
+    int queue_fd = lf_batch_fd(queue);
+
+    char arg_exe[FILE_PATH_SIZE] = {0};
+    char arg_incognito[] = "--incognito";
+    char arg_c[] = "-c";
+    char arg_cmd[] = "lf batch --child";
+    snprintf(arg_exe, sizeof(arg_exe), "%s", exe);
+    char *argv[] = {arg_exe, arg_incognito, arg_c, arg_cmd, NULL};
+
+    size_t started = 0;
+    for (; started < workers && names_fd >= 0 && queue_fd >= 0; started++) {
+        tmp[started] = tmpfile();
+        int out_fd = lf_batch_fd(tmp[started]);
+        if (out_fd < 0) {
+            break;
+        }
+
+        posix_spawn_file_actions_t fa;
+        posix_spawn_file_actions_init(&fa);
+        // some demodulators printf() directly
+        posix_spawn_file_actions_addopen(&fa, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+        posix_spawn_file_actions_adddup2(&fa, names_fd, LF_BATCH_FD_NAMES);
+        posix_spawn_file_actions_adddup2(&fa, queue_fd, LF_BATCH_FD_QUEUE);
+        posix_spawn_file_actions_adddup2(&fa, out_fd, LF_BATCH_FD_OUT);
+        int err = posix_spawn(&pids[started], exe, &fa, NULL, argv, environ);
+        posix_spawn_file_actions_destroy(&fa);
+        close(out_fd);
+        if (err != 0) {
+            break;
+        }
+    }
+    if (names_fd >= 0) {
+        close(names_fd);
+    }
+    if (queue_fd >= 0) {
+        close(queue_fd);
+    }
+
+    for (size_t w = 0; w < started; w++) {
+        int status = 0;
+        waitpid(pids[w], &status, 0);
+        if (WIFEXITED(status) == false || WEXITSTATUS(status) != 0) {
+            PrintAndLogEx(WARNING, "batch worker %zu failed,  its last file is reported as an error", w);
+        }
+    }
+
+    res = (started) ? PM3_SUCCESS : PM3_ESOFT;
+
+    for (size_t w = 0; w < started; w++) {
+        rewind(tmp[w]);
+        char *buf = NULL;
+        size_t bufsize = 0;
+        ssize_t n;
+        while ((n = getline(&buf, &bufsize, tmp[w])) > 0) {
+            char *tab = strchr(buf, '\t');
+            if (tab == NULL) {
+                continue;
+            }
+            size_t idx = strtoul(buf, NULL, 10);
+            if (idx >= fl->count || lines[idx]) {
+                continue;
+            }
+            if (buf[n - 1] == '\n') {
+                buf[n - 1] = '\0';
+            }
+            lines[idx] = strdup(tab + 1);
+        }
+        free(buf);
+    }
+
+out:
+    if (tmp) {
+        for (size_t w = 0; w < workers; w++) {
+            if (tmp[w]) {
+                fclose(tmp[w]);
+            }
+        }
+    }
+    if (names) {
+        fclose(names);
+    }
+    if (queue) {
+        fclose(queue);
+    }
+    free(tmp);
+    free(pids);
+    return res;
+}
+#endif
+
+int CmdLFBatch(const char *Cmd) {
+    CLIParserContext *ctx;
+    CLIParserInit(&ctx, "lf batch",
+                  "Decode many pm3 sample files without the interactive client.\n"
+                  "Each file is loaded like `data load` and searched like `lf search -1`,\n"
+                  "one JSON line per file with protocol, decoded ID and raw bits.\n"
+                  "Files are decoded in parallel,  results are written in file order.",
+                  "lf batch -f traces/                          -> all .pm3 files in a directory\n"
+                  "lf batch -f \"dumps/*_lf.pm3\" -o results.jsonl -> glob,  save to file\n"
+                  "proxmark3 -c \"lf batch -f dumps/ -o out.jsonl\" -> headless"
+                 );
+
+    void *argtable[] = {
+        arg_param_begin,
+        arg_strn("f", "file", "<fn>", 0, 64, "directory, glob pattern or pm3 file, can be repeated"),
+        arg_str0("o", "out", "<fn>", "write JSON lines to file (def: stdout)"),
+        arg_int0("w", "workers", "<dec>", "number of worker processes (def: number of CPUs)"),
+        arg_lit0(NULL, "child", "internal, run as a worker of another `lf batch`"),
+        arg_param_end
+    };
+    CLIExecWithReturn(ctx, Cmd, argtable, false);
+
+    if (arg_get_lit(ctx, 4)) {
+        CLIParserFree(ctx);
+#if !defined(_WIN32) && !defined(LIBPM3)
+        return lf_batch_child();
+#else
+        return PM3_ENOTIMPL;
+#endif
+    }
+
+    lf_batch_files_t fl;
+    memset(&fl, 0, sizeof(fl));
+
+    struct arg_str *files = arg_get_str(ctx, 1);
+    for (int i = 0; i < files->count; i++) {
+        // glob patterns come quoted
+        char arg[FILE_PATH_SIZE] = {0};
+        snprintf(arg, sizeof(arg), "%s", files->sval[i]);
+        size_t len = strlen(arg);
+        if (len >= 2 && arg[0] == '"' && arg[len - 1] == '"') {
+            memmove(arg, arg + 1, len - 2);
+            arg[len - 2] = '\0';
+        }
+        if (lf_batch_collect(&fl, arg) != PM3_SUCCESS) {
+            PrintAndLogEx(WARNING, "no pm3 files found for " _YELLOW_("%s"), arg);
+        }
+    }
+
+    char outfn[FILE_PATH_SIZE] = {0};
+    int outfnlen = 0;
+    CLIParamStrToBuf(arg_get_str(ctx, 2), (uint8_t *)outfn, FILE_PATH_SIZE, &outfnlen);
+
+    int workers = arg_get_int_def(ctx, 3, 0);
+    CLIParserFree(ctx);
+
+    if (fl.count == 0) {
+        PrintAndLogEx(FAILED, "No files to decode");
+        lf_batch_files_free(&fl);
+        return PM3_EINVARG;
+    }
+
+    if (workers <= 0) {
+        workers = num_CPUs();
+    }
+    if ((size_t)workers > fl.count) {
+        workers = fl.count;
+    }
+
+    char **lines = calloc(fl.count, sizeof(char *));
+    if (lines == NULL) {
+        PrintAndLogEx(WARNING, "Failed to allocate memory");
+        lf_batch_files_free(&fl);
+        return PM3_EMALLOC;
+    }
+
+    uint64_t t1 = msclock();
+
+    // the graph is reloaded for every file,  keep what the user had
+    save_restoreGB(GRAPH_SAVE);
+    save_restoreDB(GRAPH_SAVE);
+
+    int res = PM3_ESOFT;
+#if !defined(_WIN32) && !defined(LIBPM3)
+    // even a single worker keeps the demodulators' stray output away from the results
+    res = lf_batch_run_spawned(&fl, workers, lines);
+#endif
+    if (res != PM3_SUCCESS) {
+        for (size_t i = 0; i < fl.count; i++) {
+            lines[i] = lf_batch_decode(fl.names[i]);
+        }
+    }
+
+    save_restoreGB(GRAPH_RESTORE);
+    save_restoreDB(GRAPH_RESTORE);
+
+    FILE *out = stdout;
+    if (outfnlen) {
+        out = fopen(outfn, "w");
+        if (out == NULL) {
+            PrintAndLogEx(WARNING, "couldn't open " _YELLOW_("%s") " for writing", outfn);
+            out = stdout;
+            outfnlen = 0;
+        }
+    }
+    if (out == stdout) {
+        PrintAndLogFlush();
+    }
+
+    size_t found = 0, failed = 0;
+    for (size_t i = 0; i < fl.count; i++) {
+        if (lines[i] == NULL) {
+            lines[i] = lf_batch_error_line(fl.names[i], "decoder crashed");
+        }
+        if (lines[i] == NULL) {
+            continue;
+        }
+        if (strstr(lines[i], "\"error\":")) {
+            failed++;
+        } else if (strstr(lines[i], "\"protocol\":null") == NULL) {
+            found++;
+        }
+        fputs(lines[i], out);
+        fputc('\n', out);
+        free(lines[i]);
+    }
+    free(lines);
+
+    if (outfnlen) {
+        fclose(out);
+    } else {
+        fflush(out);
+    }
+
+    uint64_t t2 = msclock() - t1;
+    PrintAndLogEx(SUCCESS, "decoded " _YELLOW_("%zu") " files,  " _GREEN_("%zu") " known tags,  %zu errors,  in %" PRIu64 " ms ( %.1f files/s, %d workers )",
+                  fl.count, found, failed, t2, (t2) ? (fl.count * 1000.0) / t2 : 0.0, workers);
+    if (outfnlen) {
+        PrintAndLogEx(SUCCESS, "saved to " _YELLOW_("%s"), outfn);
+    }
+
+    lf_batch_files_free(&fl);
+    return PM3_SUCCESS;
+}
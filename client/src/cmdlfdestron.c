@@ -87,6 +87,7 @@ int demodDestron(bool verbose) {
         return PM3_ESOFT;
     }
     PrintAndLogEx(SUCCESS, "FDX-A FECAVA Destron: " _GREEN_("%s"), sprint_hex_inrow(data, 5));
+    DemodCtxReportId("%s", sprint_hex_inrow(data, 5));
     return PM3_SUCCESS;
 }
 
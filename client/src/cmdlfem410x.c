@@ -132,6 +132,7 @@ void printEM410x(uint32_t hi, uint64_t id, bool verbose, int type) {
     if (type & 0x2) { // Long ID
         //output 88 bit em id
         PrintAndLogEx(SUCCESS, "EM 410x XL ID "_GREEN_("%06X%016" PRIX64)" ( RF/%d )", hi, id, g_DemodClock);
+        DemodCtxReportId("%06X%016" PRIX64, hi, id);
     }
     if (type & 0x4) { // Short Extended ID
         PrintAndLogEx(SUCCESS, "EM 410x Short ID found on a 128b frame");
@@ -156,6 +157,7 @@ void printEM410x(uint32_t hi, uint64_t id, bool verbose, int type) {
         }
         PrintAndLogEx(SUCCESS, "EM 410x ID "_GREEN_("%010" PRIX64), id);
         PrintAndLogEx(SUCCESS, "EM410x ( RF/%d )", g_DemodClock);
+        DemodCtxReportId("%010" PRIX64, id);
         PrintAndLogEx(INFO, "-------- " _CYAN_("Possible de-scramble patterns") " ---------");
         PrintAndLogEx(SUCCESS, "Unique TAG ID      : %010" PRIX64, id2lo);
         PrintAndLogEx(INFO, "HoneyWell IdentKey");
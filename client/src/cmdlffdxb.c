@@ -150,28 +150,35 @@ static int CmdFDXBdemodBI(const char *Cmd) {
 
     int clk = 32;
     int invert = 1, errCnt = 0, offset = 0, maxErr = 100;
-    uint8_t bs[MAX_DEMOD_BUF_LEN];
-    size_t size = getFromGraphBuf(bs);
+    size_t size = 0;
+    uint8_t *bs = getGraphBufU8(&size);
+    if (bs == NULL) {
+        return PM3_ESOFT;
+    }
 
     errCnt = askdemod(bs, &size, &clk, &invert, maxErr, 0, 0);
     if (errCnt < 0 || errCnt > maxErr) {
         PrintAndLogEx(DEBUG, "DEBUG: Error - FDXB no data or error found %d, clock: %d", errCnt, clk);
+        releaseGraphBufU8(bs);
         return PM3_ESOFT;
     }
 
     errCnt = BiphaseRawDecode(bs, &size, &offset, 1);
     if (errCnt < 0 || errCnt > maxErr) {
         PrintAndLogEx(DEBUG, "DEBUG: Error - FDXB BiphaseRawDecode: %d", errCnt);
+        releaseGraphBufU8(bs);
         return PM3_ESOFT;
     }
 
     int preambleIndex = detectFDXB(bs, &size);
     if (preambleIndex < 0) {
         PrintAndLogEx(DEBUG, "DEBUG: Error - FDXB preamble not found :: %d", preambleIndex);
+        releaseGraphBufU8(bs);
         return PM3_ESOFT;
     }
     if (size != 128) {
         PrintAndLogEx(DEBUG, "DEBUG: Error - FDXB incorrect data length found");
+        releaseGraphBufU8(bs);
         return PM3_ESOFT;
     }
 
@@ -181,6 +188,7 @@ static int CmdFDXBdemodBI(const char *Cmd) {
     size = removeParity(bs, preambleIndex + 11, 9, 2, 117);
     if (size != 104) {
         PrintAndLogEx(DEBUG, "DEBUG: Error - FDXB error removeParity:: %d", size);
+        releaseGraphBufU8(bs);
         return PM3_ESOFT;
     }
     PrintAndLogEx(SUCCESS, "\nFDX-B / ISO 11784/5 Animal Tag ID Found:");
@@ -215,6 +223,7 @@ static int CmdFDXBdemodBI(const char *Cmd) {
         char *bin = sprint_bytebits_bin_break(bs, size, 16);
         PrintAndLogEx(DEBUG, "DEBUG BinStream:\n%s", bin);
     }
+    releaseGraphBufU8(bs);
     return PM3_SUCCESS;
 }
 */
@@ -563,6 +572,8 @@ int demodFDXB(bool verbose) {
     uint8_t raw[8];
     num_to_bytes(rawid, 8, raw);
 
+    DemodCtxReportId("%03u-%012" PRIu64, countryCode, NationalCode);
+
     if (!verbose) {
         PROMPT_CLEARLINE;
         PrintAndLogEx(SUCCESS, "Animal ID          " _GREEN_("%04u-%012"PRIu64), countryCode, NationalCode);
@@ -180,10 +180,13 @@ int demodGuard(bool verbose) {
             unknown = true;
             break;
     }
-    if (unknown)
+    if (unknown) {
         PrintAndLogEx(SUCCESS, "G-Prox-II - Unknown len: " _GREEN_("%u") " xor: " _GREEN_("%u")", Raw: %08x%08x%08x ", fmtLen, xorKey, raw1, raw2, raw3);
-    else
+        DemodCtxReportId("Len: %u", fmtLen);
+    } else {
         PrintAndLogEx(SUCCESS, "G-Prox-II - Len: " _GREEN_("%u")" FC: " _GREEN_("%u") " Card: " _GREEN_("%u") " xor: " _GREEN_("%u") ", Raw: %08x%08x%08x", fmtLen, FC, Card, xorKey, raw1, raw2, raw3);
+        DemodCtxReportId("Len: %u FC: %u Card: %u", fmtLen, FC, Card);
+    }
 
     return PM3_SUCCESS;
 }
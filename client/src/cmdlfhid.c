@@ -116,9 +116,9 @@ int demodHID(bool verbose) {
     //raw fsk demod no manchester decoding no start bit finding just get binary from wave
     uint32_t hi2 = 0, hi = 0, lo = 0;
 
-    uint8_t bits[g_GraphTraceLen];
-    size_t size = getFromGraphBuf(bits);
-    if (size == 0) {
+    size_t size = 0;
+    uint8_t *bits = getGraphBufU8(&size);
+    if (bits == NULL) {
         PrintAndLogEx(DEBUG, "DEBUG: Error - " _RED_("HID not enough samples"));
         return PM3_ESOFT;
     }
@@ -140,6 +140,7 @@ int demodHID(bool verbose) {
         else
             PrintAndLogEx(DEBUG, "DEBUG: Error - " _RED_("HID error demoding fsk %d"), idx);
 
+        releaseGraphBufU8(bits);
         return PM3_ESOFT;
     }
 
@@ -148,6 +149,7 @@ int demodHID(bool verbose) {
 
     if (hi2 == 0 && hi == 0 && lo == 0) {
         PrintAndLogEx(DEBUG, "DEBUG: Error - " _RED_("HID no values found"));
+        releaseGraphBufU8(bits);
         return PM3_ESOFT;
     }
 
@@ -156,6 +158,7 @@ int demodHID(bool verbose) {
         printDemodBuff(0, false, false, true);
     }
     PrintAndLogEx(INFO, "raw: " _GREEN_("%08x%08x%08x"), hi2, hi, lo);
+    DemodCtxReportId("%08x%08x%08x", hi2, hi, lo);
 
     PrintAndLogEx(DEBUG, "DEBUG: HID idx: %d, Len: %zu, Printing DemodBuffer: ", idx, size);
     if (g_debugMode) {
@@ -164,6 +167,7 @@ int demodHID(bool verbose) {
         printDemodBuff(0, false, false, false);
     }
 
+    releaseGraphBufU8(bits);
     return PM3_SUCCESS;
 }
 
@@ -92,6 +92,7 @@ int demodIdteck(bool verbose) {
 
     //output
     PrintAndLogEx(SUCCESS, "IDTECK Tag Found: Card ID %u ,  Raw: %08X%08X", id, raw1, raw2);
+    DemodCtxReportId("%08X%08X", raw1, raw2);
     return PM3_SUCCESS;
 }
 
@@ -243,6 +243,7 @@ int demodIndalaEx(int clk, int invert, int maxErr, bool verbose) {
 
     if (g_DemodBufferLen == 64) {
         PrintAndLogEx(SUCCESS, "Indala (len %zu)  Raw: " _GREEN_("%x%08x"), g_DemodBufferLen, uid1, uid2);
+        DemodCtxReportId("%x%08x", uid1, uid2);
 
         uint16_t p1  = 0;
         p1 |= g_DemodBuffer[32 + 3] << 8;
@@ -330,6 +331,7 @@ int demodIndalaEx(int clk, int invert, int maxErr, bool verbose) {
             , uid6
             , uid7
         );
+        DemodCtxReportId("%x%08x%08x%08x%08x%08x%08x", uid1, uid2, uid3, uid4, uid5, uid6, uid7);
     }
 
     if (g_debugMode) {
@@ -401,8 +403,8 @@ static int CmdIndalaDemodAlt(const char *Cmd) {
 
     // worst case with g_GraphTraceLen=40000 is < 4096
     // under normal conditions it's < 2048
-    uint8_t data[MAX_GRAPH_TRACE_LEN] = {0};
-    size_t datasize = getFromGraphBuf(data);
+    size_t datasize = 0;
+    uint8_t *data = getGraphBufU8(&datasize);
 
     uint8_t rawbits[4096] = {0};
     int rawbit = 0;
@@ -449,6 +451,7 @@ static int CmdIndalaDemodAlt(const char *Cmd) {
         PrintAndLogEx(INFO, "Recovered %d raw bits, expected: %zu", rawbit, g_GraphTraceLen / 32);
         PrintAndLogEx(INFO, "Worst metric (0=best..7=worst): %d at pos %d", worst, worstPos);
     } else {
+        releaseGraphBufU8(data);
         return PM3_ESOFT;
     }
 
@@ -478,6 +481,7 @@ static int CmdIndalaDemodAlt(const char *Cmd) {
 
     if (start == rawbit - uidlen + 1) {
         PrintAndLogEx(FAILED, "Nothing to wait for");
+        releaseGraphBufU8(data);
         return PM3_ESOFT;
     }
 
@@ -504,6 +508,7 @@ static int CmdIndalaDemodAlt(const char *Cmd) {
         }
         showbits[bit + 1] = '\0';
         PrintAndLogEx(SUCCESS, "Partial UID | %s", showbits);
+        releaseGraphBufU8(data);
         return PM3_SUCCESS;
     } else {
         for (bit = 0; bit < uidlen; bit++) {
@@ -588,6 +593,7 @@ static int CmdIndalaDemodAlt(const char *Cmd) {
     }
 
     RepaintGraphWindow();
+    releaseGraphBufU8(data);
     return PM3_SUCCESS;
 }
 
@@ -66,10 +66,11 @@ static int CmdIOProxWatch(const char *Cmd) {
 int demodIOProx(bool verbose) {
     (void) verbose; // unused so far
     int idx = 0, retval = PM3_SUCCESS;
-    uint8_t bits[MAX_GRAPH_TRACE_LEN] = {0};
-    size_t size = getFromGraphBuf(bits);
+    size_t size = 0;
+    uint8_t *bits = getGraphBufU8(&size);
     if (size < 65) {
         PrintAndLogEx(DEBUG, "DEBUG: Error - IO prox not enough samples in GraphBuffer");
+        releaseGraphBufU8(bits);
         return PM3_ESOFT;
     }
     //get binary from fsk wave
@@ -93,6 +94,7 @@ int demodIOProx(bool verbose) {
                 PrintAndLogEx(DEBUG, "DEBUG: Error - IO prox error demoding fsk %d", idx);
             }
         }
+        releaseGraphBufU8(bits);
         return PM3_ESOFT;
     }
     setDemodBuff(bits, size, idx);
@@ -103,6 +105,7 @@ int demodIOProx(bool verbose) {
             PrintAndLogEx(DEBUG, "DEBUG: Error - IO prox data not found - FSK Bits: %zu", size);
             if (size > 92) PrintAndLogEx(DEBUG, "%s", sprint_bytebits_bin_break(bits, 92, 16));
         }
+        releaseGraphBufU8(bits);
         return PM3_ESOFT;
     }
 
@@ -147,6 +150,7 @@ int demodIOProx(bool verbose) {
     }
 
     PrintAndLogEx(SUCCESS, "IO Prox - " _GREEN_("XSF(%02d)%02x:%05d") ", Raw: %08x%08x %s", version, facilitycode, number, code, code2, crc_str);
+    DemodCtxReportId("XSF(%02d)%02x:%05d", version, facilitycode, number);
 
     if (g_debugMode) {
         if (crc != calccrc)
@@ -156,6 +160,7 @@ int demodIOProx(bool verbose) {
         printDemodBuff(0, false, false, true);
         printDemodBuff(0, false, false, false);
     }
+    releaseGraphBufU8(bits);
     return retval;
 }
 
@@ -96,6 +96,7 @@ int demodJablotron(bool verbose) {
     uint64_t id = getJablontronCardId(rawid);
 
     PrintAndLogEx(SUCCESS, "Jablotron - Card: " _GREEN_("%"PRIx64) ", Raw: %08X%08X", id, raw1, raw2);
+    DemodCtxReportId("%" PRIx64, id);
 
     uint8_t chksum = raw2 & 0xFF;
     bool isok = (chksum == jablontron_chksum(g_DemodBuffer));
@@ -174,6 +174,7 @@ int demodKeri(bool verbose) {
     ID &= 0x7FFFFFFF;
 
     PrintAndLogEx(SUCCESS, "KERI - Internal ID: " _GREEN_("%u") ", Raw: %08X%08X", ID, raw1, raw2);
+    DemodCtxReportId("Internal ID: %u", ID);
 
     // Just need to the low 32 bits without the 111 trailer
     CmdKeriMSScramble(Descramble, &fc, &cardid, &raw2);
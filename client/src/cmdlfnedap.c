@@ -151,6 +151,7 @@ int demodNedap(bool verbose) {
                       , customerCode
                       , sprint_hex_inrow(data, size / 8)
                      );
+        DemodCtxReportId("ID: %05u subtype: %1u customer code: %u", badgeId, subtype, customerCode);
         PrintAndLogEx(DEBUG, "Checksum ( %s ) 0x%04X",  _GREEN_("ok"), checksum);
 
     } else {
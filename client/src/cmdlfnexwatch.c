@@ -233,6 +233,7 @@ int demodNexWatch(bool verbose) {
         nexwatch_magic_bruteforce(cn, calc_parity, chk);
     }
     PrintAndLogEx(SUCCESS, "        88bit id : " _YELLOW_("%"PRIu32) " ("  _YELLOW_("0x%08"PRIx32)")", cn, cn);
+    DemodCtxReportId("%" PRIu32, cn);
     PrintAndLogEx(SUCCESS, "            mode : %x", mode);
 
 
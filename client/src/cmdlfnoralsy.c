@@ -104,6 +104,7 @@ int demodNoralsy(bool verbose) {
     }
 
     PrintAndLogEx(SUCCESS, "Noralsy - Card: " _GREEN_("%u")", Year: " _GREEN_("%u") ", Raw: %08X%08X%08X", cardid, year, raw1, raw2, raw3);
+    DemodCtxReportId("Card: %u Year: %u", cardid, year);
     if (raw1 != 0xBB0214FF) {
         PrintAndLogEx(WARNING, "Unknown bits set in first block! Expected 0xBB0214FF, Found: 0x%08X", raw1);
         PrintAndLogEx(WARNING, "Please post this output in forum to further research on this format");
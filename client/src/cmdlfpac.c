@@ -164,8 +164,10 @@ int demodPac(bool verbose) {
     uint8_t cardid[idLen];
     int retval = pac_buf_to_cardid(g_DemodBuffer, g_DemodBufferLen, cardid, sizeof(cardid));
 
-    if (retval == PM3_SUCCESS)
+    if (retval == PM3_SUCCESS) {
         PrintAndLogEx(SUCCESS, "PAC/Stanley - Card: " _GREEN_("%s") ", Raw: %08X%08X%08X%08X", cardid, raw1, raw2, raw3, raw4);
+        DemodCtxReportId("%s", cardid);
+    }
 
     return retval;
 }
@@ -56,9 +56,9 @@ static const uint8_t paradox_lut[] = {
 int demodParadox(bool verbose) {
     (void) verbose; // unused so far
     //raw fsk demod no manchester decoding no start bit finding just get binary from wave
-    uint8_t bits[MAX_GRAPH_TRACE_LEN] = {0};
-    size_t size = getFromGraphBuf(bits);
-    if (size == 0) {
+    size_t size = 0;
+    uint8_t *bits = getGraphBufU8(&size);
+    if (bits == NULL) {
         PrintAndLogEx(DEBUG, "DEBUG: Error - Paradox not enough samples");
         return PM3_ESOFT;
     }
@@ -78,6 +78,7 @@ int demodParadox(bool verbose) {
         else
             PrintAndLogEx(DEBUG, "DEBUG: Error - Paradox error demoding fsk %d", idx);
 
+        releaseGraphBufU8(bits);
         return PM3_ESOFT;
     }
 
@@ -128,6 +129,7 @@ int demodParadox(bool verbose) {
 
     if (hi2 == 0 && hi == 0 && lo == 0) {
         PrintAndLogEx(DEBUG, "DEBUG: Error - Paradox no value found");
+        releaseGraphBufU8(bits);
         return PM3_ESOFT;
     }
 
@@ -172,12 +174,14 @@ int demodParadox(bool verbose) {
                   rawHi,
                   rawLo
                  );
+    DemodCtxReportId("%x%08x", hi >> 10, (hi & 0x3) << 26 | (lo >> 10));
 
     PrintAndLogEx(DEBUG, "DEBUG: Paradox idx: %d, len: %zu, Printing DemodBuffer:", idx, size);
     if (g_debugMode) {
         printDemodBuff(0, false, false, false);
     }
 
+    releaseGraphBufU8(bits);
     return PM3_SUCCESS;
 }
 
@@ -117,6 +117,7 @@ int demodPresco(bool verbose) {
                   , fullcode
                   , raw1, raw2, raw3, raw4
                  );
+    DemodCtxReportId("Site code: %u User code: %u Full code: %08X", sitecode, usercode, fullcode);
     return PM3_SUCCESS;
 }
 
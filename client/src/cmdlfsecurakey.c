@@ -111,6 +111,7 @@ int demodSecurakey(bool verbose) {
     bool parity = !evenparity32(lWiegand) && !oddparity32(rWiegand);
 
     PrintAndLogEx(SUCCESS, "Securakey - len: " _GREEN_("%u") " FC: " _GREEN_("0x%X")" Card: " _GREEN_("%u") ", Raw: %08X%08X%08X", bitLen, fc, cardid, raw1, raw2, raw3);
+    DemodCtxReportId("len: %u FC: 0x%X Card: %u", bitLen, fc, cardid);
     if (bitLen <= 32)
         PrintAndLogEx(SUCCESS, "Wiegand: " _GREEN_("%08X") " parity ( %s )", (lWiegand << (bitLen / 2)) | rWiegand, parity ? _GREEN_("ok") : _RED_("fail"));
 
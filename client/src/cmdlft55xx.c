@@ -24,6 +24,7 @@
 #include "cmdlft55xx.h"
 #include <ctype.h>
 #include <time.h>         // MingW
+#include <pthread.h>
 #include "cmdparser.h"    // command_t
 #include "comms.h"
 #include "commonutil.h"
@@ -76,6 +77,7 @@ void Set_t55xx_Config(t55xx_conf_block_t conf) {
 }
 
 static int CmdHelp(const char *Cmd);
+static bool testBits(const uint8_t *bits, size_t len, uint8_t mode, uint8_t *offset, int *fndBitRate, uint8_t clk, bool *Q5);
 
 static void arg_add_t55xx_downloadlink(void *at[], uint8_t *idx, uint8_t show, uint8_t dl_mode_def) {
     const size_t r_count = 56;
@@ -1039,169 +1041,208 @@ bool t55xxTryDetectModulation(uint8_t downlink_mode, bool print_config) {
     return t55xxTryDetectModulationEx(downlink_mode, print_config, 0, -1);
 }
 
+// One modulation hypothesis of t55xxTryDetectModulationEx.  Each demodulates into its own
+// context,  so they can all run at once.
+typedef enum {
+    T55_TRY_FSK,
+    T55_TRY_ASK,
+    T55_TRY_BI,
+    T55_TRY_NRZ,
+    T55_TRY_PSK,
+} t55xx_try_demod_t;
+
+typedef struct {
+    t55xx_try_demod_t demod;
+    int invert;
+    uint8_t mode;                   // for test()
+    t55xx_modulation modulation;    // reported
+    int clk;
+    const uint8_t *samples;
+    size_t len;
+    size_t maxlen;                  // of the device,  g_pm3_capabilities is per thread
+    size_t skip;                    // samples skipped at the start
+    bool psk2;                      // test as psk2
+    demod_ctx_t ctx;
+    bool demod_ok;
+    bool found;
+    t55xx_conf_block_t conf;
+} t55xx_try_t;
+
+typedef struct {
+    t55xx_try_t *tries;
+    size_t count;
+    size_t next;                    // shared
+} t55xx_try_list_t;
+
+static void t55xx_try_one(t55xx_try_t *t) {
+    if (DemodCtxInit(&t->ctx, t->samples, t->len, t->maxlen) != PM3_SUCCESS) {
+        return;
+    }
+
+    int res = PM3_ESOFT;
+    switch (t->demod) {
+        case T55_TRY_FSK:
+            res = FSKrawDemodCtx(&t->ctx, 0, t->invert, 0, 0);
+            break;
+        case T55_TRY_ASK:
+            // ST is reported whether or not a sequence terminator is found
+            t->conf.ST = true;
+            res = ASKDemodCtx(&t->ctx, 0, t->invert, 1, false, 1, &t->conf.ST);
+            break;
+        case T55_TRY_BI: {
+            int offset = 0;
+            res = ASKbiphaseDemodCtx(&t->ctx, &offset, 0, t->invert, 2);
+            break;
+        }
+        case T55_TRY_NRZ:
+            res = NRZrawDemodCtx(&t->ctx, 0, t->invert, 1);
+            break;
+        case T55_TRY_PSK:
+            res = PSKDemodCtx(&t->ctx, 0, t->invert, 6);
+            t->ctx.start_idx += t->skip;
+            break;
+    }
+    if (res != PM3_SUCCESS) {
+        return;
+    }
+    t->demod_ok = true;
+
+    if (t->psk2) {
+        psk1TOpsk2(t->ctx.bits, t->ctx.len);
+    }
+
+    int bitRate = 0;
+    if (testBits(t->ctx.bits, t->ctx.len, t->mode, &t->conf.offset, &bitRate, t->clk, &t->conf.Q5) == false) {
+        return;
+    }
+    t->conf.modulation = t->modulation;
+    t->conf.bitrate = bitRate;
+    t->conf.inverted = t->invert;
+    t->conf.block0 = PackBits(t->conf.offset, 32, t->ctx.bits);
+    t->found = true;
+}
+
+static void *t55xx_try_thread(void *arg) {
+    t55xx_try_list_t *list = (t55xx_try_list_t *)arg;
+    for (;;) {
+        size_t i = __atomic_fetch_add(&list->next, 1, __ATOMIC_RELAXED);
+        if (i >= list->count) {
+            break;
+        }
+        t55xx_try_one(&list->tries[i]);
+    }
+    return NULL;
+}
+
+static void t55xx_try_all(t55xx_try_t *tries, size_t count) {
+    t55xx_try_list_t list = { .tries = tries, .count = count, .next = 0 };
+
+    size_t thread_count = num_CPUs();
+    if (thread_count > count) {
+        thread_count = count;
+    }
+
+    pthread_t threads[16];
+    size_t started = 0;
+    for (; thread_count > 1 && started < MIN(thread_count, ARRAYLEN(threads)); started++) {
+        if (pthread_create(&threads[started], NULL, t55xx_try_thread, &list) != 0) {
+            break;
+        }
+    }
+    // whatever is left,  and everything when threads are not worth it
+    t55xx_try_thread(&list);
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
 bool t55xxTryDetectModulationEx(uint8_t downlink_mode, bool print_config, uint32_t wanted_conf, uint64_t pwd) {
 
     t55xx_conf_block_t tests[15];
-    int bitRate = 0, clk = 0, firstClockEdge = 0;
+    t55xx_try_t tries[15];
+    size_t ntries = 0;
+    int clk = 0, firstClockEdge = 0;
     uint8_t hits = 0, fc1 = 0, fc2 = 0, ans = 0;
 
+    memset(tests, 0, sizeof(tests));
+    memset(tries, 0, sizeof(tries));
+
     ans = fskClocks(&fc1, &fc2, (uint8_t *)&clk, &firstClockEdge);
 
+    // clocks are detected up front,  the demods themselves run in parallel on one copy of the samples
+    size_t size = 0;
+    uint8_t *bits = getGraphBufU8(&size);
+    if (bits == NULL) {
+        return false;
+    }
+
+#define T55_TRY(d, inv, m, mod, c) \
+    tries[ntries++] = (t55xx_try_t){ .demod = (d), .invert = (inv), .mode = (m), .modulation = (mod), .clk = (c), .samples = bits, .len = size, .maxlen = g_pm3_capabilities.bigbuf_size }
+
     if (ans && ((fc1 == 10 && fc2 == 8) || (fc1 == 8 && fc2 == 5))) {
-        if ((FSKrawDemod(0, 0, 0, 0, false) == PM3_SUCCESS) && test(DEMOD_FSK, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-            tests[hits].modulation = DEMOD_FSK;
-            if (fc1 == 8 && fc2 == 5)
-                tests[hits].modulation = DEMOD_FSK1a;
-            else if (fc1 == 10 && fc2 == 8)
-                tests[hits].modulation = DEMOD_FSK2;
-            tests[hits].bitrate = bitRate;
-            tests[hits].inverted = false;
-            tests[hits].block0 = PackBits(tests[hits].offset, 32, g_DemodBuffer);
-            tests[hits].ST = false;
-            tests[hits].downlink_mode = downlink_mode;
-            ++hits;
-        }
-        if ((FSKrawDemod(0, 1, 0, 0, false) == PM3_SUCCESS) && test(DEMOD_FSK, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-            tests[hits].modulation = DEMOD_FSK;
-            if (fc1 == 8 && fc2 == 5)
-                tests[hits].modulation = DEMOD_FSK1;
-            else if (fc1 == 10 && fc2 == 8)
-                tests[hits].modulation = DEMOD_FSK2a;
-            tests[hits].bitrate = bitRate;
-            tests[hits].inverted = true;
-            tests[hits].block0 = PackBits(tests[hits].offset, 32, g_DemodBuffer);
-            tests[hits].ST = false;
-            tests[hits].downlink_mode = downlink_mode;
-            ++hits;
-        }
+        bool fsk1 = (fc1 == 8 && fc2 == 5);
+        T55_TRY(T55_TRY_FSK, 0, DEMOD_FSK, fsk1 ? DEMOD_FSK1a : DEMOD_FSK2, clk);
+        T55_TRY(T55_TRY_FSK, 1, DEMOD_FSK, fsk1 ? DEMOD_FSK1 : DEMOD_FSK2a, clk);
     } else {
         clk = GetAskClock("", false);
         if (clk > 0) {
-            tests[hits].ST = true;
-            // "0 0 1 " == clock auto, invert false, maxError 1.
-            // false = no verbose
-            // false = no emSearch
-            // 1 = Ask/Man
-            // st = true
-            if ((ASKDemod_ext(0, 0, 1, 0, false, false, false, 1, &tests[hits].ST) == PM3_SUCCESS) && test(DEMOD_ASK, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-                tests[hits].modulation = DEMOD_ASK;
-                tests[hits].bitrate = bitRate;
-                tests[hits].inverted = false;
-                tests[hits].block0 = PackBits(tests[hits].offset, 32, g_DemodBuffer);
-                tests[hits].downlink_mode = downlink_mode;
-                ++hits;
-            }
-            tests[hits].ST = true;
-            // "0 0 1 " == clock auto, invert true, maxError 1.
-            // false = no verbose
-            // false = no emSearch
-            // 1 = Ask/Man
-            // st = true
-            if ((ASKDemod_ext(0, 1, 1, 0, false, false, false, 1, &tests[hits].ST) == PM3_SUCCESS) && test(DEMOD_ASK, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-                tests[hits].modulation = DEMOD_ASK;
-                tests[hits].bitrate = bitRate;
-                tests[hits].inverted = true;
-                tests[hits].block0 = PackBits(tests[hits].offset, 32, g_DemodBuffer);
-                tests[hits].downlink_mode = downlink_mode;
-                ++hits;
-            }
-            if ((ASKbiphaseDemod(0, 0, 0, 2, false) == PM3_SUCCESS) && test(DEMOD_BI, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-                tests[hits].modulation = DEMOD_BI;
-                tests[hits].bitrate = bitRate;
-                tests[hits].inverted = false;
-                tests[hits].block0 = PackBits(tests[hits].offset, 32, g_DemodBuffer);
-                tests[hits].ST = false;
-                tests[hits].downlink_mode = downlink_mode;
-                ++hits;
-            }
-            if ((ASKbiphaseDemod(0, 0, 1, 2, false) == PM3_SUCCESS) && test(DEMOD_BIa, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-                tests[hits].modulation = DEMOD_BIa;
-                tests[hits].bitrate = bitRate;
-                tests[hits].inverted = true;
-                tests[hits].block0 = PackBits(tests[hits].offset, 32, g_DemodBuffer);
-                tests[hits].ST = false;
-                tests[hits].downlink_mode = downlink_mode;
-                ++hits;
-            }
+            T55_TRY(T55_TRY_ASK, 0, DEMOD_ASK, DEMOD_ASK, clk);
+            T55_TRY(T55_TRY_ASK, 1, DEMOD_ASK, DEMOD_ASK, clk);
+            T55_TRY(T55_TRY_BI, 0, DEMOD_BI, DEMOD_BI, clk);
+            T55_TRY(T55_TRY_BI, 1, DEMOD_BIa, DEMOD_BIa, clk);
         }
         clk = GetNrzClock("", false);
         if (clk > 8) { //clock of rf/8 is likely a false positive, so don't use it.
-            if ((NRZrawDemod(0, 0, 1, false) == PM3_SUCCESS) && test(DEMOD_NRZ, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-                tests[hits].modulation = DEMOD_NRZ;
-                tests[hits].bitrate = bitRate;
-                tests[hits].inverted = false;
-                tests[hits].block0 = PackBits(tests[hits].offset, 32, g_DemodBuffer);
-                tests[hits].ST = false;
-                tests[hits].downlink_mode = downlink_mode;
-                ++hits;
-            }
-
-            if ((NRZrawDemod(0, 1, 1, false) == PM3_SUCCESS) && test(DEMOD_NRZ, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-                tests[hits].modulation = DEMOD_NRZ;
-                tests[hits].bitrate = bitRate;
-                tests[hits].inverted = true;
-                tests[hits].block0 = PackBits(tests[hits].offset, 32, g_DemodBuffer);
-                tests[hits].ST = false;
-                tests[hits].downlink_mode = downlink_mode;
-                ++hits;
-            }
+            T55_TRY(T55_TRY_NRZ, 0, DEMOD_NRZ, DEMOD_NRZ, clk);
+            T55_TRY(T55_TRY_NRZ, 1, DEMOD_NRZ, DEMOD_NRZ, clk);
         }
 
         clk = GetPskClock("", false);
         if (clk > 0) {
-            // allow undo
-            save_restoreGB(GRAPH_SAVE);
+            size_t first = ntries;
+            T55_TRY(T55_TRY_PSK, 0, DEMOD_PSK1, DEMOD_PSK1, clk);
+            T55_TRY(T55_TRY_PSK, 1, DEMOD_PSK1, DEMOD_PSK1, clk);
+            // PSK2 / PSK3 - psk1 demod then psk1TOpsk2,  inverse waves does not affect these
+            T55_TRY(T55_TRY_PSK, 0, DEMOD_PSK2, DEMOD_PSK2, clk);
+            tries[ntries - 1].psk2 = true;
+            T55_TRY(T55_TRY_PSK, 0, DEMOD_PSK3, DEMOD_PSK3, clk);
+            tries[ntries - 1].psk2 = true;
+
             // skip first 160 samples to allow antenna to settle in (psk gets inverted occasionally otherwise)
-            CmdLtrim("-i 160");
-            if ((PSKDemod(0, 0, 6, false) == PM3_SUCCESS) && test(DEMOD_PSK1, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-                tests[hits].modulation = DEMOD_PSK1;
-                tests[hits].bitrate = bitRate;
-                tests[hits].inverted = false;
-                tests[hits].block0 = PackBits(tests[hits].offset, 32, g_DemodBuffer);
-                tests[hits].ST = false;
-                tests[hits].downlink_mode = downlink_mode;
-                ++hits;
-            }
-            if ((PSKDemod(0, 1, 6, false) == PM3_SUCCESS) && test(DEMOD_PSK1, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-                tests[hits].modulation = DEMOD_PSK1;
-                tests[hits].bitrate = bitRate;
-                tests[hits].inverted = true;
-                tests[hits].block0 = PackBits(tests[hits].offset, 32, g_DemodBuffer);
-                tests[hits].ST = false;
-                tests[hits].downlink_mode = downlink_mode;
-                ++hits;
-            }
-            //ICEMAN: are these PSKDemod calls needed?
-            // PSK2 - needs a call to psk1TOpsk2.
-            if (PSKDemod(0, 0, 6, false) == PM3_SUCCESS) {
-                psk1TOpsk2(g_DemodBuffer, g_DemodBufferLen);
-                if (test(DEMOD_PSK2, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-                    tests[hits].modulation = DEMOD_PSK2;
-                    tests[hits].bitrate = bitRate;
-                    tests[hits].inverted = false;
-                    tests[hits].block0 = PackBits(tests[hits].offset, 32, g_DemodBuffer);
-                    tests[hits].ST = false;
-                    tests[hits].downlink_mode = downlink_mode;
-                    ++hits;
-                }
-            } // inverse waves does not affect this demod
-            // PSK3 - needs a call to psk1TOpsk2.
-            if (PSKDemod(0, 0, 6, false) == PM3_SUCCESS) {
-                psk1TOpsk2(g_DemodBuffer, g_DemodBufferLen);
-                if (test(DEMOD_PSK3, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-                    tests[hits].modulation = DEMOD_PSK3;
-                    tests[hits].bitrate = bitRate;
-                    tests[hits].inverted = false;
-                    tests[hits].block0 = PackBits(tests[hits].offset, 32, g_DemodBuffer);
-                    tests[hits].ST = false;
-                    tests[hits].downlink_mode = downlink_mode;
-                    ++hits;
+            if (size > 160) {
+                for (size_t i = first; i < ntries; i++) {
+                    tries[i].samples += 160;
+                    tries[i].len -= 160;
+                    tries[i].skip = 160;
                 }
-            } // inverse waves does not affect this demod
-            //undo trim samples
-            save_restoreGB(GRAPH_RESTORE);
+            }
+        }
+    }
+#undef T55_TRY
+
+    t55xx_try_all(tries, ntries);
+
+    const t55xx_try_t *last = NULL;
+    for (size_t i = 0; i < ntries; i++) {
+        if (tries[i].demod_ok) {
+            last = &tries[i];
+        }
+        if (tries[i].found) {
+            tests[hits] = tries[i].conf;
+            tests[hits].downlink_mode = downlink_mode;
+            ++hits;
         }
     }
+
+    // leave g_DemodBuffer as the last successful demod would have
+    if (last) {
+        DemodCtxApply(&last->ctx);
+    }
+    for (size_t i = 0; i < ntries; i++) {
+        DemodCtxFree(&tries[i].ctx);
+    }
+    releaseGraphBufU8(bits);
+
     if (hits == 1) {
         config.modulation = tests[0].modulation;
         config.bitrate = tests[0].bitrate;
@@ -1390,38 +1431,38 @@ static int convertQ5bitRate(uint8_t bitRateRead) {
     return -1;
 }
 
-static bool testQ5(uint8_t mode, uint8_t *offset, int *fndBitRate, uint8_t clk) {
+static bool testQ5(const uint8_t *bits, size_t len, uint8_t mode, uint8_t *offset, int *fndBitRate, uint8_t clk) {
 
-    if (g_DemodBufferLen < 64) return false;
+    if (len < 64) return false;
 
     for (uint8_t idx = 28; idx < 64; idx++) {
         uint8_t si = idx;
-        if (PackBits(si, 28, g_DemodBuffer) == 0x00) continue;
+        if (PackBits(si, 28, bits) == 0x00) continue;
 
-        uint8_t safer     = PackBits(si, 4, g_DemodBuffer);
+        uint8_t safer     = PackBits(si, 4, bits);
         si += 4;     //master key
-        uint8_t resv      = PackBits(si, 8, g_DemodBuffer);
+        uint8_t resv      = PackBits(si, 8, bits);
         si += 8;
         // 2nibble must be zeroed.
         if (safer != 0x6 && safer != 0x9) continue;
         if (resv > 0x00) continue;
-        //uint8_t pageSel   = PackBits(si, 1, g_DemodBuffer); si += 1;
-        //uint8_t fastWrite = PackBits(si, 1, g_DemodBuffer); si += 1;
+        //uint8_t pageSel   = PackBits(si, 1, bits); si += 1;
+        //uint8_t fastWrite = PackBits(si, 1, bits); si += 1;
         si += 1 + 1;
-        int bitRate       = PackBits(si, 6, g_DemodBuffer) * 2 + 2;
+        int bitRate       = PackBits(si, 6, bits) * 2 + 2;
         si += 6;     //bit rate
         if (bitRate > 128 || bitRate < 8) continue;
 
-        //uint8_t AOR       = PackBits(si, 1, g_DemodBuffer); si += 1;
-        //uint8_t PWD       = PackBits(si, 1, g_DemodBuffer); si += 1;
-        //uint8_t pskcr     = PackBits(si, 2, g_DemodBuffer); si += 2;  //could check psk cr
-        //uint8_t inverse   = PackBits(si, 1, g_DemodBuffer); si += 1;
+        //uint8_t AOR       = PackBits(si, 1, bits); si += 1;
+        //uint8_t PWD       = PackBits(si, 1, bits); si += 1;
+        //uint8_t pskcr     = PackBits(si, 2, bits); si += 2;  //could check psk cr
+        //uint8_t inverse   = PackBits(si, 1, bits); si += 1;
         si += 1 + 1 + 2 + 1;
-        uint8_t modread   = PackBits(si, 3, g_DemodBuffer);
+        uint8_t modread   = PackBits(si, 3, bits);
         si += 3;
-        uint8_t maxBlk    = PackBits(si, 3, g_DemodBuffer);
+        uint8_t maxBlk    = PackBits(si, 3, bits);
         si += 3;
-        //uint8_t ST        = PackBits(si, 1, g_DemodBuffer); si += 1;
+        //uint8_t ST        = PackBits(si, 1, bits); si += 1;
         if (maxBlk == 0) continue;
 
         //test modulation
@@ -1446,30 +1487,31 @@ static bool testBitRate(uint8_t readRate, uint8_t clk) {
     return false;
 }
 
-bool test(uint8_t mode, uint8_t *offset, int *fndBitRate, uint8_t clk, bool *Q5) {
+// look for a valid config block in demodulated bits
+static bool testBits(const uint8_t *bits, size_t len, uint8_t mode, uint8_t *offset, int *fndBitRate, uint8_t clk, bool *Q5) {
 
-    if (g_DemodBufferLen < 64) return false;
+    if (len < 64) return false;
     for (uint8_t idx = 28; idx < 64; idx++) {
         uint8_t si = idx;
-        if (PackBits(si, 28, g_DemodBuffer) == 0x00) continue;
+        if (PackBits(si, 28, bits) == 0x00) continue;
 
-        uint8_t safer    = PackBits(si, 4, g_DemodBuffer);
+        uint8_t safer    = PackBits(si, 4, bits);
         si += 4;     //master key
-        uint8_t resv     = PackBits(si, 4, g_DemodBuffer);
+        uint8_t resv     = PackBits(si, 4, bits);
         si += 4;     //was 7 & +=7+3 //should be only 4 bits if extended mode
         // 2nibble must be zeroed.
         // moved test to here, since this gets most faults first.
         if (resv > 0x00) continue;
 
-        int bitRate      = PackBits(si, 6, g_DemodBuffer);
+        int bitRate      = PackBits(si, 6, bits);
         si += 6;     //bit rate (includes extended mode part of rate)
-        uint8_t extend   = PackBits(si, 1, g_DemodBuffer);
+        uint8_t extend   = PackBits(si, 1, bits);
         si += 1;     //bit 15 extended mode
-        uint8_t modread  = PackBits(si, 5, g_DemodBuffer);
+        uint8_t modread  = PackBits(si, 5, bits);
         si += 5 + 2 + 1;
-        //uint8_t pskcr   = PackBits(si, 2, g_DemodBuffer); si += 2+1;  //could check psk cr
-        //uint8_t nml01    = PackBits(si, 1, g_DemodBuffer); si += 1+5;   //bit 24, 30, 31 could be tested for 0 if not extended mode
-        //uint8_t nml02    = PackBits(si, 2, g_DemodBuffer); si += 2;
+        //uint8_t pskcr   = PackBits(si, 2, bits); si += 2+1;  //could check psk cr
+        //uint8_t nml01    = PackBits(si, 1, bits); si += 1+5;   //bit 24, 30, 31 could be tested for 0 if not extended mode
+        //uint8_t nml02    = PackBits(si, 2, bits); si += 2;
 
         //if extended mode
         bool extMode = ((safer == 0x6 || safer == 0x9) && extend) ? true : false;
@@ -1488,13 +1530,17 @@ bool test(uint8_t mode, uint8_t *offset, int *fndBitRate, uint8_t clk, bool *Q5)
         *Q5 = false;
         return true;
     }
-    if (testQ5(mode, offset, fndBitRate, clk)) {
+    if (testQ5(bits, len, mode, offset, fndBitRate, clk)) {
         *Q5 = true;
         return true;
     }
     return false;
 }
 
+bool test(uint8_t mode, uint8_t *offset, int *fndBitRate, uint8_t clk, bool *Q5) {
+    return testBits(g_DemodBuffer, g_DemodBufferLen, mode, offset, fndBitRate, clk, Q5);
+}
+
 int CmdT55xxSpecial(const char *Cmd) {
 
     CLIParserContext *ctx;
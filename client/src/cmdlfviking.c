@@ -55,6 +55,7 @@ int demodViking(bool verbose) {
     uint32_t cardid = bytebits_to_byte(g_DemodBuffer + ans + 24, 32);
     uint8_t  checksum = bytebits_to_byte(g_DemodBuffer + ans + 32 + 24, 8);
     PrintAndLogEx(SUCCESS, "Viking - Card " _GREEN_("%08X") ", Raw: %08X%08X", cardid, raw1, raw2);
+    DemodCtxReportId("%08X", cardid);
     PrintAndLogEx(DEBUG, "Checksum: %02X", checksum);
     setDemodBuff(g_DemodBuffer, 64, ans);
     setClockGrid(g_DemodClock, g_DemodStartIdx + (ans * g_DemodClock));
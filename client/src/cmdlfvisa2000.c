@@ -137,6 +137,7 @@ int demodVisa2k(bool verbose) {
         return PM3_ESOFT;
     }
     PrintAndLogEx(SUCCESS, "Visa2000 - Card " _GREEN_("%u") ", Raw: %08X%08X%08X", raw2,  raw1, raw2, raw3);
+    DemodCtxReportId("%u", raw2);
     return PM3_SUCCESS;
 }
 
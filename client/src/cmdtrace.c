@@ -35,18 +35,18 @@ static int CmdHelp(const char *Cmd);
 
 // trace pointer
 static uint8_t *gs_trace;
-static uint16_t gs_traceLen = 0;
+static uint32_t gs_traceLen = 0;
 
-static bool is_last_record(uint16_t tracepos, uint16_t traceLen) {
+static bool is_last_record(uint32_t tracepos, uint32_t traceLen) {
     return ((tracepos + TRACELOG_HDR_LEN) >= traceLen);
 }
 
-static bool next_record_is_response(uint16_t tracepos, uint8_t *trace) {
+static bool next_record_is_response(uint32_t tracepos, uint8_t *trace) {
     tracelog_hdr_t *hdr = (tracelog_hdr_t *)(trace + tracepos);
     return (hdr->isResponse);
 }
 
-static bool merge_topaz_reader_frames(uint32_t timestamp, uint32_t *duration, uint16_t *tracepos, uint16_t traceLen,
+static bool merge_topaz_reader_frames(uint32_t timestamp, uint32_t *duration, uint32_t *tracepos, uint32_t traceLen,
                                       uint8_t *trace, uint8_t *frame, uint8_t *topaz_reader_command, uint16_t *data_len) {
 
 #define MAX_TOPAZ_READER_CMD_LEN 16
@@ -97,7 +97,7 @@ static uint8_t extract_epurse[8] = {0};
 
 #define SKIP_TO_NEXT(a)  (TRACELOG_HDR_LEN + (a)->data_len + TRACELOG_PARITY_LEN((a)))
 
-static uint16_t extractChall_ev2(uint16_t tracepos, uint8_t *trace, uint8_t cmdpos, uint8_t long_jmp) {
+static uint32_t extractChall_ev2(uint32_t tracepos, uint8_t *trace, uint8_t cmdpos, uint8_t long_jmp) {
     tracelog_hdr_t *next_hdr = (tracelog_hdr_t *)(trace + tracepos);
     if (next_hdr->data_len != 21) {
         return 0;
@@ -118,7 +118,7 @@ static uint16_t extractChall_ev2(uint16_t tracepos, uint8_t *trace, uint8_t cmdp
     return tracepos;
 }
 
-static uint16_t extractChallenges(uint16_t tracepos, uint16_t traceLen, uint8_t *trace) {
+static uint32_t extractChallenges(uint32_t tracepos, uint32_t traceLen, uint8_t *trace) {
 
     // sanity check
     if (is_last_record(tracepos, traceLen)) {
@@ -387,7 +387,7 @@ static uint16_t extractChallenges(uint16_t tracepos, uint16_t traceLen, uint8_t
             }
             case MFDES_AUTHENTICATE_EV2F: {
                 PrintAndLogEx(INFO, "AUTH EV2 First");
-                uint16_t tmp = extractChall_ev2(tracepos, trace, pos, long_jmp);
+                uint32_t tmp = extractChall_ev2(tracepos, trace, pos, long_jmp);
                 if (tmp == 0)
                     break;
                 else
@@ -396,7 +396,7 @@ static uint16_t extractChallenges(uint16_t tracepos, uint16_t traceLen, uint8_t
             }
             case MFDES_AUTHENTICATE_EV2NF: {
                 PrintAndLogEx(INFO, "AUTH EV2 Non First");
-                uint16_t tmp = extractChall_ev2(tracepos, trace, pos, long_jmp);
+                uint32_t tmp = extractChall_ev2(tracepos, trace, pos, long_jmp);
                 if (tmp == 0)
                     break;
                 else
@@ -408,13 +408,13 @@ static uint16_t extractChallenges(uint16_t tracepos, uint16_t traceLen, uint8_t
     return tracepos;
 }
 
-static uint16_t printHexLine(uint16_t tracepos, uint16_t traceLen, uint8_t *trace, uint8_t protocol) {
+static uint32_t printHexLine(uint32_t tracepos, uint32_t traceLen, uint8_t *trace, uint8_t protocol) {
     // sanity check
     if (is_last_record(tracepos, traceLen)) return traceLen;
 
     tracelog_hdr_t *hdr = (tracelog_hdr_t *)(trace + tracepos);
 
-    if (TRACELOG_HDR_LEN + hdr->data_len + TRACELOG_PARITY_LEN(hdr) > traceLen) {
+    if (tracepos + TRACELOG_HDR_LEN + hdr->data_len + TRACELOG_PARITY_LEN(hdr) > traceLen) {
         return traceLen;
     }
 
@@ -426,7 +426,7 @@ static uint16_t printHexLine(uint16_t tracepos, uint16_t traceLen, uint8_t *trac
         return tracepos;
     }
 
-    uint16_t ret;
+    uint32_t ret;
 
     switch (protocol) {
         case ISO_14443A: {
@@ -474,7 +474,7 @@ static uint16_t printHexLine(uint16_t tracepos, uint16_t traceLen, uint8_t *trac
     return ret;
 }
 
-static uint16_t printTraceLine(uint16_t tracepos, uint16_t traceLen, uint8_t *trace, uint8_t protocol, bool showWaitCycles, bool markCRCBytes, uint32_t *prev_eot, bool use_us,
+static uint32_t printTraceLine(uint32_t tracepos, uint32_t traceLen, uint8_t *trace, uint8_t protocol, bool showWaitCycles, bool markCRCBytes, uint32_t *prev_eot, bool use_us,
                                const uint64_t *mfDicKeys, uint32_t mfDicKeysCount) {
     // sanity check
     if (is_last_record(tracepos, traceLen)) {
@@ -916,7 +916,261 @@ static uint16_t printTraceLine(uint16_t tracepos, uint16_t traceLen, uint8_t *tr
     return tracepos;
 }
 
-static int download_trace(void) {
+//-----------------------------------------------------------------------------
+// Trace index
+// One entry per record with its byte offset, timestamp and direction.  It is built once per trace
+// and lets `trace list` jump straight to a time range or pick out one direction without walking
+// all records before it.  `trace save` stores it next to the trace file as <file>.trace.idx,
+// `trace load` uses it again as long as it still matches the trace.
+//-----------------------------------------------------------------------------
+#define TRACE_IDX_MAGIC         "PM3TIDX"
+#define TRACE_IDX_VERSION       1
+#define TRACE_IDX_SUFFIX        ".idx"
+
+#define TRACE_IDX_RESPONSE      0x01    // tag -> reader
+#define TRACE_IDX_EMPTY         0x02    // record without data bytes
+
+typedef struct {
+    uint32_t offset;
+    uint32_t timestamp;
+    uint16_t data_len;
+    uint8_t flags;
+} PACKED trace_idx_entry_t;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t trace_len;
+    uint32_t count;
+    uint8_t sorted;
+} PACKED trace_idx_hdr_t;
+
+static trace_idx_entry_t *gs_trace_idx = NULL;
+static uint32_t gs_trace_idx_count = 0;
+static bool gs_trace_idx_sorted = false;    // timestamps never decrease, time ranges can be binary searched
+
+static void trace_index_free(void) {
+    free(gs_trace_idx);
+    gs_trace_idx = NULL;
+    gs_trace_idx_count = 0;
+    gs_trace_idx_sorted = false;
+}
+
+static int trace_index_build(void) {
+    trace_index_free();
+
+    if (gs_trace == NULL || gs_traceLen == 0) {
+        return PM3_SUCCESS;
+    }
+
+    // smallest record is a header plus one parity byte
+    uint32_t max = gs_traceLen / (TRACELOG_HDR_LEN + 1) + 1;
+    gs_trace_idx = calloc(max, sizeof(trace_idx_entry_t));
+    if (gs_trace_idx == NULL) {
+        PrintAndLogEx(FAILED, "Cannot allocate memory for trace index");
+        return PM3_EMALLOC;
+    }
+
+    gs_trace_idx_sorted = true;
+    uint32_t tracepos = 0;
+    while (is_last_record(tracepos, gs_traceLen) == false && gs_trace_idx_count < max) {
+        tracelog_hdr_t *hdr = (tracelog_hdr_t *)(gs_trace + tracepos);
+        uint32_t next = tracepos + TRACELOG_HDR_LEN + hdr->data_len + TRACELOG_PARITY_LEN(hdr);
+        if (next > gs_traceLen) {
+            break;
+        }
+
+        trace_idx_entry_t *e = &gs_trace_idx[gs_trace_idx_count];
+        e->offset = tracepos;
+        e->timestamp = hdr->timestamp;
+        e->data_len = hdr->data_len;
+        e->flags = (hdr->isResponse ? TRACE_IDX_RESPONSE : 0) | ((hdr->data_len == 0) ? TRACE_IDX_EMPTY : 0);
+
+        if (gs_trace_idx_count && e->timestamp < gs_trace_idx[gs_trace_idx_count - 1].timestamp) {
+            gs_trace_idx_sorted = false;
+        }
+        gs_trace_idx_count++;
+        tracepos = next;
+    }
+    return PM3_SUCCESS;
+}
+
+static int trace_index_ensure(void) {
+    if (gs_trace_idx == NULL) {
+        return trace_index_build();
+    }
+    return PM3_SUCCESS;
+}
+
+static char *trace_index_filename(const char *tracefn) {
+    size_t len = strlen(tracefn) + strlen(TRACE_IDX_SUFFIX) + 1;
+    char *fn = calloc(len, sizeof(char));
+    if (fn) {
+        snprintf(fn, len, "%s%s", tracefn, TRACE_IDX_SUFFIX);
+    }
+    return fn;
+}
+
+static int trace_index_save(const char *tracefn) {
+    int res = trace_index_ensure();
+    if (res != PM3_SUCCESS) {
+        return res;
+    }
+
+    char *fn = trace_index_filename(tracefn);
+    if (fn == NULL) {
+        return PM3_EMALLOC;
+    }
+
+    FILE *f = fopen(fn, "wb");
+    if (f == NULL) {
+        PrintAndLogEx(WARNING, "could not write trace index " _YELLOW_("%s"), fn);
+        free(fn);
+        return PM3_EFILE;
+    }
+
+    trace_idx_hdr_t hdr = {0};
+    memcpy(hdr.magic, TRACE_IDX_MAGIC, sizeof(hdr.magic));
+    hdr.version = TRACE_IDX_VERSION;
+    hdr.trace_len = gs_traceLen;
+    hdr.count = gs_trace_idx_count;
+    hdr.sorted = gs_trace_idx_sorted;
+
+    bool ok = (fwrite(&hdr, sizeof(hdr), 1, f) == 1);
+    if (ok && gs_trace_idx_count) {
+        ok = (fwrite(gs_trace_idx, sizeof(trace_idx_entry_t), gs_trace_idx_count, f) == gs_trace_idx_count);
+    }
+    fclose(f);
+
+    if (ok) {
+        PrintAndLogEx(SUCCESS, "saved trace index ( " _YELLOW_("%u") " records ) to " _YELLOW_("%s"), gs_trace_idx_count, fn);
+    } else {
+        PrintAndLogEx(WARNING, "could not write trace index " _YELLOW_("%s"), fn);
+        remove(fn);
+    }
+    free(fn);
+    return ok ? PM3_SUCCESS : PM3_EFILE;
+}
+
+// load the index stored next to a trace file.  It is only used if it matches the trace in memory
+static bool trace_index_load(const char *tracefn) {
+    trace_index_free();
+
+    char *fn = trace_index_filename(tracefn);
+    if (fn == NULL) {
+        return false;
+    }
+    FILE *f = fopen(fn, "rb");
+    free(fn);
+    if (f == NULL) {
+        return false;
+    }
+
+    trace_idx_hdr_t hdr;
+    bool ok = (fread(&hdr, sizeof(hdr), 1, f) == 1)
+              && (memcmp(hdr.magic, TRACE_IDX_MAGIC, sizeof(hdr.magic)) == 0)
+              && (hdr.version == TRACE_IDX_VERSION)
+              && (hdr.trace_len == gs_traceLen)
+              && (hdr.count <= gs_traceLen / (TRACELOG_HDR_LEN + 1) + 1);
+
+    if (ok && hdr.count) {
+        gs_trace_idx = calloc(hdr.count, sizeof(trace_idx_entry_t));
+        ok = (gs_trace_idx != NULL) && (fread(gs_trace_idx, sizeof(trace_idx_entry_t), hdr.count, f) == hdr.count);
+    }
+    fclose(f);
+
+    // spot check that the entries still point at the records they describe
+    for (uint32_t i = 0; ok && i < hdr.count; i += MAX(1, hdr.count / 64)) {
+        const trace_idx_entry_t *e = &gs_trace_idx[i];
+        if (e->offset + TRACELOG_HDR_LEN > gs_traceLen) {
+            ok = false;
+            break;
+        }
+        tracelog_hdr_t *thdr = (tracelog_hdr_t *)(gs_trace + e->offset);
+        ok = (thdr->timestamp == e->timestamp) && (thdr->data_len == e->data_len);
+    }
+
+    if (ok == false) {
+        trace_index_free();
+        return false;
+    }
+
+    gs_trace_idx_count = hdr.count;
+    gs_trace_idx_sorted = hdr.sorted;
+    return true;
+}
+
+// first index entry which may have a timestamp >= from
+static uint32_t trace_index_first(uint32_t from) {
+    if (gs_trace_idx_sorted == false) {
+        return 0;
+    }
+    uint32_t lo = 0, hi = gs_trace_idx_count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (gs_trace_idx[mid].timestamp < from) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Record selection for `trace list`.  Without filter all records are visited in order,
+// otherwise the index is used to go straight to the matching ones.
+typedef struct {
+    bool enabled;
+    uint32_t from;
+    uint32_t to;
+    bool only_reader;
+    bool only_tag;
+    bool started;
+    uint32_t i;         // next index entry to look at
+} trace_filter_t;
+
+// advance *tracepos to the next record to print.  *tracepos holds the position returned by the last
+// print call,  records already consumed by it (merged frames) are skipped.
+static bool trace_filter_next(trace_filter_t *f, uint32_t *tracepos) {
+    if (f->enabled == false) {
+        return (*tracepos < gs_traceLen);
+    }
+
+    if (f->started == false) {
+        f->i = trace_index_first(f->from);
+        f->started = true;
+    }
+
+    for (; f->i < gs_trace_idx_count; f->i++) {
+        const trace_idx_entry_t *e = &gs_trace_idx[f->i];
+        if (e->offset < *tracepos) {
+            continue;
+        }
+        if (e->timestamp > f->to) {
+            if (gs_trace_idx_sorted) {
+                break;
+            }
+            continue;
+        }
+        if (e->timestamp < f->from) {
+            continue;
+        }
+        if (f->only_reader && (e->flags & TRACE_IDX_RESPONSE)) {
+            continue;
+        }
+        if (f->only_tag && (e->flags & TRACE_IDX_RESPONSE) == 0) {
+            continue;
+        }
+        *tracepos = e->offset;
+        f->i++;
+        return true;
+    }
+    return false;
+}
+
+// download the trace from device.  If cb is set,  it is called while the download is still running
+// every time more of the trace has arrived (see GetFromDeviceStream)
+static int download_trace_ex(download_chunk_cb_t cb, void *cb_ctx) {
 
     if (IfPm3Present() == false) {
         PrintAndLogEx(FAILED, "You requested a trace upload in offline mode, consider using parameter '-1' for working from Tracebuffer");
@@ -927,6 +1181,8 @@ static int download_trace(void) {
     if (gs_trace)
         free(gs_trace);
 
+    trace_index_free();
+
     gs_traceLen = 0;
 
     gs_trace = calloc(PM3_CMD_DATA_SIZE, sizeof(uint8_t));
@@ -958,16 +1214,67 @@ static int download_trace(void) {
             return PM3_EMALLOC;
         }
 
-        if (!GetFromDevice(BIG_BUF, gs_trace, gs_traceLen, 0, NULL, 0, NULL, 2500, false)) {
+        if (!GetFromDeviceStream(gs_trace, gs_traceLen, 0, NULL, 2500, false, cb, cb_ctx)) {
             PrintAndLogEx(WARNING, "command execution time out");
             free(gs_trace);
             gs_trace = NULL;
+            gs_traceLen = 0;
             return PM3_ETIMEOUT;
         }
+    } else if (cb) {
+        cb(gs_trace, gs_traceLen, cb_ctx);
     }
     return PM3_SUCCESS;
 }
 
+static int download_trace(void) {
+    return download_trace_ex(NULL, NULL);
+}
+
+// Streaming trace list.
+// Records are decoded as soon as they have been downloaded.  printTraceLine looks at the records
+// following the current one (wait cycles, merging of topaz reader frames), so a record is only
+// printed once TRACE_STREAM_LOOKAHEAD more complete records have arrived.  Whatever is left is
+// printed when the download is done.
+#define TRACE_STREAM_LOOKAHEAD  16
+
+typedef struct {
+    uint32_t tracepos;
+    uint8_t protocol;
+    bool show_wait_cycles;
+    bool mark_crc;
+    uint32_t *prev_eot;
+    bool use_us;
+    const uint64_t *dicKeys;
+    uint32_t dicKeysCount;
+    bool stop;
+} trace_stream_t;
+
+static bool trace_records_available(const uint8_t *trace, uint32_t tracepos, uint32_t available, uint32_t records) {
+    for (uint32_t i = 0; i < records; i++) {
+        if (tracepos + TRACELOG_HDR_LEN > available) {
+            return false;
+        }
+        tracelog_hdr_t *hdr = (tracelog_hdr_t *)(trace + tracepos);
+        tracepos += TRACELOG_HDR_LEN + hdr->data_len + TRACELOG_PARITY_LEN(hdr);
+        if (tracepos > available) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void trace_stream_chunk(const uint8_t *trace, uint32_t available, void *ctx) {
+    trace_stream_t *s = ctx;
+    while (s->stop == false && trace_records_available(trace, s->tracepos, available, TRACE_STREAM_LOOKAHEAD + 1)) {
+        s->tracepos = printTraceLine(s->tracepos, available, (uint8_t *)trace, s->protocol, s->show_wait_cycles, s->mark_crc,
+                                     s->prev_eot, s->use_us, s->dicKeys, s->dicKeysCount);
+        if (kbd_enter_pressed()) {
+            s->stop = true;
+        }
+    }
+}
+
 // sanity check. Don't use proxmark if it is offline and you didn't specify useTraceBuffer
 /*
 static int SanityOfflineCheck( bool useTraceBuffer ){
@@ -1011,7 +1318,7 @@ static int CmdTraceExtract(const char *Cmd) {
         return PM3_SUCCESS;
     }
 
-    uint16_t tracepos = 0;
+    uint32_t tracepos = 0;
 
     while (tracepos < gs_traceLen) {
         tracepos = extractChallenges(tracepos, gs_traceLen, gs_trace);
@@ -1048,6 +1355,7 @@ static int CmdTraceLoad(const char *Cmd) {
         free(gs_trace);
         gs_trace = NULL;
     }
+    trace_index_free();
 
     size_t len = 0;
     if (loadFile_safe(filename, ".trace", (void **)&gs_trace, &len) != PM3_SUCCESS) {
@@ -1055,9 +1363,28 @@ static int CmdTraceLoad(const char *Cmd) {
         return PM3_EIO;
     }
 
-    gs_traceLen = (long)len;
+    if (len > UINT32_MAX) {
+        PrintAndLogEx(FAILED, "Trace file too large ( %zu bytes )", len);
+        free(gs_trace);
+        gs_trace = NULL;
+        gs_traceLen = 0;
+        return PM3_EFILE;
+    }
+    gs_traceLen = (uint32_t)len;
+
+    // reuse the index saved with the trace,  otherwise build it now
+    char *path = NULL;
+    bool idx_loaded = false;
+    if (searchFile(&path, RESOURCES_SUBDIR, filename, ".trace", true) == PM3_SUCCESS) {
+        idx_loaded = trace_index_load(path);
+        free(path);
+    }
+    if (idx_loaded == false) {
+        trace_index_build();
+    }
 
     PrintAndLogEx(SUCCESS, "Recorded Activity (TraceLen = " _YELLOW_("%u") " bytes)", gs_traceLen);
+    PrintAndLogEx(DEBUG, "trace index %s, %u records", (idx_loaded) ? "loaded" : "built", gs_trace_idx_count);
     PrintAndLogEx(HINT, "try " _YELLOW_("`trace list -1 -t ...`") " to view trace.  Remember the " _YELLOW_("`-1`") " param");
     return PM3_SUCCESS;
 }
@@ -1067,7 +1394,7 @@ static int CmdTraceSave(const char *Cmd) {
     CLIParserContext *ctx;
     CLIParserInit(&ctx, "trace save",
                   "Save protocol data from trace buffer to binary file\n"
-                  "File extension is <.trace>",
+                  "File extension is <.trace>,  a record index is saved next to it as <.trace.idx>",
                   "trace save -f mytracefile    -> w/o file extension"
                  );
 
@@ -1091,8 +1418,18 @@ static int CmdTraceSave(const char *Cmd) {
         }
     }
 
-    saveFile(filename, ".trace", gs_trace, gs_traceLen);
-    return PM3_SUCCESS;
+    // pick the final file name here,  the index is stored next to it
+    char *fn = newfilenamemcopy(filename, ".trace");
+    if (fn == NULL) {
+        return PM3_EMALLOC;
+    }
+
+    int res = saveFile(fn, ".trace", gs_trace, gs_traceLen);
+    if (res == PM3_SUCCESS) {
+        trace_index_save(fn);
+    }
+    free(fn);
+    return res;
 }
 
 int CmdTraceListAlias(const char *Cmd, const char *alias, const char *protocol) {
@@ -1122,6 +1459,11 @@ int CmdTraceListAlias(const char *Cmd, const char *alias, const char *protocol)
         arg_lit0("x", NULL, "show hexdump to convert to pcap(ng)\n"
                  "                                   or to import into Wireshark using encapsulation type \"ISO 14443\""),
         arg_str0("f", "file", "<fn>", "filename of dictionary"),
+        arg_lit0(NULL, "stream", "print records while the trace is still being downloaded"),
+        arg_u64_0(NULL, "from", "<dec>", "only show records starting at or after this timestamp"),
+        arg_u64_0(NULL, "to", "<dec>", "only show records starting at or before this timestamp"),
+        arg_lit0(NULL, "reader", "only show reader to tag frames"),
+        arg_lit0(NULL, "tag", "only show tag to reader frames"),
         arg_param_end
     };
     CLIExecWithReturn(ctx, Cmd, argtable, true);
@@ -1160,7 +1502,10 @@ int CmdTraceList(const char *Cmd) {
                   "\n"
                   "trace list -t mf -f mfc_default_keys.dic     -> use default dictionary file\n"
                   "trace list -t 14a --frame                    -> show frame delay times\n"
-                  "trace list -t 14a -1                         -> use trace buffer "
+                  "trace list -t 14a -1                         -> use trace buffer\n"
+                  "trace list -t 14a --stream                   -> decode while downloading from device\n"
+                  "trace list -t 14a -1 --from 1000 --to 90000  -> only records within a time range\n"
+                  "trace list -t 14a -1 --tag                   -> only tag to reader frames"
                  );
 
     void *argtable[] = {
@@ -1174,6 +1519,11 @@ int CmdTraceList(const char *Cmd) {
                  "                                   or to import into Wireshark using encapsulation type \"ISO 14443\""),
         arg_str0("t", "type", NULL, "protocol to annotate the trace"),
         arg_str0("f", "file", "<fn>", "filename of dictionary"),
+        arg_lit0(NULL, "stream", "print records while the trace is still being downloaded"),
+        arg_u64_0(NULL, "from", "<dec>", "only show records starting at or after this timestamp"),
+        arg_u64_0(NULL, "to", "<dec>", "only show records starting at or before this timestamp"),
+        arg_lit0(NULL, "reader", "only show reader to tag frames"),
+        arg_lit0(NULL, "tag", "only show tag to reader frames"),
         arg_param_end
     };
     CLIExecWithReturn(ctx, Cmd, argtable, true);
@@ -1197,6 +1547,21 @@ int CmdTraceList(const char *Cmd) {
         diclen = 0;
     }
 
+    uint32_t ts_from = arg_get_u32_def(ctx, 10, 0);
+    uint32_t ts_to = arg_get_u32_def(ctx, 11, UINT32_MAX);
+    bool only_reader = arg_get_lit(ctx, 12);
+    bool only_tag = arg_get_lit(ctx, 13);
+    bool use_filter = (ts_from != 0) || (ts_to != UINT32_MAX) || only_reader || only_tag;
+
+    if (only_reader && only_tag) {
+        PrintAndLogEx(FAILED, "Select only one of " _YELLOW_("--reader") " or " _YELLOW_("--tag"));
+        CLIParserFree(ctx);
+        return PM3_EINVARG;
+    }
+
+    // streaming only makes sense when downloading from device,  filters need the complete trace
+    bool use_stream = arg_get_lit(ctx, 9) && (use_buffer == false) && (show_hex == false) && (use_filter == false);
+
     CLIParserFree(ctx);
 
     clearCommandBuffer();
@@ -1229,7 +1594,12 @@ int CmdTraceList(const char *Cmd) {
         return PM3_EINVARG;
     }
 
-    if (use_buffer == false) {
+    if (use_stream) {
+        if (IfPm3Present() == false) {
+            PrintAndLogEx(FAILED, "You requested a trace upload in offline mode, consider using parameter '-1' for working from Tracebuffer");
+            return PM3_EINVARG;
+        }
+    } else if (use_buffer == false) {
         download_trace();
     } else if (gs_traceLen == 0) {
         PrintAndLogEx(FAILED, "You requested a trace list in offline mode but there is no trace.");
@@ -1237,20 +1607,33 @@ int CmdTraceList(const char *Cmd) {
         return PM3_EINVARG;
     }
 
-    PrintAndLogEx(SUCCESS, "Recorded activity (trace len = " _YELLOW_("%u") " bytes)", gs_traceLen);
-    if (gs_traceLen == 0) {
-        return PM3_SUCCESS;
+    if (use_stream == false) {
+        PrintAndLogEx(SUCCESS, "Recorded activity (trace len = " _YELLOW_("%u") " bytes)", gs_traceLen);
+        if (gs_traceLen == 0) {
+            return PM3_SUCCESS;
+        }
     }
 
-    uint16_t tracepos = 0;
+    uint32_t tracepos = 0;
 
     /*
     if (protocol == FELICA) {
         printFelica(gs_traceLen, gs_trace);
     } */
 
+    trace_filter_t filter = {
+        .enabled = use_filter,
+        .from = ts_from,
+        .to = ts_to,
+        .only_reader = only_reader,
+        .only_tag = only_tag,
+    };
+    if (use_filter && trace_index_ensure() != PM3_SUCCESS) {
+        return PM3_EMALLOC;
+    }
+
     if (show_hex) {
-        while (tracepos < gs_traceLen) {
+        while (trace_filter_next(&filter, &tracepos)) {
             tracepos = printHexLine(tracepos, gs_traceLen, gs_trace, protocol);
         }
     } else {
@@ -1353,13 +1736,36 @@ int CmdTraceList(const char *Cmd) {
             prev_EOT = &previous_EOT;
         }
 
-        while (tracepos < gs_traceLen) {
+        bool stopped = false;
+        if (use_stream) {
+            trace_stream_t stream = {
+                .tracepos = 0,
+                .protocol = protocol,
+                .show_wait_cycles = show_wait_cycles,
+                .mark_crc = mark_crc,
+                .prev_eot = prev_EOT,
+                .use_us = use_us,
+                .dicKeys = dicKeys,
+                .dicKeysCount = dicKeysCount,
+                .stop = false,
+            };
+            download_trace_ex(trace_stream_chunk, &stream);
+            tracepos = stream.tracepos;
+            stopped = stream.stop;
+        }
+
+        while (stopped == false && trace_filter_next(&filter, &tracepos)) {
             tracepos = printTraceLine(tracepos, gs_traceLen, gs_trace, protocol, show_wait_cycles, mark_crc, prev_EOT, use_us, dicKeys, dicKeysCount);
 
             if (kbd_enter_pressed())
                 break;
         }
 
+        if (use_stream) {
+            PrintAndLogEx(NORMAL, "");
+            PrintAndLogEx(SUCCESS, "Recorded activity (trace len = " _YELLOW_("%u") " bytes)", gs_traceLen);
+        }
+
         if (dictionaryLoad)
             free((void *) dicKeys);
     }
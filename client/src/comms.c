@@ -22,6 +22,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "uart/uart.h"
 #include "ui.h"
@@ -33,43 +34,141 @@
 //#define COMMS_DEBUG
 //#define COMMS_DEBUG_RAW
 
-// Serial port that we are communicating with the PM3 on.
-static serial_port sp = NULL;
-
-communication_arg_t g_conn;
-capabilities_t g_pm3_capabilities;
-
-static pthread_t communication_thread;
-static bool comm_thread_dead = false;
+// How long the communication thread holds off reading the UART when the ring is full.
+// Stopping to read pushes back onto the device,  only after this the packet is dropped.
+#define RX_BACKPRESSURE_MS 1000
+
+// Upper bound for a single wait on rxBufferSig. Waiters are woken as soon as a packet arrives,
+// this only limits how late a timeout / the "press pm3 button" hint can be detected.
+#define RX_WAIT_SLICE_MS 100
+
+// Round trip latency histogram, from the moment a command hits the wire until the
+// matching response is picked up by WaitForResponseTimeoutW.
+// bucket 0 is < 1 ms,  bucket n is [2^(n-1), 2^n) ms,  last bucket takes the rest
+#define RTT_BUCKETS 14
+
+typedef struct {
+    PacketResponseNG packet;
+    uint64_t stored_at;     // msclock() when the slot was published, for queueing delay
+} rx_slot_t;
+
+// Everything needed to talk to one Proxmark3.
+// Each device has its own port, communication thread, transmit buffer and receive ring,
+// so several devices can be driven at the same time from different threads.
+struct pm3_comms {
+    // Serial port that we are communicating with the PM3 on.
+    serial_port sp;
+
+    pthread_t communication_thread;
+    bool comm_thread_running;
+    bool comm_thread_dead;
+    // port open and communication thread started
+    bool connected;
+
+    // Transmit buffer.
+    PacketCommandOLD txBuffer;
+    PacketCommandNGRaw txBufferNG;
+    size_t txBufferNGLen;
+    bool txBuffer_pending;
+    pthread_mutex_t txBufferMutex;
+    pthread_cond_t txBufferSig;
+
+    // Single producer / single consumer ring buffer for messages that are yet to be
+    // processed by a command handler (WaitForResponse{,Timeout}).
+    // The communication thread is the only producer, it parses NG frames straight into a free slot.
+    // The thread driving the device is the only consumer.  Head and tail are only ever written by their owner,
+    // so the ring itself needs no lock.  The mutex / condition variables are only used to sleep.
+    rx_slot_t rxBuffer[CMD_BUFFER_SIZE];
+
+    // Points to the next empty position to write to, only written by the communication thread
+    uint32_t cmd_head;
+
+    // Points to the position of the last unread command, only written by the consumer
+    uint32_t cmd_tail;
+
+    // to let producer and consumer sleep on each other
+    pthread_mutex_t rxBufferMutex;
+    // signaled by the communication thread whenever a reply is stored in rxBuffer
+    pthread_cond_t rxBufferSig;
+    // signaled by the consumer when a slot is freed while the communication thread waits for one
+    pthread_cond_t rxSpaceSig;
+    bool rx_producer_waiting;
+    // msclock() until which the frame being received may wait for a slot, only used by the communication thread
+    uint64_t rx_wait_until;
+
+    // ring statistics
+    uint64_t rx_stored;
+    uint64_t rx_dropped;
+    uint32_t rx_high_water;
+    uint64_t rx_delay_sum_ms;
+    uint64_t rx_delay_max_ms;
+    uint64_t rx_consumed;
+
+    uint64_t rtt_histogram[RTT_BUCKETS];
+    uint64_t rtt_sum_ms;
+    uint64_t rtt_max_ms;
+    uint64_t rtt_send_time;
+    bool rtt_pending;
+
+    // Start time for WaitForResponseTimeout & dl_it, so we can reset timeout when we get packets
+    // as sending lot of these packets can slow down things wuite a lot on slow links (e.g. hw status or lf read at 9600)
+    uint64_t timeout_start_time;
+
+    uint64_t last_packet_time;
+};
+
+#define PM3_COMMS_INITIALIZER { \
+        .txBufferMutex = PTHREAD_MUTEX_INITIALIZER, \
+        .txBufferSig = PTHREAD_COND_INITIALIZER, \
+        .rxBufferMutex = PTHREAD_MUTEX_INITIALIZER, \
+        .rxBufferSig = PTHREAD_COND_INITIALIZER, \
+        .rxSpaceSig = PTHREAD_COND_INITIALIZER, \
+    }
 
-// Transmit buffer.
-static PacketCommandOLD txBuffer;
-static PacketCommandNGRaw txBufferNG;
-static size_t txBufferNGLen;
-static bool txBuffer_pending = false;
-static pthread_mutex_t txBufferMutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t txBufferSig = PTHREAD_COND_INITIALIZER;
+// Used by threads that did not pick a device and no console device exists yet, i.e. offline.
+static struct pm3_comms offline_comms = PM3_COMMS_INITIALIZER;
+static pm3_device_t offline_device = { .comms = &offline_comms };
 
-// Used by PacketResponseReceived as a ring buffer for messages that are yet to be
-// processed by a command handler (WaitForResponse{,Timeout})
-static PacketResponseNG rxBuffer[CMD_BUFFER_SIZE];
+// Device the calling thread talks to, see SetCurrentDevice
+static _Thread_local pm3_device_t *thread_device = NULL;
 
-// Points to the next empty position to write to
-static int cmd_head = 0;
+// number of devices with a running communication thread
+static uint32_t open_devices = 0;
 
-// Points to the position of the last unread command
-static int cmd_tail = 0;
+pm3_device_t *GetCurrentDevice(void) {
+    if (thread_device != NULL) {
+        return thread_device;
+    }
+    if (g_session.current_device != NULL) {
+        return g_session.current_device;
+    }
+    return &offline_device;
+}
 
-// to lock rxBuffer operations from different threads
-static pthread_mutex_t rxBufferMutex = PTHREAD_MUTEX_INITIALIZER;
+pm3_device_t *SetCurrentDevice(pm3_device_t *dev) {
+    pm3_device_t *prev = thread_device;
+    thread_device = dev;
+    return prev;
+}
 
-// Global start time for WaitForResponseTimeout & dl_it, so we can reset timeout when we get packets
-// as sending lot of these packets can slow down things wuite a lot on slow links (e.g. hw status or lf read at 9600)
-static uint64_t timeout_start_time;
+static struct pm3_comms *comms_current(void) {
+    return GetCurrentDevice()->comms;
+}
 
-static uint64_t last_packet_time;
+static struct pm3_comms *comms_new(void) {
+    struct pm3_comms *c = calloc(1, sizeof(struct pm3_comms));
+    if (c == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&c->txBufferMutex, NULL);
+    pthread_cond_init(&c->txBufferSig, NULL);
+    pthread_mutex_init(&c->rxBufferMutex, NULL);
+    pthread_cond_init(&c->rxBufferSig, NULL);
+    pthread_cond_init(&c->rxSpaceSig, NULL);
+    return c;
+}
 
-static bool dl_it(uint8_t *dest, uint32_t bytes, PacketResponseNG *response, size_t ms_timeout, bool show_warning, uint32_t rec_cmd);
+static bool dl_it(uint8_t *dest, uint32_t bytes, PacketResponseNG *response, size_t ms_timeout, bool show_warning, uint32_t rec_cmd, download_chunk_cb_t cb, void *cb_ctx);
 
 // Simple alias to track usages linked to the Bootloader, these commands must not be migrated.
 // - commands sent to enter bootloader mode as we might have to talk to old firmwares
@@ -79,45 +178,46 @@ void SendCommandBL(uint64_t cmd, uint64_t arg0, uint64_t arg1, uint64_t arg2, vo
 }
 
 void SendCommandOLD(uint64_t cmd, uint64_t arg0, uint64_t arg1, uint64_t arg2, void *data, size_t len) {
-    PacketCommandOLD c = {CMD_UNKNOWN, {0, 0, 0}, {{0}}};
-    c.cmd = cmd;
-    c.arg[0] = arg0;
-    c.arg[1] = arg1;
-    c.arg[2] = arg2;
+    PacketCommandOLD packet = {CMD_UNKNOWN, {0, 0, 0}, {{0}}};
+    packet.cmd = cmd;
+    packet.arg[0] = arg0;
+    packet.arg[1] = arg1;
+    packet.arg[2] = arg2;
     if (len && data)
-        memcpy(&c.d, data, len);
+        memcpy(&packet.d, data, len);
 
 #ifdef COMMS_DEBUG
     PrintAndLogEx(NORMAL, "Sending %s", "OLD");
 #endif
 #ifdef COMMS_DEBUG_RAW
-    print_hex_break((uint8_t *)&c.cmd, sizeof(c.cmd), 32);
-    print_hex_break((uint8_t *)&c.arg, sizeof(c.arg), 32);
-    print_hex_break((uint8_t *)&c.d, sizeof(c.d), 32);
+    print_hex_break((uint8_t *)&packet.cmd, sizeof(packet.cmd), 32);
+    print_hex_break((uint8_t *)&packet.arg, sizeof(packet.arg), 32);
+    print_hex_break((uint8_t *)&packet.d, sizeof(packet.d), 32);
 #endif
 
-    if (!g_session.pm3_present) {
+    struct pm3_comms *c = comms_current();
+    if (c->connected == false) {
         PrintAndLogEx(WARNING, "Sending bytes to Proxmark3 failed." _YELLOW_("offline"));
         return;
     }
 
-    pthread_mutex_lock(&txBufferMutex);
+    pthread_mutex_lock(&c->txBufferMutex);
     /**
     This causes hangups at times, when the pm3 unit is unresponsive or disconnected. The main console thread is alive,
     but comm thread just spins here. Not good.../holiman
     **/
-    while (txBuffer_pending) {
+    while (c->txBuffer_pending) {
         // wait for communication thread to complete sending a previous command
-        pthread_cond_wait(&txBufferSig, &txBufferMutex);
+        pthread_cond_wait(&c->txBufferSig, &c->txBufferMutex);
     }
 
-    txBuffer = c;
-    txBuffer_pending = true;
+    c->txBuffer = packet;
+    c->txBuffer_pending = true;
 
     // tell communication thread that a new command can be send
-    pthread_cond_signal(&txBufferSig);
+    pthread_cond_signal(&c->txBufferSig);
 
-    pthread_mutex_unlock(&txBufferMutex);
+    pthread_mutex_unlock(&c->txBufferMutex);
 
 //__atomic_test_and_set(&txcmd_pending, __ATOMIC_SEQ_CST);
 }
@@ -127,7 +227,8 @@ static void SendCommandNG_internal(uint16_t cmd, uint8_t *data, size_t len, bool
     PrintAndLogEx(INFO, "Sending %s", ng ? "NG" : "MIX");
 #endif
 
-    if (!g_session.pm3_present) {
+    struct pm3_comms *c = comms_current();
+    if (c->connected == false) {
         PrintAndLogEx(INFO, "Sending bytes to proxmark failed - offline");
         return;
     }
@@ -136,51 +237,51 @@ static void SendCommandNG_internal(uint16_t cmd, uint8_t *data, size_t len, bool
         return;
     }
 
-    PacketCommandNGPostamble *tx_post = (PacketCommandNGPostamble *)((uint8_t *)&txBufferNG + sizeof(PacketCommandNGPreamble) + len);
+    PacketCommandNGPostamble *tx_post = (PacketCommandNGPostamble *)((uint8_t *)&c->txBufferNG + sizeof(PacketCommandNGPreamble) + len);
 
-    pthread_mutex_lock(&txBufferMutex);
+    pthread_mutex_lock(&c->txBufferMutex);
     /**
     This causes hangups at times, when the pm3 unit is unresponsive or disconnected. The main console thread is alive,
     but comm thread just spins here. Not good.../holiman
     **/
-    while (txBuffer_pending) {
+    while (c->txBuffer_pending) {
         // wait for communication thread to complete sending a previous command
-        pthread_cond_wait(&txBufferSig, &txBufferMutex);
+        pthread_cond_wait(&c->txBufferSig, &c->txBufferMutex);
     }
 
-    txBufferNG.pre.magic = COMMANDNG_PREAMBLE_MAGIC;
-    txBufferNG.pre.ng = ng;
-    txBufferNG.pre.length = len;
-    txBufferNG.pre.cmd = cmd;
+    c->txBufferNG.pre.magic = COMMANDNG_PREAMBLE_MAGIC;
+    c->txBufferNG.pre.ng = ng;
+    c->txBufferNG.pre.length = len;
+    c->txBufferNG.pre.cmd = cmd;
     if (len > 0 && data)
-        memcpy(&txBufferNG.data, data, len);
+        memcpy(&c->txBufferNG.data, data, len);
 
     if ((g_conn.send_via_fpc_usart && g_conn.send_with_crc_on_fpc) || ((!g_conn.send_via_fpc_usart) && g_conn.send_with_crc_on_usb)) {
         uint8_t first, second;
-        compute_crc(CRC_14443_A, (uint8_t *)&txBufferNG, sizeof(PacketCommandNGPreamble) + len, &first, &second);
+        compute_crc(CRC_14443_A, (uint8_t *)&c->txBufferNG, sizeof(PacketCommandNGPreamble) + len, &first, &second);
         tx_post->crc = (first << 8) + second;
     } else {
         tx_post->crc = COMMANDNG_POSTAMBLE_MAGIC;
     }
 
-    txBufferNGLen = sizeof(PacketCommandNGPreamble) + len + sizeof(PacketCommandNGPostamble);
+    c->txBufferNGLen = sizeof(PacketCommandNGPreamble) + len + sizeof(PacketCommandNGPostamble);
 
 #ifdef COMMS_DEBUG_RAW
-    print_hex_break((uint8_t *)&txBufferNG.pre, sizeof(PacketCommandNGPreamble), 32);
+    print_hex_break((uint8_t *)&c->txBufferNG.pre, sizeof(PacketCommandNGPreamble), 32);
     if (ng) {
-        print_hex_break((uint8_t *)&txBufferNG.data, len, 32);
+        print_hex_break((uint8_t *)&c->txBufferNG.data, len, 32);
     } else {
-        print_hex_break((uint8_t *)&txBufferNG.data, 3 * sizeof(uint64_t), 32);
-        print_hex_break((uint8_t *)&txBufferNG.data + 3 * sizeof(uint64_t), len - 3 * sizeof(uint64_t), 32);
+        print_hex_break((uint8_t *)&c->txBufferNG.data, 3 * sizeof(uint64_t), 32);
+        print_hex_break((uint8_t *)&c->txBufferNG.data + 3 * sizeof(uint64_t), len - 3 * sizeof(uint64_t), 32);
     }
     print_hex_break((uint8_t *)tx_post, sizeof(PacketCommandNGPostamble), 32);
 #endif
-    txBuffer_pending = true;
+    c->txBuffer_pending = true;
 
     // tell communication thread that a new command can be send
-    pthread_cond_signal(&txBufferSig);
+    pthread_cond_signal(&c->txBufferSig);
 
-    pthread_mutex_unlock(&txBufferMutex);
+    pthread_mutex_unlock(&c->txBufferMutex);
 
 //__atomic_test_and_set(&txcmd_pending, __ATOMIC_SEQ_CST);
 }
@@ -210,65 +311,249 @@ void SendCommandMIX(uint64_t cmd, uint64_t arg0, uint64_t arg1, uint64_t arg2, v
  *  operation. Right now we'll just have to live with this.
  */
 void clearCommandBuffer(void) {
+    struct pm3_comms *c = comms_current();
     //This is a very simple operation
-    pthread_mutex_lock(&rxBufferMutex);
-    cmd_tail = cmd_head;
-    pthread_mutex_unlock(&rxBufferMutex);
+    __atomic_store_n(&c->cmd_tail, __atomic_load_n(&c->cmd_head, __ATOMIC_ACQUIRE), __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&c->rx_producer_waiting, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&c->rxBufferMutex);
+        pthread_cond_signal(&c->rxSpaceSig);
+        pthread_mutex_unlock(&c->rxBufferMutex);
+    }
+}
+
+static void ms_to_abstime(uint32_t ms, struct timespec *ts) {
+    clock_gettime(CLOCK_REALTIME, ts);
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
 }
+
+static bool rx_ring_full(struct pm3_comms *c) {
+    uint32_t head = __atomic_load_n(&c->cmd_head, __ATOMIC_RELAXED);
+    return ((head + 1) % CMD_BUFFER_SIZE) == __atomic_load_n(&c->cmd_tail, __ATOMIC_SEQ_CST);
+}
+
 /**
- * @brief storeCommand stores a USB command in a circular buffer
- * @param UC
+ * @brief rxSlotAcquire hands out the slot at 'head' to the communication thread, to be filled in place.
+ *  When the ring is full we stop reading from the device until the consumer frees a slot,
+ *  for at most RX_BACKPRESSURE_MS per frame, see rx_wait_until.
+ * @return pointer to the free slot, or NULL if the ring stayed full
  */
-static void storeReply(PacketResponseNG *packet) {
-    pthread_mutex_lock(&rxBufferMutex);
-    if ((cmd_head + 1) % CMD_BUFFER_SIZE == cmd_tail) {
-        //If these two are equal, we're about to overwrite in the
-        // circular buffer.
-        PrintAndLogEx(FAILED, "WARNING: Command buffer about to overwrite command! This needs to be fixed!");
-        fflush(stdout);
+static PacketResponseNG *rxSlotAcquire(struct pm3_comms *c) {
+    uint64_t now = msclock();
+    if (rx_ring_full(c) && now < c->rx_wait_until) {
+        struct timespec ts;
+        ms_to_abstime(c->rx_wait_until - now, &ts);
+
+        pthread_mutex_lock(&c->rxBufferMutex);
+        __atomic_store_n(&c->rx_producer_waiting, true, __ATOMIC_SEQ_CST);
+        while (rx_ring_full(c)) {
+            if (pthread_cond_timedwait(&c->rxSpaceSig, &c->rxBufferMutex, &ts) != 0) {
+                break;
+            }
+        }
+        __atomic_store_n(&c->rx_producer_waiting, false, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&c->rxBufferMutex);
+    }
+    if (rx_ring_full(c)) {
+        return NULL;
+    }
+    return &c->rxBuffer[__atomic_load_n(&c->cmd_head, __ATOMIC_RELAXED)].packet;
+}
+
+/**
+ * @brief storeReply publishes a packet to the consumer.
+ *  If the packet was parsed into the slot from rxSlotAcquire this is just an index bump,
+ *  otherwise it is copied into a free slot first.
+ * @param packet
+ */
+static void storeReply(struct pm3_comms *c, PacketResponseNG *packet) {
+    uint32_t head = __atomic_load_n(&c->cmd_head, __ATOMIC_RELAXED);
+    PacketResponseNG *destination = &c->rxBuffer[head].packet;
+
+    if (packet != destination) {
+        destination = rxSlotAcquire(c);
+        if (destination == NULL) {
+            __atomic_add_fetch(&c->rx_dropped, 1, __ATOMIC_SEQ_CST);
+            PrintAndLogEx(FAILED, "WARNING: Command buffer full, dropping packet (cmd %04x)", packet->cmd);
+            return;
+        }
+        memcpy(destination, packet, sizeof(PacketResponseNG));
     }
-    //Store the command at the 'head' location
-    PacketResponseNG *destination = &rxBuffer[cmd_head];
-    memcpy(destination, packet, sizeof(PacketResponseNG));
+
+    c->rxBuffer[head].stored_at = msclock();
 
     //increment head and wrap
-    cmd_head = (cmd_head + 1) % CMD_BUFFER_SIZE;
-    pthread_mutex_unlock(&rxBufferMutex);
+    uint32_t next = (head + 1) % CMD_BUFFER_SIZE;
+    __atomic_store_n(&c->cmd_head, next, __ATOMIC_RELEASE);
+
+    uint32_t used = (next + CMD_BUFFER_SIZE - __atomic_load_n(&c->cmd_tail, __ATOMIC_ACQUIRE)) % CMD_BUFFER_SIZE;
+    if (used > c->rx_high_water) {
+        __atomic_store_n(&c->rx_high_water, used, __ATOMIC_SEQ_CST);
+    }
+    __atomic_add_fetch(&c->rx_stored, 1, __ATOMIC_SEQ_CST);
+
+    // wake up anyone waiting in WaitForResponseTimeoutW / dl_it
+    pthread_mutex_lock(&c->rxBufferMutex);
+    pthread_cond_broadcast(&c->rxBufferSig);
+    pthread_mutex_unlock(&c->rxBufferMutex);
 }
+
+/**
+ * @brief peekReply gives a reference to the oldest unread packet, without copying it.
+ *  The slot stays valid until releaseReply(c) or clearCommandBuffer() is called.
+ * @return pointer to packet, or NULL if nothing has been received
+ */
+static PacketResponseNG *peekReply(struct pm3_comms *c) {
+    uint32_t tail = __atomic_load_n(&c->cmd_tail, __ATOMIC_RELAXED);
+    //If head == tail, there's nothing to read, or if we just got initialized
+    if (__atomic_load_n(&c->cmd_head, __ATOMIC_ACQUIRE) == tail) {
+        return NULL;
+    }
+    return &c->rxBuffer[tail].packet;
+}
+
+static void releaseReply(struct pm3_comms *c) {
+    uint32_t tail = __atomic_load_n(&c->cmd_tail, __ATOMIC_RELAXED);
+
+    uint64_t delay = msclock() - c->rxBuffer[tail].stored_at;
+    c->rx_delay_sum_ms += delay;
+    c->rx_consumed++;
+    if (delay > c->rx_delay_max_ms) {
+        c->rx_delay_max_ms = delay;
+    }
+
+    //Increment tail - this is a circular buffer, so modulo buffer size
+    __atomic_store_n(&c->cmd_tail, (tail + 1) % CMD_BUFFER_SIZE, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&c->rx_producer_waiting, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&c->rxBufferMutex);
+        pthread_cond_signal(&c->rxSpaceSig);
+        pthread_mutex_unlock(&c->rxBufferMutex);
+    }
+}
+
 /**
  * @brief getCommand gets a command from an internal circular buffer.
  * @param response location to write command
  * @return 1 if response was returned, 0 if nothing has been received
  */
-static int getReply(PacketResponseNG *packet) {
-    pthread_mutex_lock(&rxBufferMutex);
-    //If head == tail, there's nothing to read, or if we just got initialized
-    if (cmd_head == cmd_tail)  {
-        pthread_mutex_unlock(&rxBufferMutex);
+static int getReply(struct pm3_comms *c, PacketResponseNG *packet) {
+    PacketResponseNG *p = peekReply(c);
+    if (p == NULL) {
         return 0;
     }
 
     //Pick out the next unread command
-    memcpy(packet, &rxBuffer[cmd_tail], sizeof(PacketResponseNG));
+    memcpy(packet, p, sizeof(PacketResponseNG));
+    releaseReply(c);
+    return 1;
+}
 
-    //Increment tail - this is a circular buffer, so modulo buffer size
-    cmd_tail = (cmd_tail + 1) % CMD_BUFFER_SIZE;
+/**
+ * @brief waitReply blocks until a reply is available in the ring buffer or ms have elapsed.
+ *  Unlike polling with msleep, the caller is woken up as soon as the communication thread stores a packet.
+ * @param ms maximum time to wait
+ * @return true if a reply is available
+ */
+static bool waitReply(struct pm3_comms *c, uint32_t ms) {
+    if (peekReply(c) != NULL) {
+        return true;
+    }
 
-    pthread_mutex_unlock(&rxBufferMutex);
-    return 1;
+    struct timespec ts;
+    ms_to_abstime(ms, &ts);
+
+    pthread_mutex_lock(&c->rxBufferMutex);
+    while (peekReply(c) == NULL) {
+        if (pthread_cond_timedwait(&c->rxBufferSig, &c->rxBufferMutex, &ts) != 0) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&c->rxBufferMutex);
+    return (peekReply(c) != NULL);
+}
+
+static void rtt_record(struct pm3_comms *c) {
+    // only the first matching response after a transmission counts
+    if (__atomic_exchange_n(&c->rtt_pending, false, __ATOMIC_SEQ_CST) == false)
+        return;
+
+    uint64_t rtt = msclock() - __atomic_load_n(&c->rtt_send_time, __ATOMIC_SEQ_CST);
+    uint8_t bucket = 0;
+    while ((bucket < RTT_BUCKETS - 1) && (rtt >= (1ULL << bucket))) {
+        bucket++;
+    }
+    __atomic_add_fetch(&c->rtt_histogram[bucket], 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&c->rtt_sum_ms, rtt, __ATOMIC_SEQ_CST);
+    if (rtt > __atomic_load_n(&c->rtt_max_ms, __ATOMIC_SEQ_CST)) {
+        __atomic_store_n(&c->rtt_max_ms, rtt, __ATOMIC_SEQ_CST);
+    }
+}
+
+void PrintCommsStats(void) {
+    struct pm3_comms *c = comms_current();
+    uint64_t total = 0;
+    uint64_t maxcnt = 0;
+    for (uint8_t i = 0; i < RTT_BUCKETS; i++) {
+        total += c->rtt_histogram[i];
+        maxcnt = MAX(maxcnt, c->rtt_histogram[i]);
+    }
+
+    PrintAndLogEx(INFO, "--- " _CYAN_("Client receive buffer") " ------------------------------");
+    PrintAndLogEx(INFO, "  packets queued....... " _YELLOW_("%" PRIu64), c->rx_stored);
+    if (c->rx_dropped) {
+        PrintAndLogEx(INFO, "  packets dropped...... " _RED_("%" PRIu64), c->rx_dropped);
+    } else {
+        PrintAndLogEx(INFO, "  packets dropped...... " _GREEN_("0"));
+    }
+    PrintAndLogEx(INFO, "  high water mark...... " _YELLOW_("%u") " / %u slots", c->rx_high_water, CMD_BUFFER_SIZE - 1);
+    if (c->rx_consumed) {
+        PrintAndLogEx(INFO, "  queueing delay....... avg " _YELLOW_("%" PRIu64) " ms,  max " _YELLOW_("%" PRIu64) " ms", c->rx_delay_sum_ms / c->rx_consumed, c->rx_delay_max_ms);
+    }
+
+    PrintAndLogEx(INFO, "--- " _CYAN_("Client round trip latency") " --------------------------");
+    if (total == 0) {
+        PrintAndLogEx(INFO, "  no round trips recorded yet");
+        return;
+    }
+
+    PrintAndLogEx(INFO, "  round trips.......... " _YELLOW_("%" PRIu64), total);
+    PrintAndLogEx(INFO, "  average.............. " _YELLOW_("%" PRIu64) " ms", c->rtt_sum_ms / total);
+    PrintAndLogEx(INFO, "  max.................. " _YELLOW_("%" PRIu64) " ms", c->rtt_max_ms);
+
+    for (uint8_t i = 0; i < RTT_BUCKETS; i++) {
+        if (c->rtt_histogram[i] == 0)
+            continue;
+
+        char bar[41] = {0};
+        memset(bar, '#', MAX(1, (size_t)(c->rtt_histogram[i] * 40 / maxcnt)));
+
+        if (i == 0) {
+            PrintAndLogEx(INFO, "  %5s - %5u ms  %8" PRIu64 " %s", "", 1, c->rtt_histogram[i], bar);
+        } else if (i == RTT_BUCKETS - 1) {
+            PrintAndLogEx(INFO, "  %5u - %5s ms  %8" PRIu64 " %s", 1U << (i - 1), "", c->rtt_histogram[i], bar);
+        } else {
+            PrintAndLogEx(INFO, "  %5u - %5u ms  %8" PRIu64 " %s", 1U << (i - 1), 1U << i, c->rtt_histogram[i], bar);
+        }
+    }
 }
 
 //-----------------------------------------------------------------------------
 // Entry point into our code: called whenever we received a packet over USB
 // that we weren't necessarily expecting, for example a debug print.
 //-----------------------------------------------------------------------------
-static void PacketResponseReceived(PacketResponseNG *packet) {
+static void PacketResponseReceived(struct pm3_comms *c, PacketResponseNG *packet) {
 
     // we got a packet, reset WaitForResponseTimeout timeout
-    uint64_t prev_clk = __atomic_load_n(&last_packet_time, __ATOMIC_SEQ_CST);
+    uint64_t prev_clk = __atomic_load_n(&c->last_packet_time, __ATOMIC_SEQ_CST);
     uint64_t clk = msclock();
-    __atomic_store_n(&timeout_start_time,  clk, __ATOMIC_SEQ_CST);
-    __atomic_store_n(&last_packet_time, clk, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&c->timeout_start_time,  clk, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&c->last_packet_time, clk, __ATOMIC_SEQ_CST);
     (void) prev_clk;
 //    PrintAndLogEx(NORMAL, "[%07"PRIu64"] RECV %s magic %08x length %04x status %04x crc %04x cmd %04x",
 //                clk - prev_clk, packet->ng ? "NG" : "OLD", packet->magic, packet->length, packet->status, packet->crc, packet->cmd);
@@ -324,15 +609,15 @@ static void PacketResponseReceived(PacketResponseNG *packet) {
         // CMD_DOWNLOAD_BIGBUF packages which is not dealt with. I wonder if simply ignoring them will
         // work. lets try it.
         default: {
-            storeReply(packet);
+            storeReply(c, packet);
             break;
         }
     }
 }
 
 
-// The communications thread.
-// signals to main thread when a response is ready to process.
+// The communications thread, one per device.
+// signals to the thread driving the device when a response is ready to process.
 //
 static void
 #ifdef __has_attribute
@@ -341,12 +626,18 @@ __attribute__((force_align_arg_pointer))
 #endif
 #endif
 *uart_communication(void *targ) {
-    communication_arg_t *connection = (communication_arg_t *)targ;
+    pm3_device_t *dev = (pm3_device_t *)targ;
+    communication_arg_t *connection = &dev->conn;
+    struct pm3_comms *c = dev->comms;
     uint32_t rxlen;
     bool commfailed = false;
-    PacketResponseNG rx;
+    PacketResponseNG rx_local;
+    PacketResponseNG *rx = &rx_local;
     PacketResponseNGRaw rx_raw;
 
+    // g_conn of this thread is the device it serves
+    SetCurrentDevice(dev);
+
 #if defined(__MACH__) && defined(__APPLE__)
     disableAppNap("Proxmark3 polling UART");
 #endif
@@ -364,34 +655,50 @@ __attribute__((force_align_arg_pointer))
             if (g_conn.last_command != CMD_HARDWARE_RESET) {
                 PrintAndLogEx(WARNING, "\nCommunicating with Proxmark3 device " _RED_("failed"));
             }
-            __atomic_test_and_set(&comm_thread_dead, __ATOMIC_SEQ_CST);
+            __atomic_test_and_set(&c->comm_thread_dead, __ATOMIC_SEQ_CST);
             break;
         }
 
-        res = uart_receive(sp, (uint8_t *)&rx_raw.pre, sizeof(PacketResponseNGPreamble), &rxlen);
+        res = uart_receive(c->sp, (uint8_t *)&rx_raw.pre, sizeof(PacketResponseNGPreamble), &rxlen);
         if ((res == PM3_SUCCESS) && (rxlen == sizeof(PacketResponseNGPreamble))) {
-            rx.magic = rx_raw.pre.magic;
+
+            // one bounded wait for a free slot per frame, shared by rxSlotAcquire here and in storeReply
+            c->rx_wait_until = msclock() + RX_BACKPRESSURE_MS;
+
+            // NG frames are parsed straight into the next free ring slot.
+            // Debug prints never reach the ring and OLD frames are rare,  those use a local buffer.
+            rx = &rx_local;
+            if ((rx_raw.pre.magic == RESPONSENG_PREAMBLE_MAGIC) &&
+                    (rx_raw.pre.cmd != CMD_DEBUG_PRINT_STRING) &&
+                    (rx_raw.pre.cmd != CMD_DEBUG_PRINT_INTEGERS)) {
+                PacketResponseNG *slot = rxSlotAcquire(c);
+                if (slot != NULL) {
+                    rx = slot;
+                }
+            }
+
+            rx->magic = rx_raw.pre.magic;
             uint16_t length = rx_raw.pre.length;
-            rx.ng = rx_raw.pre.ng;
-            rx.status = rx_raw.pre.status;
-            rx.cmd = rx_raw.pre.cmd;
-            if (rx.magic == RESPONSENG_PREAMBLE_MAGIC) { // New style NG reply
+            rx->ng = rx_raw.pre.ng;
+            rx->status = rx_raw.pre.status;
+            rx->cmd = rx_raw.pre.cmd;
+            if (rx->magic == RESPONSENG_PREAMBLE_MAGIC) { // New style NG reply
                 if (length > PM3_CMD_DATA_SIZE) {
                     PrintAndLogEx(WARNING, "Received packet frame with incompatible length: 0x%04x", length);
                     error = true;
                 }
                 if ((!error) && (length > 0)) { // Get the variable length payload
 
-                    res = uart_receive(sp, (uint8_t *)&rx_raw.data, length, &rxlen);
+                    res = uart_receive(c->sp, (uint8_t *)&rx_raw.data, length, &rxlen);
                     if ((res != PM3_SUCCESS) || (rxlen != length)) {
                         PrintAndLogEx(WARNING, "Received packet frame with variable part too short? %d/%d", rxlen, length);
                         error = true;
                     } else {
 
-                        if (rx.ng) {      // Received a valid NG frame
-                            memcpy(&rx.data, &rx_raw.data, length);
-                            rx.length = length;
-                            if ((rx.cmd == g_conn.last_command) && (rx.status == PM3_SUCCESS)) {
+                        if (rx->ng) {      // Received a valid NG frame
+                            memcpy(&rx->data, &rx_raw.data, length);
+                            rx->length = length;
+                            if ((rx->cmd == g_conn.last_command) && (rx->status == PM3_SUCCESS)) {
                                 ACK_received = true;
                             }
                         } else {
@@ -402,20 +709,20 @@ __attribute__((force_align_arg_pointer))
                             }
                             if (!error) { // Received a valid MIX frame
                                 memcpy(arg, &rx_raw.data, sizeof(arg));
-                                rx.oldarg[0] = arg[0];
-                                rx.oldarg[1] = arg[1];
-                                rx.oldarg[2] = arg[2];
-                                memcpy(&rx.data, ((uint8_t *)&rx_raw.data) + sizeof(arg), length - sizeof(arg));
-                                rx.length = length - sizeof(arg);
-                                if (rx.cmd == CMD_ACK) {
+                                rx->oldarg[0] = arg[0];
+                                rx->oldarg[1] = arg[1];
+                                rx->oldarg[2] = arg[2];
+                                memcpy(&rx->data, ((uint8_t *)&rx_raw.data) + sizeof(arg), length - sizeof(arg));
+                                rx->length = length - sizeof(arg);
+                                if (rx->cmd == CMD_ACK) {
                                     ACK_received = true;
                                 }
                             }
                         }
                     }
                 } else if ((!error) && (length == 0)) { // we received an empty frame
-                    if (rx.ng)
-                        rx.length = 0; // set received length to 0
+                    if (rx->ng)
+                        rx->length = 0; // set received length to 0
                     else {  // old frames can't be empty
                         PrintAndLogEx(WARNING, "Received empty MIX packet frame (length: 0x00)");
 
@@ -423,39 +730,39 @@ __attribute__((force_align_arg_pointer))
                     }
                 }
                 if (!error) {                        // Get the postamble
-                    res = uart_receive(sp, (uint8_t *)&rx_raw.foopost, sizeof(PacketResponseNGPostamble), &rxlen);
+                    res = uart_receive(c->sp, (uint8_t *)&rx_raw.foopost, sizeof(PacketResponseNGPostamble), &rxlen);
                     if ((res != PM3_SUCCESS) || (rxlen != sizeof(PacketResponseNGPostamble))) {
                         PrintAndLogEx(WARNING, "Received packet frame without postamble");
                         error = true;
                     }
                 }
                 if (!error) {                        // Check CRC, accept MAGIC as placeholder
-                    rx.crc = rx_raw.foopost.crc;
-                    if (rx.crc != RESPONSENG_POSTAMBLE_MAGIC) {
+                    rx->crc = rx_raw.foopost.crc;
+                    if (rx->crc != RESPONSENG_POSTAMBLE_MAGIC) {
                         uint8_t first, second;
                         compute_crc(CRC_14443_A, (uint8_t *)&rx_raw, sizeof(PacketResponseNGPreamble) + length, &first, &second);
-                        if ((first << 8) + second != rx.crc) {
-                            PrintAndLogEx(WARNING, "Received packet frame with invalid CRC %02X%02X <> %04X", first, second, rx.crc);
+                        if ((first << 8) + second != rx->crc) {
+                            PrintAndLogEx(WARNING, "Received packet frame with invalid CRC %02X%02X <> %04X", first, second, rx->crc);
                             error = true;
                         }
                     }
                 }
                 if (!error) {             // Received a valid OLD frame
 #ifdef COMMS_DEBUG
-                    PrintAndLogEx(NORMAL, "Receiving %s:", rx.ng ? "NG" : "MIX");
+                    PrintAndLogEx(NORMAL, "Receiving %s:", rx->ng ? "NG" : "MIX");
 #endif
 #ifdef COMMS_DEBUG_RAW
                     print_hex_break((uint8_t *)&rx_raw.pre, sizeof(PacketResponseNGPreamble), 32);
                     print_hex_break((uint8_t *)&rx_raw.data, rx_raw.pre.length, 32);
                     print_hex_break((uint8_t *)&rx_raw.foopost, sizeof(PacketResponseNGPostamble), 32);
 #endif
-                    PacketResponseReceived(&rx);
+                    PacketResponseReceived(c, rx);
                 }
             } else {                               // Old style reply
                 PacketResponseOLD rx_old;
                 memcpy(&rx_old, &rx_raw.pre, sizeof(PacketResponseNGPreamble));
 
-                res = uart_receive(sp, ((uint8_t *)&rx_old) + sizeof(PacketResponseNGPreamble), sizeof(PacketResponseOLD) - sizeof(PacketResponseNGPreamble), &rxlen);
+                res = uart_receive(c->sp, ((uint8_t *)&rx_old) + sizeof(PacketResponseNGPreamble), sizeof(PacketResponseOLD) - sizeof(PacketResponseNGPreamble), &rxlen);
                 if ((res != PM3_SUCCESS) || (rxlen != sizeof(PacketResponseOLD) - sizeof(PacketResponseNGPreamble))) {
                     PrintAndLogEx(WARNING, "Received packet OLD frame with payload too short? %d/%zu", rxlen, sizeof(PacketResponseOLD) - sizeof(PacketResponseNGPreamble));
                     error = true;
@@ -469,18 +776,18 @@ __attribute__((force_align_arg_pointer))
                     print_hex_break((uint8_t *)&rx_old.arg, sizeof(rx_old.arg), 32);
                     print_hex_break((uint8_t *)&rx_old.d, sizeof(rx_old.d), 32);
 #endif
-                    rx.ng = false;
-                    rx.magic = 0;
-                    rx.status = 0;
-                    rx.crc = 0;
-                    rx.cmd = rx_old.cmd;
-                    rx.oldarg[0] = rx_old.arg[0];
-                    rx.oldarg[1] = rx_old.arg[1];
-                    rx.oldarg[2] = rx_old.arg[2];
-                    rx.length = PM3_CMD_DATA_SIZE;
-                    memcpy(&rx.data, &rx_old.d, rx.length);
-                    PacketResponseReceived(&rx);
-                    if (rx.cmd == CMD_ACK) {
+                    rx->ng = false;
+                    rx->magic = 0;
+                    rx->status = 0;
+                    rx->crc = 0;
+                    rx->cmd = rx_old.cmd;
+                    rx->oldarg[0] = rx_old.arg[0];
+                    rx->oldarg[1] = rx_old.arg[1];
+                    rx->oldarg[2] = rx_old.arg[2];
+                    rx->length = PM3_CMD_DATA_SIZE;
+                    memcpy(&rx->data, &rx_old.d, rx->length);
+                    PacketResponseReceived(c, rx);
+                    if (rx->cmd == CMD_ACK) {
                         ACK_received = true;
                     }
                 }
@@ -497,7 +804,7 @@ __attribute__((force_align_arg_pointer))
 
         // TODO if error, shall we resync ?
 
-        pthread_mutex_lock(&txBufferMutex);
+        pthread_mutex_lock(&c->txBufferMutex);
 
         if (connection->block_after_ACK) {
             // if we just received an ACK, wait here until a new command is to be transmitted
@@ -506,43 +813,46 @@ __attribute__((force_align_arg_pointer))
 #ifdef COMMS_DEBUG
                 PrintAndLogEx(NORMAL, "Received ACK, fast TX mode: ignoring other RX till TX");
 #endif
-                while (!txBuffer_pending) {
-                    pthread_cond_wait(&txBufferSig, &txBufferMutex);
+                while (!c->txBuffer_pending) {
+                    pthread_cond_wait(&c->txBufferSig, &c->txBufferMutex);
                 }
             }
         }
 
-        if (txBuffer_pending) {
+        if (c->txBuffer_pending) {
 
-            if (txBufferNGLen) { // NG packet
-                res = uart_send(sp, (uint8_t *) &txBufferNG, txBufferNGLen);
+            if (c->txBufferNGLen) { // NG packet
+                res = uart_send(c->sp, (uint8_t *) &c->txBufferNG, c->txBufferNGLen);
                 if (res == PM3_EIO) {
                     commfailed = true;
                 }
-                g_conn.last_command = txBufferNG.pre.cmd;
-                txBufferNGLen = 0;
+                g_conn.last_command = c->txBufferNG.pre.cmd;
+                c->txBufferNGLen = 0;
             } else {
-                res = uart_send(sp, (uint8_t *) &txBuffer, sizeof(PacketCommandOLD));
+                res = uart_send(c->sp, (uint8_t *) &c->txBuffer, sizeof(PacketCommandOLD));
                 if (res == PM3_EIO) {
                     commfailed = true;
                 }
-                g_conn.last_command = txBuffer.cmd;
+                g_conn.last_command = c->txBuffer.cmd;
             }
 
-            txBuffer_pending = false;
+            __atomic_store_n(&c->rtt_send_time, msclock(), __ATOMIC_SEQ_CST);
+            __atomic_store_n(&c->rtt_pending, true, __ATOMIC_SEQ_CST);
+
+            c->txBuffer_pending = false;
 
             // main thread doesn't know send failed...
 
             // tell main thread that txBuffer is empty
-            pthread_cond_signal(&txBufferSig);
+            pthread_cond_signal(&c->txBufferSig);
         }
 
-        pthread_mutex_unlock(&txBufferMutex);
+        pthread_mutex_unlock(&c->txBufferMutex);
     }
 
     // when thread dies, we close the serial port.
-    uart_close(sp);
-    sp = NULL;
+    uart_close(c->sp);
+    c->sp = NULL;
 
 #if defined(__MACH__) && defined(__APPLE__)
     enableAppNap();
@@ -553,70 +863,102 @@ __attribute__((force_align_arg_pointer))
 }
 
 bool IsCommunicationThreadDead(void) {
-    bool ret = __atomic_load_n(&comm_thread_dead, __ATOMIC_SEQ_CST);
+    bool ret = __atomic_load_n(&comms_current()->comm_thread_dead, __ATOMIC_SEQ_CST);
     return ret;
 }
 
+// a device of its own that is not connected, commands run on it are offline
+pm3_device_t *NewProxmark(void) {
+    pm3_device_t *d = calloc(sizeof(pm3_device_t), sizeof(uint8_t));
+    if (d == NULL) {
+        PrintAndLogEx(WARNING, "Failed to allocate memory");
+        return NULL;
+    }
+    d->comms = comms_new();
+    if (d->comms == NULL) {
+        PrintAndLogEx(WARNING, "Failed to allocate memory");
+        free(d);
+        return NULL;
+    }
+    return d;
+}
+
 bool OpenProxmark(pm3_device_t **dev, const char *port, bool wait_for_port, int timeout, bool flash_mode, uint32_t speed) {
 
+    // every port gets its own device, the console keeps reusing g_session.current_device
+    pm3_device_t *d = *dev;
+    if (d == NULL) {
+        d = NewProxmark();
+        if (d == NULL) {
+            return false;
+        }
+    }
+    struct pm3_comms *c = d->comms;
+
+    // uart_open reports the port speed to g_conn, which has to be the one of this device
+    pm3_device_t *prev = SetCurrentDevice(d);
+
     if (!wait_for_port) {
         PrintAndLogEx(INFO, "Using UART port " _YELLOW_("%s"), port);
-        sp = uart_open(port, speed);
+        c->sp = uart_open(port, speed);
     } else {
         PrintAndLogEx(SUCCESS, "Waiting for Proxmark3 to appear on " _YELLOW_("%s"), port);
         fflush(stdout);
         int openCount = 0;
         PrintAndLogEx(INPLACE, "% 3i", timeout);
         do {
-            sp = uart_open(port, speed);
+            c->sp = uart_open(port, speed);
             msleep(500);
             PrintAndLogEx(INPLACE, "% 3i", timeout - openCount - 1);
 
-        } while (++openCount < timeout && (sp == INVALID_SERIAL_PORT || sp == CLAIMED_SERIAL_PORT));
+        } while (++openCount < timeout && (c->sp == INVALID_SERIAL_PORT || c->sp == CLAIMED_SERIAL_PORT));
     }
 
-    // check result of uart opening
-    if (sp == INVALID_SERIAL_PORT) {
-        PrintAndLogEx(WARNING, "\n" _RED_("ERROR:") " invalid serial port " _YELLOW_("%s"), port);
-        PrintAndLogEx(HINT, "Try the shell script " _YELLOW_("`./pm3 --list`") " to get a list of possible serial ports");
-        sp = NULL;
-        return false;
-    } else if (sp == CLAIMED_SERIAL_PORT) {
-        PrintAndLogEx(WARNING, "\n" _RED_("ERROR:") " serial port " _YELLOW_("%s") " is claimed by another process", port);
-        PrintAndLogEx(HINT, "Try the shell script " _YELLOW_("`./pm3 --list`") " to get a list of possible serial ports");
+    SetCurrentDevice(prev);
 
-        sp = NULL;
-        return false;
-    } else {
-        // start the communication thread
-        if (port != g_conn.serial_port_name) {
-            uint16_t len = MIN(strlen(port), FILE_PATH_SIZE - 1);
-            memset(g_conn.serial_port_name, 0, FILE_PATH_SIZE);
-            memcpy(g_conn.serial_port_name, port, len);
+    // check result of uart opening
+    if (c->sp == INVALID_SERIAL_PORT || c->sp == CLAIMED_SERIAL_PORT) {
+        if (c->sp == INVALID_SERIAL_PORT) {
+            PrintAndLogEx(WARNING, "\n" _RED_("ERROR:") " invalid serial port " _YELLOW_("%s"), port);
+        } else {
+            PrintAndLogEx(WARNING, "\n" _RED_("ERROR:") " serial port " _YELLOW_("%s") " is claimed by another process", port);
         }
-        g_conn.run = true;
-        g_conn.block_after_ACK = flash_mode;
-        // Flags to tell where to add CRC on sent replies
-        g_conn.send_with_crc_on_usb = false;
-        g_conn.send_with_crc_on_fpc = true;
-        // "Session" flag, to tell via which interface next msgs should be sent: USB or FPC USART
-        g_conn.send_via_fpc_usart = false;
-
-        pthread_create(&communication_thread, NULL, &uart_communication, &g_conn);
-        __atomic_clear(&comm_thread_dead, __ATOMIC_SEQ_CST);
-        g_session.pm3_present = true; // TODO support for multiple devices
-
-        fflush(stdout);
+        PrintAndLogEx(HINT, "Try the shell script " _YELLOW_("`./pm3 --list`") " to get a list of possible serial ports");
+        c->sp = NULL;
         if (*dev == NULL) {
-            *dev = calloc(sizeof(pm3_device_t), sizeof(uint8_t));
+            FreeProxmark(d);
         }
-        (*dev)->g_conn = &g_conn; // TODO g_conn shouldn't be global
-        return true;
+        return false;
+    }
+
+    // start the communication thread
+    communication_arg_t *conn = &d->conn;
+    if (port != conn->serial_port_name) {
+        uint16_t len = MIN(strlen(port), FILE_PATH_SIZE - 1);
+        memset(conn->serial_port_name, 0, FILE_PATH_SIZE);
+        memcpy(conn->serial_port_name, port, len);
     }
+    conn->run = true;
+    conn->block_after_ACK = flash_mode;
+    // Flags to tell where to add CRC on sent replies
+    conn->send_with_crc_on_usb = false;
+    conn->send_with_crc_on_fpc = true;
+    // "Session" flag, to tell via which interface next msgs should be sent: USB or FPC USART
+    conn->send_via_fpc_usart = false;
+
+    __atomic_clear(&c->comm_thread_dead, __ATOMIC_SEQ_CST);
+    pthread_create(&c->communication_thread, NULL, &uart_communication, d);
+    c->comm_thread_running = true;
+    c->connected = true;
+    __atomic_add_fetch(&open_devices, 1, __ATOMIC_SEQ_CST);
+    g_session.pm3_present = true;
+
+    fflush(stdout);
+    *dev = d;
+    return true;
 }
 
-// check if we can communicate with Pm3
-int TestProxmark(pm3_device_t *dev) {
+static int test_proxmark(pm3_device_t *dev) {
 
     PacketResponseNG resp;
     uint16_t len = 32;
@@ -624,7 +966,7 @@ int TestProxmark(pm3_device_t *dev) {
     for (uint16_t i = 0; i < len; i++)
         data[i] = i & 0xFF;
 
-    __atomic_store_n(&last_packet_time,  msclock(), __ATOMIC_SEQ_CST);
+    __atomic_store_n(&dev->comms->last_packet_time,  msclock(), __ATOMIC_SEQ_CST);
     clearCommandBuffer();
     SendCommandNG(CMD_PING, data, len);
 
@@ -671,7 +1013,7 @@ int TestProxmark(pm3_device_t *dev) {
     if (g_conn.send_via_fpc_usart) {
         PrintAndLogEx(INFO, "PM3 UART serial baudrate: " _YELLOW_("%u") "\n", g_conn.uart_speed);
     } else {
-        int res = uart_reconfigure_timeouts(UART_USB_CLIENT_RX_TIMEOUT_MS);
+        int res = uart_reconfigure_timeouts(dev->comms->sp, UART_USB_CLIENT_RX_TIMEOUT_MS);
         if (res != PM3_SUCCESS) {
             return res;
         }
@@ -679,32 +1021,55 @@ int TestProxmark(pm3_device_t *dev) {
     return PM3_SUCCESS;
 }
 
+// check if we can communicate with Pm3
+int TestProxmark(pm3_device_t *dev) {
+    // talk to dev, whatever device the calling thread was using
+    pm3_device_t *prev = SetCurrentDevice(dev);
+    int res = test_proxmark(dev);
+    SetCurrentDevice(prev);
+    return res;
+}
+
 void CloseProxmark(pm3_device_t *dev) {
-    dev->g_conn->run = false;
+    struct pm3_comms *c = dev->comms;
+    dev->conn.run = false;
 
-#ifdef __BIONIC__
-    if (communication_thread != 0) {
-        pthread_join(communication_thread, NULL);
+    if (c->comm_thread_running) {
+        pthread_join(c->communication_thread, NULL);
+        memset(&c->communication_thread, 0, sizeof(pthread_t));
+        c->comm_thread_running = false;
     }
-#else
-    pthread_join(communication_thread, NULL);
-#endif
 
-    if (sp) {
-        uart_close(sp);
+    if (c->sp) {
+        uart_close(c->sp);
     }
 
     // Clean up our state
-    sp = NULL;
-#ifdef __BIONIC__
-    if (communication_thread != 0) {
-        memset(&communication_thread, 0, sizeof(pthread_t));
+    c->sp = NULL;
+    if (c->connected) {
+        c->connected = false;
+        __atomic_sub_fetch(&open_devices, 1, __ATOMIC_SEQ_CST);
     }
-#else
-    memset(&communication_thread, 0, sizeof(pthread_t));
-#endif
 
-    g_session.pm3_present = false;
+    // still true while other devices are connected
+    g_session.pm3_present = (__atomic_load_n(&open_devices, __ATOMIC_SEQ_CST) > 0);
+}
+
+void FreeProxmark(pm3_device_t *dev) {
+    if (dev == NULL || dev == &offline_device) {
+        return;
+    }
+
+    CloseProxmark(dev);
+
+    struct pm3_comms *c = dev->comms;
+    pthread_mutex_destroy(&c->txBufferMutex);
+    pthread_cond_destroy(&c->txBufferSig);
+    pthread_mutex_destroy(&c->rxBufferMutex);
+    pthread_cond_destroy(&c->rxBufferSig);
+    pthread_cond_destroy(&c->rxSpaceSig);
+    free(c);
+    free(dev);
 }
 
 // Gives a rough estimate of the communication delay based on channel & baudrate
@@ -734,6 +1099,7 @@ static size_t communication_delay(void) {
  */
 bool WaitForResponseTimeoutW(uint32_t cmd, PacketResponseNG *response, size_t ms_timeout, bool show_warning) {
 
+    struct pm3_comms *c = comms_current();
     PacketResponseNG resp;
 
     if (response == NULL)
@@ -743,13 +1109,14 @@ bool WaitForResponseTimeoutW(uint32_t cmd, PacketResponseNG *response, size_t ms
     if (ms_timeout != (size_t) - 1)
         ms_timeout += communication_delay();
 
-    __atomic_store_n(&timeout_start_time,  msclock(), __ATOMIC_SEQ_CST);
+    __atomic_store_n(&c->timeout_start_time,  msclock(), __ATOMIC_SEQ_CST);
 
     // Wait until the command is received
     while (true) {
 
-        while (getReply(response)) {
+        while (getReply(c, response)) {
             if (cmd == CMD_UNKNOWN || response->cmd == cmd) {
+                rtt_record(c);
                 return true;
             }
             if (response->cmd == CMD_WTX && response->length == sizeof(uint16_t)) {
@@ -760,7 +1127,7 @@ bool WaitForResponseTimeoutW(uint32_t cmd, PacketResponseNG *response, size_t ms
             }
         }
 
-        uint64_t tmp_clk = __atomic_load_n(&timeout_start_time, __ATOMIC_SEQ_CST);
+        uint64_t tmp_clk = __atomic_load_n(&c->timeout_start_time, __ATOMIC_SEQ_CST);
         if ((ms_timeout != (size_t) - 1) && (msclock() - tmp_clk > ms_timeout))
             break;
 
@@ -770,8 +1137,8 @@ bool WaitForResponseTimeoutW(uint32_t cmd, PacketResponseNG *response, size_t ms
             PrintAndLogEx(INFO, "You can cancel this operation by pressing the pm3 button");
             show_warning = false;
         }
-        // just to avoid CPU busy loop:
-        msleep(10);
+        // sleep until the communication thread hands us a packet
+        waitReply(c, RX_WAIT_SLICE_MS);
     }
     return false;
 }
@@ -814,19 +1181,19 @@ bool GetFromDevice(DeviceMemType_t memtype, uint8_t *dest, uint32_t bytes, uint3
     switch (memtype) {
         case BIG_BUF: {
             SendCommandMIX(CMD_DOWNLOAD_BIGBUF, start_index, bytes, 0, NULL, 0);
-            return dl_it(dest, bytes, response, ms_timeout, show_warning, CMD_DOWNLOADED_BIGBUF);
+            return dl_it(dest, bytes, response, ms_timeout, show_warning, CMD_DOWNLOADED_BIGBUF, NULL, NULL);
         }
         case BIG_BUF_EML: {
             SendCommandMIX(CMD_DOWNLOAD_EML_BIGBUF, start_index, bytes, 0, NULL, 0);
-            return dl_it(dest, bytes, response, ms_timeout, show_warning, CMD_DOWNLOADED_EML_BIGBUF);
+            return dl_it(dest, bytes, response, ms_timeout, show_warning, CMD_DOWNLOADED_EML_BIGBUF, NULL, NULL);
         }
         case SPIFFS: {
             SendCommandMIX(CMD_SPIFFS_DOWNLOAD, start_index, bytes, 0, data, datalen);
-            return dl_it(dest, bytes, response, ms_timeout, show_warning, CMD_SPIFFS_DOWNLOADED);
+            return dl_it(dest, bytes, response, ms_timeout, show_warning, CMD_SPIFFS_DOWNLOADED, NULL, NULL);
         }
         case FLASH_MEM: {
             SendCommandMIX(CMD_FLASHMEM_DOWNLOAD, start_index, bytes, 0, NULL, 0);
-            return dl_it(dest, bytes, response, ms_timeout, show_warning, CMD_FLASHMEM_DOWNLOADED);
+            return dl_it(dest, bytes, response, ms_timeout, show_warning, CMD_FLASHMEM_DOWNLOADED, NULL, NULL);
         }
         case SIM_MEM: {
             //SendCommandMIX(CMD_DOWNLOAD_SIM_MEM, start_index, bytes, 0, NULL, 0);
@@ -835,16 +1202,40 @@ bool GetFromDevice(DeviceMemType_t memtype, uint8_t *dest, uint32_t bytes, uint3
         }
         case FPGA_MEM: {
             SendCommandNG(CMD_FPGAMEM_DOWNLOAD, NULL, 0);
-            return dl_it(dest, bytes, response, ms_timeout, show_warning, CMD_FPGAMEM_DOWNLOADED);
+            return dl_it(dest, bytes, response, ms_timeout, show_warning, CMD_FPGAMEM_DOWNLOADED, NULL, NULL);
         }
     }
     return false;
 }
 
-static bool dl_it(uint8_t *dest, uint32_t bytes, PacketResponseNG *response, size_t ms_timeout, bool show_warning, uint32_t rec_cmd) {
+/**
+* Data transfer from BigBuf to the client,  like GetFromDevice(BIG_BUF, ...)
+* but cb is called every time more data has arrived, while the transfer is still running.
+* @param cb called with dest and the number of bytes from the start of dest that are valid so far
+* @param cb_ctx passed on to cb
+* @return true if command was returned, otherwise false
+*/
+bool GetFromDeviceStream(uint8_t *dest, uint32_t bytes, uint32_t start_index, PacketResponseNG *response, size_t ms_timeout, bool show_warning, download_chunk_cb_t cb, void *cb_ctx) {
 
+    if (dest == NULL) return false;
+    if (bytes == 0) return true;
+
+    PacketResponseNG resp;
+    if (response == NULL)
+        response = &resp;
+
+    clearCommandBuffer();
+    SendCommandMIX(CMD_DOWNLOAD_BIGBUF, start_index, bytes, 0, NULL, 0);
+    return dl_it(dest, bytes, response, ms_timeout, show_warning, CMD_DOWNLOADED_BIGBUF, cb, cb_ctx);
+}
+
+static bool dl_it(uint8_t *dest, uint32_t bytes, PacketResponseNG *response, size_t ms_timeout, bool show_warning, uint32_t rec_cmd, download_chunk_cb_t cb, void *cb_ctx) {
+
+    struct pm3_comms *c = comms_current();
     uint32_t bytes_completed = 0;
-    __atomic_store_n(&timeout_start_time,  msclock(), __ATOMIC_SEQ_CST);
+    // number of bytes from the start of dest that are filled in without gaps,  reported to cb
+    uint32_t bytes_contiguous = 0;
+    __atomic_store_n(&c->timeout_start_time,  msclock(), __ATOMIC_SEQ_CST);
 
     // Add delay depending on the communication channel & speed
     if (ms_timeout != (size_t) - 1)
@@ -852,25 +1243,33 @@ static bool dl_it(uint8_t *dest, uint32_t bytes, PacketResponseNG *response, siz
 
     while (true) {
 
-        if (getReply(response)) {
+        // work on the ring slot directly,  only the final packet is copied out to the caller
+        PacketResponseNG *packet = peekReply(c);
+        if (packet != NULL) {
 
-            if (response->cmd == CMD_ACK)
+            if (packet->cmd == CMD_ACK) {
+                getReply(c, response);
                 return true;
-            if (response->cmd == CMD_SPIFFS_DOWNLOAD && response->status == PM3_EMALLOC)
+            }
+            if (packet->cmd == CMD_SPIFFS_DOWNLOAD && packet->status == PM3_EMALLOC) {
+                getReply(c, response);
                 return false;
+            }
             // Spiffs // fpgamem-plot download is converted to NG,
-            if (response->cmd == CMD_SPIFFS_DOWNLOAD || response->cmd == CMD_FPGAMEM_DOWNLOAD)
+            if (packet->cmd == CMD_SPIFFS_DOWNLOAD || packet->cmd == CMD_FPGAMEM_DOWNLOAD) {
+                getReply(c, response);
                 return true;
+            }
 
             // sample_buf is a array pointer, located in data.c
             // arg0 = offset in transfer. Startindex of this chunk
             // arg1 = length bytes to transfer
             // arg2 = bigbuff tracelength (?)
-            if (response->cmd == rec_cmd) {
+            if (packet->cmd == rec_cmd) {
 
-                uint32_t offset = response->oldarg[0];
-                uint32_t copy_bytes = MIN(bytes - bytes_completed, response->oldarg[1]);
-                //uint32_t tracelen = response->oldarg[2];
+                uint32_t offset = packet->oldarg[0];
+                uint32_t copy_bytes = MIN(bytes - bytes_completed, packet->oldarg[1]);
+                //uint32_t tracelen = packet->oldarg[2];
 
                 // extended bounds check1.  upper limit is PM3_CMD_DATA_SIZE
                 // shouldn't happen
@@ -879,20 +1278,31 @@ static bool dl_it(uint8_t *dest, uint32_t bytes, PacketResponseNG *response, siz
                 // extended bounds check2.
                 if (offset + copy_bytes > bytes) {
                     PrintAndLogEx(FAILED, "ERROR: Out of bounds when downloading from device,  offset %u | len %u | total len %u > buf_size %u", offset, copy_bytes,  offset + copy_bytes,  bytes);
+                    getReply(c, response);
                     break;
                 }
 
-                memcpy(dest + offset, response->data.asBytes, copy_bytes);
+                memcpy(dest + offset, packet->data.asBytes, copy_bytes);
                 bytes_completed += copy_bytes;
-            } else if (response->cmd == CMD_WTX && response->length == sizeof(uint16_t)) {
-                uint16_t wtx = response->data.asDwords[0] & 0xFFFF;
+
+                if (cb && offset == bytes_contiguous) {
+                    bytes_contiguous += copy_bytes;
+                    // hand the slot back first,  the callback may take its time
+                    releaseReply(c);
+                    cb(dest, bytes_contiguous, cb_ctx);
+                    continue;
+                }
+            } else if (packet->cmd == CMD_WTX && packet->length == sizeof(uint16_t)) {
+                uint16_t wtx = packet->data.asDwords[0] & 0xFFFF;
                 PrintAndLogEx(DEBUG, "Got Waiting Time eXtension request %i ms", wtx);
                 if (ms_timeout != (size_t) - 1)
                     ms_timeout += wtx;
             }
+            releaseReply(c);
+            continue;
         }
 
-        uint64_t tmp_clk = __atomic_load_n(&timeout_start_time, __ATOMIC_SEQ_CST);
+        uint64_t tmp_clk = __atomic_load_n(&c->timeout_start_time, __ATOMIC_SEQ_CST);
         if (msclock() - tmp_clk > ms_timeout) {
             PrintAndLogEx(FAILED, "Timed out while trying to download data from device");
             break;
@@ -904,6 +1314,8 @@ static bool dl_it(uint8_t *dest, uint32_t bytes, PacketResponseNG *response, siz
             PrintAndLogEx(INFO, "You can cancel this operation by pressing the pm3 button");
             show_warning = false;
         }
+
+        waitReply(c, RX_WAIT_SLICE_MS);
     }
     return false;
 }
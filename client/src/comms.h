@@ -68,13 +68,29 @@ typedef struct {
     char serial_port_name[FILE_PATH_SIZE];
 } communication_arg_t;
 
-extern communication_arg_t g_conn;
+// port, communication thread and receive ring of a device, private to comms.c
+struct pm3_comms;
 
 typedef struct pm3_device {
-    communication_arg_t *g_conn;
+    communication_arg_t conn;
+    capabilities_t capabilities;
+    struct pm3_comms *comms;
     int script_embedded;
+    // threads inside a pm3_* call on this device, the last one frees it after pm3_close
+    int users;
+    bool closed;
 } pm3_device_t;
 
+// Each thread talks to one device at a time. Threads that did not pick one with SetCurrentDevice
+// use the console device g_session.current_device, the communication thread of a device uses that device.
+pm3_device_t *GetCurrentDevice(void);
+// returns the previously selected device, NULL goes back to the console device
+pm3_device_t *SetCurrentDevice(pm3_device_t *dev);
+
+// connection state and capabilities of the device the calling thread talks to
+#define g_conn              (GetCurrentDevice()->conn)
+#define g_pm3_capabilities  (GetCurrentDevice()->capabilities)
+
 void *uart_receiver(void *targ);
 void SendCommandBL(uint64_t cmd, uint64_t arg0, uint64_t arg1, uint64_t arg2, void *data, size_t len);
 void SendCommandOLD(uint64_t cmd, uint64_t arg0, uint64_t arg1, uint64_t arg2, void *data, size_t len);
@@ -84,17 +100,24 @@ void clearCommandBuffer(void);
 
 #define FLASHMODE_SPEED 460800
 bool IsCommunicationThreadDead(void);
+pm3_device_t *NewProxmark(void);
 bool OpenProxmark(pm3_device_t **dev, const char *port, bool wait_for_port, int timeout, bool flash_mode, uint32_t speed);
 int TestProxmark(pm3_device_t *dev);
 void CloseProxmark(pm3_device_t *dev);
+void FreeProxmark(pm3_device_t *dev);
 
 bool WaitForResponseTimeoutW(uint32_t cmd, PacketResponseNG *response, size_t ms_timeout, bool show_warning);
 bool WaitForResponseTimeout(uint32_t cmd, PacketResponseNG *response, size_t ms_timeout);
 bool WaitForResponse(uint32_t cmd, PacketResponseNG *response);
+void PrintCommsStats(void);
 
 //bool GetFromDevice(DeviceMemType_t memtype, uint8_t *dest, uint32_t bytes, uint32_t start_index, PacketResponseNG *response, size_t ms_timeout, bool show_warning);
 bool GetFromDevice(DeviceMemType_t memtype, uint8_t *dest, uint32_t bytes, uint32_t start_index, uint8_t *data, uint32_t datalen, PacketResponseNG *response, size_t ms_timeout, bool show_warning);
 
+// available = number of bytes from the start of dest received so far
+typedef void (*download_chunk_cb_t)(const uint8_t *dest, uint32_t available, void *ctx);
+bool GetFromDeviceStream(uint8_t *dest, uint32_t bytes, uint32_t start_index, PacketResponseNG *response, size_t ms_timeout, bool show_warning, download_chunk_cb_t cb, void *cb_ctx);
+
 #ifdef __cplusplus
 }
 #endif
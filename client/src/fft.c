@@ -0,0 +1,200 @@
+//-----------------------------------------------------------------------------
+// Copyright (C) Proxmark3 contributors. See AUTHORS.md for details.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See LICENSE.txt for the text of the license.
+//-----------------------------------------------------------------------------
+// FFT based correlation of sample buffers
+//
+// Plain iterative radix-2 complex FFT, big enough for the sample buffers the
+// client handles, so no external FFT library is needed.
+//-----------------------------------------------------------------------------
+
+#include "fft.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "pm3_cmd.h"    // PM3_SUCCESS
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+typedef struct {
+    size_t n;
+    double *cos_t;  // cos(2 pi k / n), k < n / 2
+    double *sin_t;
+    double *re;
+    double *im;
+} fft_plan_t;
+
+static size_t fft_size(size_t n) {
+    size_t p = 1;
+    while (p < n) {
+        p <<= 1;
+    }
+    return p;
+}
+
+static void fft_plan_free(fft_plan_t *p) {
+    free(p->cos_t);
+    free(p->sin_t);
+    free(p->re);
+    free(p->im);
+    memset(p, 0, sizeof(fft_plan_t));
+}
+
+static int fft_plan_init(fft_plan_t *p, size_t n) {
+    memset(p, 0, sizeof(fft_plan_t));
+    p->n = n;
+    p->cos_t = calloc(n / 2 + 1, sizeof(double));
+    p->sin_t = calloc(n / 2 + 1, sizeof(double));
+    p->re = calloc(n, sizeof(double));
+    p->im = calloc(n, sizeof(double));
+    if (p->cos_t == NULL || p->sin_t == NULL || p->re == NULL || p->im == NULL) {
+        fft_plan_free(p);
+        return PM3_EMALLOC;
+    }
+    for (size_t k = 0; k < n / 2; k++) {
+        p->cos_t[k] = cos(2 * M_PI * k / n);
+        p->sin_t[k] = sin(2 * M_PI * k / n);
+    }
+    return PM3_SUCCESS;
+}
+
+// in place on p->re / p->im, the inverse is not scaled
+static void fft_run(fft_plan_t *p, bool inverse) {
+    size_t n = p->n;
+    double *re = p->re;
+    double *im = p->im;
+
+    // bit reversed order
+    for (size_t i = 1, j = 0; i < n; i++) {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            double t = re[i];
+            re[i] = re[j];
+            re[j] = t;
+            t = im[i];
+            im[i] = im[j];
+            im[j] = t;
+        }
+    }
+
+    double sign = inverse ? 1.0 : -1.0;
+    for (size_t len = 2; len <= n; len <<= 1) {
+        size_t half = len >> 1;
+        size_t step = n / len;
+        for (size_t i = 0; i < n; i += len) {
+            for (size_t j = 0; j < half; j++) {
+                double wr = p->cos_t[j * step];
+                double wi = sign * p->sin_t[j * step];
+                size_t u = i + j;
+                size_t v = u + half;
+                double xr = re[v] * wr - im[v] * wi;
+                double xi = re[v] * wi + im[v] * wr;
+                re[v] = re[u] - xr;
+                im[v] = im[u] - xi;
+                re[u] += xr;
+                im[u] += xi;
+            }
+        }
+    }
+}
+
+int fft_xcorr(const double *a, size_t alen, const double *b, size_t blen, size_t lags, double *out) {
+    if (a == NULL || b == NULL || out == NULL || alen == 0 || lags == 0) {
+        return PM3_EINVARG;
+    }
+
+    // lags computed per transform. Without wrap around a transform of n points gives
+    // n - alen + 1 lags, a short template is run over blocks of four times its size
+    size_t n = fft_size(alen + lags - 1);
+    if (alen * 8 < lags) {
+        n = fft_size(alen * 4);
+        if (n < 1024) {
+            n = 1024;
+        }
+    }
+    size_t step = n - alen + 1;
+    if (step > lags) {
+        step = lags;
+    }
+    bool autocorr = (a == b) && (alen == blen) && (step == lags);
+
+    fft_plan_t p;
+    if (fft_plan_init(&p, n) != PM3_SUCCESS) {
+        return PM3_EMALLOC;
+    }
+
+    // spectrum of the template, kept for all blocks
+    double *ar = calloc(n, sizeof(double));
+    double *ai = calloc(n, sizeof(double));
+    if (ar == NULL || ai == NULL) {
+        free(ar);
+        free(ai);
+        fft_plan_free(&p);
+        return PM3_EMALLOC;
+    }
+    memcpy(p.re, a, alen * sizeof(double));
+    fft_run(&p, false);
+    memcpy(ar, p.re, n * sizeof(double));
+    memcpy(ai, p.im, n * sizeof(double));
+
+    for (size_t k0 = 0; k0 < lags; k0 += step) {
+
+        size_t cnt = (lags - k0 < step) ? lags - k0 : step;
+
+        if (autocorr) {
+            // |A|^2, no second transform needed
+            for (size_t i = 0; i < n; i++) {
+                p.re[i] = ar[i] * ar[i] + ai[i] * ai[i];
+                p.im[i] = 0;
+            }
+        } else {
+            // b[k0 .. k0 + cnt + alen - 1), zero past blen
+            memset(p.re, 0, n * sizeof(double));
+            memset(p.im, 0, n * sizeof(double));
+            if (k0 < blen) {
+                size_t seg = cnt + alen - 1;
+                if (seg > blen - k0) {
+                    seg = blen - k0;
+                }
+                memcpy(p.re, b + k0, seg * sizeof(double));
+            }
+            fft_run(&p, false);
+
+            // conj(A) * B
+            for (size_t i = 0; i < n; i++) {
+                double br = p.re[i];
+                double bi = p.im[i];
+                p.re[i] = ar[i] * br + ai[i] * bi;
+                p.im[i] = ar[i] * bi - ai[i] * br;
+            }
+        }
+
+        fft_run(&p, true);
+        for (size_t k = 0; k < cnt; k++) {
+            out[k0 + k] = p.re[k] / n;
+        }
+    }
+
+    free(ar);
+    free(ai);
+    fft_plan_free(&p);
+    return PM3_SUCCESS;
+}
@@ -0,0 +1,46 @@
+//-----------------------------------------------------------------------------
+// Copyright (C) Proxmark3 contributors. See AUTHORS.md for details.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See LICENSE.txt for the text of the license.
+//-----------------------------------------------------------------------------
+// FFT based correlation of sample buffers
+//-----------------------------------------------------------------------------
+
+#ifndef FFT_H__
+#define FFT_H__
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Cross correlation, out[k] = sum over j of a[j] * b[j + k], for k = 0 .. lags - 1.
+ * Terms with j + k >= blen count as zero, so a == b gives the autocorrelation.
+ * A short a against a long b is done in blocks (overlap-save), everything else in one transform.
+ * O((alen + blen) log n) instead of O(alen * lags).
+ * @param a first signal, the template
+ * @param alen samples in a
+ * @param b second signal
+ * @param blen samples in b
+ * @param lags number of shifts to compute
+ * @param out lags values
+ * @return PM3_SUCCESS, PM3_EINVARG or PM3_EMALLOC
+ */
+int fft_xcorr(const double *a, size_t alen, const double *b, size_t blen, size_t lags, double *out);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -18,16 +18,74 @@
 #include "graph.h"
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
 #include "ui.h"
 #include "proxgui.h"
 #include "util.h"    //param_get32ex
 #include "lfdemod.h"
 #include "cmddata.h" //for g_debugmode
+#include "fft.h"
+#include "commonutil.h" // ARRAYLEN
 
 
-int g_GraphBuffer[MAX_GRAPH_TRACE_LEN];
+// Samples live in graph_initial until a capture needs more room,  after that in a heap block
+// that grows by doubling.  g_GraphBuffer always points to the current block.
+static int graph_initial[GRAPH_TRACE_LEN_INIT];
+static size_t graph_capacity = GRAPH_TRACE_LEN_INIT;
+
+int *g_GraphBuffer = graph_initial;
 size_t g_GraphTraceLen;
 
+// make sure g_GraphBuffer can hold len samples.  Keeps the current samples,
+// new room is zeroed.  g_GraphBuffer may move,  don't keep pointers into it.
+bool reserveGraphBuf(size_t len) {
+    if (len <= graph_capacity) {
+        return true;
+    }
+
+    size_t cap = graph_capacity;
+    while (cap < len) {
+        if (cap > (SIZE_MAX / sizeof(int)) / 2) {
+            cap = len;
+            break;
+        }
+        cap *= 2;
+    }
+    if (cap > SIZE_MAX / sizeof(int)) {
+        PrintAndLogEx(WARNING, "Graph buffer, too many samples ( %zu )", len);
+        return false;
+    }
+
+    int *tmp;
+    if (g_GraphBuffer == graph_initial) {
+        tmp = calloc(cap, sizeof(int));
+        if (tmp) {
+            memcpy(tmp, graph_initial, graph_capacity * sizeof(int));
+        }
+    } else {
+        tmp = realloc(g_GraphBuffer, cap * sizeof(int));
+        if (tmp) {
+            memset(tmp + graph_capacity, 0, (cap - graph_capacity) * sizeof(int));
+        }
+    }
+
+    if (tmp == NULL) {
+        PrintAndLogEx(WARNING, "Failed to allocate memory for %zu samples", len);
+        return false;
+    }
+
+    PrintAndLogEx(DEBUG, "Graph buffer grown to %zu samples", cap);
+    g_GraphBuffer = tmp;
+    graph_capacity = cap;
+    return true;
+}
+
+size_t getGraphBufCapacity(void) {
+    return graph_capacity;
+}
+
 /* write a manchester bit to the graph
 */
 void AppendGraph(bool redraw, uint16_t clock, int bit) {
@@ -35,18 +93,17 @@ void AppendGraph(bool redraw, uint16_t clock, int bit) {
     uint16_t end = clock;
     uint16_t i;
 
-    // overflow/underflow safe checks ... Assumptions:
-    //     _Assert(g_GraphTraceLen >= 0);
-    //     _Assert(g_GraphTraceLen <= MAX_GRAPH_TRACE_LEN);
-    // If this occurs, allow partial rendering, up to the last sample...
-    if ((MAX_GRAPH_TRACE_LEN - g_GraphTraceLen) < half) {
-        PrintAndLogEx(DEBUG, "WARNING: AppendGraph() - Request exceeds max graph length");
-        end = MAX_GRAPH_TRACE_LEN - g_GraphTraceLen;
-        half = end;
-    }
-    if ((MAX_GRAPH_TRACE_LEN - g_GraphTraceLen) < end) {
-        PrintAndLogEx(DEBUG, "WARNING: AppendGraph() - Request exceeds max graph length");
-        end = MAX_GRAPH_TRACE_LEN - g_GraphTraceLen;
+    // If we can't grow,  allow partial rendering, up to the last sample...
+    if (reserveGraphBuf(g_GraphTraceLen + end) == false) {
+        if ((graph_capacity - g_GraphTraceLen) < half) {
+            PrintAndLogEx(DEBUG, "WARNING: AppendGraph() - Request exceeds max graph length");
+            end = graph_capacity - g_GraphTraceLen;
+            half = end;
+        }
+        if ((graph_capacity - g_GraphTraceLen) < end) {
+            PrintAndLogEx(DEBUG, "WARNING: AppendGraph() - Request exceeds max graph length");
+            end = graph_capacity - g_GraphTraceLen;
+        }
     }
 
     //set first half the clock bit (all 1's or 0's for a 0 or 1 bit)
@@ -79,19 +136,38 @@ size_t ClearGraph(bool redraw) {
     return gtl;
 }
 // option '1' to save g_GraphBuffer any other to restore
+// Only the samples in use are copied,  into a snapshot buffer which is kept between saves.
 void save_restoreGB(uint8_t saveOpt) {
-    static int SavedGB[MAX_GRAPH_TRACE_LEN];
+    static int *SavedGB = NULL;
+    static size_t SavedGBcap = 0;
     static size_t SavedGBlen = 0;
     static bool GB_Saved = false;
     static int Savedg_GridOffsetAdj = 0;
 
     if (saveOpt == GRAPH_SAVE) { //save
-        memcpy(SavedGB, g_GraphBuffer, sizeof(g_GraphBuffer));
+        if (SavedGBcap < g_GraphTraceLen) {
+            int *tmp = realloc(SavedGB, g_GraphTraceLen * sizeof(int));
+            if (tmp == NULL) {
+                PrintAndLogEx(WARNING, "Failed to allocate memory");
+                GB_Saved = false;
+                return;
+            }
+            SavedGB = tmp;
+            SavedGBcap = g_GraphTraceLen;
+        }
+        if (g_GraphTraceLen) {
+            memcpy(SavedGB, g_GraphBuffer, g_GraphTraceLen * sizeof(int));
+        }
         SavedGBlen = g_GraphTraceLen;
         GB_Saved = true;
         Savedg_GridOffsetAdj = g_GridOffset;
     } else if (GB_Saved) { //restore
-        memcpy(g_GraphBuffer, SavedGB, sizeof(g_GraphBuffer));
+        if (reserveGraphBuf(SavedGBlen) == false) {
+            return;
+        }
+        if (SavedGBlen) {
+            memcpy(g_GraphBuffer, SavedGB, SavedGBlen * sizeof(int));
+        }
         g_GraphTraceLen = SavedGBlen;
         g_GridOffset = Savedg_GridOffsetAdj;
         RepaintGraphWindow();
@@ -103,8 +179,8 @@ void setGraphBuf(const uint8_t *src, size_t size) {
 
     ClearGraph(false);
 
-    if (size > MAX_GRAPH_TRACE_LEN)
-        size = MAX_GRAPH_TRACE_LEN;
+    if (reserveGraphBuf(size) == false)
+        size = graph_capacity;
 
     for (size_t i = 0; i < size; ++i)
         g_GraphBuffer[i] = src[i] - 128;
@@ -127,6 +203,71 @@ size_t getFromGraphBuf(uint8_t *dest) {
     return i;
 }
 
+// uint8_t views of the samples as used by the lfdemod functions.
+// Released views are kept for the next caller,  so demodulating doesn't
+// allocate and clear a full sized buffer every time.
+typedef struct {
+    size_t cap;
+    uint8_t data[];
+} graph_view_t;
+
+#define GRAPH_VIEW_POOL 4
+
+static graph_view_t *graph_view_pool[GRAPH_VIEW_POOL];
+static uint8_t graph_view_cnt = 0;
+static pthread_mutex_t graph_view_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// get the samples as uint8_t,  same as getFromGraphBuf().  The view holds at least
+// GRAPH_TRACE_LEN_INIT bytes and may be modified,  hand it back with releaseGraphBufU8().
+// Returns NULL if there are no samples or no memory.
+uint8_t *getGraphBufU8(size_t *size) {
+    *size = 0;
+    if (g_GraphTraceLen == 0) {
+        return NULL;
+    }
+
+    size_t need = MAX(g_GraphTraceLen, GRAPH_TRACE_LEN_INIT);
+
+    graph_view_t *v = NULL;
+    pthread_mutex_lock(&graph_view_lock);
+    if (graph_view_cnt) {
+        v = graph_view_pool[--graph_view_cnt];
+    }
+    pthread_mutex_unlock(&graph_view_lock);
+
+    if (v == NULL || v->cap < need) {
+        free(v);
+        v = malloc(sizeof(graph_view_t) + need);
+        if (v == NULL) {
+            PrintAndLogEx(WARNING, "Failed to allocate memory");
+            return NULL;
+        }
+        v->cap = need;
+    }
+
+    *size = getFromGraphBuf(v->data);
+    // old callers got a zeroed buffer,  keep the tail clean
+    memset(v->data + *size, 0, v->cap - *size);
+    return v->data;
+}
+
+void releaseGraphBufU8(uint8_t *bits) {
+    if (bits == NULL) {
+        return;
+    }
+
+    graph_view_t *v = (graph_view_t *)(bits - offsetof(graph_view_t, data));
+
+    pthread_mutex_lock(&graph_view_lock);
+    if (graph_view_cnt < GRAPH_VIEW_POOL) {
+        graph_view_pool[graph_view_cnt++] = v;
+        v = NULL;
+    }
+    pthread_mutex_unlock(&graph_view_lock);
+
+    free(v);
+}
+
 // A simple test to see if there is any data inside Graphbuffer.
 bool HasGraphData(void) {
     if (g_GraphTraceLen == 0) {
@@ -160,25 +301,108 @@ void convertGraphFromBitstreamEx(int hi, int low) {
             g_GraphBuffer[i] = 0;
     }
 
-    uint8_t *bits = calloc(g_GraphTraceLen, sizeof(uint8_t));
+    size_t size = 0;
+    uint8_t *bits = getGraphBufU8(&size);
     if (bits == NULL) {
-        PrintAndLogEx(DEBUG, "ERR: convertGraphFromBitstreamEx, failed to allocate memory");
-        return;
-    }
-
-    size_t size = getFromGraphBuf(bits);
-    if (size == 0) {
         PrintAndLogEx(WARNING, "Failed to copy from graphbuffer");
-        free(bits);
         return;
     }
 
     // set signal properties low/high/mean/amplitude and is_noise detection
     computeSignalProperties(bits, size);
-    free(bits);
+    releaseGraphBufU8(bits);
     RepaintGraphWindow();
 }
 
+// Clock estimate from the autocorrelation of a transition signal.  mark[i] is 1 where the
+// signal changes (edges for ASK, phase shifts for PSK),  those land on a grid of the bit clock,
+// so the correlation peaks at the clock and its multiples.  The smallest candidate close to the
+// best score wins.  Returns 0 if there is no clear peak.
+int GetCorrelationClock(const uint8_t *mark, size_t size) {
+    static const uint8_t clocks[] = {8, 16, 32, 40, 50, 64, 100, 128};
+    const size_t lags = 128 * 2 + 1;
+
+    if (mark == NULL || size < lags * 4) {
+        return 0;
+    }
+
+    double *sig = calloc(size, sizeof(double));
+    double *r = calloc(lags, sizeof(double));
+    if (sig == NULL || r == NULL) {
+        free(sig);
+        free(r);
+        return 0;
+    }
+
+    double mean = 0;
+    for (size_t i = 0; i < size; i++) {
+        mean += mark[i];
+    }
+    mean /= size;
+    for (size_t i = 0; i < size; i++) {
+        sig[i] = mark[i] - mean;
+    }
+
+    int clk = 0;
+    if (fft_xcorr(sig, size, sig, size, lags, r) == PM3_SUCCESS && r[0] > 0) {
+        double score[ARRAYLEN(clocks)];
+        double best = 0;
+        for (size_t i = 0; i < ARRAYLEN(clocks); i++) {
+            size_t c = clocks[i];
+            // normalise for the shorter overlap at larger lags
+            score[i] = (r[c] / (size - c) + r[c * 2] / (size - c * 2)) / (2 * r[0] / size);
+            if (score[i] > best) {
+                best = score[i];
+            }
+        }
+        if (best > 0.2) {
+            for (size_t i = 0; i < ARRAYLEN(clocks); i++) {
+                if (score[i] >= best * 0.8) {
+                    clk = clocks[i];
+                    break;
+                }
+            }
+        }
+    }
+
+    free(sig);
+    free(r);
+    return clk;
+}
+
+// transitions of a bitstream around its mean
+static int correlationClockASK(const uint8_t *bits, size_t size) {
+    uint8_t *mark = calloc(size, sizeof(uint8_t));
+    if (mark == NULL) {
+        return 0;
+    }
+    int mid = getSignalProperties()->mean;
+    for (size_t i = 1; i < size; i++) {
+        mark[i] = ((bits[i] >= mid) != (bits[i - 1] >= mid));
+    }
+    int clk = GetCorrelationClock(mark, size);
+    free(mark);
+    return clk;
+}
+
+// phase shifts,  the sample one carrier period back is on the other side of the mean
+static int correlationClockPSK(const uint8_t *bits, size_t size, uint8_t fc) {
+    if (fc == 0 || size <= fc) {
+        return 0;
+    }
+    uint8_t *mark = calloc(size, sizeof(uint8_t));
+    if (mark == NULL) {
+        return 0;
+    }
+    int mid = getSignalProperties()->mean;
+    for (size_t i = fc; i < size; i++) {
+        mark[i] = ((bits[i] >= mid) != (bits[i - fc] >= mid));
+    }
+    int clk = GetCorrelationClock(mark, size);
+    free(mark);
+    return clk;
+}
+
 // Get or auto-detect ask clock rate
 int GetAskClock(const char *str, bool verbose) {
     if (getSignalProperties()->isnoise)
@@ -190,16 +414,10 @@ int GetAskClock(const char *str, bool verbose) {
 
     // Auto-detect clock
 
-    uint8_t *bits = calloc(MAX_GRAPH_TRACE_LEN,  sizeof(uint8_t));
+    size_t size = 0;
+    uint8_t *bits = getGraphBufU8(&size);
     if (bits == NULL) {
-        PrintAndLogEx(WARNING, "Failed to allocate memory");
-        return -1;
-    }
-
-    size_t size = getFromGraphBuf(bits);
-    if (size == 0) {
         PrintAndLogEx(WARNING, "Failed to copy from graphbuffer");
-        free(bits);
         return -1;
     }
 
@@ -217,7 +435,14 @@ int GetAskClock(const char *str, bool verbose) {
     if (verbose || g_debugMode)
         PrintAndLogEx(SUCCESS, "Auto-detected clock rate: %d, Best Starting Position: %d", clock1, idx);
 
-    free(bits);
+    if (clock1 <= 0 && (verbose || g_debugMode)) {
+        int cclk = correlationClockASK(bits, size);
+        if (cclk > 0) {
+            PrintAndLogEx(HINT, "Hint: autocorrelation suggests clock " _YELLOW_("%d") ", try " _YELLOW_("`-c %d`"), cclk, cclk);
+        }
+    }
+
+    releaseGraphBufU8(bits);
     return clock1;
 }
 
@@ -225,21 +450,15 @@ int GetPskCarrier(bool verbose) {
     if (getSignalProperties()->isnoise)
         return -1;
 
-    uint8_t *bits = calloc(MAX_GRAPH_TRACE_LEN,  sizeof(uint8_t));
+    size_t size = 0;
+    uint8_t *bits = getGraphBufU8(&size);
     if (bits == NULL) {
-        PrintAndLogEx(WARNING, "Failed to allocate memory");
-        return -1;
-    }
-
-    size_t size = getFromGraphBuf(bits);
-    if (size == 0) {
         PrintAndLogEx(WARNING, "Failed to copy from graphbuffer");
-        free(bits);
         return -1;
     }
 
     uint16_t fc = countFC(bits, size, false);
-    free(bits);
+    releaseGraphBufU8(bits);
 
     uint8_t carrier = fc & 0xFF;
     if (carrier != 2 && carrier != 4 && carrier != 8) return 0;
@@ -261,16 +480,10 @@ int GetPskClock(const char *str, bool verbose) {
         return clock1;
 
     // Auto-detect clock
-    uint8_t *bits = calloc(MAX_GRAPH_TRACE_LEN,  sizeof(uint8_t));
+    size_t size = 0;
+    uint8_t *bits = getGraphBufU8(&size);
     if (bits == NULL) {
-        PrintAndLogEx(WARNING, "Failed to allocate memory");
-        return -1;
-    }
-
-    size_t size = getFromGraphBuf(bits);
-    if (size == 0) {
         PrintAndLogEx(WARNING, "Failed to copy from graphbuffer");
-        free(bits);
         return -1;
     }
 
@@ -285,7 +498,14 @@ int GetPskClock(const char *str, bool verbose) {
     if (verbose)
         PrintAndLogEx(SUCCESS, "Auto-detected clock rate: %d", clock1);
 
-    free(bits);
+    if (clock1 <= 0 && (verbose || g_debugMode)) {
+        int cclk = correlationClockPSK(bits, size, fc);
+        if (cclk > 0) {
+            PrintAndLogEx(HINT, "Hint: autocorrelation suggests clock " _YELLOW_("%d") ", try " _YELLOW_("`-c %d`"), cclk, cclk);
+        }
+    }
+
+    releaseGraphBufU8(bits);
     return clock1;
 }
 
@@ -299,16 +519,10 @@ int GetNrzClock(const char *str, bool verbose) {
         return clock1;
 
     // Auto-detect clock
-    uint8_t *bits = calloc(MAX_GRAPH_TRACE_LEN,  sizeof(uint8_t));
+    size_t size = 0;
+    uint8_t *bits = getGraphBufU8(&size);
     if (bits == NULL) {
-        PrintAndLogEx(WARNING, "Failed to allocate memory");
-        return -1;
-    }
-
-    size_t size = getFromGraphBuf(bits);
-    if (size == 0) {
         PrintAndLogEx(WARNING, "Failed to copy from graphbuffer");
-        free(bits);
         return -1;
     }
 
@@ -319,7 +533,7 @@ int GetNrzClock(const char *str, bool verbose) {
     if (verbose)
         PrintAndLogEx(SUCCESS, "Auto-detected clock rate: %d", clock1);
 
-    free(bits);
+    releaseGraphBufU8(bits);
     return clock1;
 }
 
@@ -355,23 +569,17 @@ bool fskClocks(uint8_t *fc1, uint8_t *fc2, uint8_t *rf1, int *firstClockEdge) {
     if (getSignalProperties()->isnoise)
         return false;
 
-    uint8_t *bits = calloc(MAX_GRAPH_TRACE_LEN,  sizeof(uint8_t));
+    size_t size = 0;
+    uint8_t *bits = getGraphBufU8(&size);
     if (bits == NULL) {
-        PrintAndLogEx(WARNING, "Failed to allocate memory");
-        return false;
-    }
-
-    size_t size = getFromGraphBuf(bits);
-    if (size == 0) {
         PrintAndLogEx(WARNING, "Failed to copy from graphbuffer");
-        free(bits);
         return false;
     }
 
     uint16_t ans = countFC(bits, size, true);
     if (ans == 0) {
         PrintAndLogEx(DEBUG, "DEBUG: No data found");
-        free(bits);
+        releaseGraphBufU8(bits);
         return false;
     }
 
@@ -379,7 +587,7 @@ bool fskClocks(uint8_t *fc1, uint8_t *fc2, uint8_t *rf1, int *firstClockEdge) {
     *fc2 = ans & 0xFF;
     *rf1 = detectFSKClk(bits, size, *fc1, *fc2, firstClockEdge);
 
-    free(bits);
+    releaseGraphBufU8(bits);
 
     if (*rf1 == 0) {
         PrintAndLogEx(DEBUG, "DEBUG: Clock detect error");
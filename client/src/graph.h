@@ -31,6 +31,10 @@ bool HasGraphData(void);
 void setGraphBuf(const uint8_t *src, size_t size);
 void save_restoreGB(uint8_t saveOpt);
 size_t getFromGraphBuf(uint8_t *dest);
+bool reserveGraphBuf(size_t len);
+size_t getGraphBufCapacity(void);
+uint8_t *getGraphBufU8(size_t *size);
+void releaseGraphBufU8(uint8_t *bits);
 void convertGraphFromBitstream(void);
 void convertGraphFromBitstreamEx(int hi, int low);
 bool isGraphBitstream(void);
@@ -40,13 +44,16 @@ int GetPskClock(const char *str, bool verbose);
 int GetPskCarrier(bool verbose);
 int GetNrzClock(const char *str, bool verbose);
 int GetFskClock(const char *str, bool verbose);
+int GetCorrelationClock(const uint8_t *mark, size_t size);
 bool fskClocks(uint8_t *fc1, uint8_t *fc2, uint8_t *rf1, int *firstClockEdge);
 
-#define MAX_GRAPH_TRACE_LEN (40000 * 8)
+// The graph buffer grows on demand,  this many samples are always available
+// without calling reserveGraphBuf() first.
+#define GRAPH_TRACE_LEN_INIT (40000 * 8)
 #define GRAPH_SAVE 1
 #define GRAPH_RESTORE 0
 
-extern int g_GraphBuffer[MAX_GRAPH_TRACE_LEN];
+extern int *g_GraphBuffer;
 extern size_t g_GraphTraceLen;
 
 #ifdef __cplusplus
@@ -0,0 +1,308 @@
+//-----------------------------------------------------------------------------
+// Copyright (C) Proxmark3 contributors. See AUTHORS.md for details.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See LICENSE.txt for the text of the license.
+//-----------------------------------------------------------------------------
+// Bitsliced iClass MAC.
+//
+// The MAC is computed for up to 512 keys at once, one key per bit lane, see
+// cipher_bs_core.h. The core is instantiated once per word width and the
+// widest one the CPU supports is picked at runtime, using the same SIMD
+// selection as the hardnested bruteforcer (so `hf mf hardnested --i2` etc.
+// also pins the width used here).
+//-----------------------------------------------------------------------------
+
+#include "cipher_bs.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cipher.h"
+#include "hardnested_bf_core.h"  // SIMDExecInstr, GetSIMDInstrAuto
+#include "ui.h"
+#include "util.h"                // transpose64
+#include "util_posix.h"          // msclock
+
+// 64 lanes, plain integer ops
+#define BS_BITS 64
+#define BS_FN(x) x##_64
+#define BS_TARGET
+#include "cipher_bs_core.h"
+#undef BS_TARGET
+#undef BS_FN
+#undef BS_BITS
+
+// 128 lanes, SSE2 / NEON
+#define BS_BITS 128
+#define BS_FN(x) x##_128
+#if defined(COMPILER_HAS_SIMD_X86)
+#define BS_TARGET __attribute__((target("sse2")))
+#else
+#define BS_TARGET
+#endif
+#include "cipher_bs_core.h"
+#undef BS_TARGET
+#undef BS_FN
+#undef BS_BITS
+
+#if defined(COMPILER_HAS_SIMD_X86)
+// 256 lanes, AVX2
+#define BS_BITS 256
+#define BS_FN(x) x##_256
+#define BS_TARGET __attribute__((target("avx2")))
+#include "cipher_bs_core.h"
+#undef BS_TARGET
+#undef BS_FN
+#undef BS_BITS
+#endif
+
+#if defined(COMPILER_HAS_SIMD_AVX512)
+// 512 lanes, AVX512
+#define BS_BITS 512
+#define BS_FN(x) x##_512
+#define BS_TARGET __attribute__((target("avx512f")))
+#include "cipher_bs_core.h"
+#undef BS_TARGET
+#undef BS_FN
+#undef BS_BITS
+#endif
+
+typedef void mac_bs_fn_t(const uint8_t *cc_nr, const uint8_t *mac, const uint64_t *kp, uint64_t *match, uint64_t *out);
+
+typedef struct {
+    mac_bs_fn_t *fn;
+    size_t lanes;
+    const char *name;
+} mac_bs_impl_t;
+
+static mac_bs_impl_t mac_bs_select(void) {
+    switch (GetSIMDInstrAuto()) {
+#if defined(COMPILER_HAS_SIMD_AVX512)
+        case SIMD_AVX512:
+            return (mac_bs_impl_t) { mac_bs_512, 512, "AVX512" };
+#endif
+#if defined(COMPILER_HAS_SIMD_X86)
+        case SIMD_AVX2:
+            return (mac_bs_impl_t) { mac_bs_256, 256, "AVX2" };
+        // AVX1 has no 256 bit integer ops
+        case SIMD_AVX:
+        case SIMD_SSE2:
+            return (mac_bs_impl_t) { mac_bs_128, 128, "SSE2" };
+        case SIMD_MMX:
+#endif
+#if defined(COMPILER_HAS_SIMD_NEON)
+        case SIMD_NEON:
+            return (mac_bs_impl_t) { mac_bs_128, 128, "NEON" };
+#endif
+        case SIMD_AUTO:
+        case SIMD_NONE:
+        default:
+            break;
+    }
+    return (mac_bs_impl_t) { mac_bs_64, 64, "64-bit" };
+}
+
+size_t doMAC_bs_lanes(void) {
+    return mac_bs_select().lanes;
+}
+
+const char *doMAC_bs_name(void) {
+    return mac_bs_select().name;
+}
+
+// transpose up to LOCLASS_MAC_BS_MAX keys into bit planes, kp[(byte * 8 + bit) * words + word]
+static void keys_to_planes(const uint8_t (*div_keys)[8], size_t cnt, size_t words, uint64_t *kp) {
+    for (size_t w = 0; w < words; w++) {
+        uint64_t a[64] = {0};
+        for (size_t lane = 0; lane < 64 && w * 64 + lane < cnt; lane++) {
+            const uint8_t *key = div_keys[w * 64 + lane];
+            for (int j = 0; j < 8; j++) {
+                a[lane] |= (uint64_t)key[j] << (j * 8);
+            }
+        }
+        transpose64(a);
+        for (int p = 0; p < 64; p++) {
+            kp[p * words + w] = a[p];
+        }
+    }
+}
+
+size_t doMAC_bs(const uint8_t *cc_nr, const uint8_t *mac, const uint8_t (*div_keys)[8], size_t n, size_t *hits) {
+
+    mac_bs_impl_t impl = mac_bs_select();
+    const size_t words = impl.lanes / 64;
+
+    uint64_t kp[64 * (LOCLASS_MAC_BS_MAX / 64)] __attribute__((aligned(64)));
+    uint64_t match[LOCLASS_MAC_BS_MAX / 64];
+
+    size_t found = 0;
+    for (size_t base = 0; base < n; base += impl.lanes) {
+
+        size_t cnt = n - base;
+        if (cnt > impl.lanes) {
+            cnt = impl.lanes;
+        }
+
+        keys_to_planes(div_keys + base, cnt, words, kp);
+
+        impl.fn(cc_nr, mac, kp, match, NULL);
+
+        for (size_t lane = 0; lane < cnt; lane++) {
+            if ((match[lane >> 6] >> (lane & 63)) & 1) {
+                hits[found++] = base + lane;
+            }
+        }
+    }
+    return found;
+}
+
+void doMAC_batch(const uint8_t *cc_nr, const uint8_t (*div_keys)[8], size_t n, uint8_t (*macs)[4]) {
+
+    mac_bs_impl_t impl = mac_bs_select();
+    const size_t words = impl.lanes / 64;
+
+    uint64_t kp[64 * (LOCLASS_MAC_BS_MAX / 64)] __attribute__((aligned(64)));
+    uint64_t out[32 * (LOCLASS_MAC_BS_MAX / 64)];
+
+    for (size_t base = 0; base < n; base += impl.lanes) {
+
+        size_t cnt = n - base;
+        if (cnt > impl.lanes) {
+            cnt = impl.lanes;
+        }
+
+        keys_to_planes(div_keys + base, cnt, words, kp);
+
+        impl.fn(cc_nr, NULL, kp, NULL, out);
+
+        // back from bit planes, MAC bit j is bit (j & 7) of byte j >> 3
+        for (size_t w = 0; w < words; w++) {
+            uint64_t a[64] = {0};
+            for (int j = 0; j < 32; j++) {
+                a[j] = out[j * words + w];
+            }
+            transpose64(a);
+            for (size_t lane = 0; lane < 64 && w * 64 + lane < cnt; lane++) {
+                for (int j = 0; j < 4; j++) {
+                    macs[base + w * 64 + lane][j] = (a[lane] >> (j * 8)) & 0xFF;
+                }
+            }
+        }
+    }
+}
+
+int testMAC_bs(void) {
+    PrintAndLogEx(SUCCESS, "Testing bitsliced MAC calculation ( %s, %zu lanes )...", doMAC_bs_name(), doMAC_bs_lanes());
+
+    // same vector as testMAC
+    uint8_t cc_nr[] = {0xFE, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0, 0, 0, 0};
+    uint8_t paper_key[8] = {0xE0, 0x33, 0xCA, 0x41, 0x9A, 0xEE, 0x43, 0xF9};
+    uint8_t paper_MAC[4] = {0x1d, 0x49, 0xC9, 0xDA};
+
+    const size_t n = 0x10000;
+    uint8_t (*keys)[8] = calloc(n, sizeof(*keys));
+    uint8_t (*macs)[4] = calloc(n, sizeof(*macs));
+    size_t *hits = calloc(n, sizeof(size_t));
+    if (keys == NULL || macs == NULL || hits == NULL) {
+        PrintAndLogEx(WARNING, "Failed to allocate memory");
+        free(keys);
+        free(macs);
+        free(hits);
+        return PM3_EMALLOC;
+    }
+
+    uint64_t x = 0x9E3779B97F4A7C15ULL;
+    for (size_t i = 0; i < n; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        memcpy(keys[i], &x, 8);
+    }
+    memcpy(keys[1000], paper_key, 8);
+
+    int res = PM3_SUCCESS;
+
+    // the paper key must be found, at a position that is not lane aligned
+    size_t found = doMAC_bs(cc_nr, paper_MAC, (const uint8_t (*)[8])keys, n, hits);
+    bool seen = false;
+    for (size_t i = 0; i < found; i++) {
+        seen |= (hits[i] == 1000);
+    }
+    if (seen == false) {
+        res = PM3_ESOFT;
+    }
+
+    // scalar reference, also the baseline for the benchmark
+    uint64_t t1 = msclock();
+    for (size_t i = 0; i < n; i++) {
+        doMAC(cc_nr, keys[i], macs[i]);
+    }
+    uint64_t scalar_ms = msclock() - t1;
+
+    // look for the MAC of a random key, every hit must agree with the scalar MAC
+    // and every key with that scalar MAC must be a hit
+    // repeated, a single pass is too short to time
+    const int reps = 64;
+    t1 = msclock();
+    for (int i = 0; i < reps; i++) {
+        found = doMAC_bs(cc_nr, macs[4242], (const uint8_t (*)[8])keys, n, hits);
+    }
+    uint64_t bs_ms = msclock() - t1;
+
+    size_t expected = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (memcmp(macs[i], macs[4242], 4) == 0) {
+            expected++;
+        }
+    }
+    if (found != expected) {
+        res = PM3_ESOFT;
+    }
+    for (size_t i = 0; i < found; i++) {
+        if (memcmp(macs[hits[i]], macs[4242], 4) != 0) {
+            res = PM3_ESOFT;
+        }
+    }
+
+    // batched MACs must be identical to the scalar ones
+    uint8_t (*batch)[4] = calloc(n, sizeof(*batch));
+    if (batch == NULL) {
+        res = PM3_EMALLOC;
+    } else {
+        doMAC_batch(cc_nr, (const uint8_t (*)[8])keys, n, batch);
+        if (memcmp(batch, macs, n * sizeof(*batch)) != 0) {
+            res = PM3_ESOFT;
+        }
+        free(batch);
+    }
+
+    if (res == PM3_SUCCESS) {
+        PrintAndLogEx(SUCCESS, "    Bitsliced MAC calculation ( %s )", _GREEN_("ok"));
+    } else {
+        PrintAndLogEx(FAILED, "    Bitsliced MAC calculation ( %s )", _RED_("fail"));
+    }
+
+    if (scalar_ms == 0) {
+        scalar_ms = 1;
+    }
+    if (bs_ms == 0) {
+        bs_ms = 1;
+    }
+    PrintAndLogEx(INFO, "    MAC throughput, scalar    " _YELLOW_("%8.0f") " keys/s", (double)n * 1000 / scalar_ms);
+    PrintAndLogEx(INFO, "    MAC throughput, bitsliced " _YELLOW_("%8.0f") " keys/s  ( x%.1f )", (double)n * reps * 1000 / bs_ms, (double)scalar_ms * reps / bs_ms);
+
+    free(keys);
+    free(macs);
+    free(hits);
+    return res;
+}
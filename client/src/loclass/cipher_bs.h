@@ -0,0 +1,56 @@
+//-----------------------------------------------------------------------------
+// Copyright (C) Proxmark3 contributors. See AUTHORS.md for details.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See LICENSE.txt for the text of the license.
+//-----------------------------------------------------------------------------
+// Bitsliced iClass MAC, checks many diversified keys against one cc_nr / MAC
+//-----------------------------------------------------------------------------
+
+#ifndef CIPHER_BS_H
+#define CIPHER_BS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// widest supported word, callers get the best throughput with batches of this size
+#define LOCLASS_MAC_BS_MAX    512
+
+/**
+ * @brief Computes the iClass MAC of cc_nr for n diversified keys and reports which match.
+ * Same result as calling doMAC() per key and comparing, but many keys are handled per
+ * instruction. The instruction set is picked at runtime, see GetSIMDInstrAuto().
+ * @param cc_nr 12 bytes
+ * @param mac expected 4 byte MAC
+ * @param div_keys n diversified keys
+ * @param n number of keys
+ * @param hits out, indices into div_keys of the matching keys (room for n entries)
+ * @return number of matching keys
+ */
+size_t doMAC_bs(const uint8_t *cc_nr, const uint8_t *mac, const uint8_t (*div_keys)[8], size_t n, size_t *hits);
+
+/**
+ * @brief Computes the iClass MAC of cc_nr for n diversified keys, same as calling doMAC() per key.
+ * @param cc_nr 12 bytes
+ * @param div_keys n diversified keys
+ * @param n number of keys
+ * @param macs out, n MACs
+ */
+void doMAC_batch(const uint8_t *cc_nr, const uint8_t (*div_keys)[8], size_t n, uint8_t (*macs)[4]);
+
+// lanes and name of the implementation doMAC_bs() currently uses
+size_t doMAC_bs_lanes(void);
+const char *doMAC_bs_name(void);
+
+int testMAC_bs(void);
+
+#endif // CIPHER_BS_H
@@ -0,0 +1,163 @@
+//-----------------------------------------------------------------------------
+// Copyright (C) Proxmark3 contributors. See AUTHORS.md for details.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See LICENSE.txt for the text of the license.
+//-----------------------------------------------------------------------------
+// Bitsliced iClass MAC core.
+//
+// This file has no include guard on purpose: cipher_bs.c includes it once per
+// word width, with
+//   BS_BITS    lanes per word (64, 128, 256, 512)
+//   BS_FN(x)   name mangling for this width
+//   BS_TARGET  function attribute selecting the instruction set
+//
+// Every lane of a word carries one candidate key. The cipher state is kept as
+// bit planes: l[i], r[i] hold bit i (LSB = 0) of the left/right registers and
+// the top/bottom shift registers are stored as a history so that shifting is
+// just advancing an offset.
+//-----------------------------------------------------------------------------
+
+#define BS_WORDS (BS_BITS / 64)
+
+typedef uint64_t BS_FN(bs_t) __attribute__((vector_size(BS_BITS / 8)));
+
+#define BS_MUX(s, a, b)  ((a) ^ (((a) ^ (b)) & (s)))
+
+// dst = a + b (mod 256), bitsliced ripple carry adder
+#define BS_ADD8(dst, a, b) do { \
+        BS_FN(bs_t) c_ = zero; \
+        for (int i_ = 0; i_ < 8; i_++) { \
+            BS_FN(bs_t) x_ = (a)[i_] ^ (b)[i_]; \
+            (dst)[i_] = x_ ^ c_; \
+            c_ = ((a)[i_] & (b)[i_]) | (c_ & x_); \
+        } \
+    } while (0)
+
+BS_TARGET
+static bool BS_FN(bs_all_set)(const BS_FN(bs_t) *v) {
+    for (int w = 0; w < BS_WORDS; w++) {
+        if ((*v)[w] != UINT64_MAX) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Runs the MAC for BS_BITS keys at once and compares against the expected mac.
+ * @param cc_nr 12 bytes, same layout as doMAC()
+ * @param mac expected 4 byte MAC, NULL to only collect the MAC bits in out
+ * @param kp key bit planes, kp[(byte * 8 + bit) * BS_WORDS + word]
+ * @param match out, BS_WORDS words, set bits mark lanes whose MAC matched (unused if mac is NULL)
+ * @param out out, MAC bit planes out[bit * BS_WORDS + word] for the 32 MAC bits, or NULL
+ */
+BS_TARGET
+static void BS_FN(mac_bs)(const uint8_t *cc_nr, const uint8_t *mac, const uint64_t *kp, uint64_t *match, uint64_t *out) {
+
+    const BS_FN(bs_t) zero = {0};
+    const BS_FN(bs_t) ones = ~zero;
+
+    BS_FN(bs_t) k[8][8];
+    memcpy(k, kp, sizeof(k));
+
+    BS_FN(bs_t) l[8], r[8], nl[8], nr[8], v[8];
+    BS_FN(bs_t) th[16 + 128];
+    BS_FN(bs_t) bh[8 + 128];
+
+    // init: l = (k0 ^ 0x4c) + 0xEC, r = (k0 ^ 0x4c) + 0x21, b = 0x4c, t = 0xE012
+    BS_FN(bs_t) c_ec[8], c_21[8];
+    for (int i = 0; i < 8; i++) {
+        v[i] = ((0x4C >> i) & 1) ? ~k[0][i] : k[0][i];
+        c_ec[i] = ((0xEC >> i) & 1) ? ones : zero;
+        c_21[i] = ((0x21 >> i) & 1) ? ones : zero;
+        bh[i] = ((0x4C >> i) & 1) ? ones : zero;
+    }
+    BS_ADD8(l, v, c_ec);
+    BS_ADD8(r, v, c_21);
+
+    for (int i = 0; i < 16; i++) {
+        th[i] = ((0xE012 >> i) & 1) ? ones : zero;
+    }
+
+    BS_FN(bs_t) miss = zero;
+
+    // 96 input bits followed by 32 output bits, output bit j is r5 (bit 2)
+    // of the state after 96 + j successor steps.
+    for (int step = 0; step < 128; step++) {
+
+        BS_FN(bs_t) *t = th + step;
+        BS_FN(bs_t) *b = bh + step;
+
+        if (step >= 96) {
+            int j = step - 96;
+            if (out) {
+                memcpy(out + j * BS_WORDS, &r[2], sizeof(r[2]));
+            }
+            if (mac) {
+                miss |= r[2] ^ (((mac[j >> 3] >> (j & 7)) & 1) ? ones : zero);
+                if (BS_FN(bs_all_set)(&miss)) {
+                    break;
+                }
+            }
+            if (step == 127) {
+                break;
+            }
+        }
+
+        BS_FN(bs_t) y = zero;
+        if (step < 96 && ((cc_nr[step >> 3] >> (step & 7)) & 1)) {
+            y = ones;
+        }
+
+        // T(t), taps x0 x1 x5 x7 x10 x11 x14 x15
+        BS_FN(bs_t) Tt = t[15] ^ t[14] ^ t[10] ^ t[8] ^ t[5] ^ t[4] ^ t[1] ^ t[0];
+
+        // r0 is the MSB
+        BS_FN(bs_t) r0 = r[7], r1 = r[6], r2 = r[5], r3 = r[4];
+        BS_FN(bs_t) r4 = r[3], r5 = r[2], r6 = r[1], r7 = r[0];
+
+        t[16] = Tt ^ r0 ^ r4;
+        b[8] = b[6] ^ b[5] ^ b[4] ^ b[0] ^ r7;
+
+        BS_FN(bs_t) z0 = (r0 & r2) ^ (r1 & ~r3) ^ (r2 | r4);
+        BS_FN(bs_t) z1 = (r0 | r2) ^ (r5 | r7) ^ r1 ^ r6 ^ Tt ^ y;
+        BS_FN(bs_t) z2 = (r3 & ~r5) ^ (r4 & r6) ^ r7 ^ Tt;
+
+        // k[select(T(t), y, r)] ^ b'
+        for (int i = 0; i < 8; i++) {
+            BS_FN(bs_t) m01 = BS_MUX(z2, k[0][i], k[1][i]);
+            BS_FN(bs_t) m23 = BS_MUX(z2, k[2][i], k[3][i]);
+            BS_FN(bs_t) m45 = BS_MUX(z2, k[4][i], k[5][i]);
+            BS_FN(bs_t) m67 = BS_MUX(z2, k[6][i], k[7][i]);
+            BS_FN(bs_t) m03 = BS_MUX(z1, m01, m23);
+            BS_FN(bs_t) m47 = BS_MUX(z1, m45, m67);
+            v[i] = BS_MUX(z0, m03, m47) ^ b[1 + i];
+        }
+
+        // r' = v + l,  l' = v + l + r
+        BS_ADD8(nr, v, l);
+        BS_ADD8(nl, nr, r);
+        memcpy(l, nl, sizeof(l));
+        memcpy(r, nr, sizeof(r));
+    }
+
+    if (match) {
+        for (int w = 0; w < BS_WORDS; w++) {
+            match[w] = ~miss[w];
+        }
+    }
+}
+
+#undef BS_ADD8
+#undef BS_MUX
+#undef BS_WORDS
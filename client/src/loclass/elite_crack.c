@@ -39,6 +39,7 @@
 #include <time.h>
 #include "cipherutils.h"
 #include "cipher.h"
+#include "cipher_bs.h"
 #include "ikeys.h"
 #include "elite_crack.h"
 #include "fileutils.h"
@@ -172,21 +173,23 @@ static void rk(uint8_t *key, uint8_t n, uint8_t *outp_key) {
     }
 }
 
-static mbedtls_des_context ctx_enc;
-static mbedtls_des_context ctx_dec;
-
+// contexts are local so hash2 can run from several threads at once
 static void desdecrypt_iclass(uint8_t *iclass_key, uint8_t *input, uint8_t *output) {
     uint8_t key_std_format[8] = {0};
     permutekey_rev(iclass_key, key_std_format);
+    mbedtls_des_context ctx_dec;
     mbedtls_des_setkey_dec(&ctx_dec, key_std_format);
     mbedtls_des_crypt_ecb(&ctx_dec, input, output);
+    mbedtls_des_free(&ctx_dec);
 }
 
 static void desencrypt_iclass(uint8_t *iclass_key, uint8_t *input, uint8_t *output) {
     uint8_t key_std_format[8] = {0};
     permutekey_rev(iclass_key, key_std_format);
+    mbedtls_des_context ctx_enc;
     mbedtls_des_setkey_enc(&ctx_enc, key_std_format);
     mbedtls_des_crypt_ecb(&ctx_enc, input, output);
+    mbedtls_des_free(&ctx_enc);
 }
 
 /**
@@ -325,53 +328,71 @@ static void *bf_thread(void *thread_arg) {
     memcpy(bytes_to_recover, targ->bytes_to_recover, sizeof(bytes_to_recover));
     memcpy(keytable, targ->keytable, sizeof(keytable));
 
-    while (!(brute & endmask)) {
+    // candidates are diversified one by one and their MACs checked in batches
+    // with the bitsliced implementation
+    uint8_t div_keys[LOCLASS_MAC_BS_MAX][8];
+    uint32_t brutes[LOCLASS_MAC_BS_MAX];
+    size_t hits[LOCLASS_MAC_BS_MAX];
+    size_t batched = 0;
 
-        int found = __atomic_load_n(&loclass_found, __ATOMIC_SEQ_CST);
+    while (true) {
 
-        if (found != 0xFF) return NULL;
+        bool last = (brute & endmask);
 
-        //Update the keytable with the brute-values
-        for (uint8_t i = 0; i < numbytes_to_recover; i++) {
-            keytable[bytes_to_recover[i]] &= 0xFF00;
-            keytable[bytes_to_recover[i]] |= (brute >> (i * 8) & 0xFF);
-        }
+        if (last == false) {
+            //Update the keytable with the brute-values
+            for (uint8_t i = 0; i < numbytes_to_recover; i++) {
+                keytable[bytes_to_recover[i]] &= 0xFF00;
+                keytable[bytes_to_recover[i]] |= (brute >> (i * 8) & 0xFF);
+            }
 
-        uint8_t key_sel[8] = {0};
+            uint8_t key_sel[8] = {0};
 
-        // Piece together the key
-        key_sel[0] = keytable[key_index[0]] & 0xFF;
-        key_sel[1] = keytable[key_index[1]] & 0xFF;
-        key_sel[2] = keytable[key_index[2]] & 0xFF;
-        key_sel[3] = keytable[key_index[3]] & 0xFF;
-        key_sel[4] = keytable[key_index[4]] & 0xFF;
-        key_sel[5] = keytable[key_index[5]] & 0xFF;
-        key_sel[6] = keytable[key_index[6]] & 0xFF;
-        key_sel[7] = keytable[key_index[7]] & 0xFF;
+            // Piece together the key
+            key_sel[0] = keytable[key_index[0]] & 0xFF;
+            key_sel[1] = keytable[key_index[1]] & 0xFF;
+            key_sel[2] = keytable[key_index[2]] & 0xFF;
+            key_sel[3] = keytable[key_index[3]] & 0xFF;
+            key_sel[4] = keytable[key_index[4]] & 0xFF;
+            key_sel[5] = keytable[key_index[5]] & 0xFF;
+            key_sel[6] = keytable[key_index[6]] & 0xFF;
+            key_sel[7] = keytable[key_index[7]] & 0xFF;
 
-        // Permute from iclass format to standard format
+            // Permute from iclass format to standard format
 
-        uint8_t key_sel_p[8] = {0};
-        permutekey_rev(key_sel, key_sel_p);
+            uint8_t key_sel_p[8] = {0};
+            permutekey_rev(key_sel, key_sel_p);
 
-        // Diversify
-        uint8_t div_key[8] = {0};
-        diversifyKey(csn, key_sel_p, div_key);
+            // Diversify
+            diversifyKey(csn, key_sel_p, div_keys[batched]);
+            brutes[batched] = brute;
+            batched++;
+        }
 
-        // Calc mac
-        uint8_t calculated_MAC[4] = {0};
-        doMAC(cc_nr, div_key, calculated_MAC);
+        if (batched == LOCLASS_MAC_BS_MAX || (last && batched)) {
 
-        // success
-        if (memcmp(calculated_MAC, mac, 4) == 0) {
+            int found = __atomic_load_n(&loclass_found, __ATOMIC_SEQ_CST);
+            if (found != 0xFF) return NULL;
 
-            loclass_thread_ret_t *r = (loclass_thread_ret_t *)malloc(sizeof(loclass_thread_ret_t));
+            // Calc macs
+            size_t n = doMAC_bs(cc_nr, mac, (const uint8_t (*)[8])div_keys, batched, hits);
+            batched = 0;
 
-            for (uint8_t i = 0 ; i < numbytes_to_recover; i++) {
-                r->values[i] = keytable[bytes_to_recover[i]] & 0xFF;
+            // success
+            if (n) {
+
+                loclass_thread_ret_t *r = (loclass_thread_ret_t *)malloc(sizeof(loclass_thread_ret_t));
+
+                for (uint8_t i = 0 ; i < numbytes_to_recover && i < sizeof(r->values); i++) {
+                    r->values[i] = (brutes[hits[0]] >> (i * 8)) & 0xFF;
+                }
+                __atomic_store_n(&loclass_found, targ->thread_idx, __ATOMIC_SEQ_CST);
+                pthread_exit((void *)r);
             }
-            __atomic_store_n(&loclass_found, targ->thread_idx, __ATOMIC_SEQ_CST);
-            pthread_exit((void *)r);
+        }
+
+        if (last) {
+            break;
         }
 
         brute += loclass_tc;
@@ -827,6 +848,67 @@ static int _testBruteforce(void) {
     return res;
 }
 
+// Candidates/s of the brute force inner loop (permute, diversify, MAC), single thread
+static int _testBruteforceSpeed(void) {
+
+    PrintAndLogEx(INFO, "Testing brute force speed...");
+
+    uint8_t csn[8] = {0x01, 0x02, 0x03, 0x04, 0xF7, 0xFF, 0x12, 0xE0};
+    uint8_t cc_nr[12] = {0xFE, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0, 0, 0, 0};
+    uint8_t mac[4] = {0};
+    const uint32_t n = 0x4000;
+
+    uint8_t key_sel[8] = {0x5B, 0x7C, 0x62, 0xC4, 0x91, 0xC1, 0x1B, 0x39};
+    uint8_t key_sel_p[8] = {0};
+
+    uint8_t div_keys[LOCLASS_MAC_BS_MAX][8];
+    size_t hits[LOCLASS_MAC_BS_MAX];
+    size_t found_scalar = 0, found_bs = 0;
+
+    uint64_t t1 = msclock();
+    for (uint32_t brute = 0; brute < n; brute++) {
+        key_sel[0] = brute & 0xFF;
+        key_sel[1] = brute >> 8;
+        permutekey_rev(key_sel, key_sel_p);
+        uint8_t calculated_MAC[4] = {0};
+        diversifyKey(csn, key_sel_p, div_keys[0]);
+        doMAC(cc_nr, div_keys[0], calculated_MAC);
+        if (memcmp(calculated_MAC, mac, 4) == 0) {
+            found_scalar++;
+        }
+    }
+    uint64_t scalar_ms = msclock() - t1;
+
+    t1 = msclock();
+    for (uint32_t brute = 0; brute < n; brute++) {
+        key_sel[0] = brute & 0xFF;
+        key_sel[1] = brute >> 8;
+        permutekey_rev(key_sel, key_sel_p);
+        diversifyKey(csn, key_sel_p, div_keys[brute % LOCLASS_MAC_BS_MAX]);
+        if ((brute % LOCLASS_MAC_BS_MAX) == LOCLASS_MAC_BS_MAX - 1) {
+            found_bs += doMAC_bs(cc_nr, mac, (const uint8_t (*)[8])div_keys, LOCLASS_MAC_BS_MAX, hits);
+        }
+    }
+    uint64_t bs_ms = msclock() - t1;
+
+    if (scalar_ms == 0) {
+        scalar_ms = 1;
+    }
+    if (bs_ms == 0) {
+        bs_ms = 1;
+    }
+
+    PrintAndLogEx(INFO, "    scalar MAC           " _YELLOW_("%8.0f") " keys/s", (double)n * 1000 / scalar_ms);
+    PrintAndLogEx(INFO, "    bitsliced MAC %-6s " _YELLOW_("%8.0f") " keys/s  ( x%.1f )", doMAC_bs_name(), (double)n * 1000 / bs_ms, (double)scalar_ms / bs_ms);
+    PrintAndLogEx(INFO, "    using " _YELLOW_("%d") " threads for the brute force", num_CPUs());
+
+    if (found_scalar != found_bs) {
+        PrintAndLogEx(FAILED, "    brute force speed, scalar and bitsliced disagree ( %s )", _RED_("fail"));
+        return PM3_ESOFT;
+    }
+    return PM3_SUCCESS;
+}
+
 static int _test_iclass_key_permutation(void) {
     uint8_t testcase[8] = {0x6c, 0x8d, 0x44, 0xf9, 0x2a, 0x2d, 0x01, 0xbf};
     uint8_t testcase_output[8] = {0};
@@ -904,6 +986,8 @@ int testElite(bool slowtests) {
     res += _test_iclass_key_permutation();
     PrintAndLogEx((res == PM3_SUCCESS) ? SUCCESS : WARNING, "    key diversification ( %s )", (res == PM3_SUCCESS) ? _GREEN_("ok") : _RED_("fail"));
 
+    res += _testBruteforceSpeed();
+
     if (slowtests)
         res += _testBruteforce();
 
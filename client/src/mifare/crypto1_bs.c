@@ -0,0 +1,266 @@
+//-----------------------------------------------------------------------------
+// Copyright (C) Proxmark3 contributors. See AUTHORS.md for details.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See LICENSE.txt for the text of the license.
+//-----------------------------------------------------------------------------
+// Bitsliced Crypto1.
+//
+// A sniffed nested authentication is replayed for up to 512 keys at once, one
+// key per bit lane, see crypto1_bs_core.h. The core is instantiated once per
+// word width and the widest one the CPU supports is picked at runtime, using
+// the same SIMD selection as the hardnested bruteforcer.
+//
+// The prng successor is linear, so suc(ks ^ nt_enc) == suc(ks) ^ suc(nt_enc).
+// The constant part is computed once per auth and the core only has to xor
+// keystream planes to get the expected ar / at bits.
+//-----------------------------------------------------------------------------
+
+#include "crypto1_bs.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "crapto1/crapto1.h"
+#include "hardnested_bf_core.h"  // SIMDExecInstr, GetSIMDInstrAuto
+#include "util.h"                // num_CPUs, transpose64
+
+typedef struct {
+    uint32_t in[2];        // nt_enc ^ uid, nr_enc
+    uint32_t ref[2];       // ar_enc ^ suc64(nt_enc), at_enc ^ suc96(nt_enc)
+    uint32_t rows[2][32];  // bit b of rows[k][j] is bit j of suc64 / suc96 (1 << b)
+} crypto1_bs_auth_t;
+
+// filter function (f20), same as hardnested_bf_core.c
+#define f20a(a,b,c,d) (((a|b)^(a&d))^(c&((a^b)|d)))
+#define f20b(a,b,c,d) (((a&b)|c)^((a^b)&(c|d)))
+#define f20c(a,b,c,d,e) ((a|((b|e)&(d^e)))^((a^(b&d))&((c^d)|(b&e))))
+
+// 64 lanes, plain integer ops
+#define BS_BITS 64
+#define BS_FN(x) x##_64
+#define BS_TARGET
+#include "crypto1_bs_core.h"
+#undef BS_TARGET
+#undef BS_FN
+#undef BS_BITS
+
+// 128 lanes, SSE2 / NEON
+#define BS_BITS 128
+#define BS_FN(x) x##_128
+#if defined(COMPILER_HAS_SIMD_X86)
+#define BS_TARGET __attribute__((target("sse2")))
+#else
+#define BS_TARGET
+#endif
+#include "crypto1_bs_core.h"
+#undef BS_TARGET
+#undef BS_FN
+#undef BS_BITS
+
+#if defined(COMPILER_HAS_SIMD_X86)
+// 256 lanes, AVX2
+#define BS_BITS 256
+#define BS_FN(x) x##_256
+#define BS_TARGET __attribute__((target("avx2")))
+#include "crypto1_bs_core.h"
+#undef BS_TARGET
+#undef BS_FN
+#undef BS_BITS
+#endif
+
+#if defined(COMPILER_HAS_SIMD_AVX512)
+// 512 lanes, AVX512
+#define BS_BITS 512
+#define BS_FN(x) x##_512
+#define BS_TARGET __attribute__((target("avx512f")))
+#include "crypto1_bs_core.h"
+#undef BS_TARGET
+#undef BS_FN
+#undef BS_BITS
+#endif
+
+typedef void auth_bs_fn_t(const crypto1_bs_auth_t *p, const uint64_t *kp, uint64_t *match);
+
+typedef struct {
+    auth_bs_fn_t *fn;
+    size_t lanes;
+    const char *name;
+} auth_bs_impl_t;
+
+static auth_bs_impl_t auth_bs_select(void) {
+    switch (GetSIMDInstrAuto()) {
+#if defined(COMPILER_HAS_SIMD_AVX512)
+        case SIMD_AVX512:
+            return (auth_bs_impl_t) { auth_bs_512, 512, "AVX512" };
+#endif
+#if defined(COMPILER_HAS_SIMD_X86)
+        case SIMD_AVX2:
+            return (auth_bs_impl_t) { auth_bs_256, 256, "AVX2" };
+        // AVX1 has no 256 bit integer ops
+        case SIMD_AVX:
+        case SIMD_SSE2:
+            return (auth_bs_impl_t) { auth_bs_128, 128, "SSE2" };
+        case SIMD_MMX:
+#endif
+#if defined(COMPILER_HAS_SIMD_NEON)
+        case SIMD_NEON:
+            return (auth_bs_impl_t) { auth_bs_128, 128, "NEON" };
+#endif
+        case SIMD_AUTO:
+        case SIMD_NONE:
+        default:
+            break;
+    }
+    return (auth_bs_impl_t) { auth_bs_64, 64, "64-bit" };
+}
+
+size_t crypto1_bs_lanes(void) {
+    return auth_bs_select().lanes;
+}
+
+const char *crypto1_bs_name(void) {
+    return auth_bs_select().name;
+}
+
+// transpose up to CRYPTO1_BS_MAX keys into LFSR bit planes, kp[n * words + word]
+// plane n is key bit (47 - n) ^ 7, the order crypto1_init() loads them in
+static void keys_to_planes(const uint64_t *keys, size_t cnt, size_t words, uint64_t *kp) {
+    for (size_t w = 0; w < words; w++) {
+        uint64_t a[64] = {0};
+        for (size_t lane = 0; lane < 64 && w * 64 + lane < cnt; lane++) {
+            a[lane] = keys[w * 64 + lane];
+        }
+        transpose64(a);
+        for (int n = 0; n < 48; n++) {
+            kp[n * words + w] = a[(47 - n) ^ 7];
+        }
+    }
+}
+
+typedef struct {
+    const crypto1_bs_auth_t *auth;
+    auth_bs_impl_t impl;
+    const uint64_t *keys;
+    size_t n;
+    size_t *next;   // shared, first key of the next batch
+    size_t *found;  // shared, number of hits
+    size_t *hits;
+} crypto1_bs_thread_arg_t;
+
+static void *crypto1_bs_thread(void *thread_arg) {
+    crypto1_bs_thread_arg_t *targ = (crypto1_bs_thread_arg_t *)thread_arg;
+
+    const size_t lanes = targ->impl.lanes;
+    const size_t words = lanes / 64;
+
+    uint64_t kp[48 * (CRYPTO1_BS_MAX / 64)] __attribute__((aligned(64)));
+    uint64_t match[CRYPTO1_BS_MAX / 64];
+
+    for (;;) {
+        size_t base = __atomic_fetch_add(targ->next, lanes, __ATOMIC_RELAXED);
+        if (base >= targ->n) {
+            break;
+        }
+
+        size_t cnt = targ->n - base;
+        if (cnt > lanes) {
+            cnt = lanes;
+        }
+
+        keys_to_planes(targ->keys + base, cnt, words, kp);
+
+        targ->impl.fn(targ->auth, kp, match);
+
+        for (size_t lane = 0; lane < cnt; lane++) {
+            if ((match[lane >> 6] >> (lane & 63)) & 1) {
+                targ->hits[__atomic_fetch_add(targ->found, 1, __ATOMIC_RELAXED)] = base + lane;
+            }
+        }
+    }
+    return NULL;
+}
+
+static int hits_cmp(const void *a, const void *b) {
+    size_t x = *(const size_t *)a;
+    size_t y = *(const size_t *)b;
+    return (x > y) - (x < y);
+}
+
+size_t crypto1_bs_nested_check(uint32_t uid, uint32_t nt_enc, uint32_t nr_enc, uint32_t ar_enc, uint32_t at_enc,
+                               const uint64_t *keys, size_t n, size_t *hits) {
+
+    if (keys == NULL || n == 0) {
+        return 0;
+    }
+
+    crypto1_bs_auth_t auth = {
+        .in = { nt_enc ^ uid, nr_enc },
+        .ref = { ar_enc ^ prng_successor(nt_enc, 64), at_enc ^ prng_successor(nt_enc, 96) },
+    };
+    for (int b = 0; b < 32; b++) {
+        uint32_t s64 = prng_successor(1u << b, 64);
+        uint32_t s96 = prng_successor(1u << b, 96);
+        for (int j = 0; j < 32; j++) {
+            auth.rows[0][j] |= ((s64 >> j) & 1) << b;
+            auth.rows[1][j] |= ((s96 >> j) & 1) << b;
+        }
+    }
+
+    auth_bs_impl_t impl = auth_bs_select();
+
+    size_t next = 0;
+    size_t found = 0;
+    crypto1_bs_thread_arg_t targ = {
+        .auth = &auth,
+        .impl = impl,
+        .keys = keys,
+        .n = n,
+        .next = &next,
+        .found = &found,
+        .hits = hits,
+    };
+
+    // small dictionaries are done before a thread would have started
+    size_t batches = (n + impl.lanes - 1) / impl.lanes;
+    size_t thread_count = num_CPUs();
+    if (thread_count > batches) {
+        thread_count = batches;
+    }
+
+    if (thread_count <= 1) {
+        crypto1_bs_thread(&targ);
+    } else {
+        pthread_t *threads = calloc(thread_count, sizeof(pthread_t));
+        if (threads == NULL) {
+            crypto1_bs_thread(&targ);
+        } else {
+            size_t started = 0;
+            for (; started < thread_count; started++) {
+                if (pthread_create(&threads[started], NULL, crypto1_bs_thread, &targ) != 0) {
+                    break;
+                }
+            }
+            // whatever is left if a thread could not be started
+            crypto1_bs_thread(&targ);
+            for (size_t i = 0; i < started; i++) {
+                pthread_join(threads[i], NULL);
+            }
+            free(threads);
+        }
+    }
+
+    // threads report in any order, callers expect the dictionary order
+    qsort(hits, found, sizeof(size_t), hits_cmp);
+    return found;
+}
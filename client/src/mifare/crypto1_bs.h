@@ -0,0 +1,52 @@
+//-----------------------------------------------------------------------------
+// Copyright (C) Proxmark3 contributors. See AUTHORS.md for details.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See LICENSE.txt for the text of the license.
+//-----------------------------------------------------------------------------
+// Bitsliced Crypto1, checks many keys against one sniffed nested authentication
+//-----------------------------------------------------------------------------
+
+#ifndef CRYPTO1_BS_H
+#define CRYPTO1_BS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// widest supported word, callers get the best throughput with batches of this size
+#define CRYPTO1_BS_MAX    512
+
+/**
+ * @brief Finds the keys that produce a sniffed nested authentication.
+ * A key is reported when decrypting nt_enc gives an nt whose prng successors match the
+ * decrypted ar and at, which is the same test NestedCheckKey() starts with. Callers
+ * should still confirm hits with it, parity and the following command are not checked.
+ * Many keys are handled per instruction, the instruction set is picked at runtime (see
+ * GetSIMDInstrAuto()) and large key lists are split over all CPUs.
+ * @param uid card uid
+ * @param nt_enc encrypted tag nonce
+ * @param nr_enc encrypted reader nonce
+ * @param ar_enc encrypted reader answer
+ * @param at_enc encrypted tag answer
+ * @param keys n keys
+ * @param n number of keys
+ * @param hits out, indices into keys of the matching keys in ascending order (room for n entries)
+ * @return number of matching keys
+ */
+size_t crypto1_bs_nested_check(uint32_t uid, uint32_t nt_enc, uint32_t nr_enc, uint32_t ar_enc, uint32_t at_enc,
+                               const uint64_t *keys, size_t n, size_t *hits);
+
+// lanes and name of the implementation crypto1_bs_nested_check() currently uses
+size_t crypto1_bs_lanes(void);
+const char *crypto1_bs_name(void);
+
+#endif // CRYPTO1_BS_H
@@ -0,0 +1,116 @@
+//-----------------------------------------------------------------------------
+// Copyright (C) Proxmark3 contributors. See AUTHORS.md for details.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See LICENSE.txt for the text of the license.
+//-----------------------------------------------------------------------------
+// Bitsliced Crypto1 nested authentication core.
+//
+// This file has no include guard on purpose: crypto1_bs.c includes it once per
+// word width, with
+//   BS_BITS    lanes per word (64, 128, 256, 512)
+//   BS_FN(x)   name mangling for this width
+//   BS_TARGET  function attribute selecting the instruction set
+//
+// Every lane of a word carries one candidate key. The LFSR is kept as the
+// sequence of its bits: s[0..47] is the initial state, s[48 + t] the bit fed
+// back at clock t. At clock t odd bit i is s[t + 47 - 2i] and even bit i is
+// s[t + 46 - 2i], so shifting is just advancing an offset.
+//-----------------------------------------------------------------------------
+
+#define BS_WORDS (BS_BITS / 64)
+
+typedef uint64_t BS_FN(bs_t) __attribute__((vector_size(BS_BITS / 8)));
+
+BS_TARGET
+static bool BS_FN(bs_all_set)(const BS_FN(bs_t) *v) {
+    for (int w = 0; w < BS_WORDS; w++) {
+        if ((*v)[w] != UINT64_MAX) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Runs the card side of a nested authentication for BS_BITS keys at once.
+ * Lanes whose keystream gives ar == suc64(nt) and at == suc96(nt) are marked.
+ * @param p precomputed per auth values, see crypto1_bs_auth_t
+ * @param kp key bit planes in LFSR sequence order, kp[n * BS_WORDS + word] for n = 0..47
+ * @param match out, BS_WORDS words, set bits mark candidate keys
+ */
+BS_TARGET
+static void BS_FN(auth_bs)(const crypto1_bs_auth_t *p, const uint64_t *kp, uint64_t *match) {
+
+    const BS_FN(bs_t) zero = {0};
+    const BS_FN(bs_t) ones = ~zero;
+
+    BS_FN(bs_t) s[48 + 128];
+    memcpy(s, kp, 48 * sizeof(s[0]));
+
+    BS_FN(bs_t) ks0[32];
+    BS_FN(bs_t) miss = zero;
+
+    for (int step = 0; step < 128; step++) {
+
+        const BS_FN(bs_t) *x = s + step;
+
+        // keystream bit, filter over odd bits 0..19
+        BS_FN(bs_t) ks = f20c(f20a(x[9], x[11], x[13], x[15]),
+                              f20b(x[17], x[19], x[21], x[23]),
+                              f20b(x[25], x[27], x[29], x[31]),
+                              f20a(x[33], x[35], x[37], x[39]),
+                              f20b(x[41], x[43], x[45], x[47]));
+
+        BS_FN(bs_t) fb = zero;
+        for (int i = 0; i < 24; i++) {
+            if ((LF_POLY_ODD >> i) & 1) {
+                fb ^= x[47 - 2 * i];
+            }
+            if ((LF_POLY_EVEN >> i) & 1) {
+                fb ^= x[46 - 2 * i];
+            }
+        }
+
+        // crypto1_word() handles its words big endian per byte
+        int bit = (step & 31) ^ 24;
+
+        if (step < 32) {
+            // nt_enc ^ uid, encrypted feedback
+            ks0[bit] = ks;
+            fb ^= ks ^ (((p->in[0] >> bit) & 1) ? ones : zero);
+        } else if (step < 64) {
+            // nr_enc, encrypted feedback
+            fb ^= ks ^ (((p->in[1] >> bit) & 1) ? ones : zero);
+        } else {
+            // ar, at keystream, compare against the prng successor of nt = ks0 ^ nt_enc
+            int k = (step >> 5) - 2;
+            BS_FN(bs_t) e = (((p->ref[k] >> bit) & 1) ? ones : zero);
+            for (int b = 0; b < 32; b++) {
+                if ((p->rows[k][bit] >> b) & 1) {
+                    e ^= ks0[b];
+                }
+            }
+            miss |= ks ^ e;
+            if (BS_FN(bs_all_set)(&miss)) {
+                break;
+            }
+        }
+        s[48 + step] = fb;
+    }
+
+    for (int w = 0; w < BS_WORDS; w++) {
+        match[w] = ~miss[w];
+    }
+}
+
+#undef BS_WORDS
@@ -64,6 +64,7 @@ void DesfireClearSession(DesfireContext_t *ctx) {
     ctx->lastRequestZeroLen = false;
     ctx->cmdCntr = 0;
     memset(ctx->TI, 0, sizeof(ctx->TI));
+    memset(ctx->keySchedule, 0, sizeof(ctx->keySchedule));
 }
 
 void DesfireClearIV(DesfireContext_t *ctx) {
@@ -185,74 +186,193 @@ uint8_t *DesfireGetKey(DesfireContext_t *ctx, DesfireCryptoOpKeyType key_type) {
 }
 
 
-static void DesfireCryptoEncDecSingleBlock(uint8_t *key, DesfireCryptoAlgorithm keyType, uint8_t *data, uint8_t *dstdata, uint8_t *ivect, bool dir_to_send, bool encode) {
-    size_t block_size = desfire_get_key_block_length(keyType);
-    uint8_t sdata[DESFIRE_MAX_CRYPTO_BLOCK_SIZE] = {0};
-    memcpy(sdata, data, block_size);
-    if (dir_to_send) {
-        bin_xor(sdata, ivect, block_size);
+#if (defined(__i386__) || defined(__x86_64__)) && (defined(__GNUC__) || defined(__clang__))
+#define DESFIRE_HAS_AESNI
+#include <wmmintrin.h>
+
+// mbedtls keeps the round keys in the byte order AES-NI expects, and its decryption schedule
+// is already the "equivalent inverse cipher" one, so both can be used as they are.
+__attribute__((target("aes,sse2")))
+static void DesfireAESNIBlock(const mbedtls_aes_context *actx, bool encode, const uint8_t *in, uint8_t *out) {
+    const __m128i *rk = (const __m128i *)actx->rk;
+    __m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i *)in), _mm_loadu_si128(rk));
+    if (encode) {
+        for (int i = 1; i < actx->nr; i++)
+            b = _mm_aesenc_si128(b, _mm_loadu_si128(rk + i));
+        b = _mm_aesenclast_si128(b, _mm_loadu_si128(rk + actx->nr));
+    } else {
+        for (int i = 1; i < actx->nr; i++)
+            b = _mm_aesdec_si128(b, _mm_loadu_si128(rk + i));
+        b = _mm_aesdeclast_si128(b, _mm_loadu_si128(rk + actx->nr));
+    }
+    _mm_storeu_si128((__m128i *)out, b);
+}
+
+// CBC decryption of received data, the blocks do not depend on each other so four are in flight at once
+__attribute__((target("aes,sse2")))
+static size_t DesfireAESNIDecryptCBC(const mbedtls_aes_context *actx, const uint8_t *src, size_t blocks, uint8_t *dst, uint8_t *iv) {
+    const __m128i *rk = (const __m128i *)actx->rk;
+    __m128i prev = _mm_loadu_si128((const __m128i *)iv);
+    size_t i = 0;
+    for (; i + 4 <= blocks; i += 4) {
+        __m128i c0 = _mm_loadu_si128((const __m128i *)(src + (i + 0) * 16));
+        __m128i c1 = _mm_loadu_si128((const __m128i *)(src + (i + 1) * 16));
+        __m128i c2 = _mm_loadu_si128((const __m128i *)(src + (i + 2) * 16));
+        __m128i c3 = _mm_loadu_si128((const __m128i *)(src + (i + 3) * 16));
+
+        __m128i k = _mm_loadu_si128(rk);
+        __m128i b0 = _mm_xor_si128(c0, k);
+        __m128i b1 = _mm_xor_si128(c1, k);
+        __m128i b2 = _mm_xor_si128(c2, k);
+        __m128i b3 = _mm_xor_si128(c3, k);
+        for (int r = 1; r < actx->nr; r++) {
+            k = _mm_loadu_si128(rk + r);
+            b0 = _mm_aesdec_si128(b0, k);
+            b1 = _mm_aesdec_si128(b1, k);
+            b2 = _mm_aesdec_si128(b2, k);
+            b3 = _mm_aesdec_si128(b3, k);
+        }
+        k = _mm_loadu_si128(rk + actx->nr);
+        b0 = _mm_aesdeclast_si128(b0, k);
+        b1 = _mm_aesdeclast_si128(b1, k);
+        b2 = _mm_aesdeclast_si128(b2, k);
+        b3 = _mm_aesdeclast_si128(b3, k);
+
+        _mm_storeu_si128((__m128i *)(dst + (i + 0) * 16), _mm_xor_si128(b0, prev));
+        _mm_storeu_si128((__m128i *)(dst + (i + 1) * 16), _mm_xor_si128(b1, c0));
+        _mm_storeu_si128((__m128i *)(dst + (i + 2) * 16), _mm_xor_si128(b2, c1));
+        _mm_storeu_si128((__m128i *)(dst + (i + 3) * 16), _mm_xor_si128(b3, c2));
+        prev = c3;
     }
+    _mm_storeu_si128((__m128i *)iv, prev);
+    return i;
+}
+#endif
 
-    uint8_t edata[DESFIRE_MAX_CRYPTO_BLOCK_SIZE] = {0};
+static bool hwaes_enabled = true;
 
-    switch (keyType) {
+bool DesfireCryptoHwAESAvailable(void) {
+#if defined(DESFIRE_HAS_AESNI)
+    return __builtin_cpu_supports("aes");
+#else
+    return false;
+#endif
+}
+
+// for benchmarks and to rule it out when something looks wrong
+void DesfireCryptoSetHwAES(bool enable) {
+    hwaes_enabled = enable;
+}
+
+static bool DesfireUseHwAES(void) {
+    return hwaes_enabled && DesfireCryptoHwAESAvailable();
+}
+
+static DesfireKeySchedule_t *DesfireGetKeySchedule(DesfireContext_t *ctx, DesfireCryptoOpKeyType key_type, bool encode) {
+    uint8_t *key = DesfireGetKey(ctx, key_type);
+    DesfireKeySchedule_t *ks = &ctx->keySchedule[key_type][encode ? 1 : 0];
+    size_t keylen = desfire_get_key_length(ctx->keyType);
+
+    if (ks->valid && ks->keyType == ctx->keyType && memcmp(ks->key, key, keylen) == 0) {
+        // mbedtls points rk into the context itself, a copied context would still use the original
+        if (ctx->keyType != T_AES || ks->ctx.aes.rk == ks->ctx.aes.buf)
+            return ks;
+    }
+
+    memset(ks, 0, sizeof(DesfireKeySchedule_t));
+    switch (ctx->keyType) {
         case T_DES:
             if (encode)
-                des_encrypt(edata, sdata, key);
+                mbedtls_des_setkey_enc(&ks->ctx.des, key);
             else
-                des_decrypt(edata, sdata, key);
+                mbedtls_des_setkey_dec(&ks->ctx.des, key);
             break;
         case T_3DES:
-            if (encode) {
-                mbedtls_des3_context ctx3;
-                mbedtls_des3_set2key_enc(&ctx3, key);
-                mbedtls_des3_crypt_ecb(&ctx3, sdata, edata);
-            } else {
-                mbedtls_des3_context ctx3;
-                mbedtls_des3_set2key_dec(&ctx3, key);
-                mbedtls_des3_crypt_ecb(&ctx3, sdata, edata);
-            }
+            if (encode)
+                mbedtls_des3_set2key_enc(&ks->ctx.des3, key);
+            else
+                mbedtls_des3_set2key_dec(&ks->ctx.des3, key);
             break;
         case T_3K3DES:
-            if (encode) {
-                mbedtls_des3_context ctx3;
-                mbedtls_des3_set3key_enc(&ctx3, key);
-                mbedtls_des3_crypt_ecb(&ctx3, sdata, edata);
-            } else {
-                mbedtls_des3_context ctx3;
-                mbedtls_des3_set3key_dec(&ctx3, key);
-                mbedtls_des3_crypt_ecb(&ctx3, sdata, edata);
-            }
+            if (encode)
+                mbedtls_des3_set3key_enc(&ks->ctx.des3, key);
+            else
+                mbedtls_des3_set3key_dec(&ks->ctx.des3, key);
             break;
         case T_AES:
-            if (encode) {
-                mbedtls_aes_context actx;
-                mbedtls_aes_init(&actx);
-                mbedtls_aes_setkey_enc(&actx, key, 128);
-                mbedtls_aes_crypt_ecb(&actx, MBEDTLS_AES_ENCRYPT, sdata, edata);
-                mbedtls_aes_free(&actx);
-            } else {
-                mbedtls_aes_context actx;
-                mbedtls_aes_init(&actx);
-                mbedtls_aes_setkey_dec(&actx, key, 128);
-                mbedtls_aes_crypt_ecb(&actx, MBEDTLS_AES_DECRYPT, sdata, edata);
-                mbedtls_aes_free(&actx);
-            }
+            mbedtls_aes_init(&ks->ctx.aes);
+            if (encode)
+                mbedtls_aes_setkey_enc(&ks->ctx.aes, key, 128);
+            else
+                mbedtls_aes_setkey_dec(&ks->ctx.aes, key, 128);
             break;
     }
 
-    if (dir_to_send) {
-        memcpy(ivect, edata, block_size);
-    } else {
-        bin_xor(edata, ivect, block_size);
-        memcpy(ivect, data, block_size);
+    ks->valid = true;
+    ks->keyType = ctx->keyType;
+    memcpy(ks->key, key, keylen);
+    return ks;
+}
+
+static void DesfireCryptoBlock(DesfireKeySchedule_t *ks, bool encode, bool hwaes, const uint8_t *in, uint8_t *out) {
+    switch (ks->keyType) {
+        case T_DES:
+            mbedtls_des_crypt_ecb(&ks->ctx.des, in, out);
+            break;
+        case T_3DES:
+        case T_3K3DES:
+            mbedtls_des3_crypt_ecb(&ks->ctx.des3, in, out);
+            break;
+        case T_AES:
+#if defined(DESFIRE_HAS_AESNI)
+            if (hwaes) {
+                DesfireAESNIBlock(&ks->ctx.aes, encode, in, out);
+                break;
+            }
+#endif
+            mbedtls_aes_crypt_ecb(&ks->ctx.aes, encode ? MBEDTLS_AES_ENCRYPT : MBEDTLS_AES_DECRYPT, in, out);
+            break;
     }
+}
+
+// CBC over srcdatalen bytes, dstdata may be equal to srcdata or NULL.
+// dir_to_send: the iv is xored before the cipher (sending), otherwise after it (receiving).
+// a last incomplete block is zero padded and only its first bytes are written.
+static void DesfireCryptoCBC(DesfireKeySchedule_t *ks, bool encode, const uint8_t *srcdata, size_t srcdatalen, uint8_t *dstdata, uint8_t *ivect, bool dir_to_send) {
+    size_t block_size = desfire_get_key_block_length(ks->keyType);
+    bool hwaes = (ks->keyType == T_AES) && DesfireUseHwAES();
 
-    memcpy(dstdata, edata, block_size);
+    size_t offset = 0;
+#if defined(DESFIRE_HAS_AESNI)
+    if (hwaes && !encode && !dir_to_send && dstdata != NULL)
+        offset = DesfireAESNIDecryptCBC(&ks->ctx.aes, srcdata, srcdatalen / block_size, dstdata, ivect) * block_size;
+#endif
+
+    for (; offset < srcdatalen; offset += block_size) {
+        size_t len = MIN(block_size, srcdatalen - offset);
+
+        uint8_t sdata[DESFIRE_MAX_CRYPTO_BLOCK_SIZE] = {0};
+        memcpy(sdata, srcdata + offset, len);
+        if (dir_to_send)
+            bin_xor(sdata, ivect, block_size);
+
+        uint8_t edata[DESFIRE_MAX_CRYPTO_BLOCK_SIZE] = {0};
+        DesfireCryptoBlock(ks, encode, hwaes, sdata, edata);
+
+        if (dir_to_send) {
+            memcpy(ivect, edata, block_size);
+        } else {
+            bin_xor(edata, ivect, block_size);
+            memcpy(ivect, srcdata + offset, len);
+            memset(ivect + len, 0, block_size - len);
+        }
+
+        if (dstdata)
+            memcpy(dstdata + offset, edata, len);
+    }
 }
 
 void DesfireCryptoEncDecEx(DesfireContext_t *ctx, DesfireCryptoOpKeyType key_type, uint8_t *srcdata, size_t srcdatalen, uint8_t *dstdata, bool dir_to_send, bool encode, uint8_t *iv) {
-    uint8_t data[1024] = {0};
     uint8_t xiv[DESFIRE_MAX_CRYPTO_BLOCK_SIZE] = {0};
 
     if (ctx->secureChannel == DACd40) {
@@ -271,24 +391,25 @@ void DesfireCryptoEncDecEx(DesfireContext_t *ctx, DesfireCryptoOpKeyType key_typ
         return;
 
     if (ctx->secureChannel == DACLRP) {
+        // LRP output is padded to whole blocks
+        uint8_t *data = calloc(padded_data_length(srcdatalen + 1, CRYPTO_AES_BLOCK_SIZE), 1);
+        if (data == NULL)
+            return;
+
         size_t dstlen = 0;
         LRPEncDec(key, xiv, encode, srcdata, srcdatalen, data, &dstlen);
+        if (dstdata)
+            memcpy(dstdata, data, srcdatalen);
+        free(data);
     } else {
-        size_t offset = 0;
-        while (offset < srcdatalen) {
-            DesfireCryptoEncDecSingleBlock(key, ctx->keyType, srcdata + offset, data + offset, xiv, dir_to_send, encode);
-
-            offset += block_size;
-        }
+        DesfireKeySchedule_t *ks = DesfireGetKeySchedule(ctx, key_type, encode);
+        DesfireCryptoCBC(ks, encode, srcdata, srcdatalen, dstdata, xiv, dir_to_send);
     }
 
     if (iv == NULL)
         memcpy(ctx->IV, xiv, block_size);
     else
         memcpy(iv, xiv, block_size);
-
-    if (dstdata)
-        memcpy(dstdata, data, srcdatalen);
 }
 
 void DesfireCryptoEncDec(DesfireContext_t *ctx, DesfireCryptoOpKeyType key_type, uint8_t *srcdata, size_t srcdatalen, uint8_t *dstdata, bool encode) {
@@ -20,6 +20,8 @@
 #define __DESFIRECRYPTO_H
 
 #include "common.h"
+#include <mbedtls/aes.h>
+#include <mbedtls/des.h>
 #include "desfire.h"
 #include "crypto/libpcrypto.h"
 #include "mifare/lrpcrypto.h"
@@ -56,6 +58,20 @@ typedef enum {
     DCOSessionKeyEnc
 } DesfireCryptoOpKeyType;
 
+// expanded key of one DesfireCryptoOpKeyType slot and direction.
+// it is rebuilt when the key bytes or the algorithm differ from the ones it was made from,
+// so code that writes the key buffers directly does not need to know about it.
+typedef struct {
+    bool valid;
+    DesfireCryptoAlgorithm keyType;
+    uint8_t key[DESFIRE_MAX_KEY_SIZE];
+    union {
+        mbedtls_des_context des;
+        mbedtls_des3_context des3;
+        mbedtls_aes_context aes;
+    } ctx;
+} DesfireKeySchedule_t;
+
 typedef struct {
     uint8_t keyNum;
     DesfireCryptoAlgorithm keyType;   // des/2tdea/3tdea/aes
@@ -86,6 +102,8 @@ typedef struct {
     bool lastRequestZeroLen;
     uint16_t cmdCntr;   // for AES
     uint8_t TI[4];      // for AES
+
+    DesfireKeySchedule_t keySchedule[DCOSessionKeyEnc + 1][2]; // [key type][encode]
 } DesfireContext_t;
 
 void DesfireClearContext(DesfireContext_t *ctx);
@@ -107,6 +125,8 @@ void DesfireCryptoEncDecEx(DesfireContext_t *ctx, DesfireCryptoOpKeyType key_typ
 void DesfireCMACGenerateSubkeys(DesfireContext_t *ctx, DesfireCryptoOpKeyType key_type, uint8_t *sk1, uint8_t *sk2);
 void DesfireCryptoCMAC(DesfireContext_t *ctx, uint8_t *data, size_t len, uint8_t *cmac);
 void DesfireCryptoCMACEx(DesfireContext_t *ctx, DesfireCryptoOpKeyType key_type, uint8_t *data, size_t len, size_t minlen, uint8_t *cmac);
+bool DesfireCryptoHwAESAvailable(void);
+void DesfireCryptoSetHwAES(bool enable);
 void MifareKdfAn10922(DesfireContext_t *ctx, DesfireCryptoOpKeyType key_type, const uint8_t *data, size_t len);
 
 void DesfireGenSessionKeyLRP(uint8_t *key, uint8_t *rndA, uint8_t *rndB, bool enckey, uint8_t *sessionkey);
@@ -22,6 +22,10 @@
 #include <unistd.h>
 #include <string.h>      // memcpy memset
 #include "fileutils.h"
+#include "commonutil.h"   // ARRAYLEN
+#include "util_posix.h"   // msclock
+#include <mbedtls/des.h>
+#include <mbedtls/aes.h>
 
 #include "crypto/libpcrypto.h"
 #include "mifare/desfirecrypto.h"
@@ -885,6 +889,153 @@ static bool TestLRPSessionKeys(void) {
     return res;
 }
 
+static const DesfireCryptoAlgorithm CBCAlgos[] = {T_DES, T_3DES, T_3K3DES, T_AES};
+static const uint8_t CBCKey[DESFIRE_MAX_KEY_SIZE] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+                                                     0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF,
+                                                     0x0F, 0x1E, 0x2D, 0x3C, 0x4B, 0x5A, 0x69, 0x78
+                                                    };
+
+// reference CBC encryption straight from mbedtls
+static void CBCEncodeRef(DesfireCryptoAlgorithm keyType, uint8_t *iv, const uint8_t *src, size_t len, uint8_t *dst) {
+    switch (keyType) {
+        case T_DES: {
+            mbedtls_des_context ctx;
+            mbedtls_des_setkey_enc(&ctx, CBCKey);
+            mbedtls_des_crypt_cbc(&ctx, MBEDTLS_DES_ENCRYPT, len, iv, src, dst);
+            break;
+        }
+        case T_3DES: {
+            mbedtls_des3_context ctx;
+            mbedtls_des3_set2key_enc(&ctx, CBCKey);
+            mbedtls_des3_crypt_cbc(&ctx, MBEDTLS_DES_ENCRYPT, len, iv, src, dst);
+            break;
+        }
+        case T_3K3DES: {
+            mbedtls_des3_context ctx;
+            mbedtls_des3_set3key_enc(&ctx, CBCKey);
+            mbedtls_des3_crypt_cbc(&ctx, MBEDTLS_DES_ENCRYPT, len, iv, src, dst);
+            break;
+        }
+        case T_AES: {
+            mbedtls_aes_context ctx;
+            mbedtls_aes_init(&ctx);
+            mbedtls_aes_setkey_enc(&ctx, CBCKey, 128);
+            mbedtls_aes_crypt_cbc(&ctx, MBEDTLS_AES_ENCRYPT, len, iv, src, dst);
+            mbedtls_aes_free(&ctx);
+            break;
+        }
+    }
+}
+
+// long buffers, in place decoding and key changes between calls, with and without hardware AES
+static bool TestCBCLong(void) {
+    bool res = true;
+
+    uint8_t plain[2048 + 8];
+    for (size_t i = 0; i < sizeof(plain); i++)
+        plain[i] = (i * 7) ^ (i >> 3);
+
+    for (int hw = 0; hw < 2; hw++) {
+        if (hw && DesfireCryptoHwAESAvailable() == false)
+            break;
+        DesfireCryptoSetHwAES(hw);
+
+        for (size_t a = 0; a < ARRAYLEN(CBCAlgos); a++) {
+            DesfireContext_t ctx = {0};
+            DesfireSetKey(&ctx, 0, CBCAlgos[a], (uint8_t *)CBCKey);
+            ctx.secureChannel = DACEV1;
+            size_t bs = desfire_get_key_block_length(CBCAlgos[a]);
+
+            // 2048 bytes and an odd number of blocks, the AES-NI decoder does four at a time
+            size_t lens[] = {2048, 2048 - 3 * bs};
+            for (size_t l = 0; l < ARRAYLEN(lens); l++) {
+                uint8_t ref[sizeof(plain)] = {0};
+                uint8_t refiv[DESFIRE_MAX_CRYPTO_BLOCK_SIZE] = {0};
+                CBCEncodeRef(CBCAlgos[a], refiv, plain, lens[l], ref);
+
+                uint8_t enc[sizeof(plain)] = {0};
+                DesfireClearIV(&ctx);
+                DesfireCryptoEncDecEx(&ctx, DCOMainKey, plain, lens[l], enc, true, true, NULL);
+                res = res && (memcmp(enc, ref, lens[l]) == 0);
+                res = res && (memcmp(ctx.IV, refiv, bs) == 0);
+
+                DesfireClearIV(&ctx);
+                DesfireCryptoEncDecEx(&ctx, DCOMainKey, enc, lens[l], enc, false, false, NULL);
+                res = res && (memcmp(enc, plain, lens[l]) == 0);
+                res = res && (memcmp(ctx.IV, ref + lens[l] - bs, bs) == 0);
+            }
+
+            // the key schedule has to follow a key written straight into the context
+            uint8_t enc1[16] = {0};
+            uint8_t enc2[16] = {0};
+            DesfireClearIV(&ctx);
+            DesfireCryptoEncDecEx(&ctx, DCOMainKey, plain, 16, enc1, true, true, NULL);
+            ctx.key[1] ^= 0x02; // bit 0 is the DES parity bit
+            DesfireClearIV(&ctx);
+            DesfireCryptoEncDecEx(&ctx, DCOMainKey, plain, 16, enc2, true, true, NULL);
+            res = res && (memcmp(enc1, enc2, 16) != 0);
+        }
+    }
+    DesfireCryptoSetHwAES(true);
+
+    if (res)
+        PrintAndLogEx(INFO, "CBC long data..... " _GREEN_("ok"));
+    else
+        PrintAndLogEx(ERR,  "CBC long data..... " _RED_("fail"));
+
+    return res;
+}
+
+// MB/s of DesfireCryptoEncDecEx over a read sized buffer, keyonce = false runs the key setup for every block like it used to
+static double BenchCBC(DesfireCryptoAlgorithm keyType, bool keyonce) {
+    DesfireContext_t ctx = {0};
+    DesfireSetKey(&ctx, 0, keyType, (uint8_t *)CBCKey);
+    ctx.secureChannel = DACEV1;
+
+    size_t bs = desfire_get_key_block_length(keyType);
+    uint8_t data[4096] = {0};
+
+    size_t total = 0;
+    uint64_t start = msclock();
+    uint64_t elapsed = 0;
+    while (elapsed < 200) {
+        if (keyonce) {
+            DesfireCryptoEncDecEx(&ctx, DCOMainKey, data, sizeof(data), data, false, false, NULL);
+        } else {
+            for (size_t i = 0; i < sizeof(data); i += bs) {
+                memset(ctx.keySchedule, 0, sizeof(ctx.keySchedule));
+                DesfireCryptoEncDecEx(&ctx, DCOMainKey, data + i, bs, data + i, false, false, NULL);
+            }
+        }
+        total += sizeof(data);
+        elapsed = msclock() - start;
+    }
+    return (double)total / 1000.0 / elapsed;
+}
+
+void DesfireBenchmark(void) {
+    const char *names[] = {"DES", "2TDEA", "3TDEA", "AES"};
+    bool hwaes = DesfireCryptoHwAESAvailable();
+
+    PrintAndLogEx(INFO, "------ " _CYAN_("MIFARE DESFire crypto benchmark") " ------");
+    PrintAndLogEx(INFO, "CBC decode of 4096 bytes, MB/s");
+    PrintAndLogEx(INFO, "algo  | key per block | cached key | hardware AES");
+    PrintAndLogEx(INFO, "------+---------------+------------+-------------");
+    for (size_t a = 0; a < ARRAYLEN(CBCAlgos); a++) {
+        DesfireCryptoSetHwAES(false);
+        double perblock = BenchCBC(CBCAlgos[a], false);
+        double cached = BenchCBC(CBCAlgos[a], true);
+        DesfireCryptoSetHwAES(true);
+
+        if (CBCAlgos[a] == T_AES && hwaes) {
+            PrintAndLogEx(INFO, "%-5s | %13.1f | %10.1f | " _GREEN_("%12.1f"), names[a], perblock, cached, BenchCBC(CBCAlgos[a], true));
+        } else {
+            PrintAndLogEx(INFO, "%-5s | %13.1f | %10.1f | %12s", names[a], perblock, cached, (CBCAlgos[a] == T_AES) ? "n/a" : "");
+        }
+    }
+    PrintAndLogEx(NORMAL, "");
+}
+
 bool DesfireTest(bool verbose) {
     bool res = true;
 
@@ -912,6 +1063,7 @@ bool DesfireTest(bool verbose) {
     res = res && TestLRPSubkeys();
     res = res && TestLRPCMAC();
     res = res && TestLRPSessionKeys();
+    res = res && TestCBCLong();
 
     PrintAndLogEx(INFO, "---------------------------");
     if (res)
@@ -23,5 +23,6 @@
 #include "common.h"
 
 bool DesfireTest(bool verbose);
+void DesfireBenchmark(void);
 
 #endif /* __CIPURSETEST_H__ */
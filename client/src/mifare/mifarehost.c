@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "comms.h"
 #include "commonutil.h"
@@ -393,33 +394,596 @@ inline static int Compare16Bits(const void *a, const void *b) {
     return -1;
 }
 
-// wrapper function for multi-threaded lfsr_recovery32
+//-----------------------------------------------------------------------------
+// Multi-threaded nested key recovery.
+// lfsr_recovery32 of both nonces is split into independent parts (see lfsr_recovery32_split).
+// The parts of both nonces are put in one job list, largest first, and a pool of num_CPUs()
+// threads keeps taking the next job through an atomic cursor until the list is exhausted.
+// Threads that finish a small part early simply pick up the next one.
+//-----------------------------------------------------------------------------
+#define NESTED_STATELIST_SIZE   (1 << 18)
+#define RADIX_MIN_PARALLEL      (1 << 16)
+
+typedef struct {
+    uint8_t list;
+    uint8_t part;
+    uint64_t size;      // odd * even entries, used to schedule large parts first
+} nested_job_t;
+
+// Candidates found while the second statelist is still being recovered.
+// The pool rolls back every state it recovers, looks it up in the already finished statelist
+// and queues the hits here, so the caller can check them on the device while recovery goes on.
+typedef struct {
+    const uint64_t *ref;        // rolled back states of the finished statelist, sorted
+    uint32_t reflen;
+    uint8_t *claimed;           // one flag per ref entry, every candidate is queued only once
+    uint32_t in;                // nt_enc ^ uid of the statelist being recovered
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint64_t *keys;             // queued candidate keys, reflen entries
+    uint32_t count;
+    uint32_t running;           // number of pool threads still working
+    uint32_t states;            // number of states recovered so far
+    bool cancel;
+} nested_sink_t;
+
+typedef struct {
+    StateList_t *statelists;
+    lfsr_split_t *splits;
+    nested_job_t *jobs;
+    uint32_t numjobs;
+    uint32_t next_job;  // shared cursor into jobs
+    uint32_t fill[2];   // number of states written to statelists[i]
+    nested_sink_t *sink;
+    bool failed;
+} nested_pool_t;
+
+typedef struct {
+    StateList_t *statelist;
+    lfsr_split_t *split;
+    bool ok;
+} nested_split_arg_t;
+
+static int compare_nested_job(const void *a, const void *b) {
+    const nested_job_t *ja = a;
+    const nested_job_t *jb = b;
+    return (ja->size < jb->size) - (ja->size > jb->size);
+}
+
 static void
 #ifdef __has_attribute
 #if __has_attribute(force_align_arg_pointer)
 __attribute__((force_align_arg_pointer))
 #endif
 #endif
-*nested_worker_thread(void *arg) {
-    struct Crypto1State *p1;
-    StateList_t *statelist = arg;
-    statelist->head.slhead = lfsr_recovery32(statelist->ks1, statelist->nt_enc ^ statelist->uid);
+*nested_split_thread(void *arg) {
+    nested_split_arg_t *a = arg;
+    a->ok = lfsr_recovery32_split(a->statelist->ks1, a->statelist->nt_enc ^ a->statelist->uid, a->split);
+    return NULL;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// roll back freshly recovered states, keep those also present in the finished statelist
+// and queue their keys. Rolling back in place is fine, the states are not used afterwards.
+static void nested_sink_states(nested_sink_t *sink, struct Crypto1State *states, uint32_t n) {
+    uint32_t found = 0;
+    uint64_t *keys = (uint64_t *)states;
+    __atomic_fetch_add(&sink->states, n, __ATOMIC_SEQ_CST);
+
+    for (uint32_t i = 0; i < n; i++) {
+        struct Crypto1State s = states[i];
+        lfsr_rollback_word(&s, sink->in, 0);
+
+        uint64_t *hit = bsearch(&s, sink->ref, sink->reflen, sizeof(uint64_t), compare_u64);
+        if (hit == NULL) {
+            continue;
+        }
+        if (__atomic_test_and_set(&sink->claimed[hit - sink->ref], __ATOMIC_SEQ_CST)) {
+            continue;
+        }
+        // found <= i, so this never overwrites a state we still have to look at
+        crypto1_get_lfsr(&s, &keys[found++]);
+    }
+
+    if (found == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&sink->lock);
+    memcpy(sink->keys + sink->count, keys, found * sizeof(uint64_t));
+    sink->count += found;
+    pthread_cond_signal(&sink->cond);
+    pthread_mutex_unlock(&sink->lock);
+}
+
+static void
+#ifdef __has_attribute
+#if __has_attribute(force_align_arg_pointer)
+__attribute__((force_align_arg_pointer))
+#endif
+#endif
+*nested_pool_worker(void *arg) {
+    nested_pool_t *pool = arg;
+
+    // only parts are recovered here, sized for the largest one instead of a full lfsr_recovery32
+    lfsr_recovery32_ws_t *ws = lfsr_recovery32_ws_alloc_parts(pool->splits, 2);
+    struct Crypto1State *local = calloc(NESTED_STATELIST_SIZE + 1, sizeof(struct Crypto1State));
+    nested_sink_t *sink = pool->sink;
+
+    if (ws == NULL || local == NULL) {
+        __atomic_store_n(&pool->failed, true, __ATOMIC_SEQ_CST);
+    }
+
+    while (ws != NULL && local != NULL) {
+        if (sink && __atomic_load_n(&sink->cancel, __ATOMIC_SEQ_CST)) {
+            break;
+        }
+
+        uint32_t j = __atomic_fetch_add(&pool->next_job, 1, __ATOMIC_SEQ_CST);
+        if (j >= pool->numjobs) {
+            break;
+        }
+
+        nested_job_t *job = &pool->jobs[j];
+        struct Crypto1State *end = lfsr_recovery32_part(&pool->splits[job->list], job->part, local, ws);
+        uint32_t n = end - local;
+        if (n == 0) {
+            continue;
+        }
+
+        if (sink) {
+            nested_sink_states(sink, local, n);
+            continue;
+        }
+
+        // reserve room in the shared statelist and copy our states over
+        uint32_t pos = __atomic_fetch_add(&pool->fill[job->list], n, __ATOMIC_SEQ_CST);
+        if (pos >= NESTED_STATELIST_SIZE) {
+            continue;
+        }
+        n = MIN(n, NESTED_STATELIST_SIZE - pos);
+        memcpy(pool->statelists[job->list].head.slhead + pos, local, n * sizeof(struct Crypto1State));
+    }
+
+    lfsr_recovery32_ws_free(ws);
+    free(local);
+
+    if (sink) {
+        pthread_mutex_lock(&sink->lock);
+        sink->running--;
+        pthread_cond_signal(&sink->cond);
+        pthread_mutex_unlock(&sink->lock);
+    }
+    return NULL;
+}
+
+typedef struct {
+    uint64_t *src;
+    uint64_t *dst;
+    size_t start;
+    size_t stop;
+    uint8_t shift;
+    size_t hist[256];
+} radix_slice_t;
+
+static void *radix_hist_thread(void *arg) {
+    radix_slice_t *r = arg;
+    memset(r->hist, 0, sizeof(r->hist));
+    for (size_t i = r->start; i < r->stop; i++) {
+        r->hist[(r->src[i] >> r->shift) & 0xFF]++;
+    }
+    return NULL;
+}
+
+static void *radix_scatter_thread(void *arg) {
+    radix_slice_t *r = arg;
+    // hist now holds the output offset of each bucket for this slice
+    for (size_t i = r->start; i < r->stop; i++) {
+        r->dst[r->hist[(r->src[i] >> r->shift) & 0xFF]++] = r->src[i];
+    }
+    return NULL;
+}
+
+// LSD radix sort of 64 bit values, ascending, 8 bits per pass.
+// Only the bytes selected in bytemask take part. A pass where all values fall in the same bucket is skipped.
+// Histogram and scatter of every pass are split over threads, slices keep their order so each pass is stable.
+static int radix_sort_u64(uint64_t *data, size_t n, uint8_t bytemask) {
+    if (n < 2) {
+        return PM3_SUCCESS;
+    }
+
+    uint64_t *tmp = calloc(n, sizeof(uint64_t));
+    if (tmp == NULL) {
+        return PM3_EMALLOC;
+    }
+
+    uint8_t nthreads = 1;
+    if (n >= RADIX_MIN_PARALLEL) {
+        nthreads = MIN(MAX(num_CPUs(), 1), 16);
+    }
+
+    radix_slice_t slices[16];
+    pthread_t threads[16];
+    uint64_t *src = data;
+    uint64_t *dst = tmp;
+
+    for (uint8_t byte = 0; byte < 8; byte++) {
+        if ((bytemask & (1 << byte)) == 0) {
+            continue;
+        }
+
+        for (uint8_t t = 0; t < nthreads; t++) {
+            slices[t].src = src;
+            slices[t].dst = dst;
+            slices[t].start = n * t / nthreads;
+            slices[t].stop = n * (t + 1) / nthreads;
+            slices[t].shift = byte * 8;
+            pthread_create(&threads[t], NULL, radix_hist_thread, &slices[t]);
+        }
+        for (uint8_t t = 0; t < nthreads; t++) {
+            pthread_join(threads[t], NULL);
+        }
+
+        // turn counts into output offsets, bucket by bucket and slice by slice
+        size_t offset = 0;
+        bool skip = false;
+        for (uint16_t b = 0; b < 256; b++) {
+            size_t total = 0;
+            for (uint8_t t = 0; t < nthreads; t++) {
+                size_t cnt = slices[t].hist[b];
+                slices[t].hist[b] = offset;
+                offset += cnt;
+                total += cnt;
+            }
+            if (total == n) {
+                skip = true;
+            }
+        }
+        if (skip) {
+            continue;
+        }
+
+        for (uint8_t t = 0; t < nthreads; t++) {
+            pthread_create(&threads[t], NULL, radix_scatter_thread, &slices[t]);
+        }
+        for (uint8_t t = 0; t < nthreads; t++) {
+            pthread_join(threads[t], NULL);
+        }
+
+        uint64_t *swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if (src != data) {
+        memcpy(data, src, n * sizeof(uint64_t));
+    }
+    free(tmp);
+    return PM3_SUCCESS;
+}
+
+// build and split the tables of both nonces, one thread per nonce, and allocate the statelists
+static int nested_split_statelists(StateList_t *statelists, lfsr_split_t *splits) {
+    pthread_t split_threads[2];
+    nested_split_arg_t split_args[2];
+    for (uint8_t i = 0; i < 2; i++) {
+        split_args[i].statelist = &statelists[i];
+        split_args[i].split = &splits[i];
+        split_args[i].ok = false;
+        pthread_create(&split_threads[i], NULL, nested_split_thread, &split_args[i]);
+    }
+    for (uint8_t i = 0; i < 2; i++) {
+        pthread_join(split_threads[i], NULL);
+    }
+
+    for (uint8_t i = 0; i < 2; i++) {
+        statelists[i].head.slhead = calloc(NESTED_STATELIST_SIZE + 1, sizeof(struct Crypto1State));
+    }
+
+    if (split_args[0].ok == false || split_args[1].ok == false
+            || statelists[0].head.slhead == NULL || statelists[1].head.slhead == NULL) {
+        free(statelists[0].head.slhead);
+        free(statelists[1].head.slhead);
+        statelists[0].head.slhead = NULL;
+        statelists[1].head.slhead = NULL;
+        return PM3_EMALLOC;
+    }
+    return PM3_SUCCESS;
+}
+
+// queue all parts of the statelists selected in list_mask, largest first
+static int nested_pool_set_jobs(nested_pool_t *pool, uint8_t list_mask) {
+    free(pool->jobs);
+    pool->jobs = calloc(pool->splits[0].numparts + pool->splits[1].numparts, sizeof(nested_job_t));
+    if (pool->jobs == NULL) {
+        return PM3_EMALLOC;
+    }
+
+    pool->numjobs = 0;
+    pool->next_job = 0;
+    for (uint8_t i = 0; i < 2; i++) {
+        if ((list_mask & (1 << i)) == 0) {
+            continue;
+        }
+        for (uint32_t p = 0; p < pool->splits[i].numparts; p++) {
+            nested_job_t *job = &pool->jobs[pool->numjobs++];
+            job->list = i;
+            job->part = p;
+            job->size = (uint64_t)(pool->splits[i].part[p].o_tail - pool->splits[i].part[p].o_head + 1) *
+                        (uint64_t)(pool->splits[i].part[p].e_tail - pool->splits[i].part[p].e_head + 1);
+        }
+    }
+    qsort(pool->jobs, pool->numjobs, sizeof(nested_job_t), compare_nested_job);
+    return PM3_SUCCESS;
+}
+
+static uint32_t nested_pool_threads(const nested_pool_t *pool) {
+    return MAX(1, MIN((uint32_t)num_CPUs(), pool->numjobs));
+}
+
+static void nested_pool_start(nested_pool_t *pool, pthread_t *threads, uint32_t nthreads) {
+    for (uint32_t t = 0; t < nthreads; t++) {
+        pthread_create(&threads[t], NULL, nested_pool_worker, pool);
+    }
+}
+
+static void nested_pool_join(pthread_t *threads, uint32_t nthreads) {
+    for (uint32_t t = 0; t < nthreads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+}
+
+// run the queued jobs on all cores and wait for them
+static int nested_pool_run(nested_pool_t *pool, uint32_t *nthreads) {
+    *nthreads = nested_pool_threads(pool);
+    pthread_t *threads = calloc(*nthreads, sizeof(pthread_t));
+    if (threads == NULL) {
+        return PM3_EMALLOC;
+    }
+    nested_pool_start(pool, threads, *nthreads);
+    nested_pool_join(threads, *nthreads);
+    free(threads);
+    return (pool->failed) ? PM3_EMALLOC : PM3_SUCCESS;
+}
+
+static void nested_print_recovery(uint32_t total, uint64_t start_time, uint32_t nthreads) {
+    uint64_t t = msclock() - start_time;
+    PrintAndLogEx(INFO, "Recovered " _YELLOW_("%u") " candidate states in %.1f s ( " _YELLOW_("%.0f") " states/s,  %u threads )",
+                  total,
+                  (float)t / 1000.0,
+                  (t) ? (float)total * 1000.0 / t : (float)total,
+                  nthreads
+                 );
+}
+
+// check up to NESTED_FLASH_KEYS candidate keys on the device.
+// More than KEYS_IN_BLOCK keys don't fit in one command, they go through a key file in flash memory (RDV4).
+#define NESTED_FLASH_KEYS   1000
+// ms between keyboard checks while waiting for candidates
+#define NESTED_POLL_MS      100
+
+static int nested_check_keys(const StateList_t *sl, const uint64_t *keys, uint32_t n, uint8_t *mem, bool clear_trace, uint64_t *key64) {
+    if (n <= KEYS_IN_BLOCK) {
+        for (uint32_t j = 0; j < n; j++) {
+            num_to_bytes(keys[j], 6, mem + j * 6);
+        }
+        return mfCheckKeys(sl->blockNo, sl->keyType, clear_trace, n, mem, key64);
+    }
+
+    // mfCheckKeys_file needs a header
+    mem[0] = sl->keyType;
+    mem[1] = sl->blockNo;
+    mem[2] = 1;
+    mem[3] = ((n >> 8) & 0xFF);
+    mem[4] = (n & 0xFF);
+    for (uint32_t j = 0; j < n; j++) {
+        num_to_bytes(keys[j], 6, mem + 5 + j * 6);
+    }
+
+    uint8_t fn[26] = "static_nested_000.bin";
+    int res = flashmem_spiffs_load((char *)fn, mem, 5 + (n * 6));
+    if (res != PM3_SUCCESS) {
+        PrintAndLogEx(WARNING, "\nSPIFFS upload failed");
+        return res;
+    }
+    return mfCheckKeys_file(fn, key64);
+}
+
+// Pipelined nested key recovery.
+// statelists[1] is recovered completely and rolled back first.  While the pool recovers statelists[0],
+// every state it finds in statelists[1] is queued as candidate and this thread keeps checking the queue on
+// the device, whatever is queued each time the device is done with the previous block.
+// The first valid key cancels the remaining recovery work.
+// With use_flash, big blocks are checked through a key file in flash memory instead of KEYS_IN_BLOCK at a time.
+// clear_trace is passed on to mfCheckKeys, only static nested clears the trace.
+static int nested_recover_and_check(StateList_t *statelists, uint64_t *found_key, bool use_flash, bool clear_trace) {
+
+    uint64_t start_time = msclock();
+    lfsr_split_t *splits = calloc(2, sizeof(lfsr_split_t));
+    if (splits == NULL) {
+        return PM3_EMALLOC;
+    }
+
+    nested_sink_t sink = {0};
+    pthread_mutex_init(&sink.lock, NULL);
+    pthread_cond_init(&sink.cond, NULL);
+
+    nested_pool_t pool = {0};
+    pool.statelists = statelists;
+    pool.splits = splits;
+
+    uint32_t nthreads = 0;
+    pthread_t *threads = NULL;
+    int res = nested_split_statelists(statelists, splits);
+    if (res != PM3_SUCCESS) {
+        goto out;
+    }
+
+    // stage 1, recover and roll back statelists[1]
+    res = nested_pool_set_jobs(&pool, 0x02);
+    if (res != PM3_SUCCESS) {
+        goto out;
+    }
+
+    res = nested_pool_run(&pool, &nthreads);
+    if (res != PM3_SUCCESS) {
+        goto out;
+    }
+
+    StateList_t *ref = &statelists[1];
+    ref->len = MIN(pool.fill[1], NESTED_STATELIST_SIZE);
+    for (uint32_t i = 0; i < ref->len; i++) {
+        lfsr_rollback_word(ref->head.slhead + i, ref->nt_enc ^ ref->uid, 0);
+    }
+    res = radix_sort_u64(ref->head.keyhead, ref->len, 0xFF);
+    if (res != PM3_SUCCESS) {
+        goto out;
+    }
+
+    sink.ref = ref->head.keyhead;
+    sink.reflen = ref->len;
+    sink.in = statelists[0].nt_enc ^ statelists[0].uid;
+    sink.claimed = calloc(MAX(1, sink.reflen), sizeof(uint8_t));
+    sink.keys = calloc(MAX(1, sink.reflen), sizeof(uint64_t));
+    if (sink.claimed == NULL || sink.keys == NULL) {
+        res = PM3_EMALLOC;
+        goto out;
+    }
+
+    // stage 2, recover statelists[0] in the background and check candidates as they come in
+    res = nested_pool_set_jobs(&pool, 0x01);
+    if (res != PM3_SUCCESS) {
+        goto out;
+    }
 
-    for (p1 = statelist->head.slhead; p1->odd | p1->even; p1++) {};
+    nthreads = nested_pool_threads(&pool);
+    threads = calloc(nthreads, sizeof(pthread_t));
+    if (threads == NULL) {
+        res = PM3_EMALLOC;
+        goto out;
+    }
+    pool.sink = &sink;
+    sink.running = nthreads;
+    nested_pool_start(&pool, threads, nthreads);
+
+    uint32_t maxkeys = (use_flash) ? NESTED_FLASH_KEYS : KEYS_IN_BLOCK;
+    uint8_t *mem = calloc(5 + maxkeys * 6, sizeof(uint8_t));
+    if (mem == NULL) {
+        __atomic_store_n(&sink.cancel, true, __ATOMIC_SEQ_CST);
+        nested_pool_join(threads, nthreads);
+        res = PM3_EMALLOC;
+        goto out;
+    }
 
-    statelist->len = p1 - statelist->head.slhead;
-    statelist->tail.sltail = --p1;
+    res = PM3_ESOFT;
+    uint32_t sent = 0;
+    uint64_t check_time = 0;
+
+    while (true) {
 
-    qsort(statelist->head.slhead, statelist->len, sizeof(uint64_t), Compare16Bits);
+        if (kbd_enter_pressed()) {
+            SendCommandNG(CMD_BREAK_LOOP, NULL, 0);
+            res = PM3_EOPABORTED;
+            break;
+        }
 
-    return statelist->head.slhead;
+        // the device is idle, wait for any candidate, or for the recovery to finish.
+        // Wakes up every NESTED_POLL_MS, the recovery can take minutes without finding a candidate
+        bool abort = false;
+        pthread_mutex_lock(&sink.lock);
+        while (sink.count == sent && sink.running > 0) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += NESTED_POLL_MS * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            if (pthread_cond_timedwait(&sink.cond, &sink.lock, &ts) != 0 && kbd_enter_pressed()) {
+                abort = true;
+                break;
+            }
+        }
+        uint32_t avail = sink.count - sent;
+        pthread_mutex_unlock(&sink.lock);
+
+        if (abort) {
+            SendCommandNG(CMD_BREAK_LOOP, NULL, 0);
+            res = PM3_EOPABORTED;
+            break;
+        }
+        if (avail == 0) {
+            break;
+        }
+
+        uint32_t size = MIN(avail, maxkeys);
+        uint64_t t1 = msclock();
+        uint64_t key64 = -1;
+        int isok = nested_check_keys(&statelists[0], sink.keys + sent, size, mem, clear_trace, &key64);
+        check_time += msclock() - t1;
+        sent += size;
+
+        if (isok == PM3_SUCCESS) {
+            *found_key = key64;
+            res = PM3_SUCCESS;
+            break;
+        }
+        if (isok == PM3_ETIMEOUT || isok == PM3_EOPABORTED) {
+            res = isok;
+            break;
+        }
+
+        float bruteforce_per_second = (check_time) ? (float)sent * 1000.0 / check_time : (float)sent;
+        PrintAndLogEx(INPLACE, "%6u keys checked | %5.1f keys/sec | %u candidates found so far", sent, bruteforce_per_second, sink.count);
+    }
+    free(mem);
+
+    // first hit, or nothing left.  Stop whatever recovery work is still going on
+    bool cancelled = __atomic_load_n(&pool.next_job, __ATOMIC_SEQ_CST) < pool.numjobs;
+    __atomic_store_n(&sink.cancel, true, __ATOMIC_SEQ_CST);
+    nested_pool_join(threads, nthreads);
+
+    if (pool.failed) {
+        res = PM3_EMALLOC;
+        goto out;
+    }
+
+    PrintAndLogEx(NORMAL, "");
+    nested_print_recovery(ref->len + sink.states, start_time, nthreads);
+    PrintAndLogEx(SUCCESS, "Checked " _YELLOW_("%u") " of " _YELLOW_("%u") " key candidates in %.1f s ( " _YELLOW_("%.1f") " keys/s )%s",
+                  sent,
+                  sink.count,
+                  (float)check_time / 1000.0,
+                  (check_time) ? (float)sent * 1000.0 / check_time : (float)sent,
+                  (cancelled) ? ", remaining recovery cancelled" : ""
+                 );
+
+out:
+    free(threads);
+    free(sink.claimed);
+    free(sink.keys);
+    pthread_mutex_destroy(&sink.lock);
+    pthread_cond_destroy(&sink.cond);
+    lfsr_recovery32_split_free(&splits[0]);
+    lfsr_recovery32_split_free(&splits[1]);
+    free(splits);
+    free(pool.jobs);
+    free(statelists[0].head.slhead);
+    free(statelists[1].head.slhead);
+    statelists[0].head.slhead = NULL;
+    statelists[1].head.slhead = NULL;
+    return res;
 }
 
 int mfnested(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBlockNo, uint8_t trgKeyType, uint8_t *resultKey, bool calibrate) {
 
     uint32_t uid;
     StateList_t statelists[2];
-    struct Crypto1State *p1, *p2, *p3, *p4;
 
     struct {
         uint8_t block;
@@ -475,114 +1039,28 @@ int mfnested(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBlockNo,
     memcpy(&statelists[1].nt_enc,  package->nt_b, sizeof(package->nt_b));
     memcpy(&statelists[1].ks1, package->ks_b, sizeof(package->ks_b));
 
-    // calc keys
-    pthread_t thread_id[2];
-
-    // create and run worker threads
-    for (uint8_t i = 0; i < 2; i++)
-        pthread_create(thread_id + i, NULL, nested_worker_thread, &statelists[i]);
-
-    // wait for threads to terminate:
-    for (uint8_t i = 0; i < 2; i++)
-        pthread_join(thread_id[i], (void *)&statelists[i].head.slhead);
-
-    // the first 16 Bits of the cryptostate already contain part of our key.
-    // Create the intersection of the two lists based on these 16 Bits and
-    // roll back the cryptostate
-    p1 = p3 = statelists[0].head.slhead;
-    p2 = p4 = statelists[1].head.slhead;
-
-    while (p1 <= statelists[0].tail.sltail && p2 <= statelists[1].tail.sltail) {
-        if (Compare16Bits(p1, p2) == 0) {
-
-            struct Crypto1State savestate;
-            savestate = *p1;
-            while (Compare16Bits(p1, &savestate) == 0 && p1 <= statelists[0].tail.sltail) {
-                *p3 = *p1;
-                lfsr_rollback_word(p3, statelists[0].nt_enc ^ statelists[0].uid, 0);
-                p3++;
-                p1++;
-            }
-            savestate = *p2;
-            while (Compare16Bits(p2, &savestate) == 0 && p2 <= statelists[1].tail.sltail) {
-                *p4 = *p2;
-                lfsr_rollback_word(p4, statelists[1].nt_enc ^ statelists[1].uid, 0);
-                p4++;
-                p2++;
-            }
-        } else {
-            while (Compare16Bits(p1, p2) == -1) p1++;
-            while (Compare16Bits(p1, p2) == 1) p2++;
-        }
-    }
-
-    p3->odd = -1;
-    p3->even = -1;
-    p4->odd = -1;
-    p4->even = -1;
-    statelists[0].len = p3 - statelists[0].head.slhead;
-    statelists[1].len = p4 - statelists[1].head.slhead;
-    statelists[0].tail.sltail = --p3;
-    statelists[1].tail.sltail = --p4;
-
-    // the statelists now contain possible keys. The key we are searching for must be in the
-    // intersection of both lists
-    qsort(statelists[0].head.keyhead, statelists[0].len, sizeof(uint64_t), compare_uint64);
-    qsort(statelists[1].head.keyhead, statelists[1].len, sizeof(uint64_t), compare_uint64);
-    // Create the intersection
-    statelists[0].len = intersection(statelists[0].head.keyhead, statelists[1].head.keyhead);
-
-    //statelists[0].tail.keytail = --p7;
-    uint32_t keycnt = statelists[0].len;
-    if (keycnt == 0) goto out;
-
-    PrintAndLogEx(SUCCESS, "Found " _YELLOW_("%u") " key candidates", keycnt);
-
-    memset(resultKey, 0, 6);
+    // calc keys, and check candidates on the device while the keys are still being calculated
     uint64_t key64 = -1;
-
-    // The list may still contain several key candidates. Test each of them with mfCheckKeys
-    uint32_t max_keys = keycnt > KEYS_IN_BLOCK ? KEYS_IN_BLOCK : keycnt;
-    uint8_t keyBlock[PM3_CMD_DATA_SIZE] = {0x00};
-
-    for (uint32_t i = 0; i < keycnt; i += max_keys) {
-
-        uint64_t start_time = msclock();
-
-        uint8_t size = keycnt - i > max_keys ? max_keys : keycnt - i;
-
-        register uint8_t j;
-        for (j = 0; j < size; j++) {
-            crypto1_get_lfsr(statelists[0].head.slhead + i, &key64);
-            num_to_bytes(key64, 6, keyBlock + j * 6);
-        }
-
-        if (mfCheckKeys(statelists[0].blockNo, statelists[0].keyType, false, size, keyBlock, &key64) == PM3_SUCCESS) {
-            free(statelists[0].head.slhead);
-            free(statelists[1].head.slhead);
-            num_to_bytes(key64, 6, resultKey);
-
-            PrintAndLogEx(SUCCESS, "\nTarget block %4u key type %c -- found valid key [ " _GREEN_("%s") " ]",
-                          package->block,
-                          package->keytype ? 'B' : 'A',
-                          sprint_hex_inrow(resultKey, 6)
-                         );
-            return PM3_SUCCESS;
-        }
-
-        float bruteforce_per_second = (float)(i + max_keys) / ((msclock() - start_time) / 1000.0);
-        PrintAndLogEx(INPLACE, "%6d/%u keys | %5.1f keys/sec | worst case %6.1f seconds remaining", i, keycnt, bruteforce_per_second, (keycnt - i) / bruteforce_per_second);
+    int res = nested_recover_and_check(statelists, &key64, false, false);
+    if (res == PM3_SUCCESS) {
+        num_to_bytes(key64, 6, resultKey);
+
+        PrintAndLogEx(SUCCESS, "\nTarget block %4u key type %c -- found valid key [ " _GREEN_("%s") " ]",
+                      package->block,
+                      package->keytype ? 'B' : 'A',
+                      sprint_hex_inrow(resultKey, 6)
+                     );
+        return PM3_SUCCESS;
     }
 
-out:
-    PrintAndLogEx(SUCCESS, "\nTarget block %4u key type %c",
-                  package->block,
-                  package->keytype ? 'B' : 'A'
-                 );
-
-    free(statelists[0].head.slhead);
-    free(statelists[1].head.slhead);
-    return PM3_ESOFT;
+    if (res == PM3_ESOFT) {
+        memset(resultKey, 0, 6);
+        PrintAndLogEx(SUCCESS, "\nTarget block %4u key type %c",
+                      package->block,
+                      package->keytype ? 'B' : 'A'
+                     );
+    }
+    return res;
 }
 
 
@@ -590,7 +1068,6 @@ int mfStaticNested(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBl
 
     uint32_t uid;
     StateList_t statelists[2];
-    struct Crypto1State *p1, * p2, * p3, * p4;
 
     struct {
         uint8_t block;
@@ -640,227 +1117,29 @@ int mfStaticNested(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBl
     memcpy(&statelists[1].nt_enc, package->nt_b, sizeof(package->nt_b));
     memcpy(&statelists[1].ks1, package->ks_b, sizeof(package->ks_b));
 
-    // calc keys
-    pthread_t thread_id[2];
-
-    // create and run worker threads
-    for (uint8_t i = 0; i < 2; i++)
-        pthread_create(thread_id + i, NULL, nested_worker_thread, &statelists[i]);
-
-    // wait for threads to terminate:
-    for (uint8_t i = 0; i < 2; i++)
-        pthread_join(thread_id[i], (void *)&statelists[i].head.slhead);
-
-    // the first 16 Bits of the cryptostate already contain part of our key.
-    // Create the intersection of the two lists based on these 16 Bits and
-    // roll back the cryptostate
-    p1 = p3 = statelists[0].head.slhead;
-    p2 = p4 = statelists[1].head.slhead;
-
-    while (p1 <= statelists[0].tail.sltail && p2 <= statelists[1].tail.sltail) {
-        if (Compare16Bits(p1, p2) == 0) {
-
-            struct Crypto1State savestate;
-            savestate = *p1;
-            while (Compare16Bits(p1, &savestate) == 0 && p1 <= statelists[0].tail.sltail) {
-                *p3 = *p1;
-                lfsr_rollback_word(p3, statelists[0].nt_enc ^ statelists[0].uid, 0);
-                p3++;
-                p1++;
-            }
-            savestate = *p2;
-            while (Compare16Bits(p2, &savestate) == 0 && p2 <= statelists[1].tail.sltail) {
-                *p4 = *p2;
-                lfsr_rollback_word(p4, statelists[1].nt_enc ^ statelists[1].uid, 0);
-                p4++;
-                p2++;
-            }
-        } else {
-            while (Compare16Bits(p1, p2) == -1) p1++;
-            while (Compare16Bits(p1, p2) == 1) p2++;
-        }
-    }
-
-    p3->odd = -1;
-    p3->even = -1;
-    p4->odd = -1;
-    p4->even = -1;
-    statelists[0].len = p3 - statelists[0].head.slhead;
-    statelists[1].len = p4 - statelists[1].head.slhead;
-    statelists[0].tail.sltail = --p3;
-    statelists[1].tail.sltail = --p4;
-
-    // the statelists now contain possible keys. The key we are searching for must be in the
-    // intersection of both lists
-    qsort(statelists[0].head.keyhead, statelists[0].len, sizeof(uint64_t), compare_uint64);
-    qsort(statelists[1].head.keyhead, statelists[1].len, sizeof(uint64_t), compare_uint64);
-    // Create the intersection
-    statelists[0].len = intersection(statelists[0].head.keyhead, statelists[1].head.keyhead);
-
-
-    /*
-
-        memcpy(&uid, package->cuid, sizeof(package->cuid));
-
-        statelists[0].blockNo = package->block;
-        statelists[0].keyType = package->keytype;
-        statelists[0].uid = uid;
-
-        memcpy(&statelists[0].nt_enc, package->nt, sizeof(package->nt));
-        memcpy(&statelists[0].ks1, package->ks, sizeof(package->ks));
-
-        // calc keys
-        pthread_t t;
-
-        // create and run worker thread
-        pthread_create(&t, NULL, nested_worker_thread, &statelists[0]);
-
-        // wait for thread to terminate:
-        pthread_join(t, (void *)&statelists[0].head.slhead);
-
-        // the first 16 Bits of the cryptostate already contain part of our key.
-        p1 = p3 = statelists[0].head.slhead;
-
-        // create key candidates.
-        while (p1 <= statelists[0].tail.sltail) {
-            struct Crypto1State savestate;
-            savestate = *p1;
-            while (Compare16Bits(p1, &savestate) == 0 && p1 <= statelists[0].tail.sltail) {
-                *p3 = *p1;
-                lfsr_rollback_word(p3, statelists[0].nt_enc ^ statelists[0].uid, 0);
-                p3++;
-                p1++;
-            }
-        }
-
-        p3->odd = -1;
-        p3->even = -1;
-        statelists[0].len = p3 - statelists[0].head.slhead;
-        statelists[0].tail.sltail = --p3;
-    */
-
-    uint32_t keycnt = statelists[0].len;
-    if (keycnt == 0) goto out;
-
-    PrintAndLogEx(SUCCESS, "Found " _YELLOW_("%u") " key candidates", keycnt);
-
-    memset(resultKey, 0, 6);
-
-    // The list may still contain several key candidates. Test each of them with mfCheckKeys
-    uint32_t maxkeysinblock = IfPm3Flash() ? 1000 : KEYS_IN_BLOCK;
-    uint32_t max_keys_chunk = keycnt > maxkeysinblock ? maxkeysinblock : keycnt;
-
-    uint8_t *mem = NULL;
-    uint8_t *p_keyblock = NULL;
-
-    // if RDV4 and more than 10 candidate keys
-    if (IfPm3Flash() && keycnt > 70) {
-
-        // used for mfCheckKeys_file, which needs a header
-        mem = calloc((maxkeysinblock * 6) + 5, sizeof(uint8_t));
-        if (mem == NULL) {
-            free(statelists[0].head.slhead);
-            return PM3_EMALLOC;
-        }
-
-        mem[0] = statelists[0].keyType;
-        mem[1] = statelists[0].blockNo;
-        mem[2] = 1;
-        mem[3] = ((max_keys_chunk >> 8) & 0xFF);
-        mem[4] = (max_keys_chunk & 0xFF);
-
-        p_keyblock = mem + 5;
-    } else {
-
-        // used for mfCheckKeys, which adds its own header.
-        mem = calloc((maxkeysinblock * 6), sizeof(uint8_t));
-        if (mem == NULL) {
-            free(statelists[0].head.slhead);
-            return PM3_EMALLOC;
-        }
-        p_keyblock = mem;
+    // calc keys, and check candidates on the device while the keys are still being calculated.
+    // Static nonces leave many candidates, RDV4 checks them in big blocks from flash memory
+    uint64_t key64 = -1;
+    int res = nested_recover_and_check(statelists, &key64, IfPm3Flash(), true);
+    if (res == PM3_SUCCESS) {
+        num_to_bytes(key64, 6, resultKey);
+
+        PrintAndLogEx(SUCCESS, "target block %4u key type %c -- found valid key [ " _GREEN_("%s") " ]",
+                      package->block,
+                      package->keytype ? 'B' : 'A',
+                      sprint_hex_inrow(resultKey, 6)
+                     );
+        return PM3_SUCCESS;
     }
 
-    uint8_t fn[26] = "static_nested_000.bin";
-
-    uint64_t start_time = msclock();
-    for (uint32_t i = 0; i < keycnt; i += max_keys_chunk) {
-
-        //flush queue
-        while (kbd_enter_pressed()) {
-            SendCommandNG(CMD_BREAK_LOOP, NULL, 0);
-            PrintAndLogEx(NORMAL, "");
-            free(mem);
-            return PM3_EOPABORTED;
-        }
-
-        int res = 0;
-        uint64_t key64 = 0;
-        uint32_t chunk = keycnt - i > max_keys_chunk ? max_keys_chunk : keycnt - i;
-
-        // copy x keys to device.
-        for (uint32_t j = 0; j < chunk; j++) {
-            crypto1_get_lfsr(statelists[0].head.slhead + i + j, &key64);
-            num_to_bytes(key64, 6, p_keyblock + j * 6);
-        }
-
-        // check a block of generated key candidates.
-        if (IfPm3Flash() && keycnt > 70) {
-
-            mem[3] = ((chunk >> 8) & 0xFF);
-            mem[4] = (chunk & 0xFF);
-
-            // upload to flash.
-            res = flashmem_spiffs_load((char *)fn, mem, 5 + (chunk * 6));
-            if (res != PM3_SUCCESS) {
-                PrintAndLogEx(WARNING, "\nSPIFFS upload failed");
-                free(mem);
-                return res;
-            }
-            res = mfCheckKeys_file(fn, &key64);
-        } else {
-            res = mfCheckKeys(statelists[0].blockNo, statelists[0].keyType, true, chunk, mem, &key64);
-        }
-
-        if (res == PM3_SUCCESS) {
-            p_keyblock = NULL;
-            free(statelists[0].head.slhead);
-            free(mem);
-
-            num_to_bytes(key64, 6, resultKey);
-
-            if (IfPm3Flash() && keycnt > 70)
-                PrintAndLogEx(NORMAL, "");
-
-            PrintAndLogEx(SUCCESS, "target block %4u key type %c -- found valid key [ " _GREEN_("%s") " ]",
-                          package->block,
-                          package->keytype ? 'B' : 'A',
-                          sprint_hex_inrow(resultKey, 6)
-                         );
-            return PM3_SUCCESS;
-        } else if (res == PM3_ETIMEOUT || res == PM3_EOPABORTED) {
-            PrintAndLogEx(NORMAL, "");
-            free(mem);
-            return res;
-        }
-
-        float bruteforce_per_second = (float)(i + max_keys_chunk) / ((msclock() - start_time) / 1000.0);
-        PrintAndLogEx(INPLACE, "%6u/%u keys | %5.1f keys/sec | worst case %6.1f seconds", i, keycnt, bruteforce_per_second, (keycnt - i) / bruteforce_per_second);
+    if (res == PM3_ESOFT) {
+        memset(resultKey, 0, 6);
+        PrintAndLogEx(SUCCESS, "\nTarget block %4u key type %c",
+                      package->block,
+                      package->keytype ? 'B' : 'A'
+                     );
     }
-
-    p_keyblock = NULL;
-    free(mem);
-
-out:
-
-    PrintAndLogEx(SUCCESS, "\nTarget block %4u key type %c",
-                  package->block,
-                  package->keytype ? 'B' : 'A'
-                 );
-
-    free(statelists[0].head.slhead);
-    free(statelists[1].head.slhead);
-    return PM3_ESOFT;
+    return res;
 }
 
 // MIFARE
@@ -19,6 +19,9 @@
 #include "pm3.h"
 
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <jansson.h>
 
 #include "proxmark3.h"
 #include "cmdmain.h"
@@ -26,44 +29,388 @@
 #include "usart_defs.h"
 #include "util_posix.h"
 #include "comms.h"
+#include "util.h"
+#include "mifare.h"
+#include "mifare/mifarehost.h"
+#include "mifare/mifaredefault.h"
+#include "mifare/mifare4.h"
+
+static pthread_once_t pm3_init_once = PTHREAD_ONCE_INIT;
+// guards g_session.current_device while devices are opened and closed from several threads
+static pthread_mutex_t pm3_devices_lock = PTHREAD_MUTEX_INITIALIZER;
 
 pm3_device_t *pm3_open(const char *port) {
-    pm3_init();
-    OpenProxmark(&g_session.current_device, port, false, 20, false, USART_BAUD_RATE);
-    if (g_session.pm3_present && (TestProxmark(g_session.current_device) != PM3_SUCCESS)) {
-        PrintAndLogEx(ERR, _RED_("ERROR:") " cannot communicate with the Proxmark\n");
-        CloseProxmark(g_session.current_device);
+    pthread_once(&pm3_init_once, pm3_init);
+
+    // owned by the caller like any other device, never the one of the console
+    if (port == NULL) {
+        PrintAndLogEx(INFO, "Running in " _YELLOW_("OFFLINE") " mode");
+        return NewProxmark();
     }
 
-    if ((port != NULL) && (!g_session.pm3_present))
-        exit(EXIT_FAILURE);
+    pm3_device_t *dev = NULL;
+    if (OpenProxmark(&dev, port, false, 20, false, USART_BAUD_RATE) == false) {
+        return NULL;
+    }
 
-    if (!g_session.pm3_present)
-        PrintAndLogEx(INFO, "Running in " _YELLOW_("OFFLINE") " mode");
-    // For now, there is no real device context:
-    return g_session.current_device;
+    if (TestProxmark(dev) != PM3_SUCCESS) {
+        PrintAndLogEx(ERR, _RED_("ERROR:") " cannot communicate with the Proxmark on " _YELLOW_("%s") "\n", port);
+        FreeProxmark(dev);
+        return NULL;
+    }
+
+    // the first device opened is the one of the console,  i.e. threads that did not pick one
+    pthread_mutex_lock(&pm3_devices_lock);
+    if (g_session.current_device == NULL) {
+        g_session.current_device = dev;
+    }
+    pthread_mutex_unlock(&pm3_devices_lock);
+    return dev;
+}
+
+// Threads inside a call keep dev allocated, so pm3_close from another thread can't pull it
+// from under them
+static void device_acquire(pm3_device_t *dev) {
+    pthread_mutex_lock(&pm3_devices_lock);
+    dev->users++;
+    pthread_mutex_unlock(&pm3_devices_lock);
+}
+
+static void device_release(pm3_device_t *dev) {
+    pthread_mutex_lock(&pm3_devices_lock);
+    dev->users--;
+    bool unused = (dev->users == 0) && dev->closed;
+    pthread_mutex_unlock(&pm3_devices_lock);
+    if (unused) {
+        FreeProxmark(dev);
+    }
 }
 
 void pm3_close(pm3_device_t *dev) {
+    if (dev == NULL) {
+        return;
+    }
+
     // Clean up the port
-    if (g_session.pm3_present) {
+    pm3_device_t *prev = SetCurrentDevice(dev);
+    if (IsCommunicationThreadDead() == false && g_conn.run) {
         clearCommandBuffer();
         SendCommandNG(CMD_QUIT_SESSION, NULL, 0);
         msleep(100); // Make sure command is sent before killing client
+    }
+    SetCurrentDevice(prev);
+
+    pthread_mutex_lock(&pm3_devices_lock);
+    if (g_session.current_device == dev) {
+        g_session.current_device = NULL;
+    }
+    dev->closed = true;
+    bool unused = (dev->users == 0);
+    pthread_mutex_unlock(&pm3_devices_lock);
+
+    if (unused) {
+        FreeProxmark(dev);
+    } else {
+        // the port goes now, the memory once the last call on dev returns
         CloseProxmark(dev);
     }
 }
 
 int pm3_console(pm3_device_t *dev, const char *cmd) {
-    // For now, there is no real device context:
-    (void) dev;
-    return CommandReceived(cmd);
+    if (dev == NULL || cmd == NULL) {
+        return PM3_EINVARG;
+    }
+    // commands run on this thread talk to dev, other threads keep their own device
+    device_acquire(dev);
+    pm3_device_t *prev = SetCurrentDevice(dev);
+    int res = CommandReceived(cmd);
+    SetCurrentDevice(prev);
+    device_release(dev);
+    return res;
 }
 
 const char *pm3_name_get(pm3_device_t *dev) {
-    return dev->g_conn->serial_port_name;
+    if (dev == NULL) {
+        return NULL;
+    }
+    return dev->conn.serial_port_name;
 }
 
 pm3_device_t *pm3_get_current_dev(void) {
-    return g_session.current_device;
+    return GetCurrentDevice();
+}
+
+// Structured calls.  They bind dev to the calling thread like pm3_console, but keep the console
+// quiet and hand the results back in buffers allocated here, to be released with pm3_free.
+
+typedef struct {
+    pm3_device_t *dev;
+    pm3_device_t *prev;
+    bool quiet;
+} pm3_call_t;
+
+static bool call_begin(pm3_device_t *dev, pm3_call_t *call) {
+    device_acquire(dev);
+    call->dev = dev;
+    call->prev = SetCurrentDevice(dev);
+    call->quiet = GetQuietOutput();
+    SetQuietOutput(true);
+    return (IsCommunicationThreadDead() == false && g_conn.run);
+}
+
+static void call_end(pm3_call_t *call) {
+    SetQuietOutput(call->quiet);
+    SetCurrentDevice(call->prev);
+    device_release(call->dev);
+}
+
+int pm3_send(pm3_device_t *dev, uint16_t cmd, const uint8_t *in, size_t inlen) {
+    if (dev == NULL || inlen > PM3_CMD_DATA_SIZE || (in == NULL && inlen)) {
+        return PM3_EINVARG;
+    }
+
+    pm3_call_t call;
+    if (call_begin(dev, &call) == false) {
+        call_end(&call);
+        return PM3_ENOTTY;
+    }
+    clearCommandBuffer();
+    SendCommandNG(cmd, (uint8_t *)in, inlen);
+    call_end(&call);
+    return PM3_SUCCESS;
+}
+
+int pm3_receive(pm3_device_t *dev, uint16_t cmd, uint32_t timeout, uint8_t **out, size_t *outlen) {
+    if (dev == NULL || out == NULL || outlen == NULL) {
+        return PM3_EINVARG;
+    }
+    *out = NULL;
+    *outlen = 0;
+
+    pm3_call_t call;
+    if (call_begin(dev, &call) == false) {
+        call_end(&call);
+        return PM3_ENOTTY;
+    }
+    PacketResponseNG resp;
+    bool got = WaitForResponseTimeoutW(cmd, &resp, timeout, false);
+    call_end(&call);
+    if (got == false) {
+        return PM3_ETIMEOUT;
+    }
+
+    // MIX / OLD frames: the three arguments (little endian uint64) come first
+    size_t args = resp.ng ? 0 : sizeof(resp.oldarg);
+    size_t len = MIN(resp.length, PM3_CMD_DATA_SIZE);
+    uint8_t *buf = calloc(args + len + 1, sizeof(uint8_t));
+    if (buf == NULL) {
+        return PM3_EMALLOC;
+    }
+    for (size_t i = 0; i < args; i++) {
+        buf[i] = (resp.oldarg[i / 8] >> ((i % 8) * 8)) & 0xFF;
+    }
+    memcpy(buf + args, resp.data.asBytes, len);
+    *out = buf;
+    *outlen = args + len;
+    return resp.ng ? resp.status : PM3_SUCCESS;
+}
+
+int pm3_trace(pm3_device_t *dev, uint8_t **out, size_t *outlen) {
+    if (dev == NULL || out == NULL || outlen == NULL) {
+        return PM3_EINVARG;
+    }
+    *out = NULL;
+    *outlen = 0;
+
+    uint8_t *buf = calloc(PM3_CMD_DATA_SIZE, sizeof(uint8_t));
+    if (buf == NULL) {
+        return PM3_EMALLOC;
+    }
+
+    pm3_call_t call;
+    if (call_begin(dev, &call) == false) {
+        call_end(&call);
+        free(buf);
+        return PM3_ENOTTY;
+    }
+
+    // first chunk tells the size of the trace
+    int res = PM3_SUCCESS;
+    PacketResponseNG resp;
+    size_t len = 0;
+    if (GetFromDevice(BIG_BUF, buf, PM3_CMD_DATA_SIZE, 0, NULL, 0, &resp, 4000, false) == false) {
+        res = PM3_ETIMEOUT;
+    } else {
+        len = resp.oldarg[2];
+        if (len > PM3_CMD_DATA_SIZE) {
+            free(buf);
+            buf = calloc(len, sizeof(uint8_t));
+            if (buf == NULL) {
+                res = PM3_EMALLOC;
+            } else if (GetFromDevice(BIG_BUF, buf, len, 0, NULL, 0, NULL, 2500, false) == false) {
+                res = PM3_ETIMEOUT;
+            }
+        }
+    }
+    call_end(&call);
+
+    if (res != PM3_SUCCESS) {
+        free(buf);
+        return res;
+    }
+    *out = buf;
+    *outlen = len;
+    return PM3_SUCCESS;
+}
+
+static json_t *mf_key_json(const sector_t *s, uint8_t keytype) {
+    if (s->foundKey[keytype] == 0) {
+        return json_null();
+    }
+    char hex[13];
+    snprintf(hex, sizeof(hex), "%012" PRIX64, s->Key[keytype]);
+    return json_string(hex);
+}
+
+int pm3_mf_chk(pm3_device_t *dev, uint8_t sectors, const uint8_t *keys, size_t keyslen, char **json) {
+    if (dev == NULL || json == NULL) {
+        return PM3_EINVARG;
+    }
+    *json = NULL;
+    // the found key bitmap of CMD_HF_MIFARE_CHKKEYS_FAST covers 40 sectors
+    if (sectors == 0 || sectors > 40 || keys == NULL || keyslen < 6 || keyslen % 6) {
+        return PM3_EINVARG;
+    }
+
+    uint32_t keycnt = keyslen / 6;
+    uint8_t *keyblock = malloc(keyslen);
+    sector_t *e_sector = calloc(sectors, sizeof(sector_t));
+    if (keyblock == NULL || e_sector == NULL) {
+        free(keyblock);
+        free(e_sector);
+        return PM3_EMALLOC;
+    }
+    memcpy(keyblock, keys, keyslen);
+
+    pm3_call_t call;
+    if (call_begin(dev, &call) == false) {
+        call_end(&call);
+        free(keyblock);
+        free(e_sector);
+        return PM3_ENOTTY;
+    }
+
+    // same chunking and strategies as hf mf fchk
+    uint32_t chunksize = MIN(keycnt, PM3_CMD_DATA_SIZE / 6);
+    int res = PM3_EUNDEF;
+    for (uint8_t strategy = 1; strategy < 3 && res != PM3_SUCCESS && res != PM3_ETIMEOUT; strategy++) {
+        bool firstChunk = true, lastChunk = false;
+        for (uint32_t i = 0; i < keycnt; i += chunksize) {
+            uint32_t size = MIN(keycnt - i, chunksize);
+            lastChunk = (size == keycnt - i);
+            res = mfCheckKeys_fast(sectors, firstChunk, lastChunk, strategy, size, keyblock + (i * 6), e_sector, false);
+            firstChunk = false;
+            if (res == PM3_SUCCESS || res == PM3_ETIMEOUT || res == PM3_EMALLOC) {
+                break;
+            }
+        }
+    }
+    call_end(&call);
+    free(keyblock);
+
+    if (res == PM3_ETIMEOUT || res == PM3_EMALLOC) {
+        free(e_sector);
+        return res;
+    }
+
+    json_t *root = json_object();
+    json_t *arr = json_array();
+    int found = 0;
+    for (uint8_t i = 0; i < sectors; i++) {
+        found += e_sector[i].foundKey[0] + e_sector[i].foundKey[1];
+        json_t *s = json_object();
+        json_object_set_new(s, "sector", json_integer(i));
+        json_object_set_new(s, "a", mf_key_json(&e_sector[i], MF_KEY_A));
+        json_object_set_new(s, "b", mf_key_json(&e_sector[i], MF_KEY_B));
+        json_array_append_new(arr, s);
+    }
+    json_object_set_new(root, "found", json_integer(found));
+    json_object_set_new(root, "sectors", arr);
+    *json = json_dumps(root, JSON_COMPACT);
+    json_decref(root);
+    free(e_sector);
+
+    if (*json == NULL) {
+        return PM3_EMALLOC;
+    }
+    return (found == sectors * 2) ? PM3_SUCCESS : PM3_EPARTIAL;
+}
+
+int pm3_mf_dump(pm3_device_t *dev, uint8_t sectors, const uint8_t *keys, size_t keyslen, uint8_t **out, size_t *outlen) {
+    if (dev == NULL || out == NULL || outlen == NULL) {
+        return PM3_EINVARG;
+    }
+    *out = NULL;
+    *outlen = 0;
+    if (sectors == 0 || sectors > 40 || keys == NULL || keyslen != sectors * 12) {
+        return PM3_EINVARG;
+    }
+
+    size_t len = mfFirstBlockOfSector(sectors - 1) * MFBLOCK_SIZE + mfNumBlocksPerSector(sectors - 1) * MFBLOCK_SIZE;
+    uint8_t *buf = calloc(len, sizeof(uint8_t));
+    if (buf == NULL) {
+        return PM3_EMALLOC;
+    }
+
+    pm3_call_t call;
+    if (call_begin(dev, &call) == false) {
+        call_end(&call);
+        free(buf);
+        return PM3_ENOTTY;
+    }
+
+    int res = PM3_SUCCESS;
+    for (uint8_t s = 0; s < sectors; s++) {
+        uint8_t *data = buf + mfFirstBlockOfSector(s) * MFBLOCK_SIZE;
+        uint8_t *trailer = data + (mfNumBlocksPerSector(s) - 1) * MFBLOCK_SIZE;
+        const uint8_t *keya = keys + (s * 12);
+        const uint8_t *keyb = keya + 6;
+
+        int sres = mfReadSector(s, MF_KEY_A, keya, data);
+        if (sres == PM3_ETIMEOUT) {
+            res = sres;
+            break;
+        }
+        if (sres != PM3_SUCCESS) {
+            sres = mfReadSector(s, MF_KEY_B, keyb, data);
+            if (sres == PM3_ETIMEOUT) {
+                res = sres;
+                break;
+            }
+        }
+        if (sres != PM3_SUCCESS) {
+            res = PM3_EPARTIAL;
+            continue;
+        }
+
+        // key A always reads back as zeros, key B only when the access bits hide it
+        memcpy(trailer, keya, 6);
+        static const uint8_t zeros[6] = {0};
+        if (memcmp(trailer + 10, zeros, 6) == 0) {
+            memcpy(trailer + 10, keyb, 6);
+        }
+    }
+    call_end(&call);
+
+    if (res == PM3_ETIMEOUT) {
+        free(buf);
+        return res;
+    }
+    *out = buf;
+    *outlen = len;
+    return res;
+}
+
+void pm3_free(void *p) {
+    free(p);
 }
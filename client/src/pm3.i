@@ -1,9 +1,101 @@
-%module pm3
+%module(threads="1") pm3
+#ifdef SWIGPYTHON
+%begin %{
+/* The GIL is always set up since Python 3.7, PyEval_InitThreads is deprecated */
+#define SWIG_PYTHON_INITIALIZE_THREADS
+%}
+#endif
 %{
 /* Include the header in the wrapper code */
 #include "pm3.h"
 #include "comms.h"
 %}
+%include "exception.i"
+%include "stdint.i"
+
+/* Structured calls: bytes in, status code out, followed by the result as bytes / str (nil / None if none) */
+%typemap(in, numinputs=0) (uint8_t **out, size_t *outlen) (uint8_t *buf = NULL, size_t len = 0) {
+    $1 = &buf;
+    $2 = &len;
+}
+%typemap(freearg) (uint8_t **out, size_t *outlen) {
+    pm3_free(*$1);
+}
+%typemap(in, numinputs=0) char **json (char *str = NULL) {
+    $1 = &str;
+}
+%typemap(freearg) char **json {
+    pm3_free(*$1);
+}
+#ifdef SWIGPYTHON
+%typemap(in) (const uint8_t *in, size_t inlen) {
+    char *buf = NULL;
+    Py_ssize_t len = 0;
+    if (PyBytes_AsStringAndSize($input, &buf, &len) == -1) {
+        SWIG_fail;
+    }
+    $1 = (uint8_t *)buf;
+    $2 = (size_t)len;
+}
+%typemap(argout) (uint8_t **out, size_t *outlen) {
+    PyObject *o = Py_None;
+    if (*$1 != NULL) {
+        o = PyBytes_FromStringAndSize((const char *)*$1, (Py_ssize_t)*$2);
+    } else {
+        Py_INCREF(o);
+    }
+    $result = SWIG_Python_AppendOutput($result, o);
+}
+%typemap(argout, fragment="SWIG_FromCharPtr") char **json {
+    $result = SWIG_Python_AppendOutput($result, SWIG_FromCharPtr(*$1));
+}
+#endif
+#ifdef SWIGLUA
+/* Numbers go through a lua_Number, casting the lua_tonumber() call itself fails -Wbad-function-cast */
+%typemap(in, checkfn="lua_isnumber") uint8_t, uint16_t, uint32_t (lua_Number num) {
+    SWIG_contract_assert((lua_tonumber(L, $input) >= 0), "number must not be negative")
+    num = lua_tonumber(L, $input);
+    $1 = ($1_ltype)num;
+}
+%typemap(in) (const uint8_t *in, size_t inlen) {
+    $1 = (uint8_t *)luaL_checklstring(L, $input, &$2);
+}
+%typemap(argout) (uint8_t **out, size_t *outlen) {
+    if (*$1 != NULL) {
+        lua_pushlstring(L, (const char *)*$1, *$2);
+    } else {
+        lua_pushnil(L);
+    }
+    SWIG_arg++;
+}
+%typemap(argout) char **json {
+    if (*$1 != NULL) {
+        lua_pushstring(L, *$1);
+    } else {
+        lua_pushnil(L);
+    }
+    SWIG_arg++;
+}
+#endif
+
+/* Only the calls talking to a device release the Python GIL,
+   so several threads can drive their own device at the same time */
+%nothread;
+%thread pm3::pm3(char *port);
+%thread pm3::~pm3;
+%thread pm3::console;
+%thread pm3::send;
+%thread pm3::receive;
+%thread pm3::trace;
+%thread pm3::mf_chk;
+%thread pm3::mf_dump;
+
+%exception pm3::pm3(char *port) {
+    $action
+    if (result == NULL) {
+        SWIG_exception(SWIG_IOError, "cannot open Proxmark3");
+    }
+}
 
 /* Strip "pm3_" from API functions for SWIG */
 %rename("%(strip:[pm3_])s") "";
@@ -19,7 +111,9 @@ typedef struct {
         pm3(char *port) {
 //            printf("SWIG pm3 constructor with port, open pm3\n");
             pm3_device_t * p = pm3_open(port);
-            p->script_embedded = 0;
+            if (p != NULL) {
+                p->script_embedded = 0;
+            }
             return p;
         }
         ~pm3() {
@@ -31,6 +125,11 @@ typedef struct {
             }
         }
         int console(char *cmd);
+        int send(uint16_t cmd, const uint8_t *in, size_t inlen);
+        int receive(uint16_t cmd, uint32_t timeout, uint8_t **out, size_t *outlen);
+        int trace(uint8_t **out, size_t *outlen);
+        int mf_chk(uint8_t sectors, const uint8_t *in, size_t inlen, char **json);
+        int mf_dump(uint8_t sectors, const uint8_t *in, size_t inlen, uint8_t **out, size_t *outlen);
         char const * const name;
     }
 } pm3;
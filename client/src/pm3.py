@@ -71,6 +71,21 @@ class pm3(object):
 
     def console(self, cmd):
         return _pm3.pm3_console(self, cmd)
+
+    def send(self, cmd, _in):
+        return _pm3.pm3_send(self, cmd, _in)
+
+    def receive(self, cmd, timeout):
+        return _pm3.pm3_receive(self, cmd, timeout)
+
+    def trace(self):
+        return _pm3.pm3_trace(self)
+
+    def mf_chk(self, sectors, _in):
+        return _pm3.pm3_mf_chk(self, sectors, _in)
+
+    def mf_dump(self, sectors, _in):
+        return _pm3.pm3_mf_dump(self, sectors, _in)
     name = property(_pm3.pm3_name_get)
 
 # Register pm3 in _pm3:
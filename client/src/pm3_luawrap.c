@@ -2610,6 +2610,14 @@ static swig_module_info swig_module = {swig_types, 1, 0, 0, 0, 0};
 #include "pm3.h"
 #include "comms.h"
 
+
+#define SWIG_exception(a,b)\
+{ lua_pushfstring(L,"%s:%s",#a,b);SWIG_fail; }
+
+
+#include <stdint.h>		// Use the C99 official header
+
+
 SWIGINTERN pm3 *new_pm3__SWIG_0(void) {
 //            printf("SWIG pm3 constructor, get current pm3\n");
     pm3_device_t *p = pm3_get_current_dev();
@@ -2627,7 +2635,9 @@ SWIGINTERN int SWIG_lua_isnilstring(lua_State *L, int idx) {
 SWIGINTERN pm3 *new_pm3__SWIG_1(char *port) {
 //            printf("SWIG pm3 constructor with port, open pm3\n");
     pm3_device_t *p = pm3_open(port);
-    p->script_embedded = 0;
+    if (p != NULL) {
+        p->script_embedded = 0;
+    }
     return p;
 }
 SWIGINTERN void delete_pm3(pm3 *self) {
@@ -2667,7 +2677,12 @@ static int _wrap_new_pm3__SWIG_1(lua_State *L) {
     SWIG_check_num_args("pm3::pm3", 1, 1)
     if (!SWIG_lua_isnilstring(L, 1)) SWIG_fail_arg("pm3::pm3", 1, "char *");
     arg1 = (char *)lua_tostring(L, 1);
-    result = (pm3 *)new_pm3__SWIG_1(arg1);
+    {
+        result = (pm3 *)new_pm3__SWIG_1(arg1);
+        if (result == NULL) {
+            SWIG_exception(SWIG_IOError, "cannot open Proxmark3");
+        }
+    }
     SWIG_NewPointerObj(L, result, SWIGTYPE_p_pm3, 1);
     SWIG_arg++;
     return SWIG_arg;
@@ -2737,6 +2752,271 @@ fail:
 }
 
 
+static int _wrap_pm3_send(lua_State *L) {
+    int SWIG_arg = 0;
+    pm3 *arg1 = (pm3 *) 0 ;
+    uint16_t arg2 ;
+    uint8_t *arg3 = (uint8_t *) 0 ;
+    size_t arg4 ;
+    lua_Number num2 ;
+    int result;
+
+    SWIG_check_num_args("pm3::send", 3, 3)
+    if (!SWIG_isptrtype(L, 1)) SWIG_fail_arg("pm3::send", 1, "pm3 *");
+    if (!lua_isnumber(L, 2)) SWIG_fail_arg("pm3::send", 2, "uint16_t");
+
+    if (!SWIG_IsOK(SWIG_ConvertPtr(L, 1, (void **)&arg1, SWIGTYPE_p_pm3, 0))) {
+        SWIG_fail_ptr("pm3_send", 1, SWIGTYPE_p_pm3);
+    }
+
+    {
+        SWIG_contract_assert((lua_tonumber(L, 2) >= 0), "number must not be negative")
+        num2 = lua_tonumber(L, 2);
+        arg2 = (uint16_t)num2;
+    }
+    {
+        arg3 = (uint8_t *)luaL_checklstring(L, 3, &arg4);
+    }
+    result = (int)pm3_send(arg1, arg2, (uint8_t const *)arg3, arg4);
+    lua_pushnumber(L, (lua_Number) result);
+    SWIG_arg++;
+    return SWIG_arg;
+
+    if (0) SWIG_fail;
+
+fail:
+    lua_error(L);
+    return SWIG_arg;
+}
+
+
+static int _wrap_pm3_receive(lua_State *L) {
+    int SWIG_arg = 0;
+    pm3 *arg1 = (pm3 *) 0 ;
+    uint16_t arg2 ;
+    uint32_t arg3 ;
+    uint8_t **arg4 = (uint8_t **) 0 ;
+    size_t *arg5 = (size_t *) 0 ;
+    lua_Number num2 ;
+    lua_Number num3 ;
+    uint8_t *buf4 = NULL ;
+    size_t len4 = 0 ;
+    int result;
+
+    {
+        arg4 = &buf4;
+        arg5 = &len4;
+    }
+    SWIG_check_num_args("pm3::receive", 3, 3)
+    if (!SWIG_isptrtype(L, 1)) SWIG_fail_arg("pm3::receive", 1, "pm3 *");
+    if (!lua_isnumber(L, 2)) SWIG_fail_arg("pm3::receive", 2, "uint16_t");
+    if (!lua_isnumber(L, 3)) SWIG_fail_arg("pm3::receive", 3, "uint32_t");
+
+    if (!SWIG_IsOK(SWIG_ConvertPtr(L, 1, (void **)&arg1, SWIGTYPE_p_pm3, 0))) {
+        SWIG_fail_ptr("pm3_receive", 1, SWIGTYPE_p_pm3);
+    }
+
+    {
+        SWIG_contract_assert((lua_tonumber(L, 2) >= 0), "number must not be negative")
+        num2 = lua_tonumber(L, 2);
+        arg2 = (uint16_t)num2;
+    }
+    {
+        SWIG_contract_assert((lua_tonumber(L, 3) >= 0), "number must not be negative")
+        num3 = lua_tonumber(L, 3);
+        arg3 = (uint32_t)num3;
+    }
+    result = (int)pm3_receive(arg1, arg2, arg3, arg4, arg5);
+    lua_pushnumber(L, (lua_Number) result);
+    SWIG_arg++;
+    {
+        if (*arg4 != NULL) {
+            lua_pushlstring(L, (const char *)*arg4, *arg5);
+        } else {
+            lua_pushnil(L);
+        }
+        SWIG_arg++;
+    }
+    {
+        pm3_free(*arg4);
+    }
+    return SWIG_arg;
+
+    if (0) SWIG_fail;
+
+fail:
+    {
+        pm3_free(*arg4);
+    }
+    lua_error(L);
+    return SWIG_arg;
+}
+
+
+static int _wrap_pm3_trace(lua_State *L) {
+    int SWIG_arg = 0;
+    pm3 *arg1 = (pm3 *) 0 ;
+    uint8_t **arg2 = (uint8_t **) 0 ;
+    size_t *arg3 = (size_t *) 0 ;
+    uint8_t *buf2 = NULL ;
+    size_t len2 = 0 ;
+    int result;
+
+    {
+        arg2 = &buf2;
+        arg3 = &len2;
+    }
+    SWIG_check_num_args("pm3::trace", 1, 1)
+    if (!SWIG_isptrtype(L, 1)) SWIG_fail_arg("pm3::trace", 1, "pm3 *");
+
+    if (!SWIG_IsOK(SWIG_ConvertPtr(L, 1, (void **)&arg1, SWIGTYPE_p_pm3, 0))) {
+        SWIG_fail_ptr("pm3_trace", 1, SWIGTYPE_p_pm3);
+    }
+
+    result = (int)pm3_trace(arg1, arg2, arg3);
+    lua_pushnumber(L, (lua_Number) result);
+    SWIG_arg++;
+    {
+        if (*arg2 != NULL) {
+            lua_pushlstring(L, (const char *)*arg2, *arg3);
+        } else {
+            lua_pushnil(L);
+        }
+        SWIG_arg++;
+    }
+    {
+        pm3_free(*arg2);
+    }
+    return SWIG_arg;
+
+    if (0) SWIG_fail;
+
+fail:
+    {
+        pm3_free(*arg2);
+    }
+    lua_error(L);
+    return SWIG_arg;
+}
+
+
+static int _wrap_pm3_mf_chk(lua_State *L) {
+    int SWIG_arg = 0;
+    pm3 *arg1 = (pm3 *) 0 ;
+    uint8_t arg2 ;
+    uint8_t *arg3 = (uint8_t *) 0 ;
+    size_t arg4 ;
+    char **arg5 = (char **) 0 ;
+    lua_Number num2 ;
+    char *str5 = NULL ;
+    int result;
+
+    {
+        arg5 = &str5;
+    }
+    SWIG_check_num_args("pm3::mf_chk", 3, 3)
+    if (!SWIG_isptrtype(L, 1)) SWIG_fail_arg("pm3::mf_chk", 1, "pm3 *");
+    if (!lua_isnumber(L, 2)) SWIG_fail_arg("pm3::mf_chk", 2, "uint8_t");
+
+    if (!SWIG_IsOK(SWIG_ConvertPtr(L, 1, (void **)&arg1, SWIGTYPE_p_pm3, 0))) {
+        SWIG_fail_ptr("pm3_mf_chk", 1, SWIGTYPE_p_pm3);
+    }
+
+    {
+        SWIG_contract_assert((lua_tonumber(L, 2) >= 0), "number must not be negative")
+        num2 = lua_tonumber(L, 2);
+        arg2 = (uint8_t)num2;
+    }
+    {
+        arg3 = (uint8_t *)luaL_checklstring(L, 3, &arg4);
+    }
+    result = (int)pm3_mf_chk(arg1, arg2, (uint8_t const *)arg3, arg4, arg5);
+    lua_pushnumber(L, (lua_Number) result);
+    SWIG_arg++;
+    {
+        if (*arg5 != NULL) {
+            lua_pushstring(L, *arg5);
+        } else {
+            lua_pushnil(L);
+        }
+        SWIG_arg++;
+    }
+    {
+        pm3_free(*arg5);
+    }
+    return SWIG_arg;
+
+    if (0) SWIG_fail;
+
+fail:
+    {
+        pm3_free(*arg5);
+    }
+    lua_error(L);
+    return SWIG_arg;
+}
+
+
+static int _wrap_pm3_mf_dump(lua_State *L) {
+    int SWIG_arg = 0;
+    pm3 *arg1 = (pm3 *) 0 ;
+    uint8_t arg2 ;
+    uint8_t *arg3 = (uint8_t *) 0 ;
+    size_t arg4 ;
+    uint8_t **arg5 = (uint8_t **) 0 ;
+    size_t *arg6 = (size_t *) 0 ;
+    lua_Number num2 ;
+    uint8_t *buf5 = NULL ;
+    size_t len5 = 0 ;
+    int result;
+
+    {
+        arg5 = &buf5;
+        arg6 = &len5;
+    }
+    SWIG_check_num_args("pm3::mf_dump", 3, 3)
+    if (!SWIG_isptrtype(L, 1)) SWIG_fail_arg("pm3::mf_dump", 1, "pm3 *");
+    if (!lua_isnumber(L, 2)) SWIG_fail_arg("pm3::mf_dump", 2, "uint8_t");
+
+    if (!SWIG_IsOK(SWIG_ConvertPtr(L, 1, (void **)&arg1, SWIGTYPE_p_pm3, 0))) {
+        SWIG_fail_ptr("pm3_mf_dump", 1, SWIGTYPE_p_pm3);
+    }
+
+    {
+        SWIG_contract_assert((lua_tonumber(L, 2) >= 0), "number must not be negative")
+        num2 = lua_tonumber(L, 2);
+        arg2 = (uint8_t)num2;
+    }
+    {
+        arg3 = (uint8_t *)luaL_checklstring(L, 3, &arg4);
+    }
+    result = (int)pm3_mf_dump(arg1, arg2, (uint8_t const *)arg3, arg4, arg5, arg6);
+    lua_pushnumber(L, (lua_Number) result);
+    SWIG_arg++;
+    {
+        if (*arg5 != NULL) {
+            lua_pushlstring(L, (const char *)*arg5, *arg6);
+        } else {
+            lua_pushnil(L);
+        }
+        SWIG_arg++;
+    }
+    {
+        pm3_free(*arg5);
+    }
+    return SWIG_arg;
+
+    if (0) SWIG_fail;
+
+fail:
+    {
+        pm3_free(*arg5);
+    }
+    lua_error(L);
+    return SWIG_arg;
+}
+
+
 static int _wrap_pm3_name_get(lua_State *L) {
     int SWIG_arg = 0;
     pm3 *arg1 = (pm3 *) 0 ;
@@ -2780,6 +3060,11 @@ static swig_lua_attribute swig_pm3_attributes[] = {
 };
 static swig_lua_method swig_pm3_methods[] = {
     { "console", _wrap_pm3_console},
+    { "send", _wrap_pm3_send},
+    { "receive", _wrap_pm3_receive},
+    { "trace", _wrap_pm3_trace},
+    { "mf_chk", _wrap_pm3_mf_chk},
+    { "mf_dump", _wrap_pm3_mf_dump},
     {0, 0}
 };
 static swig_lua_method swig_pm3_meta[] = {
@@ -8,11 +8,15 @@
  * interface file instead.
  * ----------------------------------------------------------------------------- */
 
+/* The GIL is always set up since Python 3.7, PyEval_InitThreads is deprecated */
+#define SWIG_PYTHON_INITIALIZE_THREADS
+
 
 #ifndef SWIGPYTHON
 #define SWIGPYTHON
 #endif
 
+#define SWIG_PYTHON_THREADS
 #define SWIG_PYTHON_DIRECTOR_NO_VTABLE
 
 /* -----------------------------------------------------------------------------
@@ -2621,6 +2625,9 @@ SWIGINTERN PyObject *SWIG_PyStaticMethod_New(PyObject *SWIGUNUSEDPARM(self), PyO
 #endif
 
 
+#define SWIG_exception(code, msg) do { SWIG_Error(code, msg); SWIG_fail;; } while(0)
+
+
 /* -------- TYPES TABLE (BEGIN) -------- */
 
 #define SWIGTYPE_p_char swig_types[0]
@@ -2661,6 +2668,8 @@ static swig_module_info swig_module = {swig_types, 2, 0, 0, 0, 0};
 #include "pm3.h"
 #include "comms.h"
 
+#include <stdint.h>		// Use the C99 official header
+
 SWIGINTERN pm3 *new_pm3__SWIG_0(void) {
 //            printf("SWIG pm3 constructor, get current pm3\n");
     pm3_device_t *p = pm3_get_current_dev();
@@ -2795,7 +2804,9 @@ SWIG_AsCharPtrAndSize(PyObject *obj, char **cptr, size_t *psize, int *alloc) {
 SWIGINTERN pm3 *new_pm3__SWIG_1(char *port) {
 //            printf("SWIG pm3 constructor with port, open pm3\n");
     pm3_device_t *p = pm3_open(port);
-    p->script_embedded = 0;
+    if (p != NULL) {
+        p->script_embedded = 0;
+    }
     return p;
 }
 SWIGINTERN void delete_pm3(pm3 *self) {
@@ -2813,6 +2824,189 @@ SWIG_From_int(int value) {
 }
 
 
+#include <limits.h>
+#if !defined(SWIG_NO_LLONG_MAX)
+# if !defined(LLONG_MAX) && defined(__GNUC__) && defined (__LONG_LONG_MAX__)
+#   define LLONG_MAX __LONG_LONG_MAX__
+#   define LLONG_MIN (-LLONG_MAX - 1LL)
+#   define ULLONG_MAX (LLONG_MAX * 2ULL + 1ULL)
+# endif
+#endif
+
+
+SWIGINTERN int
+SWIG_AsVal_double(PyObject *obj, double *val) {
+    int res = SWIG_TypeError;
+    if (PyFloat_Check(obj)) {
+        if (val) *val = PyFloat_AsDouble(obj);
+        return SWIG_OK;
+#if PY_VERSION_HEX < 0x03000000
+    } else if (PyInt_Check(obj)) {
+        if (val) *val = (double) PyInt_AsLong(obj);
+        return SWIG_OK;
+#endif
+    } else if (PyLong_Check(obj)) {
+        double v = PyLong_AsDouble(obj);
+        if (!PyErr_Occurred()) {
+            if (val) *val = v;
+            return SWIG_OK;
+        } else {
+            PyErr_Clear();
+        }
+    }
+#ifdef SWIG_PYTHON_CAST_MODE
+    {
+        int dispatch = 0;
+        double d = PyFloat_AsDouble(obj);
+        if (!PyErr_Occurred()) {
+            if (val) *val = d;
+            return SWIG_AddCast(SWIG_OK);
+        } else {
+            PyErr_Clear();
+        }
+        if (!dispatch) {
+            long v = PyLong_AsLong(obj);
+            if (!PyErr_Occurred()) {
+                if (val) *val = v;
+                return SWIG_AddCast(SWIG_AddCast(SWIG_OK));
+            } else {
+                PyErr_Clear();
+            }
+        }
+    }
+#endif
+    return res;
+}
+
+
+#include <float.h>
+
+
+#include <math.h>
+
+
+SWIGINTERNINLINE int
+SWIG_CanCastAsInteger(double *d, double min, double max) {
+    double x = *d;
+    if ((min <= x && x <= max)) {
+        double fx = floor(x);
+        double cx = ceil(x);
+        double rd = ((x - fx) < 0.5) ? fx : cx; /* simple rint */
+        if ((errno == EDOM) || (errno == ERANGE)) {
+            errno = 0;
+        } else {
+            double summ, reps, diff;
+            if (rd < x) {
+                diff = x - rd;
+            } else if (rd > x) {
+                diff = rd - x;
+            } else {
+                return 1;
+            }
+            summ = rd + x;
+            reps = diff / summ;
+            if (reps < 8 * DBL_EPSILON) {
+                *d = rd;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+
+SWIGINTERN int
+SWIG_AsVal_unsigned_SS_long(PyObject *obj, unsigned long *val) {
+#if PY_VERSION_HEX < 0x03000000
+    if (PyInt_Check(obj)) {
+        long v = PyInt_AsLong(obj);
+        if (v >= 0) {
+            if (val) *val = v;
+            return SWIG_OK;
+        } else {
+            return SWIG_OverflowError;
+        }
+    } else
+#endif
+        if (PyLong_Check(obj)) {
+            unsigned long v = PyLong_AsUnsignedLong(obj);
+            if (!PyErr_Occurred()) {
+                if (val) *val = v;
+                return SWIG_OK;
+            } else {
+                PyErr_Clear();
+                return SWIG_OverflowError;
+            }
+        }
+#ifdef SWIG_PYTHON_CAST_MODE
+    {
+        int dispatch = 0;
+        unsigned long v = PyLong_AsUnsignedLong(obj);
+        if (!PyErr_Occurred()) {
+            if (val) *val = v;
+            return SWIG_AddCast(SWIG_OK);
+        } else {
+            PyErr_Clear();
+        }
+        if (!dispatch) {
+            double d;
+            int res = SWIG_AddCast(SWIG_AsVal_double(obj, &d));
+            if (SWIG_IsOK(res) && SWIG_CanCastAsInteger(&d, 0, ULONG_MAX)) {
+                if (val) *val = (unsigned long)(d);
+                return res;
+            }
+        }
+    }
+#endif
+    return SWIG_TypeError;
+}
+
+
+SWIGINTERN int
+SWIG_AsVal_unsigned_SS_short(PyObject *obj, unsigned short *val) {
+    unsigned long v;
+    int res = SWIG_AsVal_unsigned_SS_long(obj, &v);
+    if (SWIG_IsOK(res)) {
+        if ((v > USHRT_MAX)) {
+            return SWIG_OverflowError;
+        } else {
+            if (val) *val = (unsigned short)(v);
+        }
+    }
+    return res;
+}
+
+
+SWIGINTERN int
+SWIG_AsVal_unsigned_SS_int(PyObject *obj, unsigned int *val) {
+    unsigned long v;
+    int res = SWIG_AsVal_unsigned_SS_long(obj, &v);
+    if (SWIG_IsOK(res)) {
+        if ((v > UINT_MAX)) {
+            return SWIG_OverflowError;
+        } else {
+            if (val) *val = (unsigned int)(v);
+        }
+    }
+    return res;
+}
+
+
+SWIGINTERN int
+SWIG_AsVal_unsigned_SS_char(PyObject *obj, unsigned char *val) {
+    unsigned long v;
+    int res = SWIG_AsVal_unsigned_SS_long(obj, &v);
+    if (SWIG_IsOK(res)) {
+        if ((v > UCHAR_MAX)) {
+            return SWIG_OverflowError;
+        } else {
+            if (val) *val = (unsigned char)(v);
+        }
+    }
+    return res;
+}
+
+
 SWIGINTERNINLINE PyObject *
 SWIG_FromCharPtrAndSize(const char *carray, size_t size) {
     if (carray) {
@@ -2872,7 +3066,16 @@ SWIGINTERN PyObject *_wrap_new_pm3__SWIG_1(PyObject *SWIGUNUSEDPARM(self), Py_ss
         SWIG_exception_fail(SWIG_ArgError(res1), "in method '" "new_pm3" "', argument " "1"" of type '" "char *""'");
     }
     arg1 = (char *)(buf1);
-    result = (pm3 *)new_pm3__SWIG_1(arg1);
+    {
+        {
+            SWIG_PYTHON_THREAD_BEGIN_ALLOW;
+            result = (pm3 *)new_pm3__SWIG_1(arg1);
+            SWIG_PYTHON_THREAD_END_ALLOW;
+        }
+        if (result == NULL) {
+            SWIG_exception(SWIG_IOError, "cannot open Proxmark3");
+        }
+    }
     resultobj = SWIG_NewPointerObj(SWIG_as_voidptr(result), SWIGTYPE_p_pm3, SWIG_POINTER_NEW |  0);
     if (alloc1 == SWIG_NEWOBJ) free((char *)buf1);
     return resultobj;
@@ -2925,7 +3128,11 @@ SWIGINTERN PyObject *_wrap_delete_pm3(PyObject *SWIGUNUSEDPARM(self), PyObject *
         SWIG_exception_fail(SWIG_ArgError(res1), "in method '" "delete_pm3" "', argument " "1"" of type '" "pm3 *""'");
     }
     arg1 = (pm3 *)(argp1);
-    delete_pm3(arg1);
+    {
+        SWIG_PYTHON_THREAD_BEGIN_ALLOW;
+        delete_pm3(arg1);
+        SWIG_PYTHON_THREAD_END_ALLOW;
+    }
     resultobj = SWIG_Py_Void();
     return resultobj;
 fail:
@@ -2956,7 +3163,11 @@ SWIGINTERN PyObject *_wrap_pm3_console(PyObject *SWIGUNUSEDPARM(self), PyObject
         SWIG_exception_fail(SWIG_ArgError(res2), "in method '" "pm3_console" "', argument " "2"" of type '" "char *""'");
     }
     arg2 = (char *)(buf2);
-    result = (int)pm3_console(arg1, arg2);
+    {
+        SWIG_PYTHON_THREAD_BEGIN_ALLOW;
+        result = (int)pm3_console(arg1, arg2);
+        SWIG_PYTHON_THREAD_END_ALLOW;
+    }
     resultobj = SWIG_From_int((int)(result));
     if (alloc2 == SWIG_NEWOBJ) free((char *)buf2);
     return resultobj;
@@ -2966,6 +3177,293 @@ fail:
 }
 
 
+SWIGINTERN PyObject *_wrap_pm3_send(PyObject *SWIGUNUSEDPARM(self), PyObject *args) {
+    PyObject *resultobj = 0;
+    pm3 *arg1 = (pm3 *) 0 ;
+    uint16_t arg2 ;
+    uint8_t *arg3 = (uint8_t *) 0 ;
+    size_t arg4 ;
+    void *argp1 = 0 ;
+    int res1 = 0 ;
+    unsigned short val2 ;
+    int ecode2 = 0 ;
+    PyObject *swig_obj[3] ;
+    int result;
+
+    if (!SWIG_Python_UnpackTuple(args, "pm3_send", 3, 3, swig_obj)) SWIG_fail;
+    res1 = SWIG_ConvertPtr(swig_obj[0], &argp1, SWIGTYPE_p_pm3, 0 |  0);
+    if (!SWIG_IsOK(res1)) {
+        SWIG_exception_fail(SWIG_ArgError(res1), "in method '" "pm3_send" "', argument " "1"" of type '" "pm3 *""'");
+    }
+    arg1 = (pm3 *)(argp1);
+    ecode2 = SWIG_AsVal_unsigned_SS_short(swig_obj[1], &val2);
+    if (!SWIG_IsOK(ecode2)) {
+        SWIG_exception_fail(SWIG_ArgError(ecode2), "in method '" "pm3_send" "', argument " "2"" of type '" "uint16_t""'");
+    }
+    arg2 = (uint16_t)(val2);
+    {
+        char *buf = NULL;
+        Py_ssize_t len = 0;
+        if (PyBytes_AsStringAndSize(swig_obj[2], &buf, &len) == -1) {
+            SWIG_fail;
+        }
+        arg3 = (uint8_t *)buf;
+        arg4 = (size_t)len;
+    }
+    {
+        SWIG_PYTHON_THREAD_BEGIN_ALLOW;
+        result = (int)pm3_send(arg1, arg2, (uint8_t const *)arg3, arg4);
+        SWIG_PYTHON_THREAD_END_ALLOW;
+    }
+    resultobj = SWIG_From_int((int)(result));
+    return resultobj;
+fail:
+    return NULL;
+}
+
+
+SWIGINTERN PyObject *_wrap_pm3_receive(PyObject *SWIGUNUSEDPARM(self), PyObject *args) {
+    PyObject *resultobj = 0;
+    pm3 *arg1 = (pm3 *) 0 ;
+    uint16_t arg2 ;
+    uint32_t arg3 ;
+    uint8_t **arg4 = (uint8_t **) 0 ;
+    size_t *arg5 = (size_t *) 0 ;
+    void *argp1 = 0 ;
+    int res1 = 0 ;
+    unsigned short val2 ;
+    int ecode2 = 0 ;
+    unsigned int val3 ;
+    int ecode3 = 0 ;
+    uint8_t *buf4 = NULL ;
+    size_t len4 = 0 ;
+    PyObject *swig_obj[3] ;
+    int result;
+
+    {
+        arg4 = &buf4;
+        arg5 = &len4;
+    }
+    if (!SWIG_Python_UnpackTuple(args, "pm3_receive", 3, 3, swig_obj)) SWIG_fail;
+    res1 = SWIG_ConvertPtr(swig_obj[0], &argp1, SWIGTYPE_p_pm3, 0 |  0);
+    if (!SWIG_IsOK(res1)) {
+        SWIG_exception_fail(SWIG_ArgError(res1), "in method '" "pm3_receive" "', argument " "1"" of type '" "pm3 *""'");
+    }
+    arg1 = (pm3 *)(argp1);
+    ecode2 = SWIG_AsVal_unsigned_SS_short(swig_obj[1], &val2);
+    if (!SWIG_IsOK(ecode2)) {
+        SWIG_exception_fail(SWIG_ArgError(ecode2), "in method '" "pm3_receive" "', argument " "2"" of type '" "uint16_t""'");
+    }
+    arg2 = (uint16_t)(val2);
+    ecode3 = SWIG_AsVal_unsigned_SS_int(swig_obj[2], &val3);
+    if (!SWIG_IsOK(ecode3)) {
+        SWIG_exception_fail(SWIG_ArgError(ecode3), "in method '" "pm3_receive" "', argument " "3"" of type '" "uint32_t""'");
+    }
+    arg3 = (uint32_t)(val3);
+    {
+        SWIG_PYTHON_THREAD_BEGIN_ALLOW;
+        result = (int)pm3_receive(arg1, arg2, arg3, arg4, arg5);
+        SWIG_PYTHON_THREAD_END_ALLOW;
+    }
+    resultobj = SWIG_From_int((int)(result));
+    {
+        PyObject *o = Py_None;
+        if (*arg4 != NULL) {
+            o = PyBytes_FromStringAndSize((const char *)*arg4, (Py_ssize_t)*arg5);
+        } else {
+            Py_INCREF(o);
+        }
+        resultobj = SWIG_Python_AppendOutput(resultobj, o);
+    }
+    {
+        pm3_free(*arg4);
+    }
+    return resultobj;
+fail:
+    {
+        pm3_free(*arg4);
+    }
+    return NULL;
+}
+
+
+SWIGINTERN PyObject *_wrap_pm3_trace(PyObject *SWIGUNUSEDPARM(self), PyObject *args) {
+    PyObject *resultobj = 0;
+    pm3 *arg1 = (pm3 *) 0 ;
+    uint8_t **arg2 = (uint8_t **) 0 ;
+    size_t *arg3 = (size_t *) 0 ;
+    void *argp1 = 0 ;
+    int res1 = 0 ;
+    uint8_t *buf2 = NULL ;
+    size_t len2 = 0 ;
+    PyObject *swig_obj[1] ;
+    int result;
+
+    {
+        arg2 = &buf2;
+        arg3 = &len2;
+    }
+    if (!args) SWIG_fail;
+    swig_obj[0] = args;
+    res1 = SWIG_ConvertPtr(swig_obj[0], &argp1, SWIGTYPE_p_pm3, 0 |  0);
+    if (!SWIG_IsOK(res1)) {
+        SWIG_exception_fail(SWIG_ArgError(res1), "in method '" "pm3_trace" "', argument " "1"" of type '" "pm3 *""'");
+    }
+    arg1 = (pm3 *)(argp1);
+    {
+        SWIG_PYTHON_THREAD_BEGIN_ALLOW;
+        result = (int)pm3_trace(arg1, arg2, arg3);
+        SWIG_PYTHON_THREAD_END_ALLOW;
+    }
+    resultobj = SWIG_From_int((int)(result));
+    {
+        PyObject *o = Py_None;
+        if (*arg2 != NULL) {
+            o = PyBytes_FromStringAndSize((const char *)*arg2, (Py_ssize_t)*arg3);
+        } else {
+            Py_INCREF(o);
+        }
+        resultobj = SWIG_Python_AppendOutput(resultobj, o);
+    }
+    {
+        pm3_free(*arg2);
+    }
+    return resultobj;
+fail:
+    {
+        pm3_free(*arg2);
+    }
+    return NULL;
+}
+
+
+SWIGINTERN PyObject *_wrap_pm3_mf_chk(PyObject *SWIGUNUSEDPARM(self), PyObject *args) {
+    PyObject *resultobj = 0;
+    pm3 *arg1 = (pm3 *) 0 ;
+    uint8_t arg2 ;
+    uint8_t *arg3 = (uint8_t *) 0 ;
+    size_t arg4 ;
+    char **arg5 = (char **) 0 ;
+    void *argp1 = 0 ;
+    int res1 = 0 ;
+    unsigned char val2 ;
+    int ecode2 = 0 ;
+    char *str5 = NULL ;
+    PyObject *swig_obj[3] ;
+    int result;
+
+    {
+        arg5 = &str5;
+    }
+    if (!SWIG_Python_UnpackTuple(args, "pm3_mf_chk", 3, 3, swig_obj)) SWIG_fail;
+    res1 = SWIG_ConvertPtr(swig_obj[0], &argp1, SWIGTYPE_p_pm3, 0 |  0);
+    if (!SWIG_IsOK(res1)) {
+        SWIG_exception_fail(SWIG_ArgError(res1), "in method '" "pm3_mf_chk" "', argument " "1"" of type '" "pm3 *""'");
+    }
+    arg1 = (pm3 *)(argp1);
+    ecode2 = SWIG_AsVal_unsigned_SS_char(swig_obj[1], &val2);
+    if (!SWIG_IsOK(ecode2)) {
+        SWIG_exception_fail(SWIG_ArgError(ecode2), "in method '" "pm3_mf_chk" "', argument " "2"" of type '" "uint8_t""'");
+    }
+    arg2 = (uint8_t)(val2);
+    {
+        char *buf = NULL;
+        Py_ssize_t len = 0;
+        if (PyBytes_AsStringAndSize(swig_obj[2], &buf, &len) == -1) {
+            SWIG_fail;
+        }
+        arg3 = (uint8_t *)buf;
+        arg4 = (size_t)len;
+    }
+    {
+        SWIG_PYTHON_THREAD_BEGIN_ALLOW;
+        result = (int)pm3_mf_chk(arg1, arg2, (uint8_t const *)arg3, arg4, arg5);
+        SWIG_PYTHON_THREAD_END_ALLOW;
+    }
+    resultobj = SWIG_From_int((int)(result));
+    {
+        resultobj = SWIG_Python_AppendOutput(resultobj, SWIG_FromCharPtr(*arg5));
+    }
+    {
+        pm3_free(*arg5);
+    }
+    return resultobj;
+fail:
+    {
+        pm3_free(*arg5);
+    }
+    return NULL;
+}
+
+
+SWIGINTERN PyObject *_wrap_pm3_mf_dump(PyObject *SWIGUNUSEDPARM(self), PyObject *args) {
+    PyObject *resultobj = 0;
+    pm3 *arg1 = (pm3 *) 0 ;
+    uint8_t arg2 ;
+    uint8_t *arg3 = (uint8_t *) 0 ;
+    size_t arg4 ;
+    uint8_t **arg5 = (uint8_t **) 0 ;
+    size_t *arg6 = (size_t *) 0 ;
+    void *argp1 = 0 ;
+    int res1 = 0 ;
+    unsigned char val2 ;
+    int ecode2 = 0 ;
+    uint8_t *buf5 = NULL ;
+    size_t len5 = 0 ;
+    PyObject *swig_obj[3] ;
+    int result;
+
+    {
+        arg5 = &buf5;
+        arg6 = &len5;
+    }
+    if (!SWIG_Python_UnpackTuple(args, "pm3_mf_dump", 3, 3, swig_obj)) SWIG_fail;
+    res1 = SWIG_ConvertPtr(swig_obj[0], &argp1, SWIGTYPE_p_pm3, 0 |  0);
+    if (!SWIG_IsOK(res1)) {
+        SWIG_exception_fail(SWIG_ArgError(res1), "in method '" "pm3_mf_dump" "', argument " "1"" of type '" "pm3 *""'");
+    }
+    arg1 = (pm3 *)(argp1);
+    ecode2 = SWIG_AsVal_unsigned_SS_char(swig_obj[1], &val2);
+    if (!SWIG_IsOK(ecode2)) {
+        SWIG_exception_fail(SWIG_ArgError(ecode2), "in method '" "pm3_mf_dump" "', argument " "2"" of type '" "uint8_t""'");
+    }
+    arg2 = (uint8_t)(val2);
+    {
+        char *buf = NULL;
+        Py_ssize_t len = 0;
+        if (PyBytes_AsStringAndSize(swig_obj[2], &buf, &len) == -1) {
+            SWIG_fail;
+        }
+        arg3 = (uint8_t *)buf;
+        arg4 = (size_t)len;
+    }
+    {
+        SWIG_PYTHON_THREAD_BEGIN_ALLOW;
+        result = (int)pm3_mf_dump(arg1, arg2, (uint8_t const *)arg3, arg4, arg5, arg6);
+        SWIG_PYTHON_THREAD_END_ALLOW;
+    }
+    resultobj = SWIG_From_int((int)(result));
+    {
+        PyObject *o = Py_None;
+        if (*arg5 != NULL) {
+            o = PyBytes_FromStringAndSize((const char *)*arg5, (Py_ssize_t)*arg6);
+        } else {
+            Py_INCREF(o);
+        }
+        resultobj = SWIG_Python_AppendOutput(resultobj, o);
+    }
+    {
+        pm3_free(*arg5);
+    }
+    return resultobj;
+fail:
+    {
+        pm3_free(*arg5);
+    }
+    return NULL;
+}
+
+
 SWIGINTERN PyObject *_wrap_pm3_name_get(PyObject *SWIGUNUSEDPARM(self), PyObject *args) {
     PyObject *resultobj = 0;
     pm3 *arg1 = (pm3 *) 0 ;
@@ -3005,6 +3503,11 @@ static PyMethodDef SwigMethods[] = {
     { "new_pm3", _wrap_new_pm3, METH_VARARGS, NULL},
     { "delete_pm3", _wrap_delete_pm3, METH_O, NULL},
     { "pm3_console", _wrap_pm3_console, METH_VARARGS, NULL},
+    { "pm3_send", _wrap_pm3_send, METH_VARARGS, NULL},
+    { "pm3_receive", _wrap_pm3_receive, METH_VARARGS, NULL},
+    { "pm3_trace", _wrap_pm3_trace, METH_O, NULL},
+    { "pm3_mf_chk", _wrap_pm3_mf_chk, METH_VARARGS, NULL},
+    { "pm3_mf_dump", _wrap_pm3_mf_dump, METH_VARARGS, NULL},
     { "pm3_name_get", _wrap_pm3_name_get, METH_O, NULL},
     { "pm3_swigregister", pm3_swigregister, METH_O, NULL},
     { "pm3_swiginit", pm3_swiginit, METH_VARARGS, NULL},
@@ -3768,6 +4271,8 @@ SWIG_init(void) {
 
     SWIG_InstallConstants(d, swig_const_table);
 
+    /* Initialize threading */
+    SWIG_PYTHON_INITIALIZE_THREADS;
 #if PY_VERSION_HEX >= 0x03000000
     return m;
 #else
@@ -405,6 +405,7 @@ check_script:
                 // process cmd
                 g_pendingPrompt = false;
                 mainret = CommandReceived(cmd);
+                PrintAndLogFlush();
 
                 // exit or quit
                 if (mainret == PM3_EFATAL)
@@ -767,6 +768,10 @@ int main(int argc, char *argv[]) {
     //   if ((fstat (STDOUT_FILENO, &tmp_stat) == 0) && (S_ISCHR (tmp_stat.st_mode)) && isatty(STDIN_FILENO))
     g_session.stdinOnTTY = isatty(STDIN_FILENO);
     g_session.stdoutOnTTY = isatty(STDOUT_FILENO);
+    // output goes to a file or a pipe, hand it over in large writes
+    if (g_session.stdoutOnTTY == false) {
+        SetBatchedOutput(true);
+    }
     g_session.supports_colors = false;
     g_session.emoji_mode = EMO_ALTTEXT;
     if (g_session.stdinOnTTY && g_session.stdoutOnTTY) {
@@ -74,8 +74,9 @@ bool uart_set_speed(serial_port sp, const uint32_t uiPortSpeed);
  */
 uint32_t uart_get_speed(const serial_port sp);
 
-/* Reconfigure timeouts
+/* Reconfigure the receive timeout of the port, in ms.
+ * Takes effect on the next uart_receive, so it is safe while another thread polls the port.
  */
-int uart_reconfigure_timeouts(uint32_t value);
+int uart_reconfigure_timeouts(serial_port sp, uint32_t value);
 #endif // _UART_H_
 
@@ -52,20 +52,15 @@ typedef struct {
     int fd;           // Serial port file descriptor
     term_info tiOld;  // Terminal info before using the port
     term_info tiNew;  // Terminal info during the transaction
+    struct timeval timeout;     // see pm3_cmd.h
+    uint32_t newtimeout_value;  // applied by the next uart_receive, on the thread that polls the port
+    bool newtimeout_pending;
 } serial_port_unix_t_t;
 
-// see pm3_cmd.h
-struct timeval timeout = {
-    .tv_sec  = 0, // 0 second
-    .tv_usec = UART_FPC_CLIENT_RX_TIMEOUT_MS * 1000
-};
-
-static uint32_t newtimeout_value = 0;
-static bool newtimeout_pending = false;
-
-int uart_reconfigure_timeouts(uint32_t value) {
-    newtimeout_value = value;
-    newtimeout_pending = true;
+int uart_reconfigure_timeouts(serial_port sp, uint32_t value) {
+    serial_port_unix_t_t *spu = (serial_port_unix_t_t *)sp;
+    spu->newtimeout_value = value;
+    __atomic_store_n(&spu->newtimeout_pending, true, __ATOMIC_SEQ_CST);
     return PM3_SUCCESS;
 }
 
@@ -78,7 +73,8 @@ serial_port uart_open(const char *pcPortName, uint32_t speed) {
     }
 
     // init timeouts
-    timeout.tv_usec = UART_FPC_CLIENT_RX_TIMEOUT_MS * 1000;
+    sp->timeout.tv_sec = 0;
+    sp->timeout.tv_usec = UART_FPC_CLIENT_RX_TIMEOUT_MS * 1000;
 
     char *prefix = strdup(pcPortName);
     if (prefix == NULL) {
@@ -105,7 +101,7 @@ serial_port uart_open(const char *pcPortName, uint32_t speed) {
             return INVALID_SERIAL_PORT;
         }
 
-        timeout.tv_usec = UART_TCP_CLIENT_RX_TIMEOUT_MS * 1000;
+        sp->timeout.tv_usec = UART_TCP_CLIENT_RX_TIMEOUT_MS * 1000;
 
         char *colon = strrchr(addrstr, ':');
         const char *portstr;
@@ -225,7 +221,7 @@ serial_port uart_open(const char *pcPortName, uint32_t speed) {
         }
 
         // we must use max timeout!
-        timeout.tv_usec = UART_TCP_CLIENT_RX_TIMEOUT_MS * 1000;
+        sp->timeout.tv_usec = UART_TCP_CLIENT_RX_TIMEOUT_MS * 1000;
 
         size_t servernameLen = (strlen(pcPortName) - 7) + 1;
         char serverNameBuf[servernameLen];
@@ -351,9 +347,9 @@ int uart_receive(const serial_port sp, uint8_t *pbtRx, uint32_t pszMaxRxLen, uin
     fd_set rfds;
     struct timeval tv;
 
-    if (newtimeout_pending) {
-        timeout.tv_usec = newtimeout_value * 1000;
-        newtimeout_pending = false;
+    serial_port_unix_t_t *spu = (serial_port_unix_t_t *)sp;
+    if (__atomic_exchange_n(&spu->newtimeout_pending, false, __ATOMIC_SEQ_CST)) {
+        spu->timeout.tv_usec = spu->newtimeout_value * 1000;
     }
     // Reset the output count
     *pszRxLen = 0;
@@ -361,7 +357,7 @@ int uart_receive(const serial_port sp, uint8_t *pbtRx, uint32_t pszMaxRxLen, uin
         // Reset file descriptor
         FD_ZERO(&rfds);
         FD_SET(((serial_port_unix_t_t *)sp)->fd, &rfds);
-        tv = timeout;
+        tv = ((serial_port_unix_t_t *)sp)->timeout;
         int res = select(((serial_port_unix_t_t *)sp)->fd + 1, &rfds, NULL, NULL, &tv);
 
         // Read error
@@ -419,7 +415,7 @@ int uart_send(const serial_port sp, const uint8_t *pbtTx, const uint32_t len) {
         // Reset file descriptor
         FD_ZERO(&rfds);
         FD_SET(((serial_port_unix_t_t *)sp)->fd, &rfds);
-        tv = timeout;
+        tv = ((serial_port_unix_t_t *)sp)->timeout;
         int res = select(((serial_port_unix_t_t *)sp)->fd + 1, NULL, &rfds, NULL, &tv);
 
         // Write error
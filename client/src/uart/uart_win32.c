@@ -37,34 +37,28 @@ typedef struct {
     DCB dcb;          // Device control settings
     COMMTIMEOUTS ct;  // Serial port time-out configuration
     SOCKET hSocket;   // Socket handle
+    struct timeval timeout;     // this is for TCP connection
+    uint32_t newtimeout_value;  // applied by the next uart_receive, on the thread that polls the port
+    bool newtimeout_pending;
 } serial_port_windows_t;
 
-// this is for TCP connection
-struct timeval timeout = {
-    .tv_sec  = 0, // 0 second
-    .tv_usec = UART_TCP_CLIENT_RX_TIMEOUT_MS * 1000
-};
-
-uint32_t newtimeout_value = 0;
-bool newtimeout_pending = false;
-
-int uart_reconfigure_timeouts(uint32_t value) {
-    newtimeout_value = value;
-    newtimeout_pending = true;
+int uart_reconfigure_timeouts(serial_port sp, uint32_t value) {
+    serial_port_windows_t *spw = (serial_port_windows_t *)sp;
+    spw->newtimeout_value = value;
+    __atomic_store_n(&spw->newtimeout_pending, true, __ATOMIC_SEQ_CST);
     return PM3_SUCCESS;
 }
 
 static int uart_reconfigure_timeouts_polling(serial_port sp) {
-    if (newtimeout_pending == false)
-        return PM3_SUCCESS;
-    newtimeout_pending = false;
-
     serial_port_windows_t *spw;
     spw = (serial_port_windows_t *)sp;
-    spw->ct.ReadIntervalTimeout         = newtimeout_value;
+    if (__atomic_exchange_n(&spw->newtimeout_pending, false, __ATOMIC_SEQ_CST) == false)
+        return PM3_SUCCESS;
+
+    spw->ct.ReadIntervalTimeout         = spw->newtimeout_value;
     spw->ct.ReadTotalTimeoutMultiplier  = 0;
-    spw->ct.ReadTotalTimeoutConstant    = newtimeout_value;
-    spw->ct.WriteTotalTimeoutMultiplier = newtimeout_value;
+    spw->ct.ReadTotalTimeoutConstant    = spw->newtimeout_value;
+    spw->ct.WriteTotalTimeoutMultiplier = spw->newtimeout_value;
     spw->ct.WriteTotalTimeoutConstant   = 0;
 
     if (!SetCommTimeouts(spw->hPort, &spw->ct)) {
@@ -79,12 +73,13 @@ static int uart_reconfigure_timeouts_polling(serial_port sp) {
 serial_port uart_open(const char *pcPortName, uint32_t speed) {
     char acPortName[255] = {0};
     serial_port_windows_t *sp = calloc(sizeof(serial_port_windows_t), sizeof(uint8_t));
-    sp->hSocket = INVALID_SOCKET; // default: serial port
-
     if (sp == 0) {
         PrintAndLogEx(WARNING, "UART failed to allocate memory\n");
         return INVALID_SERIAL_PORT;
     }
+    sp->hSocket = INVALID_SOCKET; // default: serial port
+    sp->timeout.tv_sec = 0;
+    sp->timeout.tv_usec = UART_TCP_CLIENT_RX_TIMEOUT_MS * 1000;
 
     char *prefix = strdup(pcPortName);
     if (prefix == NULL) {
@@ -111,8 +106,6 @@ serial_port uart_open(const char *pcPortName, uint32_t speed) {
             return INVALID_SERIAL_PORT;
         }
 
-        timeout.tv_usec = UART_TCP_CLIENT_RX_TIMEOUT_MS * 1000;
-
         char *colon = strrchr(addrstr, ':');
         const char *portstr;
         if (colon) {
@@ -213,7 +206,7 @@ serial_port uart_open(const char *pcPortName, uint32_t speed) {
         return INVALID_SERIAL_PORT;
     }
 
-    uart_reconfigure_timeouts(UART_FPC_CLIENT_RX_TIMEOUT_MS);
+    uart_reconfigure_timeouts(sp, UART_FPC_CLIENT_RX_TIMEOUT_MS);
     uart_reconfigure_timeouts_polling(sp);
 
     if (!uart_set_speed(sp, speed)) {
@@ -300,9 +293,8 @@ int uart_receive(const serial_port sp, uint8_t *pbtRx, uint32_t pszMaxRxLen, uin
         fd_set rfds;
         struct timeval tv;
 
-        if (newtimeout_pending) {
-            timeout.tv_usec = newtimeout_value * 1000;
-            newtimeout_pending = false;
+        if (__atomic_exchange_n(&spw->newtimeout_pending, false, __ATOMIC_SEQ_CST)) {
+            spw->timeout.tv_usec = spw->newtimeout_value * 1000;
         }
         // Reset the output count
         *pszRxLen = 0;
@@ -310,7 +302,7 @@ int uart_receive(const serial_port sp, uint8_t *pbtRx, uint32_t pszMaxRxLen, uin
             // Reset file descriptor
             FD_ZERO(&rfds);
             FD_SET(spw->hSocket, &rfds);
-            tv = timeout;
+            tv = spw->timeout;
             // the first argument nfds is ignored in Windows
             int res = select(0, &rfds, NULL, NULL, &tv);
 
@@ -384,7 +376,7 @@ int uart_send(const serial_port sp, const uint8_t *p_tx, const uint32_t len) {
             // Reset file descriptor
             FD_ZERO(&wfds);
             FD_SET(spw->hSocket, &wfds);
-            tv = timeout;
+            tv = spw->timeout;
             // the first argument nfds is ignored in Windows
             int res = select(0, NULL, &wfds, NULL, &tv);
 
@@ -61,6 +61,26 @@ pthread_mutex_t g_print_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static void fPrintAndLog(FILE *stream, const char *fmt, ...);
 
+static FILE *logfile = NULL;
+static int logging = 1;
+
+// Batched output.
+// When stdout is not a terminal, lines are left in a large stdio buffer and the
+// log file is no longer flushed per line. Everything else printing to stdout
+// (printf, argtable, scripts) goes through the same FILE, so the output keeps the
+// order it was printed in. A writer thread flushes stdout and the log file
+// PRINT_BATCH_INTERVAL_MS after a line was printed, so slow commands still show
+// their progress.
+#define PRINT_BATCH_SIZE          (64 * 1024)
+#define PRINT_BATCH_INTERVAL_MS   50
+
+// guarded by g_print_lock
+static bool batch_enabled = false;
+static bool batch_pending = false;
+static pthread_t batch_thread;
+static pthread_cond_t batch_cond = PTHREAD_COND_INITIALIZER;
+static char batch_stdout_buf[PRINT_BATCH_SIZE];
+
 #ifdef _WIN32
 #define MKDIR_CHK _mkdir(path)
 #else
@@ -191,8 +211,22 @@ void PrintAndLogOptions(const char *str[][2], size_t size, size_t space) {
 
 static uint8_t PrintAndLogEx_spinidx = 0;
 
+// per thread,  structured libpm3 calls don't want any output and shouldn't pay for formatting it
+static _Thread_local bool quiet_output = false;
+
+void SetQuietOutput(bool value) {
+    quiet_output = value;
+}
+
+bool GetQuietOutput(void) {
+    return quiet_output;
+}
+
 void PrintAndLogEx(logLevel_t level, const char *fmt, ...) {
 
+    if (quiet_output)
+        return;
+
     // skip debug messages if client debugging is turned off i.e. 'DATA SETDEBUG -0'
     if (g_debugMode == 0 && level == DEBUG)
         return;
@@ -202,8 +236,10 @@ void PrintAndLogEx(logLevel_t level, const char *fmt, ...) {
         return;
 
     char prefix[40] = {0};
-    char buffer[MAX_PRINT_BUFFER] = {0};
-    char buffer2[MAX_PRINT_BUFFER + sizeof(prefix)] = {0};
+    // per thread, no need to clear a few kB on every call
+    static _Thread_local char buffer[MAX_PRINT_BUFFER];
+    static _Thread_local char buffer2[MAX_PRINT_BUFFER + sizeof(prefix)];
+    buffer2[0] = '\0';
     char *token = NULL;
     char *tmp_ptr = NULL;
     FILE *stream = stdout;
@@ -299,8 +335,8 @@ void PrintAndLogEx(logLevel_t level, const char *fmt, ...) {
         if (level == INPLACE) {
             char buffer3[sizeof(buffer2)] = {0};
             char buffer4[sizeof(buffer2)] = {0};
-            memcpy_filter_ansi(buffer3, buffer2, sizeof(buffer2), !g_session.supports_colors);
-            memcpy_filter_emoji(buffer4, buffer3, sizeof(buffer3), g_session.emoji_mode);
+            memcpy_filter_ansi(buffer3, buffer2, strlen(buffer2) + 1, !g_session.supports_colors);
+            memcpy_filter_emoji(buffer4, buffer3, strlen(buffer3) + 1, g_session.emoji_mode);
             fprintf(stream, "\r%s", buffer4);
             fflush(stream);
         } else {
@@ -309,17 +345,100 @@ void PrintAndLogEx(logLevel_t level, const char *fmt, ...) {
     }
 }
 
-static void fPrintAndLog(FILE *stream, const char *fmt, ...) {
-    va_list argptr;
-    static FILE *logfile = NULL;
-    static int logging = 1;
-    char buffer[MAX_PRINT_BUFFER] = {0};
-    char buffer2[MAX_PRINT_BUFFER] = {0};
-    char buffer3[MAX_PRINT_BUFFER] = {0};
-    // lock this section to avoid interlacing prints from different threads
+// caller holds g_print_lock
+static void print_batch_flush(void) {
+    fflush(stdout);
+    if (logfile) {
+        fflush(logfile);
+    }
+    batch_pending = false;
+}
+
+// hands everything pending to the OS, must not be called with g_print_lock held
+void PrintAndLogFlush(void) {
     pthread_mutex_lock(&g_print_lock);
-    bool linefeed = true;
+    print_batch_flush();
+    pthread_mutex_unlock(&g_print_lock);
+}
+
+static void *print_batch_writer(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&g_print_lock);
+    while (batch_enabled) {
+        if (batch_pending == false) {
+            pthread_cond_wait(&batch_cond, &g_print_lock);
+            continue;
+        }
+
+        // give more lines a chance to join
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += PRINT_BATCH_INTERVAL_MS * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&batch_cond, &g_print_lock, &ts);
+
+        print_batch_flush();
+    }
+    pthread_mutex_unlock(&g_print_lock);
+    return NULL;
+}
+
+static void print_batch_atexit(void) {
+    SetBatchedOutput(false);
+}
+
+// must be called before anything is printed to stdout
+void SetBatchedOutput(bool value) {
+    static bool buffer_set = false;
+    static bool atexit_set = false;
+
+    if (value == GetBatchedOutput()) {
+        return;
+    }
+
+    if (value) {
+        if (buffer_set == false) {
+            if (setvbuf(stdout, batch_stdout_buf, _IOFBF, sizeof(batch_stdout_buf)) != 0) {
+                PrintAndLogEx(WARNING, "Failed to set the output buffer, batched output disabled");
+                return;
+            }
+            buffer_set = true;
+        }
+        if (atexit_set == false) {
+            atexit(print_batch_atexit);
+            atexit_set = true;
+        }
+        pthread_mutex_lock(&g_print_lock);
+        batch_enabled = true;
+        if (pthread_create(&batch_thread, NULL, print_batch_writer, NULL) != 0) {
+            batch_enabled = false;
+        }
+        pthread_mutex_unlock(&g_print_lock);
+        if (GetBatchedOutput() == false) {
+            PrintAndLogEx(WARNING, "Failed to start the output writer, batched output disabled");
+        }
+    } else {
+        pthread_mutex_lock(&g_print_lock);
+        batch_enabled = false;
+        pthread_cond_signal(&batch_cond);
+        pthread_mutex_unlock(&g_print_lock);
+        pthread_join(batch_thread, NULL);
+        PrintAndLogFlush();
+    }
+}
+
+bool GetBatchedOutput(void) {
+    pthread_mutex_lock(&g_print_lock);
+    bool res = batch_enabled;
+    pthread_mutex_unlock(&g_print_lock);
+    return res;
+}
 
+// caller holds g_print_lock
+static void print_open_logfile(void) {
     if (logging && g_session.incognito) {
         logging = 0;
     }
@@ -351,7 +470,57 @@ static void fPrintAndLog(FILE *stream, const char *fmt, ...) {
             free(my_logfile_path);
         }
     }
+}
+
+static void fPrintAndLog(FILE *stream, const char *fmt, ...) {
+    va_list argptr;
+    // per thread, lines are formatted and filtered before taking the print lock
+    static _Thread_local char buffer[MAX_PRINT_BUFFER];
+    static _Thread_local char buffer2[MAX_PRINT_BUFFER];
+    static _Thread_local char buffer3[MAX_PRINT_BUFFER];
+    static _Thread_local char buffer4[MAX_PRINT_BUFFER];
+    bool linefeed = true;
 
+    va_start(argptr, fmt);
+    vsnprintf(buffer, sizeof(buffer), fmt, argptr);
+    va_end(argptr);
+    size_t len = strlen(buffer);
+    if (len > 0 && buffer[len - 1] == NOLF[0]) {
+        linefeed = false;
+        buffer[--len] = 0;
+    }
+
+    // filters only need to see the string, not the whole buffer
+    bool filter_ansi = !g_session.supports_colors;
+    memcpy_filter_ansi(buffer2, buffer, len + 1, filter_ansi);
+    size_t len2 = strlen(buffer2);
+
+    const char *print_text = NULL;
+    if (g_printAndLog & PRINTANDLOG_PRINT) {
+        memcpy_filter_emoji(buffer3, buffer2, len2 + 1, g_session.emoji_mode);
+        print_text = buffer3;
+    }
+
+    const char *log_text = NULL;
+    if ((g_printAndLog & PRINTANDLOG_LOG) && logging) {
+        memcpy_filter_emoji(buffer4, buffer2, len2 + 1, EMO_ALTTEXT);
+        if (filter_ansi) { // already done
+            log_text = buffer4;
+        } else {
+            memcpy_filter_ansi(buffer, buffer4, strlen(buffer4) + 1, true);
+            log_text = buffer;
+        }
+    }
+
+    // lock this section to avoid interlacing prints from different threads
+    pthread_mutex_lock(&g_print_lock);
+
+    print_open_logfile();
+
+    // stderr is unbuffered, whatever stdout still holds goes first
+    if (batch_enabled && stream != stdout) {
+        print_batch_flush();
+    }
 
 // If there is an incoming message from the hardware (eg: lf hid read) in
 // the background (while the prompt is displayed and accepting user input),
@@ -371,18 +540,8 @@ static void fPrintAndLog(FILE *stream, const char *fmt, ...) {
     }
 #endif
 
-    va_start(argptr, fmt);
-    vsnprintf(buffer, sizeof(buffer), fmt, argptr);
-    va_end(argptr);
-    if (strlen(buffer) > 0 && buffer[strlen(buffer) - 1] == NOLF[0]) {
-        linefeed = false;
-        buffer[strlen(buffer) - 1] = 0;
-    }
-    bool filter_ansi = !g_session.supports_colors;
-    memcpy_filter_ansi(buffer2, buffer, sizeof(buffer), filter_ansi);
-    if (g_printAndLog & PRINTANDLOG_PRINT) {
-        memcpy_filter_emoji(buffer3, buffer2, sizeof(buffer2), g_session.emoji_mode);
-        fprintf(stream, "%s", buffer3);
+    if (print_text) {
+        fprintf(stream, "%s", print_text);
         if (linefeed)
             fprintf(stream, "\n");
     }
@@ -398,22 +557,23 @@ static void fPrintAndLog(FILE *stream, const char *fmt, ...) {
     }
 #endif
 
-    if ((g_printAndLog & PRINTANDLOG_LOG) && logging && logfile) {
-        memcpy_filter_emoji(buffer3, buffer2, sizeof(buffer2), EMO_ALTTEXT);
-        if (filter_ansi) { // already done
-            fprintf(logfile, "%s", buffer3);
-        } else {
-            memcpy_filter_ansi(buffer, buffer3, sizeof(buffer3), true);
-            fprintf(logfile, "%s", buffer);
-        }
+    if (log_text && logging && logfile) {
+        fprintf(logfile, "%s", log_text);
         if (linefeed)
             fprintf(logfile, "\n");
-        fflush(logfile);
+        if (batch_enabled == false)
+            fflush(logfile);
     }
 
     if (flushAfterWrite)
         fflush(stdout);
 
+    // wake the writer to start its interval
+    if (batch_enabled && batch_pending == false) {
+        batch_pending = true;
+        pthread_cond_signal(&batch_cond);
+    }
+
     //release lock
     pthread_mutex_unlock(&g_print_lock);
 }
@@ -476,42 +636,94 @@ void memcpy_filter_ansi(void *dest, const void *src, size_t n, bool filter) {
     }
 }
 
+// EmojiTable and EmojiAltTable index by alias, open addressing, built on first use
+#define EMOJI_HASH_BITS 12
+typedef struct {
+    const char *alias;
+    int16_t emoji;      // first EmojiTable entry with this alias, -1 if none
+    int16_t alttext;    // first EmojiAltTable entry with this alias, -1 if none
+} emoji_slot_t;
+static emoji_slot_t emoji_hash[1 << EMOJI_HASH_BITS];
+static pthread_once_t emoji_hash_once = PTHREAD_ONCE_INIT;
+
+static uint32_t emoji_hash_str(const char *s, size_t len) {
+    // FNV-1a
+    uint32_t h = 0x811C9DC5;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (uint8_t)s[i]) * 0x01000193;
+    }
+    return h;
+}
+
+// slot of alias, or the free slot where it goes
+static emoji_slot_t *emoji_slot(const char *token, size_t token_length) {
+    const uint32_t mask = (1 << EMOJI_HASH_BITS) - 1;
+    uint32_t h = emoji_hash_str(token, token_length) & mask;
+    while (emoji_hash[h].alias) {
+        if ((strlen(emoji_hash[h].alias) == token_length) && (0 == memcmp(emoji_hash[h].alias, token, token_length))) {
+            break;
+        }
+        h = (h + 1) & mask;
+    }
+    return &emoji_hash[h];
+}
+
+static void emoji_hash_add(const char *alias, int16_t emoji, int16_t alttext) {
+    emoji_slot_t *slot = emoji_slot(alias, strlen(alias));
+    if (slot->alias == NULL) {
+        slot->alias = alias;
+        slot->emoji = -1;
+        slot->alttext = -1;
+    }
+    if (slot->emoji < 0) {
+        slot->emoji = emoji;
+    }
+    if (slot->alttext < 0) {
+        slot->alttext = alttext;
+    }
+}
+
+static void emoji_hash_init(void) {
+    // at most half full
+    int n = 0;
+    for (int i = 0; EmojiTable[i].alias && EmojiTable[i].emoji && n < (1 << (EMOJI_HASH_BITS - 1)); i++, n++) {
+        emoji_hash_add(EmojiTable[i].alias, i, -1);
+    }
+    for (int i = 0; EmojiAltTable[i].alias && EmojiAltTable[i].alttext && n < (1 << (EMOJI_HASH_BITS - 1)); i++, n++) {
+        emoji_hash_add(EmojiAltTable[i].alias, -1, i);
+    }
+}
+
 static bool emojify_token(const char *token, uint8_t token_length, const char **emojified_token, uint8_t *emojified_token_length, emojiMode_t mode) {
-    int i = 0;
-    while (EmojiTable[i].alias && EmojiTable[i].emoji) {
-        if ((strlen(EmojiTable[i].alias) == token_length) && (0 == memcmp(EmojiTable[i].alias, token, token_length))) {
-            switch (mode) {
-                case EMO_EMOJI: {
-                    *emojified_token = EmojiTable[i].emoji;
-                    *emojified_token_length = strlen(EmojiTable[i].emoji);
-                    break;
-                }
-                case EMO_ALTTEXT: {
-                    int j = 0;
-                    *emojified_token_length = 0;
-                    while (EmojiAltTable[j].alias && EmojiAltTable[j].alttext) {
-                        if ((strlen(EmojiAltTable[j].alias) == token_length) && (0 == memcmp(EmojiAltTable[j].alias, token, token_length))) {
-                            *emojified_token = EmojiAltTable[j].alttext;
-                            *emojified_token_length = strlen(EmojiAltTable[j].alttext);
-                            break;
-                        }
-                        ++j;
-                    }
-                    break;
-                }
-                case EMO_NONE: {
-                    *emojified_token_length = 0;
-                    break;
-                }
-                case EMO_ALIAS: { // should never happen
-                    return false;
-                }
+    pthread_once(&emoji_hash_once, emoji_hash_init);
+    const emoji_slot_t *slot = emoji_slot(token, token_length);
+    if (slot->alias == NULL || slot->emoji < 0) {
+        return false;
+    }
+
+    switch (mode) {
+        case EMO_EMOJI: {
+            *emojified_token = EmojiTable[slot->emoji].emoji;
+            *emojified_token_length = strlen(EmojiTable[slot->emoji].emoji);
+            break;
+        }
+        case EMO_ALTTEXT: {
+            *emojified_token_length = 0;
+            if (slot->alttext >= 0) {
+                *emojified_token = EmojiAltTable[slot->alttext].alttext;
+                *emojified_token_length = strlen(EmojiAltTable[slot->alttext].alttext);
             }
-            return true;
+            break;
+        }
+        case EMO_NONE: {
+            *emojified_token_length = 0;
+            break;
+        }
+        case EMO_ALIAS: { // should never happen
+            return false;
         }
-        ++i;
     }
-    return false;
+    return true;
 }
 
 static bool token_charset(uint8_t c) {
@@ -75,6 +75,11 @@ void PrintAndLogOptions(const char *str[][2], size_t size, size_t space);
 void PrintAndLogEx(logLevel_t level, const char *fmt, ...);
 void SetFlushAfterWrite(bool value);
 bool GetFlushAfterWrite(void);
+void SetBatchedOutput(bool value);
+bool GetBatchedOutput(void);
+void PrintAndLogFlush(void);
+void SetQuietOutput(bool value);
+bool GetQuietOutput(void);
 void memcpy_filter_ansi(void *dest, const void *src, size_t n, bool filter);
 void memcpy_filter_rlmarkers(void *dest, const void *src, size_t n);
 void memcpy_filter_emoji(void *dest, const void *src, size_t n, emojiMode_t mode);
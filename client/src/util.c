@@ -1067,6 +1067,18 @@ uint64_t HornerScheme(uint64_t num, uint64_t divider, uint64_t factor) {
     return result;
 }
 
+// 64x64 bit matrix transpose, afterwards bit l of a[p] is bit p of the former a[l]
+void transpose64(uint64_t a[64]) {
+    uint64_t m = 0x00000000FFFFFFFFULL;
+    for (int j = 32; j; j >>= 1, m ^= m << j) {
+        for (int k = 0; k < 64; k = ((k | j) + 1) & ~j) {
+            uint64_t t = ((a[k] >> j) ^ a[k | j]) & m;
+            a[k | j] ^= t;
+            a[k] ^= t << j;
+        }
+    }
+}
+
 // determine number of logical CPU cores (use for multithreaded functions)
 int num_CPUs(void) {
 #if defined(_WIN32)
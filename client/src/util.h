@@ -126,6 +126,8 @@ void wiegand_add_parity_swapped(uint8_t *target, uint8_t *source, uint8_t length
 uint32_t PackBits(uint8_t start, uint8_t len, const uint8_t *bits);
 uint64_t HornerScheme(uint64_t num, uint64_t divider, uint64_t factor);
 
+void transpose64(uint64_t a[64]); // 64x64 bit matrix transpose, bit l of a[p] <-> bit p of a[l]
+
 int num_CPUs(void); // number of logical CPUs
 
 void str_lower(char *s); // converts string to lower case
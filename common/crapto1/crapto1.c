@@ -19,6 +19,7 @@
 #include "bucketsort.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include "parity.h"
 
 #if !defined LOWMEM && defined __GNUC__
@@ -77,13 +78,60 @@ static inline void extend_table_simple(uint32_t *tbl, uint32_t **end, int bit) {
         }
     }
 }
+/** sort_intersect
+ * bucket_sort_intersect on the most significant byte, with the buckets laid out back to back in
+ * one scratch table per list (sort[0] even, sort[1] odd) instead of 0x100 buckets of fixed size.
+ * The scratch tables only need to hold the lists.  Same result as bucket_sort_intersect: the
+ * intersecting buckets are written back in ascending order.
+ */
+static void sort_intersect(uint32_t *const e_head, uint32_t *const e_tail,
+                           uint32_t *const o_head, uint32_t *const o_tail,
+                           bucket_info_t *bucket_info, uint32_t *const sort[2]) {
+    uint32_t *const head[2] = {e_head, o_head};
+    uint32_t *const tail[2] = {e_tail, o_tail};
+    uint32_t count[2][0x100] = {{0}};
+    uint32_t start[2][0x100];
+
+    for (int i = 0; i < 2; i++) {
+        for (uint32_t *p = head[i]; p <= tail[i]; p++)
+            count[i][*p >> 24]++;
+
+        uint32_t pos = 0;
+        for (int j = 0; j < 0x100; j++) {
+            start[i][j] = pos;
+            pos += count[i][j];
+        }
+
+        uint32_t next[0x100];
+        memcpy(next, start[i], sizeof(next));
+        for (uint32_t *p = head[i]; p <= tail[i]; p++)
+            sort[i][next[*p >> 24]++] = *p;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        uint32_t *p = head[i];
+        uint32_t n = 0;
+        for (int j = 0; j < 0x100; j++) {
+            if (count[0][j] == 0 || count[1][j] == 0)
+                continue;
+
+            bucket_info->bucket_info[i][n].head = p;
+            memcpy(p, sort[i] + start[i][j], count[i][j] * sizeof(uint32_t));
+            p += count[i][j];
+            bucket_info->bucket_info[i][n].tail = p - 1;
+            n++;
+        }
+        bucket_info->numbuckets = n;
+    }
+}
+
 /** recover
  * recursively narrow down the search space, 4 bits of keystream at a time
  */
 static struct Crypto1State *
 recover(uint32_t *o_head, uint32_t *o_tail, uint32_t oks,
         uint32_t *e_head, uint32_t *e_tail, uint32_t eks, int rem,
-        struct Crypto1State *sl, uint32_t in, bucket_array_t bucket) {
+        struct Crypto1State *sl, uint32_t in, uint32_t *const sort[2]) {
     bucket_info_t bucket_info;
 
     if (rem == -1) {
@@ -111,12 +159,12 @@ recover(uint32_t *o_head, uint32_t *o_tail, uint32_t oks,
             return sl;
     }
 
-    bucket_sort_intersect(e_head, e_tail, o_head, o_tail, &bucket_info, bucket);
+    sort_intersect(e_head, e_tail, o_head, o_tail, &bucket_info, sort);
 
     for (int i = bucket_info.numbuckets - 1; i >= 0; i--) {
         sl = recover(bucket_info.bucket_info[1][i].head, bucket_info.bucket_info[1][i].tail, oks,
                      bucket_info.bucket_info[0][i].head, bucket_info.bucket_info[0][i].tail, eks,
-                     rem, sl, in, bucket);
+                     rem, sl, in, sort);
     }
 
     return sl;
@@ -124,46 +172,129 @@ recover(uint32_t *o_head, uint32_t *o_tail, uint32_t oks,
 
 
 #if !defined(__arm__) || defined(__linux__) || defined(_WIN32) || defined(__APPLE__) // bare metal ARM Proxmark lacks malloc()/free()
-/** lfsr_recovery
- * recover the state of the lfsr given 32 bits of the keystream
- * additionally you can use the in parameter to specify the value
- * that was fed into the lfsr at the time the keystream was generated
+/** lfsr_recovery32_ws
+ * per thread working memory for lfsr_recovery32_part / lfsr_recovery32_into: private copies of the
+ * odd and even tables the parts are extended in (parts grow while being extended, so they can't be
+ * worked on in place) and the scratch tables of sort_intersect, all of the same size.
+ * lfsr_recovery32_into also builds its odd and even tables in here, instead of allocating a split.
  */
-struct Crypto1State *lfsr_recovery32(uint32_t ks2, uint32_t in) {
-    struct Crypto1State *statelist;
-    uint32_t *odd_head = 0, *odd_tail = 0, oks = 0;
-    uint32_t *even_head = 0, *even_tail = 0, eks = 0;
+struct lfsr_recovery32_ws {
+    uint32_t size;              // entries of odd, even and sort[]
+    uint32_t *odd;
+    uint32_t *even;
+    uint32_t *sort[2];
+    uint32_t *split_odd;
+    uint32_t *split_even;
+};
+
+// the tables of lfsr_recovery32 (and of a split) never hold more than this
+#define RECOVERY32_TABLE_SIZE   (1 << 21)
+// a part still goes through 7 extend_table steps, each of them at most doubles it
+#define RECOVERY32_PART_GROWTH  (1 << 7)
+
+static lfsr_recovery32_ws_t *ws_alloc(uint32_t size) {
+    lfsr_recovery32_ws_t *ws = calloc(1, sizeof(lfsr_recovery32_ws_t));
+    if (ws == NULL)
+        return NULL;
+
+    ws->size = size;
+    ws->odd = calloc(size, sizeof(uint32_t));
+    ws->even = calloc(size, sizeof(uint32_t));
+    ws->sort[0] = calloc(size, sizeof(uint32_t));
+    ws->sort[1] = calloc(size, sizeof(uint32_t));
+    if (!ws->odd || !ws->even || !ws->sort[0] || !ws->sort[1]) {
+        lfsr_recovery32_ws_free(ws);
+        return NULL;
+    }
+    return ws;
+}
+
+lfsr_recovery32_ws_t *lfsr_recovery32_ws_alloc(void) {
+    return ws_alloc(RECOVERY32_TABLE_SIZE);
+}
+
+/** lfsr_recovery32_ws_alloc_parts
+ * workspace for lfsr_recovery32_part only, sized for the largest part of the given splits.
+ * Parts are a small fraction of the full tables, so this is much smaller than lfsr_recovery32_ws_alloc.
+ */
+lfsr_recovery32_ws_t *lfsr_recovery32_ws_alloc_parts(const lfsr_split_t *splits, uint32_t numsplits) {
+    uint32_t largest = 1;
+    for (uint32_t s = 0; s < numsplits; s++) {
+        for (uint32_t i = 0; i < splits[s].numparts; i++) {
+            uint32_t on = splits[s].part[i].o_tail - splits[s].part[i].o_head + 1;
+            uint32_t en = splits[s].part[i].e_tail - splits[s].part[i].e_head + 1;
+            if (on > largest)
+                largest = on;
+            if (en > largest)
+                largest = en;
+        }
+    }
+
+    uint32_t size = RECOVERY32_TABLE_SIZE;
+    if (largest < RECOVERY32_TABLE_SIZE / RECOVERY32_PART_GROWTH)
+        size = largest * RECOVERY32_PART_GROWTH;
+    return ws_alloc(size);
+}
+
+void lfsr_recovery32_ws_free(lfsr_recovery32_ws_t *ws) {
+    if (ws == NULL)
+        return;
+
+    free(ws->odd);
+    free(ws->even);
+    free(ws->sort[0]);
+    free(ws->sort[1]);
+    free(ws->split_odd);
+    free(ws->split_even);
+    free(ws);
+}
+
+static void split_tables(uint32_t ks2, uint32_t in, lfsr_split_t *split, uint32_t *odd, uint32_t *even, uint32_t *const sort[2]);
+
+/** lfsr_recovery32_split
+ * first stage of lfsr_recovery32.
+ * Builds the odd and even tables from the keystream, does the first narrowing step and
+ * splits the tables into independent (odd, even) parts. The tables are read-only afterwards,
+ * so parts can be handed to lfsr_recovery32_part from different threads.
+ * returns false on memory allocation failure. split->numparts may be zero.
+ */
+bool lfsr_recovery32_split(uint32_t ks2, uint32_t in, lfsr_split_t *split) {
+    split->numparts = 0;
+    split->odd = calloc(RECOVERY32_TABLE_SIZE, sizeof(uint32_t));
+    split->even = calloc(RECOVERY32_TABLE_SIZE, sizeof(uint32_t));
+    uint32_t *sort[2] = {
+        calloc(RECOVERY32_TABLE_SIZE, sizeof(uint32_t)),
+        calloc(RECOVERY32_TABLE_SIZE, sizeof(uint32_t))
+    };
+    bool ok = split->odd && split->even && sort[0] && sort[1];
+    if (ok)
+        split_tables(ks2, in, split, split->odd, split->even, sort);
+    else
+        lfsr_recovery32_split_free(split);
+
+    free(sort[0]);
+    free(sort[1]);
+    return ok;
+}
+
+/** split_tables
+ * body of lfsr_recovery32_split, the odd and even tables and the sort scratch tables
+ * (RECOVERY32_TABLE_SIZE entries each) are given by the caller
+ */
+static void split_tables(uint32_t ks2, uint32_t in, lfsr_split_t *split, uint32_t *odd, uint32_t *even, uint32_t *const sort[2]) {
+    uint32_t *odd_head = odd, *odd_tail = odd - 1, oks = 0;
+    uint32_t *even_head = even, *even_tail = even - 1, eks = 0;
+    bucket_info_t bucket_info;
     int i;
 
+    split->numparts = 0;
+
     // split the keystream into an odd and even part
     for (i = 31; i >= 0; i -= 2)
         oks = oks << 1 | BEBIT(ks2, i);
     for (i = 30; i >= 0; i -= 2)
         eks = eks << 1 | BEBIT(ks2, i);
 
-    odd_head = odd_tail = calloc(1, sizeof(uint32_t) << 21);
-    even_head = even_tail = calloc(1, sizeof(uint32_t) << 21);
-    statelist =  calloc(1, sizeof(struct Crypto1State) << 18);
-    if (!odd_tail-- || !even_tail-- || !statelist) {
-        free(statelist);
-        statelist = 0;
-        goto out;
-    }
-
-    statelist->odd = statelist->even = 0;
-
-    // allocate memory for out of place bucket_sort
-    bucket_array_t bucket;
-
-    for (i = 0; i < 2; i++) {
-        for (uint32_t j = 0; j <= 0xff; j++) {
-            bucket[i][j].head = calloc(1, sizeof(uint32_t) << 14);
-            if (!bucket[i][j].head) {
-                goto out;
-            }
-        }
-    }
-
     // initialize statelists: add all possible states which would result into the rightmost 2 bits of the keystream
     for (i = 1 << 20; i >= 0; --i) {
         if (filter(i) == (oks & 1))
@@ -182,17 +313,113 @@ struct Crypto1State *lfsr_recovery32(uint32_t ks2, uint32_t in) {
     // 22 bits to go to recover 32 bits in total. From now on, we need to take the "in"
     // parameter into account.
     in = (in >> 16 & 0xff) | (in << 16) | (in & 0xff00); // Byte swapping
-    recover(odd_head, odd_tail, oks, even_head, even_tail, eks, 11, statelist, in << 1, bucket);
+    in <<= 1;
 
-out:
-    for (i = 0; i < 2; i++)
-        for (uint32_t j = 0; j <= 0xff; j++)
-            free(bucket[i][j].head);
-    free(odd_head);
-    free(even_head);
+    // first level of recover(), the resulting buckets are the independent parts
+    int rem = 11;
+    for (i = 0; i < 4 && rem--; i++) {
+        oks >>= 1;
+        eks >>= 1;
+        in >>= 2;
+        extend_table(odd_head, &odd_tail, oks & 1, LF_POLY_EVEN << 1 | 1, LF_POLY_ODD << 1, 0);
+        if (odd_head > odd_tail)
+            return;
+
+        extend_table(even_head, &even_tail, eks & 1, LF_POLY_ODD, LF_POLY_EVEN << 1 | 1, in & 3);
+        if (even_head > even_tail)
+            return;
+    }
+
+    sort_intersect(even_head, even_tail, odd_head, odd_tail, &bucket_info, sort);
+
+    split->oks = oks;
+    split->eks = eks;
+    split->in = in;
+    split->rem = rem;
+    split->numparts = bucket_info.numbuckets;
+    for (i = 0; i < (int)bucket_info.numbuckets; i++) {
+        split->part[i].o_head = bucket_info.bucket_info[1][i].head;
+        split->part[i].o_tail = bucket_info.bucket_info[1][i].tail;
+        split->part[i].e_head = bucket_info.bucket_info[0][i].head;
+        split->part[i].e_tail = bucket_info.bucket_info[0][i].tail;
+    }
+}
+
+/** lfsr_recovery32_part
+ * recover all states of one part of a split. Writes the states starting at sl,
+ * followed by a zero terminator, and returns the position after the last state.
+ * ws comes from lfsr_recovery32_ws_alloc, or from lfsr_recovery32_ws_alloc_parts for this split.
+ */
+struct Crypto1State *lfsr_recovery32_part(const lfsr_split_t *split, uint32_t idx, struct Crypto1State *sl, lfsr_recovery32_ws_t *ws) {
+    if (idx >= split->numparts)
+        return sl;
+
+    uint32_t on = split->part[idx].o_tail - split->part[idx].o_head + 1;
+    uint32_t en = split->part[idx].e_tail - split->part[idx].e_head + 1;
+    memcpy(ws->odd, split->part[idx].o_head, on * sizeof(uint32_t));
+    memcpy(ws->even, split->part[idx].e_head, en * sizeof(uint32_t));
+
+    return recover(ws->odd, ws->odd + on - 1, split->oks,
+                   ws->even, ws->even + en - 1, split->eks,
+                   split->rem, sl, split->in, ws->sort);
+}
+
+void lfsr_recovery32_split_free(lfsr_split_t *split) {
+    free(split->odd);
+    free(split->even);
+    split->odd = NULL;
+    split->even = NULL;
+    split->numparts = 0;
+}
+
+/** lfsr_recovery
+ * recover the state of the lfsr given 32 bits of the keystream
+ * additionally you can use the in parameter to specify the value
+ * that was fed into the lfsr at the time the keystream was generated
+ */
+struct Crypto1State *lfsr_recovery32(uint32_t ks2, uint32_t in) {
+    struct Crypto1State *statelist = calloc(1, sizeof(struct Crypto1State) * LFSR_RECOVERY32_STATES);
+    lfsr_recovery32_ws_t *ws = lfsr_recovery32_ws_alloc();
+    if (!statelist || !ws) {
+        free(statelist);
+        lfsr_recovery32_ws_free(ws);
+        return 0;
+    }
+
+    lfsr_recovery32_into(ks2, in, statelist, ws);
+    lfsr_recovery32_ws_free(ws);
     return statelist;
 }
 
+/** lfsr_recovery32_into
+ * lfsr_recovery32 without any allocation after the first call, for callers running it in a loop.
+ * ws comes from lfsr_recovery32_ws_alloc and can be used again for the next call (one thread at a time),
+ * the odd / even tables of the split are added to it on the first call.
+ * the states are written to sl, which must hold LFSR_RECOVERY32_STATES entries, zero terminated.
+ * returns the number of states, 0 if ws is too small or out of memory
+ */
+size_t lfsr_recovery32_into(uint32_t ks2, uint32_t in, struct Crypto1State *sl, lfsr_recovery32_ws_t *ws) {
+    lfsr_split_t split;
+    struct Crypto1State *end = sl;
+
+    end->odd = end->even = 0;
+    if (ws->size < RECOVERY32_TABLE_SIZE)
+        return 0;
+
+    if (ws->split_odd == NULL)
+        ws->split_odd = calloc(RECOVERY32_TABLE_SIZE, sizeof(uint32_t));
+    if (ws->split_even == NULL)
+        ws->split_even = calloc(RECOVERY32_TABLE_SIZE, sizeof(uint32_t));
+    if (!ws->split_odd || !ws->split_even)
+        return 0;
+
+    split_tables(ks2, in, &split, ws->split_odd, ws->split_even, ws->sort);
+    for (int i = split.numparts - 1; i >= 0; i--) {
+        end = lfsr_recovery32_part(&split, i, end, ws);
+    }
+    return end - sl;
+}
+
 static const uint32_t S1[] = {     0x62141, 0x310A0, 0x18850, 0x0C428, 0x06214,
                                    0x0310A, 0x85E30, 0xC69AD, 0x634D6, 0xB5CDE, 0xDE8DA, 0x6F46D, 0xB3C83,
                                    0x59E41, 0xA8995, 0xD027F, 0x6813F, 0x3409F, 0x9E6FA
@@ -221,15 +448,25 @@ static const uint32_t C2[] = { 0x1A822E0, 0x21A822E0, 0x21A822E0};
  * Variation mentioned in the paper. Somewhat optimized version
  */
 struct Crypto1State *lfsr_recovery64(uint32_t ks2, uint32_t ks3) {
-    struct Crypto1State *statelist, *sl;
+    struct Crypto1State *statelist = calloc(1, sizeof(struct Crypto1State) * LFSR_RECOVERY64_STATES);
+    if (!statelist)
+        return 0;
+
+    lfsr_recovery64_into(ks2, ks3, statelist);
+    return statelist;
+}
+
+/** lfsr_recovery64_into
+ * lfsr_recovery64 without allocation, the states are written to sl, which must hold
+ * LFSR_RECOVERY64_STATES entries, zero terminated.  returns the number of states
+ */
+size_t lfsr_recovery64_into(uint32_t ks2, uint32_t ks3, struct Crypto1State *statelist) {
+    struct Crypto1State *sl = statelist;
     uint8_t oks[32], eks[32], hi[32];
     uint32_t low = 0,  win = 0;
     uint32_t *tail, table[1 << 16];
     int i, j;
 
-    sl = statelist = calloc(1, sizeof(struct Crypto1State) << 4);
-    if (!sl)
-        return 0;
     sl->odd = sl->even = 0;
 
     for (i = 30; i >= 0; i -= 2) {
@@ -280,11 +517,13 @@ struct Crypto1State *lfsr_recovery64(uint32_t ks2, uint32_t ks3) {
             sl->even = win;
             ++sl;
             sl->odd = sl->even = 0;
+            if (sl - statelist == LFSR_RECOVERY64_STATES - 1)
+                return sl - statelist;
 continue2:
             ;
         }
     }
-    return statelist;
+    return sl - statelist;
 }
 #endif
 
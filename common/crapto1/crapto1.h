@@ -36,7 +36,35 @@ uint32_t prng_successor(uint32_t x, uint32_t n);
 
 #if !defined(__arm__) || defined(__linux__) || defined(_WIN32) || defined(__APPLE__) // bare metal ARM Proxmark lacks malloc()/free()
 struct Crypto1State *lfsr_recovery32(uint32_t ks2, uint32_t in);
+
+// size of the state lists of lfsr_recovery32 / lfsr_recovery64, terminator included
+#define LFSR_RECOVERY32_STATES (1 << 18)
+#define LFSR_RECOVERY64_STATES (1 << 4)
+
+// lfsr_recovery32 split in independent parts, for multi-threaded callers
+typedef struct {
+    uint32_t *odd, *even;       // tables backing all parts
+    uint32_t oks, eks, in;
+    int rem;
+    uint32_t numparts;
+    struct {
+        uint32_t *o_head, *o_tail;
+        uint32_t *e_head, *e_tail;
+    } part[0x100];
+} lfsr_split_t;
+
+typedef struct lfsr_recovery32_ws lfsr_recovery32_ws_t;
+
+lfsr_recovery32_ws_t *lfsr_recovery32_ws_alloc(void);
+lfsr_recovery32_ws_t *lfsr_recovery32_ws_alloc_parts(const lfsr_split_t *splits, uint32_t numsplits);
+void lfsr_recovery32_ws_free(lfsr_recovery32_ws_t *ws);
+bool lfsr_recovery32_split(uint32_t ks2, uint32_t in, lfsr_split_t *split);
+struct Crypto1State *lfsr_recovery32_part(const lfsr_split_t *split, uint32_t idx, struct Crypto1State *sl, lfsr_recovery32_ws_t *ws);
+void lfsr_recovery32_split_free(lfsr_split_t *split);
+// allocation free variants, for callers running the recovery in a loop.  See crapto1.c
+size_t lfsr_recovery32_into(uint32_t ks2, uint32_t in, struct Crypto1State *sl, lfsr_recovery32_ws_t *ws);
 struct Crypto1State *lfsr_recovery64(uint32_t ks2, uint32_t ks3);
+size_t lfsr_recovery64_into(uint32_t ks2, uint32_t ks3, struct Crypto1State *sl);
 struct Crypto1State *
 lfsr_common_prefix(uint32_t pfx, uint32_t rr, uint8_t ks[8], uint8_t par[8][8], uint32_t no_par);
 #endif
@@ -93,11 +93,25 @@ static void printSignal(void) {
 }
 
 #ifndef ON_DEVICE
-static int cmp_uint8(const void *a, const void *b) {
-    if (*(const uint8_t *)a < * (const uint8_t *)b)
-        return -1;
-    else
-        return *(const uint8_t *)a > *(const uint8_t *)b;
+// The percentiles below come from a histogram instead of sorting a copy of the samples,
+// so any capture length works without a large temporary buffer.
+static void histogram_uint8(const uint8_t *samples, uint32_t size, uint32_t hist[256]) {
+    memset(hist, 0, 256 * sizeof(uint32_t));
+    for (uint32_t i = 0; i < size; i++) {
+        hist[samples[i]]++;
+    }
+}
+
+// value at index n,  as if the samples were sorted
+static uint8_t histogram_nth(const uint32_t hist[256], uint32_t n) {
+    uint32_t acc = 0;
+    for (uint16_t v = 0; v < 256; v++) {
+        acc += hist[v];
+        if (acc > n) {
+            return v;
+        }
+    }
+    return 255;
 }
 #endif
 
@@ -106,33 +120,35 @@ void computeSignalProperties(const uint8_t *samples, uint32_t size) {
 
     if (samples == NULL || size < SIGNAL_MIN_SAMPLES) return;
 
-    uint32_t sum = 0;
     uint32_t offset_size = size - SIGNAL_IGNORE_FIRST_SAMPLES;
 
 #ifndef ON_DEVICE
-    uint8_t tmp[offset_size];
-    memcpy(tmp, samples + SIGNAL_IGNORE_FIRST_SAMPLES, sizeof(tmp));
-    qsort(tmp, sizeof(tmp), sizeof(uint8_t), cmp_uint8);
+    uint32_t hist[256];
+    histogram_uint8(samples + SIGNAL_IGNORE_FIRST_SAMPLES, offset_size, hist);
 
-    uint8_t low10 = 0.5 * (tmp[(int)(offset_size * 0.1)] + tmp[(int)((offset_size - 1) * 0.1)]);
-    uint8_t hi90 =  0.5 * (tmp[(int)(offset_size * 0.9)] + tmp[(int)((offset_size - 1) * 0.9)]);
+    uint8_t low10 = 0.5 * (histogram_nth(hist, offset_size * 0.1) + histogram_nth(hist, (offset_size - 1) * 0.1));
+    uint8_t hi90 =  0.5 * (histogram_nth(hist, offset_size * 0.9) + histogram_nth(hist, (offset_size - 1) * 0.9));
+    uint64_t sum = 0;
     uint32_t cnt = 0;
-    for (uint32_t i = SIGNAL_IGNORE_FIRST_SAMPLES; i < size; i++) {
+    for (uint16_t v = 0; v < 256; v++) {
+        if (hist[v] == 0)
+            continue;
 
-        if (samples[i] < signalprop.low) signalprop.low = samples[i];
-        if (samples[i] > signalprop.high) signalprop.high = samples[i];
+        if (v < signalprop.low) signalprop.low = v;
+        if (v > signalprop.high) signalprop.high = v;
 
-        if (samples[i] < low10 || samples[i] > hi90)
+        if (v < low10 || v > hi90)
             continue;
 
-        sum += samples[i];
-        cnt++;
+        sum += (uint64_t)hist[v] * v;
+        cnt += hist[v];
     }
     if (cnt > 0)
         signalprop.mean = sum / cnt;
     else
         signalprop.mean = 0;
 #else
+    uint32_t sum = 0;
     for (uint32_t i =  SIGNAL_IGNORE_FIRST_SAMPLES; i < size; i++) {
         if (samples[i] < signalprop.low) signalprop.low = samples[i];
         if (samples[i] > signalprop.high) signalprop.high = samples[i];
@@ -159,23 +175,19 @@ void removeSignalOffset(uint8_t *samples, uint32_t size) {
 
 #ifndef ON_DEVICE
 
-    uint8_t tmp[offset_size];
-    memcpy(tmp, samples + SIGNAL_IGNORE_FIRST_SAMPLES, sizeof(tmp));
-    qsort(tmp, sizeof(tmp), sizeof(uint8_t), cmp_uint8);
+    uint32_t hist[256];
+    histogram_uint8(samples + SIGNAL_IGNORE_FIRST_SAMPLES, offset_size, hist);
 
-    uint8_t low10 = 0.5 * (tmp[(int)(offset_size * 0.05)] + tmp[(int)((offset_size - 1) * 0.05)]);
-    uint8_t hi90 =  0.5 * (tmp[(int)(offset_size * 0.95)] + tmp[(int)((offset_size - 1) * 0.95)]);
-    int32_t cnt = 0;
-    for (uint32_t i = SIGNAL_IGNORE_FIRST_SAMPLES; i < size; i++) {
-
-        if (samples[i] < low10 || samples[i] > hi90)
-            continue;
-
-        acc_off += samples[i] - 128;
-        cnt++;
+    uint8_t low10 = 0.5 * (histogram_nth(hist, offset_size * 0.05) + histogram_nth(hist, (offset_size - 1) * 0.05));
+    uint8_t hi90 =  0.5 * (histogram_nth(hist, offset_size * 0.95) + histogram_nth(hist, (offset_size - 1) * 0.95));
+    int64_t acc64 = 0;
+    int64_t cnt = 0;
+    for (uint16_t v = low10; v <= hi90; v++) {
+        acc64 += (int64_t)hist[v] * (v - 128);
+        cnt += hist[v];
     }
     if (cnt > 0)
-        acc_off /= cnt;
+        acc_off = acc64 / cnt;
     else
         acc_off = 0;
 #else
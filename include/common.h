@@ -47,6 +47,7 @@
 #define TRACES_SUBDIR        "traces" PATHSEP
 #define LOGS_SUBDIR          "logs" PATHSEP
 #define FIRMWARES_SUBDIR     "firmware" PATHSEP
+#define CACHE_SUBDIR         "cache" PATHSEP
 #define BOOTROM_SUBDIR       "bootrom" PATHSEP "obj" PATHSEP
 #define FULLIMAGE_SUBDIR     "armsrc" PATHSEP "obj" PATHSEP
 
@@ -208,7 +208,6 @@ typedef struct {
     bool is_rdv4                       : 1;
 } PACKED capabilities_t;
 #define CAPABILITIES_VERSION 6
-extern capabilities_t g_pm3_capabilities;
 
 // For CMD_LF_T55XX_WRITEBL
 typedef struct {
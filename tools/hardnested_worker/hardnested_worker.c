@@ -0,0 +1,343 @@
+// Searches one shard of a hardnested brute force, written by
+// `hf mf hardnested --shards <n>` (see bf_shard_header_t in
+// client/deps/hardnested/hardnested_bruteforce.h for the file layout).
+// The result goes to a small JSON file, so shards and results can be moved
+// between hosts with plain file copies.
+#define __STDC_FORMAT_MACROS
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "hardnested_bruteforce.h"
+#include "hardnested_bf_core.h"
+#include "util_posix.h"
+
+#define PROGRESS_INTERVAL   (10 * 1000)   // ms
+#define MAX_NONCES          (1 << 20)
+
+static int thread_count = 1;
+
+static bf_shard_header_t hdr;
+static uint8_t best_first_bytes[256];
+static uint32_t test_nonce[256];
+static uint8_t test_nonce_par[256];
+static uint8_t test_nonce_2nd_byte[256];
+static noncelist_t *nonces = NULL;
+static noncelistentry_t *nonce_entries = NULL;
+
+static statelist_t buckets[128];
+static statelist_t *bucket_ptrs[128];
+static uint32_t bucket_count = 0;
+static bf_chunk_t *chunks = NULL;
+static uint32_t chunk_count = 0;
+static uint32_t next_chunk = 0;
+
+static uint32_t keys_found = 0;
+static uint64_t found_key = 0;
+static uint64_t num_keys_tested = 0;
+static uint64_t states_total = 0;
+static uint64_t start_time = 0;
+static uint64_t progress_time = 0;
+
+// the brute force cores report errors through the client's log function
+void PrintAndLogEx(int level, const char *fmt, ...);
+void PrintAndLogEx(int level, const char *fmt, ...) {
+    (void)level;
+    va_list args;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+    printf("\n");
+}
+
+static int usage(void) {
+    printf("\n");
+    printf("syntax:  hardnested_worker [-t <threads>] [-o <result file>] <shard file>\n\n");
+    printf("    -t   number of threads, default the number of cpus\n");
+    printf("    -o   result file, default <shard file> with -result.json instead of .bin\n\n");
+    printf("The shard files are written by the client with `hf mf hardnested --shards <n>`.\n");
+    printf("Copy each shard to a host, run the worker on it and collect the result files.\n");
+    printf("Exits with 0 when the shard was searched, look at \"found\" in the result file.\n\n");
+    printf("samples:\n");
+    printf("\n");
+    printf("  ./hardnested_worker hf-mf-12345678-shard-1-of-4.bin\n");
+    printf("  ./hardnested_worker -t 16 -o result1.json hf-mf-12345678-shard-1-of-4.bin\n\n");
+    return 1;
+}
+
+static bool read_exact(FILE *f, void *dst, size_t len) {
+    return (len == 0) || (fread(dst, len, 1, f) == 1);
+}
+
+static void free_buckets(void) {
+    for (uint32_t i = 0; i < bucket_count; i++) {
+        free(buckets[i].states[EVEN_STATE]);
+        free(buckets[i].states[ODD_STATE]);
+    }
+    memset(buckets, 0, sizeof(buckets));
+    bucket_count = 0;
+    free(chunks);
+    chunks = NULL;
+    chunk_count = 0;
+    next_chunk = 0;
+}
+
+static bool read_header(FILE *f) {
+    if (read_exact(f, &hdr, sizeof(hdr)) == false
+            || memcmp(hdr.magic, BF_SHARD_MAGIC, sizeof(BF_SHARD_MAGIC)) != 0) {
+        printf("not a hardnested shard file\n");
+        return false;
+    }
+    if (hdr.version != BF_SHARD_VERSION) {
+        printf("unsupported shard file version %" PRIu32 "\n", hdr.version);
+        return false;
+    }
+    if (hdr.num_test_nonces == 0 || hdr.num_test_nonces > 256 || hdr.num_nonces > MAX_NONCES) {
+        printf("shard file corrupt, %" PRIu32 " test nonces, %" PRIu32 " nonces\n", hdr.num_test_nonces, hdr.num_nonces);
+        return false;
+    }
+
+    if (read_exact(f, best_first_bytes, sizeof(best_first_bytes)) == false) {
+        return false;
+    }
+    for (uint32_t i = 0; i < hdr.num_test_nonces; i++) {
+        if (read_exact(f, &test_nonce[i], sizeof(uint32_t)) == false
+                || read_exact(f, &test_nonce_par[i], sizeof(uint8_t)) == false) {
+            return false;
+        }
+        test_nonce_2nd_byte[i] = (test_nonce[i] >> 16) & 0xff;
+    }
+
+    // all nonces, for the final verification of a key
+    nonces = calloc(256, sizeof(noncelist_t));
+    nonce_entries = calloc(hdr.num_nonces + 1, sizeof(noncelistentry_t));
+    if (nonces == NULL || nonce_entries == NULL) {
+        printf("out of memory\n");
+        return false;
+    }
+    noncelistentry_t *last[256] = {NULL};
+    for (uint32_t i = 0; i < hdr.num_nonces; i++) {
+        uint8_t first_byte;
+        noncelistentry_t *p = &nonce_entries[i];
+        if (read_exact(f, &first_byte, sizeof(uint8_t)) == false
+                || read_exact(f, &p->nonce_enc, sizeof(uint32_t)) == false
+                || read_exact(f, &p->par_enc, sizeof(uint8_t)) == false) {
+            return false;
+        }
+        if (last[first_byte] == NULL) {
+            nonces[first_byte].first = p;
+        } else {
+            last[first_byte]->next = p;
+        }
+        last[first_byte] = p;
+        nonces[first_byte].num++;
+    }
+    return true;
+}
+
+// returns false at the end of the file
+static bool read_section(FILE *f, bf_shard_section_t *section, bool *ok) {
+    *ok = true;
+    if (fread(section, sizeof(bf_shard_section_t), 1, f) != 1) {
+        return false;
+    }
+    if (section->num_buckets > 128) {
+        *ok = false;
+        return false;
+    }
+
+    for (uint32_t i = 0; i < section->num_buckets; i++) {
+        statelist_t *b = &buckets[i];
+        bucket_ptrs[i] = b;
+        bucket_count++;
+        if (read_exact(f, b->len, sizeof(b->len)) == false) {
+            *ok = false;
+            return false;
+        }
+        for (uint8_t oe = EVEN_STATE; oe <= ODD_STATE; oe++) {
+            b->states[oe] = calloc((size_t)b->len[oe] + 1, sizeof(uint32_t));
+            if (b->states[oe] == NULL || read_exact(f, b->states[oe], (size_t)b->len[oe] * sizeof(uint32_t)) == false) {
+                *ok = false;
+                return false;
+            }
+            b->states[oe][b->len[oe]] = -1;
+        }
+    }
+
+    chunks = bf_make_chunks(bucket_ptrs, bucket_count, &chunk_count);
+    if (chunks == NULL) {
+        *ok = false;
+        return false;
+    }
+    return true;
+}
+
+static void print_progress(void) {
+    uint64_t last = __atomic_load_n(&progress_time, __ATOMIC_RELAXED);
+    uint64_t now = msclock();
+    if (now - last < PROGRESS_INTERVAL
+            || __atomic_compare_exchange_n(&progress_time, &last, now, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED) == false) {
+        return;
+    }
+    uint64_t tested = __atomic_load_n(&num_keys_tested, __ATOMIC_RELAXED);
+    double seconds = (now - start_time) / 1000.0;
+    printf("%6.1fs  %6.2f%%  %1.0f keys/s\n", seconds, 100.0 * tested / (states_total ? states_total : 1), (seconds > 0) ? tested / seconds : 0);
+    fflush(stdout);
+}
+
+static void *
+#ifdef __has_attribute
+#if __has_attribute(force_align_arg_pointer)
+__attribute__((force_align_arg_pointer))
+#endif
+#endif
+crack_thread(void *arg) {
+    (void)arg;
+    while (__atomic_load_n(&keys_found, __ATOMIC_ACQUIRE) == 0) {
+        uint32_t c = __atomic_fetch_add(&next_chunk, 1, __ATOMIC_SEQ_CST);
+        if (c >= chunk_count) {
+            break;
+        }
+
+        uint64_t key = bf_crack_chunk(bucket_ptrs, &chunks[c], hdr.cuid, best_first_bytes, &keys_found, &num_keys_tested,
+                                      hdr.num_test_nonces, test_nonce_2nd_byte, nonces);
+        if (key != (uint64_t) -1) {
+            uint32_t expected = 0;
+            if (__atomic_compare_exchange_n(&keys_found, &expected, 1, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+                found_key = key;
+            }
+            break;
+        }
+        print_progress();
+    }
+    return NULL;
+}
+
+static void search_section(void) {
+    pthread_t threads[thread_count];
+    for (int i = 0; i < thread_count; i++) {
+        pthread_create(&threads[i], NULL, crack_thread, NULL);
+    }
+    for (int i = 0; i < thread_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+static bool write_result(const char *fn, double seconds) {
+    FILE *f = fopen(fn, "w");
+    if (f == NULL) {
+        printf("could not create %s\n", fn);
+        return false;
+    }
+    fprintf(f, "{\n");
+    fprintf(f, "  \"shard\": %" PRIu32 ",\n", hdr.shard);
+    fprintf(f, "  \"num_shards\": %" PRIu32 ",\n", hdr.num_shards);
+    fprintf(f, "  \"cuid\": \"%08" PRIx32 "\",\n", hdr.cuid);
+    fprintf(f, "  \"found\": %s,\n", keys_found ? "true" : "false");
+    if (keys_found)
+        fprintf(f, "  \"key\": \"%012" PRIx64 "\",\n", found_key);
+    else
+        fprintf(f, "  \"key\": null,\n");
+    fprintf(f, "  \"states\": %" PRIu64 ",\n", states_total);
+    fprintf(f, "  \"tested\": %" PRIu64 ",\n", num_keys_tested);
+    fprintf(f, "  \"seconds\": %.1f\n", seconds);
+    fprintf(f, "}\n");
+    return fclose(f) == 0;
+}
+
+static char *default_result_name(const char *fn) {
+    size_t len = strlen(fn);
+    char *res = calloc(len + 16, sizeof(char));
+    if (res == NULL)
+        return NULL;
+    memcpy(res, fn, len);
+    if (len > 4 && strcmp(fn + len - 4, ".bin") == 0)
+        len -= 4;
+    strcpy(res + len, "-result.json");
+    return res;
+}
+
+int main(int argc, char *argv[]) {
+    printf("\nMifare classic hardnested brute force worker\n\n");
+
+#if !defined(_WIN32) || !defined(__WIN32__)
+    thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (thread_count < 1)
+        thread_count = 1;
+#endif  /* _WIN32 */
+
+    const char *out = NULL;
+    int argi = 1;
+    while (argi < argc && argv[argi][0] == '-') {
+        if (strcmp(argv[argi], "-t") == 0 && argi + 1 < argc) {
+            thread_count = atoi(argv[argi + 1]);
+            argi += 2;
+        } else if (strcmp(argv[argi], "-o") == 0 && argi + 1 < argc) {
+            out = argv[argi + 1];
+            argi += 2;
+        } else {
+            return usage();
+        }
+    }
+    if (thread_count < 1 || argc - argi != 1)
+        return usage();
+
+    const char *fn = argv[argi];
+    char *result_fn = (out) ? strdup(out) : default_result_name(fn);
+    FILE *f = fopen(fn, "rb");
+    if (f == NULL || result_fn == NULL) {
+        printf("could not open %s\n", fn);
+        free(result_fn);
+        return 1;
+    }
+
+    bool ok = read_header(f);
+    if (ok) {
+        printf("shard %" PRIu32 " of %" PRIu32 ", cuid %08" PRIx32 ", %" PRIu32 " test nonces, %d threads\n\n",
+               hdr.shard, hdr.num_shards, hdr.cuid, hdr.num_test_nonces, thread_count);
+        bitslice_test_nonces(hdr.num_test_nonces, test_nonce, test_nonce_par);
+    }
+
+    start_time = msclock();
+    progress_time = start_time;
+    uint32_t section_no = 0;
+    bf_shard_section_t section;
+    while (ok && keys_found == 0 && read_section(f, &section, &ok)) {
+        section_no++;
+        states_total += section.num_states;
+        printf("candidate space %" PRIu32 ": %" PRIu32 " buckets, %" PRIu64 " states\n", section_no, section.num_buckets, section.num_states);
+        fflush(stdout);
+        search_section();
+        free_buckets();
+    }
+    free_buckets();
+    fclose(f);
+
+    if (ok == false) {
+        printf("could not read %s\n", fn);
+        free(result_fn);
+        free(nonces);
+        free(nonce_entries);
+        return 1;
+    }
+
+    double seconds = (msclock() - start_time) / 1000.0;
+    if (keys_found)
+        printf("\nValid Key found: [%012" PRIx64 "]\n", found_key);
+    else
+        printf("\nNo key in this shard\n");
+    printf("%" PRIu64 " keys tested in %.1f s\n", num_keys_tested, seconds);
+
+    ok = write_result(result_fn, seconds);
+    if (ok)
+        printf("result written to %s\n\n", result_fn);
+
+    free(result_fn);
+    free(nonces);
+    free(nonce_entries);
+    return ok ? 0 : 1;
+}
@@ -21,9 +21,6 @@
 
 #define odd_parity(i) (( (i) ^ (i)>>1 ^ (i)>>2 ^ (i)>>3 ^ (i)>>4 ^ (i)>>5 ^ (i)>>6 ^ (i)>>7 ^ 1) & 0x01)
 
-// a global mutex to prevent interlaced printing from different threads
-pthread_mutex_t print_lock;
-
 //--------------------- define options here
 uint32_t uid = 0;     // serial number
 uint32_t nt_enc = 0;  // Encrypted tag nonce
@@ -36,13 +33,6 @@ uint32_t nt_par_err = 0;
 uint32_t ar_par_err = 0;
 uint32_t at_par_err = 0;
 
-typedef struct thread_args {
-    uint16_t xored;
-    int thread;
-    int idx;
-    bool ev1;
-} targs;
-
 #define ENC_LEN  (200)
 typedef struct thread_key_args {
     int thread;
@@ -68,12 +58,36 @@ uint8_t cmds[8][2] = {
     {MIFARE_CMD_TRANSFER, 0}
 };
 
-//static int global_counter = 0;
 static int global_found = 0;
-static int global_found_candidate = 0;
-static uint64_t global_candidate_key = 0;
 static int thread_count = 2;
 
+// parity checks of all 2^16 tag nonces, see nonce_parity_bits()
+static uint16_t nonce_sig[0x10000];
+
+// candidate nonces (upper 16 bits of nt) of the current sniff. The ones passing all
+// ten parity checks come first, followed by the ones only passing the eight EV1 checks.
+// Phase 1 threads take them from candidate_cursor.
+static uint16_t candidates[0x10000];
+static uint32_t candidates_strict = 0;
+static uint32_t candidates_len = 0;
+static uint32_t candidate_cursor = 0;
+static uint32_t candidates_rejected = 0;
+
+// phase 1 results, a slot is taken with an atomic add on results_len and read after the join
+#define MAX_RESULTS  (64)
+typedef struct {
+    uint64_t key;
+    uint32_t nt;
+    uint32_t ks4;
+    bool ev1;
+} result_t;
+static result_t results[MAX_RESULTS];
+static uint32_t results_len = 0;
+
+// phase 2 result, written by the thread setting global_found
+static uint64_t found_key = 0;
+static uint8_t found_dec[ENC_LEN];
+
 static int param_getptr(const char *line, int *bg, int *en, int paramnum) {
     int i;
     int len = strlen(line);
@@ -257,66 +271,101 @@ static uint16_t xored_bits(uint16_t nt_par, uint32_t ntenc, uint16_t ar_par, uin
     return xored;
 }
 
-static bool candidate_nonce(uint32_t xored, uint32_t nt, bool ev1) {
-    uint8_t byte, check;
+// the ten parity checks of a tag nonce, bit order as in xored_bits(). A nonce is a
+// candidate when these bits equal the xored bits, EV1 cards only use the lower eight
+static uint16_t nonce_parity_bits(uint32_t nt) {
+    uint16_t bits = 0;
+    uint8_t byte;
 
-    if (!ev1) {
-        //1st (1st nt)
-        byte = (nt >> 24) & 0xFF;
-        check = odd_parity(byte) ^ ((nt >> 16) & 1) ^ ((xored >> 9) & 1);
-        if (check) return false;
+    //1st (1st nt)
+    byte = (nt >> 24) & 0xFF;
+    bits |= odd_parity(byte) ^ ((nt >> 16) & 1);
+    bits <<= 1;
 
-        //2nd (2nd nt)
-        byte = (nt >> 16) & 0xFF;
-        check = odd_parity(byte) ^ ((nt >> 8) & 1) ^ ((xored >> 8) & 1);
-        if (check) return false;
-    }
+    //2nd (2nd nt)
+    byte = (nt >> 16) & 0xFF;
+    bits |= odd_parity(byte) ^ ((nt >> 8) & 1);
+    bits <<= 1;
 
     //3rd (3rd nt)
     byte = (nt >> 8) & 0xFF;
-    check = odd_parity(byte) ^ (nt & 1) ^ ((xored >> 7) & 1);
-    if (check) return false;
+    bits |= odd_parity(byte) ^ (nt & 1);
+    bits <<= 1;
 
     uint32_t ar = prng_successor(nt, 64);
 
     //4th (1st ar)
     byte = (ar >> 24) & 0xFF;
-    check = odd_parity(byte) ^ ((ar >> 16) & 1) ^ ((xored >> 6) & 1);
-    if (check) return false;
+    bits |= odd_parity(byte) ^ ((ar >> 16) & 1);
+    bits <<= 1;
 
     //5th (2nd ar)
-    byte = (ar >> 16) & 0x0FF;
-    check = odd_parity(byte) ^ ((ar >> 8) & 1) ^ ((xored >> 5) & 1);
-    if (check) return false;
+    byte = (ar >> 16) & 0xFF;
+    bits |= odd_parity(byte) ^ ((ar >> 8) & 1);
+    bits <<= 1;
 
     //6th (3rd ar)
     byte = (ar >> 8) & 0xFF;
-    check = odd_parity(byte) ^ (ar & 1) ^ ((xored >> 4) & 1);
-    if (check) return false;
+    bits |= odd_parity(byte) ^ (ar & 1);
+    bits <<= 1;
 
     uint32_t at = prng_successor(nt, 96);
 
     //7th (4th ar)
     byte = ar & 0xFF;
-    check = odd_parity(byte) ^ ((at >> 24) & 1) ^ ((xored >> 3) & 1);
-    if (check) return false;
+    bits |= odd_parity(byte) ^ ((at >> 24) & 1);
+    bits <<= 1;
 
     //8th (1st at)
     byte = (at >> 24) & 0xFF;
-    check = odd_parity(byte) ^ ((at >> 16) & 1) ^ ((xored >> 2) & 1);
-    if (check) return false;
+    bits |= odd_parity(byte) ^ ((at >> 16) & 1);
+    bits <<= 1;
 
     //9th (2nd at)
     byte = (at >> 16) & 0xFF;
-    check = odd_parity(byte) ^ ((at >> 8) & 1) ^ ((xored >> 1) & 1) ;
-    if (check) return false;
+    bits |= odd_parity(byte) ^ ((at >> 8) & 1);
+    bits <<= 1;
 
     //10th (3rd at)
     byte = (at >> 8) & 0xFF;
-    check = odd_parity(byte) ^ (at & 1) ^ (xored & 1);
-    if (check) return false;
+    bits |= odd_parity(byte) ^ (at & 1);
 
-    return true;
+    return bits;
+}
+
+// the nonces only depend on their upper 16 bits, so the parity checks are computed once
+// and shared by all sniffs
+static void init_nonce_sig(void) {
+    for (uint32_t count = 0; count <= 0xFFFF; count++) {
+        uint32_t nt = count << 16 | prng_successor(count, 16);
+        nonce_sig[count] = nonce_parity_bits(nt);
+    }
+}
+
+// appends the nonces whose checks under mask equal xored, and which fail at least one
+// check of skip (when given), to out. Returns the new length.
+// Works on blocks of 64 nonces, the compare loop has no branches so the compiler
+// vectorises it and blocks without any hit are rejected as a whole.
+static uint32_t filter_nonces(uint16_t xored, uint16_t mask, uint16_t skip, uint16_t *out, uint32_t len) {
+    for (uint32_t base = 0; base <= 0xFFFF; base += 64) {
+        const uint16_t *sig = nonce_sig + base;
+        uint8_t hit[64];
+        uint8_t any = 0;
+
+        for (int i = 0; i < 64; i++) {
+            uint16_t d = sig[i] ^ xored;
+            hit[i] = ((d & mask) == 0) & (((d & skip) != 0) | (skip == 0));
+            any |= hit[i];
+        }
+        if (any == 0)
+            continue;
+
+        for (int i = 0; i < 64; i++) {
+            if (hit[i])
+                out[len++] = base + i;
+        }
+    }
+    return len;
 }
 
 static bool checkValidCmd(uint32_t decrypted) {
@@ -361,76 +410,51 @@ static bool checkCRC(uint32_t decrypted) {
 }
 
 static void *brute_thread(void *arguments) {
+    (void)arguments;
 
-    //int shift = (int)arg;
-    struct thread_args *args = (struct thread_args *) arguments;
-
-    struct Crypto1State *revstate = NULL;
-    uint64_t key;     // recovered key candidate
+    uint64_t key;     // recovered key
     uint32_t ks2;     // keystream used to encrypt reader response
     uint32_t ks3;     // keystream used to encrypt tag response
     uint32_t ks4;     // keystream used to encrypt next command
     uint32_t nt;      // current tag nonce
-
     uint32_t p64 = 0;
-    uint32_t count;
-    // TC == 4  (
-    // threads calls 0 ev1 == false
-    // threads calls 0,1,2  ev1 == true
-    for (count = args->idx; count <= 0xFFFF; count += thread_count - 1) {
+
+    // recovery buffer, reused for every candidate of this thread
+    struct Crypto1State states[LFSR_RECOVERY64_STATES];
+
+    for (;;) {
 
         if (__atomic_load_n(&global_found, __ATOMIC_ACQUIRE) == 1) {
             break;
         }
 
-        nt = count << 16 | prng_successor(count, 16);
+        uint32_t idx = __atomic_fetch_add(&candidate_cursor, 1, __ATOMIC_RELAXED);
+        if (idx >= candidates_len)
+            break;
 
-        if (candidate_nonce(args->xored, nt, args->ev1) == false)
-            continue;
+        bool ev1 = (idx >= candidates_strict);
+        uint32_t count = candidates[idx];
+        nt = count << 16 | prng_successor(count, 16);
 
         p64 = prng_successor(nt, 64);
         ks2 = ar_enc ^ p64;
         ks3 = at_enc ^ prng_successor(p64, 32);
-        revstate = lfsr_recovery64(ks2, ks3);
-        ks4 = crypto1_word(revstate, 0, 0);
-
-        if (ks4 != 0) {
-
-            // lock this section to avoid interlacing prints from different threats
-            pthread_mutex_lock(&print_lock);
-            if (args->ev1)
-                printf("\n**** Possible key candidate ****\n");
-
-#if 0
-            printf("thread #%d idx %d %s\n", args->thread, args->idx, (args->ev1) ? "(Ev1)" : "");
-            printf("current nt(%08x)  ar_enc(%08x)  at_enc(%08x)\n", nt, ar_enc, at_enc);
-            printf("ks2:%08x\n", ks2);
-            printf("ks3:%08x\n", ks3);
-            printf("ks4:%08x\n", ks4);
-#endif
+
+        size_t n = lfsr_recovery64_into(ks2, ks3, states);
+        for (size_t i = 0; i < n; i++) {
+            struct Crypto1State *revstate = &states[i];
+
+            ks4 = crypto1_word(revstate, 0, 0);
+            if (ks4 == 0)
+                continue;
+
             if (cmd_enc) {
                 uint32_t decrypted = ks4 ^ cmd_enc;
-                printf("CMD enc( %08x )\n", cmd_enc);
-                printf("    dec( %08x )    ", decrypted);
-
-                // check if cmd exists
-                uint8_t isOK = checkValidCmd(decrypted);
-                if (isOK == false) {
-                    printf(_RED_("<-- not a valid cmd\n"));
-                    pthread_mutex_unlock(&print_lock);
-                    free(revstate);
-                    continue;
-                }
 
-                // Add a crc-check.
-                isOK = checkCRC(decrypted);
-                if (isOK == false) {
-                    printf(_RED_("<-- not a valid crc\n"));
-                    pthread_mutex_unlock(&print_lock);
-                    free(revstate);
+                // check if cmd exists and has a valid crc
+                if (checkValidCmd(decrypted) == false || checkCRC(decrypted) == false) {
+                    __atomic_fetch_add(&candidates_rejected, 1, __ATOMIC_RELAXED);
                     continue;
-                } else {
-                    printf("<-- valid cmd\n");
                 }
             }
 
@@ -441,23 +465,22 @@ static void *brute_thread(void *arguments) {
             lfsr_rollback_word(revstate, uid ^ nt, 0);
             crypto1_get_lfsr(revstate, &key);
 
-            if (args->ev1) {
-                // if it was EV1,  we know for sure xxxAAAAAAAA recovery
-                printf("\nKey candidate [ " _YELLOW_("....%08" PRIx64)" ]\n\n", key & 0xFFFFFFFF);
-                __sync_fetch_and_add(&global_found_candidate, 1);
-            } else {
-                printf("\nKey candidate [ " _GREEN_("....%08" PRIx64) " ]\n\n", key & 0xFFFFFFFF);
-                __sync_fetch_and_add(&global_found, 1);
+            uint32_t slot = __atomic_fetch_add(&results_len, 1, __ATOMIC_RELAXED);
+            if (slot < MAX_RESULTS) {
+                results[slot].key = key;
+                results[slot].nt = nt;
+                results[slot].ks4 = ks4;
+                results[slot].ev1 = ev1;
+            }
+
+            // if it wasn't EV1 we know for sure, without a next command there is
+            // nothing to tell candidates apart
+            if (ev1 == false || cmd_enc == 0) {
+                __atomic_store_n(&global_found, 1, __ATOMIC_RELEASE);
             }
-            //release lock
-            pthread_mutex_unlock(&print_lock);
-            __sync_fetch_and_add(&global_candidate_key, key);
-            free(revstate);
             break;
         }
-        free(revstate);
     }
-    free(args);
     return NULL;
 }
 
@@ -466,8 +489,11 @@ static void *brute_key_thread(void *arguments) {
     struct thread_key_args *args = (struct thread_key_args *) arguments;
     uint64_t key;
     uint8_t local_enc[args->enc_len];
+    uint8_t dec[args->enc_len];
     memcpy(local_enc, args->enc, args->enc_len);
 
+    struct Crypto1State pcs;
+
     for (uint64_t count = args->idx; count <= 0xFFFF; count += thread_count) {
 
         if (__atomic_load_n(&global_found, __ATOMIC_ACQUIRE) == 1) {
@@ -477,33 +503,29 @@ static void *brute_key_thread(void *arguments) {
         key = args->part_key | (count << 32);
 
         // Init cipher with key
-        struct Crypto1State *pcs = crypto1_create(key);
+        crypto1_init(&pcs, key);
 
         // NESTED decrypt nt with help of new key
-        crypto1_word(pcs, args->nt_enc ^ args->uid, 1);
-        crypto1_word(pcs, args->nr_enc, 1);
-        crypto1_word(pcs, 0, 0);
-        crypto1_word(pcs, 0, 0);
+        crypto1_word(&pcs, args->nt_enc ^ args->uid, 1);
+        crypto1_word(&pcs, args->nr_enc, 1);
+        crypto1_word(&pcs, 0, 0);
+        crypto1_word(&pcs, 0, 0);
 
         // decrypt 22 bytes
-        uint8_t dec[args->enc_len];
         for (int i = 0; i < args->enc_len; i++)
-            dec[i] = crypto1_byte(pcs, 0x00, 0) ^ local_enc[i];
-
-        crypto1_destroy(pcs);
+            dec[i] = crypto1_byte(&pcs, 0x00, 0) ^ local_enc[i];
 
         // check if cmd exists
         if (checkValidCmdByte(dec, args->enc_len) == false) {
             continue;
         }
-        __sync_fetch_and_add(&global_found, 1);
-
-        // lock this section to avoid interlacing prints from different threats
-        pthread_mutex_lock(&print_lock);
-        printf("\nenc:  %s\n", sprint_hex_inrow_ex(local_enc, args->enc_len, 0));
-        printf("dec:  %s\n", sprint_hex_inrow_ex(dec, args->enc_len, 0));
-        printf("\nValid Key found [ " _GREEN_("%012" PRIx64) " ]\n\n", key);
-        pthread_mutex_unlock(&print_lock);
+
+        // first thread to get here reports the key
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&global_found, &expected, 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            found_key = key;
+            memcpy(found_dec, dec, args->enc_len);
+        }
         break;
     }
     free(args);
@@ -512,7 +534,10 @@ static void *brute_key_thread(void *arguments) {
 
 static int usage(void) {
     printf("\n");
-    printf("syntax:  mf_nonce_brute <uid> <nt> <nt_par_err> <nr> <ar> <ar_par_err> <at> <at_par_err> [<next_command>]\n\n");
+    printf("syntax:  mf_nonce_brute [-t <threads>] <uid> <nt> <nt_par_err> <nr> <ar> <ar_par_err> <at> <at_par_err> [<next_command>]\n");
+    printf("         mf_nonce_brute [-t <threads>] -f <file>\n\n");
+    printf("    -t   number of threads, default the number of cpus\n");
+    printf("    -f   file with one sniff per line, same fields as on the command line, # starts a comment\n\n");
     printf("how to convert trace data to needed input:\n");
     printf("    nt in trace = 8c! 42 e6! 4e!\n");
     printf("             nt = 8c42e64e\n");
@@ -533,28 +558,53 @@ static int usage(void) {
     return 1;
 }
 
-int main(int argc, char *argv[]) {
-    printf("\nMifare classic nested auth key recovery\n\n");
+// phase 2, returns true when the upper 16 bits of the partial key were found
+static bool brute_key(uint32_t part_key, const uint8_t *enc, int enc_len, pthread_t *threads) {
 
-    if (argc < 9) return usage();
+    global_found = 0;
 
-    sscanf(argv[1], "%x", &uid);
-    sscanf(argv[2], "%x", &nt_enc);
-    sscanf(argv[3], "%x", &nt_par_err);
-    sscanf(argv[4], "%x", &nr_enc);
-    sscanf(argv[5], "%x", &ar_enc);
-    sscanf(argv[6], "%x", &ar_par_err);
-    sscanf(argv[7], "%x", &at_enc);
-    sscanf(argv[8], "%x", &at_par_err);
+    printf("\n----------- " _CYAN_("Phase 2") " ------------------------\n");
+    printf("uid.................. %08x\n", uid);
+    printf("partial key.......... %08x\n", part_key);
+    printf("nt enc............... %08x\n", nt_enc);
+    printf("nr enc............... %08x\n", nr_enc);
+    printf("next encrypted cmd... %s\n", sprint_hex_inrow_ex(enc, enc_len, 0));
+    printf("\nlooking for the upper 16 bits of key\n");
+    fflush(stdout);
 
-    int enc_len = 0;
-    uint8_t enc[ENC_LEN] = {0};  // next encrypted command + a full read/write
-    if (argc > 9) {
-//        sscanf(argv[9], "%x", &cmd_enc);
-        param_gethex_to_eol(argv[9], 0, enc, sizeof(enc), &enc_len);
-        cmd_enc = (enc[0] << 24 | enc[1] << 16 | enc[2] << 8 | enc[3]);
+    // threads
+    for (int i = 0; i < thread_count; ++i) {
+        struct thread_key_args *b = calloc(1, sizeof(struct thread_key_args));
+        b->thread = i;
+        b->idx = i;
+        b->uid = uid;
+        b->part_key = part_key;
+        b->nt_enc = nt_enc;
+        b->nr_enc = nr_enc;
+        b->enc_len = enc_len;
+        memcpy(b->enc, enc, enc_len);
+        pthread_create(&threads[i], NULL, brute_key_thread, (void *)b);
+    }
+
+    // wait for threads to terminate:
+    for (int i = 0; i < thread_count; ++i)
+        pthread_join(threads[i], NULL);
+
+    if (global_found == 0) {
+        printf("\nfailed to find a key\n\n");
+        return false;
     }
 
+    printf("\nenc:  %s\n", sprint_hex_inrow_ex(enc, enc_len, 0));
+    printf("dec:  %s\n", sprint_hex_inrow_ex(found_dec, enc_len, 0));
+    printf("\nValid Key found [ " _GREEN_("%012" PRIx64) " ]\n\n", found_key);
+    return true;
+}
+
+// both phases for the sniff in the globals.
+// returns 0 when nothing was found, 1 for a partial key (lower 32 bits) and 2 for a full key
+static int brute_sniff(const uint8_t *enc, int enc_len, uint64_t *key) {
+
     printf("----------- " _CYAN_("Phase 1") " ------------------------\n");
     printf("uid.................. %08x\n", uid);
     printf("nt encrypted......... %08x\n", nt_enc);
@@ -565,7 +615,7 @@ int main(int argc, char *argv[]) {
     printf("at encrypted......... %08x\n", at_enc);
     printf("at parity err........ %04x\n", at_par_err);
 
-    if (argc > 9) {
+    if (enc_len > 0) {
         printf("next encrypted cmd... %s\n", sprint_hex_inrow_ex(enc, enc_len, 0));
     }
 
@@ -577,93 +627,223 @@ int main(int argc, char *argv[]) {
     //calc (parity XOR corresponding nonce bit encoded with the same keystream bit)
     uint16_t xored = xored_bits(nt_par, nt_enc, ar_par, ar_enc, at_par, at_enc);
 
-#if !defined(_WIN32) || !defined(__WIN32__)
-    thread_count = sysconf(_SC_NPROCESSORS_CONF);
-    if (thread_count < 2)
-        thread_count = 2;
-#endif  /* _WIN32 */
+    // all ten checks first, then the EV1 ones which skip the first two
+    candidates_strict = filter_nonces(xored, 0x3FF, 0, candidates, 0);
+    candidates_len = filter_nonces(xored, 0x0FF, 0x300, candidates, candidates_strict);
+    candidate_cursor = 0;
+    candidates_rejected = 0;
+    results_len = 0;
+    global_found = 0;
 
+    printf("candidate nonces..... %u ( %u EV1 )\n", candidates_len, candidates_len - candidates_strict);
     printf("\nBruteforce using " _YELLOW_("%d") " threads\n", thread_count);
     printf("looking for the last bytes of the encrypted tagnonce\n");
+    fflush(stdout);
 
     pthread_t threads[thread_count];
 
-    // create a mutex to avoid interlacing print commands from our different threads
-    pthread_mutex_init(&print_lock, NULL);
-
-    // one thread T0 for none EV1.
-    struct thread_args *a = calloc(1, sizeof(struct thread_args));
-    a->xored = xored;
-    a->thread = 0;
-    a->idx = 0;
-    a->ev1 = false;
-    pthread_create(&threads[0], NULL, brute_thread, (void *)a);
-
-    // the rest of available threads to EV1 scenario
-    for (int i = 0; i < thread_count - 1; ++i) {
-        struct thread_args *b = calloc(1, sizeof(struct thread_args));
-        b->xored = xored;
-        b->thread = i + 1;
-        b->idx = i;
-        b->ev1 = true;
-        pthread_create(&threads[i + 1], NULL, brute_thread, (void *)b);
-    }
+    for (int i = 0; i < thread_count; ++i)
+        pthread_create(&threads[i], NULL, brute_thread, NULL);
 
     // wait for threads to terminate:
     for (int i = 0; i < thread_count; ++i)
         pthread_join(threads[i], NULL);
 
     t1 = msclock() - t1;
-    printf("execution time " _YELLOW_("%.2f") " sec\n", (float)t1 / 1000.0);
 
+    uint32_t found = (results_len > MAX_RESULTS) ? MAX_RESULTS : results_len;
+    if (results_len > MAX_RESULTS) {
+        printf("\n" _YELLOW_("%u") " key candidates, only the first %u are kept\n", results_len, MAX_RESULTS);
+    }
+
+    if (cmd_enc && candidates_rejected) {
+        printf("\n%u candidates rejected by next cmd / crc\n", candidates_rejected);
+    }
+
+    // non EV1 results first
+    const result_t *best = NULL;
+    for (uint32_t i = 0; i < found; i++) {
+        const result_t *r = &results[i];
+        if (best == NULL || (best->ev1 && r->ev1 == false))
+            best = r;
+
+        if (r->ev1)
+            printf("\n**** Possible key candidate ****\n");
+
+        if (cmd_enc) {
+            printf("CMD enc( %08x )\n", cmd_enc);
+            printf("    dec( %08x )    <-- valid cmd\n", r->ks4 ^ cmd_enc);
+        }
+
+        if (r->ev1)
+            printf("\nKey candidate [ " _YELLOW_("....%08" PRIx64)" ]\n\n", r->key & 0xFFFFFFFF);
+        else
+            printf("\nKey candidate [ " _GREEN_("....%08" PRIx64) " ]\n\n", r->key & 0xFFFFFFFF);
+    }
 
-    if (!global_found && !global_found_candidate) {
+    printf("execution time " _YELLOW_("%.2f") " sec\n", (float)t1 / 1000.0);
+
+    if (best == NULL) {
         printf("\nFailed to find a key\n\n");
-        goto out;
+        return 0;
     }
 
+    *key = best->key & 0xFFFFFFFF;
+
     if (enc_len < 4) {
         printf("Too few next cmd bytes, skipping phase 2\n");
-        goto out;
+        return 1;
     }
 
-    // reset thread signals
-    global_found = 0;
-    global_found_candidate = 0;
+    if (brute_key(*key, enc, enc_len, threads)) {
+        *key = found_key;
+        return 2;
+    }
 
-    printf("\n----------- " _CYAN_("Phase 2") " ------------------------\n");
-    printf("uid.................. %08x\n", uid);
-    printf("partial key.......... %08x\n", (uint32_t)(global_candidate_key & 0xFFFFFFFF));
-    printf("nt enc............... %08x\n", nt_enc);
-    printf("nr enc............... %08x\n", nr_enc);
-    printf("next encrypted cmd... %s\n", sprint_hex_inrow_ex(enc, enc_len, 0));
-    printf("\nlooking for the upper 16 bits of key\n");
-    fflush(stdout);
+    // with EV1 all candidates are equally likely, try the other partial keys as well
+    for (uint32_t i = 0; best->ev1 && i < found; i++) {
+        const result_t *r = &results[i];
+        if (r == best || (r->key & 0xFFFFFFFF) == *key)
+            continue;
 
-    // threads
-    for (int i = 0; i < thread_count; ++i) {
-        struct thread_key_args *b = calloc(1, sizeof(struct thread_key_args));
-        b->thread = i;
-        b->idx = i;
-        b->uid = uid;
-        b->part_key = (uint32_t)(global_candidate_key & 0xFFFFFFFF);
-        b->nt_enc = nt_enc;
-        b->nr_enc = nr_enc;
-        b->enc_len = enc_len;
-        memcpy(b->enc, enc, enc_len);
-        pthread_create(&threads[i], NULL, brute_key_thread, (void *)b);
+        if (brute_key(r->key & 0xFFFFFFFF, enc, enc_len, threads)) {
+            *key = found_key;
+            return 2;
+        }
     }
+    return 1;
+}
 
-    // wait for threads to terminate:
-    for (int i = 0; i < thread_count; ++i)
-        pthread_join(threads[i], NULL);
+// one sniff per line, same fields as on the command line
+static int brute_file(const char *fn) {
+    FILE *f = fopen(fn, "r");
+    if (f == NULL) {
+        printf("Failed to open " _YELLOW_("%s") "\n", fn);
+        return 1;
+    }
 
-    if (!global_found && !global_found_candidate) {
-        printf("\nfailed to find a key\n\n");
+    typedef struct {
+        int line;
+        uint32_t uid;
+        int found;
+        uint64_t key;
+    } summary_t;
+
+    summary_t *sum = NULL;
+    int sum_len = 0;
+    int lineno = 0;
+    char line[1024];
+
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+
+        char *hash = strchr(line, '#');
+        if (hash)
+            *hash = '\0';
+        line[strcspn(line, "\r\n")] = '\0';
+
+        int bg, en;
+        if (param_getptr(line, &bg, &en, 0))
+            continue;
+
+        if (sscanf(line, "%x %x %x %x %x %x %x %x", &uid, &nt_enc, &nt_par_err, &nr_enc, &ar_enc, &ar_par_err, &at_enc, &at_par_err) != 8) {
+            printf(_RED_("line %d: expected 8 fields, skipping") "\n\n", lineno);
+            continue;
+        }
+
+        int enc_len = 0;
+        uint8_t enc[ENC_LEN] = {0};
+        cmd_enc = 0;
+        if (param_getptr(line, &bg, &en, 8) == 0) {
+            if (param_gethex_to_eol(line, 8, enc, sizeof(enc), &enc_len) || enc_len < 4) {
+                printf(_RED_("line %d: invalid next command, skipping") "\n\n", lineno);
+                continue;
+            }
+            cmd_enc = (enc[0] << 24 | enc[1] << 16 | enc[2] << 8 | enc[3]);
+        }
+
+        summary_t *tmp = realloc(sum, (sum_len + 1) * sizeof(summary_t));
+        if (tmp == NULL) {
+            printf("out of memory\n");
+            break;
+        }
+        sum = tmp;
+
+        printf("\n=========== " _CYAN_("line %d") " ========================\n", lineno);
+        summary_t *e = &sum[sum_len++];
+        e->line = lineno;
+        e->uid = uid;
+        e->key = 0;
+        e->found = brute_sniff(enc, enc_len, &e->key);
+    }
+    fclose(f);
+
+    printf("\n----------- " _CYAN_("Summary") " ------------------------\n");
+    printf(" line | uid      | key\n");
+    printf("------+----------+---------------\n");
+    for (int i = 0; i < sum_len; i++) {
+        if (sum[i].found == 2)
+            printf(" %4d | %08x | " _GREEN_("%012" PRIx64) "\n", sum[i].line, sum[i].uid, sum[i].key);
+        else if (sum[i].found == 1)
+            printf(" %4d | %08x | " _YELLOW_("....%08" PRIx64) "\n", sum[i].line, sum[i].uid, sum[i].key);
+        else
+            printf(" %4d | %08x | " _RED_("not found") "\n", sum[i].line, sum[i].uid);
+    }
+    printf("\n");
+    free(sum);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    printf("\nMifare classic nested auth key recovery\n\n");
+
+#if !defined(_WIN32) || !defined(__WIN32__)
+    thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (thread_count < 1)
+        thread_count = 1;
+#endif  /* _WIN32 */
+
+    const char *fn = NULL;
+    int argi = 1;
+    while (argi < argc && argv[argi][0] == '-') {
+        if (strcmp(argv[argi], "-t") == 0 && argi + 1 < argc) {
+            thread_count = atoi(argv[argi + 1]);
+            argi += 2;
+        } else if (strcmp(argv[argi], "-f") == 0 && argi + 1 < argc) {
+            fn = argv[argi + 1];
+            argi += 2;
+        } else {
+            return usage();
+        }
+    }
+
+    if (thread_count < 1)
+        return usage();
+
+    init_nonce_sig();
+
+    if (fn)
+        return brute_file(fn);
+
+    if (argc - argi < 8) return usage();
+
+    sscanf(argv[argi + 0], "%x", &uid);
+    sscanf(argv[argi + 1], "%x", &nt_enc);
+    sscanf(argv[argi + 2], "%x", &nt_par_err);
+    sscanf(argv[argi + 3], "%x", &nr_enc);
+    sscanf(argv[argi + 4], "%x", &ar_enc);
+    sscanf(argv[argi + 5], "%x", &ar_par_err);
+    sscanf(argv[argi + 6], "%x", &at_enc);
+    sscanf(argv[argi + 7], "%x", &at_par_err);
+
+    int enc_len = 0;
+    uint8_t enc[ENC_LEN] = {0};  // next encrypted command + a full read/write
+    if (argc - argi > 8) {
+        param_gethex_to_eol(argv[argi + 8], 0, enc, sizeof(enc), &enc_len);
+        cmd_enc = (enc[0] << 24 | enc[1] << 16 | enc[2] << 8 | enc[3]);
     }
 
-out:
-    // clean up mutex
-    pthread_mutex_destroy(&print_lock);
+    uint64_t key = 0;
+    brute_sniff(enc, enc_len, &key);
     return 0;
 }
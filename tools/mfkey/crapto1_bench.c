@@ -0,0 +1,149 @@
+// Compares calls/s of the allocating lfsr_recovery32 / lfsr_recovery64 against the
+// lfsr_recovery32_into / lfsr_recovery64_into variants with a reused workspace,
+// and checks both against state lists of the original bucket sort implementation.
+#define __STDC_FORMAT_MACROS
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "crapto1/crapto1.h"
+#include "util_posix.h"
+#include "commonutil.h"  // ARRAYLEN
+
+static uint32_t rnd_state = 0x12345678;
+static uint32_t rnd(void) {
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+// keystream of the first auth word for known keys, number of states and FNV-1a hash of the
+// state list in order, as returned by the crapto1 bucket sort implementation
+typedef struct {
+    uint32_t ks2;
+    uint32_t in;
+    size_t count;
+    uint32_t hash;
+} known_states_t;
+
+static const known_states_t known32[] = {
+    {0xff77ff5a, 0x1efd8d5e, 60631, 0x3f2f8c51}, // key FFFFFFFFFFFF
+    {0x7afd4b43, 0x9d799a77, 60928, 0x3c176720}, // key A0A1A2A3A4A5
+    {0xbb8cb14c, 0x1214b04e, 36338, 0x90aad859}, // key 3B7E4FD575AD
+};
+
+static const known_states_t known64[] = {
+    {0xcec80caa, 0x8a405804, 1, 0xbc14539b}, // key FFFFFFFFFFFF
+    {0xed3b938e, 0xdbb307e9, 1, 0x30b7f651}, // key A0A1A2A3A4A5
+    {0x6275f0c4, 0xc77f4919, 1, 0xdf01a627}, // key 3B7E4FD575AD
+};
+
+static bool check_states(const struct Crypto1State *sl, const known_states_t *k) {
+    if (sl == NULL)
+        return false;
+
+    uint32_t hash = 2166136261U;
+    size_t n = 0;
+    for (; sl[n].odd | sl[n].even; n++) {
+        hash = (hash ^ sl[n].odd) * 16777619U;
+        hash = (hash ^ sl[n].even) * 16777619U;
+    }
+    return (n == k->count) && (hash == k->hash);
+}
+
+static void report(const char *name, int calls, uint64_t ms_old, uint64_t ms_new) {
+    double old_rate = (ms_old) ? calls * 1000.0 / ms_old : 0;
+    double new_rate = (ms_new) ? calls * 1000.0 / ms_new : 0;
+    printf("%-16s %8d calls   %10.1f calls/s   %10.1f calls/s   x%.2f\n", name, calls, old_rate, new_rate,
+           (old_rate > 0) ? new_rate / old_rate : 0);
+}
+
+int main(int argc, char *argv[]) {
+    int calls32 = 20;
+    int calls64 = 50;
+
+    if (argc > 1 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0)) {
+        printf(" syntax: %s [calls lfsr_recovery32] [calls lfsr_recovery64]\n\n", argv[0]);
+        return 1;
+    }
+    if (argc > 1)
+        calls32 = atoi(argv[1]);
+    if (argc > 2)
+        calls64 = atoi(argv[2]);
+    if (calls32 <= 0 || calls64 <= 0) {
+        printf("calls must be > 0\n");
+        return 1;
+    }
+
+    uint32_t *ks = calloc(calls64 > calls32 ? calls64 : calls32, 2 * sizeof(uint32_t));
+    struct Crypto1State *sl = calloc(LFSR_RECOVERY32_STATES, sizeof(struct Crypto1State));
+    lfsr_recovery32_ws_t *ws = lfsr_recovery32_ws_alloc();
+    if (ks == NULL || sl == NULL || ws == NULL) {
+        printf("out of memory\n");
+        free(ks);
+        free(sl);
+        lfsr_recovery32_ws_free(ws);
+        return 1;
+    }
+    for (int i = 0; i < 2 * (calls64 > calls32 ? calls64 : calls32); i++)
+        ks[i] = rnd();
+
+    printf("%-16s %14s   %17s   %17s\n", "", "", "allocating", "workspace");
+
+    // lfsr_recovery32
+    bool ok = true;
+    uint64_t t = msclock();
+    for (int i = 0; i < calls32; i++) {
+        struct Crypto1State *s = lfsr_recovery32(ks[i], 0);
+        free(s);
+    }
+    uint64_t ms_old = msclock() - t;
+
+    t = msclock();
+    for (int i = 0; i < calls32; i++) {
+        lfsr_recovery32_into(ks[i], 0, sl, ws);
+    }
+    uint64_t ms_new = msclock() - t;
+    report("lfsr_recovery32", calls32, ms_old, ms_new);
+
+    for (size_t i = 0; i < ARRAYLEN(known32); i++) {
+        struct Crypto1State *s = lfsr_recovery32(known32[i].ks2, known32[i].in);
+        ok &= check_states(s, &known32[i]);
+        free(s);
+        lfsr_recovery32_into(known32[i].ks2, known32[i].in, sl, ws);
+        ok &= check_states(sl, &known32[i]);
+    }
+
+    // lfsr_recovery64
+    t = msclock();
+    for (int i = 0; i < calls64; i++) {
+        struct Crypto1State *s = lfsr_recovery64(ks[2 * i], ks[2 * i + 1]);
+        free(s);
+    }
+    ms_old = msclock() - t;
+
+    struct Crypto1State states64[LFSR_RECOVERY64_STATES];
+    t = msclock();
+    for (int i = 0; i < calls64; i++) {
+        lfsr_recovery64_into(ks[2 * i], ks[2 * i + 1], states64);
+    }
+    ms_new = msclock() - t;
+    report("lfsr_recovery64", calls64, ms_old, ms_new);
+
+    for (size_t i = 0; i < ARRAYLEN(known64); i++) {
+        struct Crypto1State *s = lfsr_recovery64(known64[i].ks2, known64[i].in);
+        ok &= check_states(s, &known64[i]);
+        free(s);
+        lfsr_recovery64_into(known64[i].ks2, known64[i].in, states64);
+        ok &= check_states(states64, &known64[i]);
+    }
+
+    printf("\nstate lists %s\n", ok ? "match the known ones" : "DIFFER from the known ones");
+
+    free(ks);
+    free(sl);
+    lfsr_recovery32_ws_free(ws);
+    return ok ? 0 : 1;
+}
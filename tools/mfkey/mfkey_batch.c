@@ -0,0 +1,412 @@
+// Batch MIFARE Classic key recovery over collected reader authentications.
+//
+// Reads one authentication per line, from a file or stdin:
+//     <uid> <sector> <A|B> <nt> <{nr}> <{ar}> [<{at}>]
+// hex values, '#' starts a comment. Duplicate lines are dropped, the rest is grouped
+// by uid / sector / key type and every group is solved on a pool of threads:
+//  - with a tag response {at}, mfkey64 on that single authentication
+//  - otherwise mfkey32 (moebius), one lfsr_recovery32 of a base authentication
+//    checked against all others of the group
+// Found keys are verified against every authentication of their group.
+// Results are written as a JSON array, one object per group.
+#define __STDC_FORMAT_MACROS
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "crapto1/crapto1.h"
+#include "util_posix.h"
+
+// lfsr_recovery32 runs per group at most, when the first base authentications give nothing
+#define MAX_BASES 4
+
+typedef struct {
+    uint32_t uid;
+    uint8_t sector;
+    uint8_t keytype;        // 0 = A, 1 = B
+    bool has_at;
+    uint32_t nt;
+    uint32_t nr;            // encrypted reader nonce
+    uint32_t ar;            // encrypted reader response
+    uint32_t at;            // encrypted tag response
+} mf_auth_t;
+
+typedef struct {
+    size_t first;           // first authentication of the group
+    size_t count;
+    bool found;
+    uint64_t key;
+    size_t verified;        // authentications the key matches
+    const char *method;
+} mf_group_t;
+
+typedef struct {
+    const mf_auth_t *auths;
+    mf_group_t *groups;
+    size_t numgroups;
+    size_t next;            // next group to solve, taken atomically
+    size_t done;
+    bool progress;
+} batch_t;
+
+static int cmp_auth(const void *a, const void *b) {
+    const mf_auth_t *x = a, *y = b;
+#define CMP(f) if (x->f != y->f) return (x->f < y->f) ? -1 : 1
+    CMP(uid);
+    CMP(sector);
+    CMP(keytype);
+    CMP(has_at);        // tag responses last, mfkey32 bases stay at the front
+    CMP(nt);
+    CMP(nr);
+    CMP(ar);
+    CMP(at);
+#undef CMP
+    return 0;
+}
+
+static bool same_group(const mf_auth_t *a, const mf_auth_t *b) {
+    return a->uid == b->uid && a->sector == b->sector && a->keytype == b->keytype;
+}
+
+// parses one line, returns false for blank / comment lines and sets *err on bad ones
+static bool parse_line(char *line, mf_auth_t *a, bool *err) {
+    char *hash = strchr(line, '#');
+    if (hash)
+        *hash = 0;
+
+    *err = false;
+    char *p = line;
+    while (isspace((unsigned char)*p))
+        p++;
+    if (*p == 0)
+        return false;
+
+    char kt[8] = {0};
+    unsigned int sector = 0;
+    int n = sscanf(p, "%x %u %7s %x %x %x %x", &a->uid, &sector, kt, &a->nt, &a->nr, &a->ar, &a->at);
+
+    if (n < 6 || sector > 39) {
+        *err = true;
+        return false;
+    }
+    a->sector = sector;
+    a->has_at = (n == 7);
+    if (a->has_at == false)
+        a->at = 0;
+
+    switch (toupper((unsigned char)kt[0])) {
+        case 'A':
+        case '0':
+            a->keytype = 0;
+            break;
+        case 'B':
+        case '1':
+            a->keytype = 1;
+            break;
+        default:
+            *err = true;
+            return false;
+    }
+    return true;
+}
+
+// does key produce the reader response of a?
+static bool key_matches(uint64_t key, const mf_auth_t *a) {
+    struct Crypto1State s;
+    crypto1_init(&s, key);
+    crypto1_word(&s, a->uid ^ a->nt, 0);
+    crypto1_word(&s, a->nr, 1);
+    return (crypto1_word(&s, 0, 0) ^ prng_successor(a->nt, 64)) == a->ar;
+}
+
+static size_t count_matches(uint64_t key, const mf_auth_t *auths, size_t n) {
+    size_t cnt = 0;
+    for (size_t i = 0; i < n; i++)
+        cnt += key_matches(key, &auths[i]);
+    return cnt;
+}
+
+static void set_key(mf_group_t *g, uint64_t key, size_t verified, const char *method) {
+    if (g->found == false || verified > g->verified) {
+        g->found = true;
+        g->key = key;
+        g->verified = verified;
+        g->method = method;
+    }
+}
+
+static void solve_mfkey64(mf_group_t *g, const mf_auth_t *auths) {
+    struct Crypto1State states[LFSR_RECOVERY64_STATES];
+
+    for (size_t i = 0; i < g->count; i++) {
+        const mf_auth_t *a = &auths[i];
+        if (a->has_at == false)
+            continue;
+
+        uint32_t ks2 = a->ar ^ prng_successor(a->nt, 64);
+        uint32_t ks3 = a->at ^ prng_successor(a->nt, 96);
+        if (lfsr_recovery64_into(ks2, ks3, states) == 0)
+            continue;
+
+        struct Crypto1State *s = states;
+        uint64_t key = 0;
+        lfsr_rollback_word(s, 0, 0);
+        lfsr_rollback_word(s, 0, 0);
+        lfsr_rollback_word(s, a->nr, 1);
+        lfsr_rollback_word(s, a->uid ^ a->nt, 0);
+        crypto1_get_lfsr(s, &key);
+
+        if (key_matches(key, a)) {
+            set_key(g, key, count_matches(key, auths, g->count), "mfkey64");
+            // every authentication agrees, nothing better to find
+            if (g->verified == g->count)
+                return;
+        }
+    }
+}
+
+static void solve_mfkey32(mf_group_t *g, const mf_auth_t *auths, struct Crypto1State *sl, lfsr_recovery32_ws_t *ws) {
+    for (size_t b = 0; b < g->count - 1 && b < MAX_BASES; b++) {
+        const mf_auth_t *base = &auths[b];
+        uint32_t p640 = prng_successor(base->nt, 64);
+
+        lfsr_recovery32_into(base->ar ^ p640, 0, sl, ws);
+
+        for (struct Crypto1State *t = sl; t->odd | t->even; ++t) {
+            uint64_t key = 0;
+            lfsr_rollback_word(t, 0, 0);
+            lfsr_rollback_word(t, base->nr, 1);
+            lfsr_rollback_word(t, base->uid ^ base->nt, 0);
+            crypto1_get_lfsr(t, &key);
+
+            // t is the initial state of key now, run the other authentications from a copy
+            for (size_t i = b + 1; i < g->count; i++) {
+                const mf_auth_t *a = &auths[i];
+                struct Crypto1State s = *t;
+                crypto1_word(&s, a->uid ^ a->nt, 0);
+                crypto1_word(&s, a->nr, 1);
+                if (a->ar == (crypto1_word(&s, 0, 0) ^ prng_successor(a->nt, 64))) {
+                    set_key(g, key, count_matches(key, auths, g->count), "mfkey32");
+                    break;
+                }
+            }
+        }
+        if (g->found && g->verified > 1)
+            return;
+    }
+}
+
+static void *solve_thread(void *arg) {
+    batch_t *batch = (batch_t *)arg;
+
+    struct Crypto1State *sl = NULL;
+    lfsr_recovery32_ws_t *ws = NULL;
+
+    for (;;) {
+        size_t idx = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED);
+        if (idx >= batch->numgroups)
+            break;
+
+        mf_group_t *g = &batch->groups[idx];
+        const mf_auth_t *auths = &batch->auths[g->first];
+
+        solve_mfkey64(g, auths);
+
+        if (g->found == false && g->count > 1) {
+            // workspace allocated once per thread, only when some group needs it
+            if (ws == NULL) {
+                sl = calloc(LFSR_RECOVERY32_STATES, sizeof(struct Crypto1State));
+                ws = lfsr_recovery32_ws_alloc();
+                if (sl == NULL || ws == NULL) {
+                    fprintf(stderr, "out of memory\n");
+                    exit(1);
+                }
+            }
+            solve_mfkey32(g, auths, sl, ws);
+        }
+
+        size_t done = __atomic_add_fetch(&batch->done, 1, __ATOMIC_RELAXED);
+        if (batch->progress)
+            fprintf(stderr, "\r%zu / %zu groups", done, batch->numgroups);
+    }
+
+    free(sl);
+    lfsr_recovery32_ws_free(ws);
+    return NULL;
+}
+
+static void write_json(FILE *f, const batch_t *batch) {
+    fprintf(f, "[\n");
+    for (size_t i = 0; i < batch->numgroups; i++) {
+        const mf_group_t *g = &batch->groups[i];
+        const mf_auth_t *a = &batch->auths[g->first];
+        fprintf(f, "  {\"uid\": \"%08X\", \"sector\": %u, \"keytype\": \"%c\", \"auths\": %zu, ",
+                a->uid, a->sector, a->keytype ? 'B' : 'A', g->count);
+        if (g->found)
+            fprintf(f, "\"key\": \"%012" PRIX64 "\", \"verified\": %zu, \"method\": \"%s\"}", g->key, g->verified, g->method);
+        else
+            fprintf(f, "\"key\": null}");
+        fprintf(f, "%s\n", (i + 1 < batch->numgroups) ? "," : "");
+    }
+    fprintf(f, "]\n");
+}
+
+static void usage(const char *name) {
+    printf(" syntax: %s [-t <threads>] [-o <out.json>] [-q] [<file> | -]\n\n", name);
+    printf(" one authentication per line, hex values, '#' comments:\n");
+    printf("     <uid> <sector> <A|B> <nt> <{nr}> <{ar}> [<{at}>]\n\n");
+    printf(" example:\n");
+    printf("     %s nonces.txt -o keys.json\n", name);
+    printf("     cat *.txt | %s -t 8 -\n\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    const char *in_name = "-";
+    const char *out_name = NULL;
+    bool quiet = false;
+    long threads = sysconf(_SC_NPROCESSORS_CONF);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:o:qh")) != -1) {
+        switch (opt) {
+            case 't':
+                threads = strtol(optarg, NULL, 10);
+                break;
+            case 'o':
+                out_name = optarg;
+                break;
+            case 'q':
+                quiet = true;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind < argc)
+        in_name = argv[optind];
+    if (threads < 1)
+        threads = 1;
+
+    FILE *in = (strcmp(in_name, "-") == 0) ? stdin : fopen(in_name, "r");
+    if (in == NULL) {
+        fprintf(stderr, "can't open %s\n", in_name);
+        return 1;
+    }
+
+    // read everything, the input may be a stream
+    size_t n = 0, cap = 1024, lineno = 0, bad = 0;
+    mf_auth_t *auths = malloc(cap * sizeof(mf_auth_t));
+    char line[512];
+    while (auths && fgets(line, sizeof(line), in)) {
+        lineno++;
+        bool err;
+        if (n == cap) {
+            cap *= 2;
+            mf_auth_t *tmp = realloc(auths, cap * sizeof(mf_auth_t));
+            if (tmp == NULL) {
+                free(auths);
+                auths = NULL;
+                break;
+            }
+            auths = tmp;
+        }
+        if (parse_line(line, &auths[n], &err)) {
+            n++;
+        } else if (err) {
+            fprintf(stderr, "line %zu: can't parse, skipped\n", lineno);
+            bad++;
+        }
+    }
+    if (in != stdin)
+        fclose(in);
+    if (auths == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    // sort, drop duplicates and cut into groups
+    qsort(auths, n, sizeof(mf_auth_t), cmp_auth);
+    size_t uniq = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (uniq == 0 || cmp_auth(&auths[uniq - 1], &auths[i]) != 0)
+            auths[uniq++] = auths[i];
+    }
+
+    mf_group_t *groups = calloc(uniq ? uniq : 1, sizeof(mf_group_t));
+    if (groups == NULL) {
+        fprintf(stderr, "out of memory\n");
+        free(auths);
+        return 1;
+    }
+    size_t numgroups = 0;
+    for (size_t i = 0; i < uniq; i++) {
+        if (numgroups == 0 || same_group(&auths[groups[numgroups - 1].first], &auths[i]) == false) {
+            groups[numgroups].first = i;
+            numgroups++;
+        }
+        groups[numgroups - 1].count++;
+    }
+
+    if (threads > (long)numgroups)
+        threads = numgroups ? numgroups : 1;
+
+    if (quiet == false) {
+        fprintf(stderr, "%zu authentications, %zu duplicates, %zu unparsable lines\n", n, n - uniq, bad);
+        fprintf(stderr, "%zu groups (uid / sector / key type) on %ld threads\n", numgroups, threads);
+    }
+
+    batch_t batch = {
+        .auths = auths,
+        .groups = groups,
+        .numgroups = numgroups,
+        .next = 0,
+        .done = 0,
+        .progress = (quiet == false) && isatty(fileno(stderr)),
+    };
+
+    uint64_t t1 = msclock();
+    pthread_t thread_ids[threads];
+    long started = 0;
+    for (; started < threads; started++) {
+        if (pthread_create(&thread_ids[started], NULL, solve_thread, &batch) != 0) {
+            fprintf(stderr, "could only start %ld of %ld threads\n", started, threads);
+            break;
+        }
+    }
+    // groups are taken from a shared counter, whatever threads run get through all of them
+    if (started == 0)
+        solve_thread(&batch);
+    for (long i = 0; i < started; i++)
+        pthread_join(thread_ids[i], NULL);
+    t1 = msclock() - t1;
+
+    size_t found = 0;
+    for (size_t i = 0; i < numgroups; i++)
+        found += groups[i].found;
+
+    if (quiet == false) {
+        if (batch.progress)
+            fprintf(stderr, "\n");
+        fprintf(stderr, "keys found for %zu / %zu groups in %.1f s\n", found, numgroups, t1 / 1000.0);
+    }
+
+    FILE *out = (out_name) ? fopen(out_name, "w") : stdout;
+    if (out == NULL) {
+        fprintf(stderr, "can't write %s\n", out_name);
+        free(groups);
+        free(auths);
+        return 1;
+    }
+    write_json(out, &batch);
+    if (out != stdout)
+        fclose(out);
+
+    free(groups);
+    free(auths);
+    return 0;
+}